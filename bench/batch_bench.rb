@@ -0,0 +1,33 @@
+# Compares inserting rows one execute at a time with Statement#execute_batch and #execute_columns.
+# Run it against a remote server to see the round trips saved:
+#   ruby bench/batch_bench.rb [rows] [batch size]
+require File.join(File.dirname(__FILE__), 'bench_helper')
+
+rows = (ARGV[0] || 20_000).to_i
+batch_size = (ARGV[1] || 100).to_i
+now = Time.now
+data = Array.new(rows) { |i| [i, i, i * 2, "Name #{i}", now] }
+
+FbBench.with_database do |connection|
+  connection.execute("CREATE TABLE TEST (ID INTEGER NOT NULL, I1 INTEGER, I2 INTEGER, NAME VARCHAR(40), TS TIMESTAMP)")
+  connection.prepare("INSERT INTO TEST VALUES (?, ?, ?, ?, ?)") do |insert|
+    t = Benchmark.realtime do
+      connection.transaction { data.each { |row| insert.execute(*row) } }
+    end
+    FbBench.report("execute per row", rows, t)
+    connection.execute("DELETE FROM TEST")
+
+    t = Benchmark.realtime do
+      insert.execute_batch(data, :batch_size => batch_size)
+    end
+    FbBench.report("execute_batch(#{batch_size})", rows, t)
+    connection.execute("DELETE FROM TEST")
+
+    ids = (0...rows).to_a
+    columns = [ids.pack("l*"), ids.pack("l*"), ids.map { |i| i * 2 }.pack("l*"), data.map { |row| row[3] }, data.map { |row| row[4] }]
+    t = Benchmark.realtime do
+      insert.execute_columns(columns, :batch_size => batch_size)
+    end
+    FbBench.report("execute_columns(#{batch_size})", rows, t)
+  end
+end
@@ -0,0 +1,51 @@
+$: << File.join(File.dirname(__FILE__), '..')
+require 'benchmark'
+require 'fileutils'
+require 'fb'
+
+# Shared setup for the benchmark scripts in this directory.
+# Override the database location with FB_BENCH_DATABASE, e.g. "localhost:/tmp/bench.fdb".
+module FbBench
+  include Fb
+
+  def self.parms
+    db_file = case RUBY_PLATFORM
+      when /win32/ then 'c:/var/fbdata/benchmark.fdb'
+      else '/var/fbdata/benchmark.fdb'
+    end
+    {
+      :database => ENV['FB_BENCH_DATABASE'] || "localhost:#{db_file}",
+      :username => ENV['FB_BENCH_USERNAME'] || 'sysdba',
+      :password => ENV['FB_BENCH_PASSWORD'] || 'masterkey',
+      :charset => 'NONE' }
+  end
+
+  # Creates a fresh benchmark database, yields a connection to it and drops it afterwards.
+  def self.with_database(parms = {})
+    Fb::Database.drop(self.parms) rescue nil
+    Fb::Database.create(self.parms.merge(parms)) do |connection|
+      begin
+        yield connection
+      ensure
+        connection.drop
+      end
+    end
+  end
+
+  # Fills TEST with +rows+ rows of +cols+ INTEGER columns plus a VARCHAR and a TIMESTAMP.
+  def self.load_rows(connection, rows, cols = 4)
+    int_cols = (1..cols).map { |i| "I#{i} INTEGER" }.join(', ')
+    connection.execute("CREATE TABLE TEST (ID INTEGER NOT NULL, #{int_cols}, NAME VARCHAR(40), TS TIMESTAMP)")
+    marks = (['?'] * (cols + 3)).join(', ')
+    now = Time.now
+    connection.transaction do
+      rows.times do |i|
+        connection.execute("INSERT INTO TEST VALUES (#{marks})", i, *((1..cols).map { |c| i * c }), "Name #{i}", now)
+      end
+    end
+  end
+
+  def self.report(label, rows, seconds)
+    printf("%-36s %10d rows %9.3f s %12.0f rows/s %8.2f us/row\n", label, rows, seconds, rows / seconds, seconds * 1_000_000 / rows)
+  end
+end
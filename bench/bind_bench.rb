@@ -0,0 +1,18 @@
+# Measures parameter binding throughput (rows/s) for wide rows sent with execute_batch,
+# where binding rather than round trips dominates.  Run against two builds to compare them:
+#   ruby bench/bind_bench.rb [rows] [batch size]
+require File.join(File.dirname(__FILE__), 'bench_helper')
+
+rows = (ARGV[0] || 50_000).to_i
+batch_size = (ARGV[1] || 200).to_i
+now = Time.now
+today = Date.today
+data = Array.new(rows) { |i| [i, i * 3, i * 0.5, "Name #{i}", now, today, i * 1.25] }
+
+FbBench.with_database do |connection|
+  connection.execute("CREATE TABLE TEST (ID INTEGER, BIG BIGINT, RATE DOUBLE PRECISION, NAME VARCHAR(40), TS TIMESTAMP, DT DATE, AMOUNT NUMERIC(15,2))")
+  connection.prepare("INSERT INTO TEST VALUES (?, ?, ?, ?, ?, ?, ?)") do |insert|
+    t = Benchmark.realtime { insert.execute_batch(data, :batch_size => batch_size) }
+    FbBench.report("execute_batch 7 params", rows, t)
+  end
+end
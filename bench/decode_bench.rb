@@ -0,0 +1,21 @@
+# Measures column decoding throughput (rows/s) on a wide result set.
+# Run against two builds of the extension to compare them:
+#   ruby bench/decode_bench.rb [rows] [integer columns]
+require File.join(File.dirname(__FILE__), 'bench_helper')
+
+rows = (ARGV[0] || 50_000).to_i
+cols = (ARGV[1] || 32).to_i
+
+FbBench.with_database do |connection|
+  FbBench.load_rows(connection, rows, cols)
+
+  [["all columns", "SELECT * FROM TEST"],
+   ["integers", "SELECT #{(1..cols).map { |i| "I#{i}" }.join(', ')} FROM TEST"],
+   ["varchar", "SELECT NAME, NAME, NAME, NAME FROM TEST"]].each do |label, sql|
+    connection.execute(sql) do |cursor|
+      n = 0
+      t = Benchmark.realtime { n = cursor.fetchall.size }
+      FbBench.report("fetchall #{label} (#{cursor.fields.size} cols)", n, t)
+    end
+  end
+end
@@ -0,0 +1,29 @@
+# Measures the per-row cost of Cursor#fetch against fetchall and each.
+# Run against two builds of the extension to compare them:
+#   ruby bench/fetch_bench.rb [rows]
+require File.join(File.dirname(__FILE__), 'bench_helper')
+
+rows = (ARGV[0] || 100_000).to_i
+
+FbBench.with_database do |connection|
+  FbBench.load_rows(connection, rows)
+  sql = "SELECT * FROM TEST"
+
+  connection.execute(sql) do |cursor|
+    n = 0
+    t = Benchmark.realtime { n += 1 while cursor.fetch }
+    FbBench.report("fetch (one row per call)", n, t)
+  end
+
+  connection.execute(sql) do |cursor|
+    n = 0
+    t = Benchmark.realtime { cursor.each { n += 1 } }
+    FbBench.report("each", n, t)
+  end
+
+  connection.execute(sql) do |cursor|
+    n = 0
+    t = Benchmark.realtime { n = cursor.fetchall.size }
+    FbBench.report("fetchall", n, t)
+  end
+end
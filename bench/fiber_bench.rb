@@ -0,0 +1,32 @@
+# Runs many concurrent fibers under a Fiber.scheduler over a fixed number of attachments.
+# Needs Ruby 3.1+ and the async gem:
+#   ruby bench/fiber_bench.rb [fibers] [attachments] [worker threads]
+require File.join(File.dirname(__FILE__), 'bench_helper')
+require 'async'
+
+fibers = (ARGV[0] || 1_000).to_i
+attachments = (ARGV[1] || 8).to_i
+Fb.worker_threads = (ARGV[2] || attachments).to_i
+sql = "SELECT COUNT(*) FROM TEST A, TEST B WHERE A.I1 <= B.I2"
+
+FbBench.with_database do |connection|
+  FbBench.load_rows(connection, 100)
+  connection.commit if connection.transaction_started
+
+  pool = Fb::Pool.new(FbBench.parms, :size => attachments, :timeout => 60, :warm_up => attachments)
+  begin
+    ticks = 0
+    t = Benchmark.realtime do
+      Async do |task|
+        # Counts reactor turns while queries run: a stalled reactor barely ticks.
+        ticker = task.async { loop { ticks += 1; sleep 0.001 } }
+        fibers.times.map { task.async { pool.with { |c| c.query(sql) } } }.each(&:wait)
+        ticker.stop
+      end
+    end
+    FbBench.report("#{fibers} fibers, #{attachments} attachments", fibers, t)
+    printf("%-36s %10d ticks %9.3f s\n", "reactor ticks while querying", ticks, t)
+  ensure
+    pool.close
+  end
+end
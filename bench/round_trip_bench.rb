@@ -0,0 +1,23 @@
+# Counts round trips and time per execute of a prepared INSERT, with and without rows-affected counting.
+# The difference only shows against a remote server, e.g. FB_BENCH_DATABASE=otherhost:/tmp/bench.fdb:
+#   ruby bench/round_trip_bench.rb [rows]
+require File.join(File.dirname(__FILE__), 'bench_helper')
+
+rows = (ARGV[0] || 5_000).to_i
+
+FbBench.with_database do |connection|
+  connection.execute("CREATE TABLE TEST (ID INTEGER NOT NULL, NAME VARCHAR(40))")
+
+  [true, false].each do |count_rows|
+    connection.count_rows = count_rows
+    connection.execute("DELETE FROM TEST")
+    connection.transaction do
+      connection.prepare("INSERT INTO TEST (ID, NAME) VALUES (?, ?)") do |insert|
+        trips = connection.round_trips
+        t = Benchmark.realtime { rows.times { |i| insert.execute(i, "Name #{i}") } }
+        FbBench.report("count_rows = #{count_rows}", rows, t)
+        printf("%-36s %10.2f round trips/row\n", "", (connection.round_trips - trips).to_f / rows)
+      end
+    end
+  end
+end
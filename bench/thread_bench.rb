@@ -0,0 +1,25 @@
+# Measures query throughput with several threads, each using its own connection.
+# Compare against a build that holds the GVL during fbclient calls:
+#   ruby bench/thread_bench.rb [threads] [queries per thread]
+require File.join(File.dirname(__FILE__), 'bench_helper')
+
+threads = (ARGV[0] || 8).to_i
+queries = (ARGV[1] || 200).to_i
+sql = "SELECT COUNT(*) FROM TEST A, TEST B WHERE A.I1 <= B.I2"
+
+FbBench.with_database do |connection|
+  FbBench.load_rows(connection, 300)
+  connection.commit if connection.transaction_started
+
+  [1, threads].uniq.each do |n|
+    connections = Array.new(n) { Fb::Database.connect(FbBench.parms) }
+    begin
+      t = Benchmark.realtime do
+        connections.map { |c| Thread.new { queries.times { c.query(sql) } } }.each(&:join)
+      end
+      FbBench.report("#{n} thread(s), one connection each", n * queries, t)
+    ensure
+      connections.each(&:close)
+    end
+  end
+end
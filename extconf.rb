@@ -71,4 +71,16 @@ else
   libs.find {|lib| have_library(lib, test_func) }
 end
 
+have_func("fb_cancel_operation", "ibase.h")
+have_func("fb_dsql_set_timeout", "ibase.h")
+have_func("fb_ping", "ibase.h")
+have_func("rb_time_timespec_new")
+have_func("rb_time_timespec")
+have_func("rb_time_utc_offset")
+have_func("rb_hash_bulk_insert")
+have_header("ruby/thread.h")
+have_func("rb_thread_call_without_gvl2", "ruby/thread.h")
+have_header("ruby/fiber/scheduler.h")
+have_func("rb_fiber_scheduler_current", "ruby/fiber/scheduler.h")
+
 create_makefile("fb")
@@ -21,6 +21,12 @@
   */
 
 #include "ruby.h"
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#include "ruby/fiber/scheduler.h"
+#endif
 
 /* Ensure compatibility with early releases of Ruby 1.8.5 */
 #ifndef RSTRING_PTR
@@ -85,16 +91,61 @@
 #define	EXECF_EXECDML	0
 #define	EXECF_SETPARM	1
 
+/* How scaled NUMERIC/DECIMAL columns are returned */
+#define	DECIMAL_INHERIT		-1
+#define	DECIMAL_FLOAT		0
+#define	DECIMAL_BIGDECIMAL	1
+#define	DECIMAL_RATIONAL	2
+#define	DECIMAL_SCALED_INTEGER	3
+#define	DECIMAL_SCALE_MAX	18
+
+/* Row formats accepted by fetch, fetchall, each, query, ... */
+#define	ROW_ARRAY		0
+#define	ROW_HASH		1
+#define	ROW_SYMBOL_HASH		2
+#define	ROW_STRUCT		3
+#define	ROW_LAZY		4
+#define	ROW_STRUCTS_MAX		64	/* Struct classes a connection keeps, least recently used dropped first */
+
+/* How TIMESTAMP and TIME columns are returned */
+#define	TIMESTAMP_INHERIT	-1
+#define	TIMESTAMP_TIME		0
+#define	TIMESTAMP_EPOCH_FLOAT	1
+#define	TIMESTAMP_EPOCH_INT	2
+
+/* How BLOB columns are returned */
+#define	BLOB_INHERIT		-1
+#define	BLOB_STRING		0
+#define	BLOB_STREAM		1
+
+#define	ISC_TIME_FRACTIONS	10000	/* ISC_TIME units per second */
+#define	MJD_UNIX_EPOCH		40587	/* ISC_DATE of 1970-01-01 */
+#define	MJD_GREGORIAN		-100840	/* ISC_DATE of 1582-10-15 */
+#define	JD_MJD_OFFSET		2400001
+#define	UNIX_Y2K		946684800	/* 2000-01-01 00:00:00 UTC, the date given to TIME values */
+#define	UTC_OFFSET_BUCKET	900	/* local clock changes are assumed to fall on quarter hours */
+#define	UTC_OFFSET_CACHE_SIZE	256
+
 static VALUE rb_mFb;
 static VALUE rb_cFbDatabase;
 static VALUE rb_cFbConnection;
 static VALUE rb_cFbCursor;
+static VALUE rb_cFbStatement;
+static VALUE rb_cFbRow;
+static VALUE rb_cFbBlob;
+static VALUE rb_cFbBlobWriter;
+static VALUE rb_cFbPool;
+static VALUE rb_cFbTransactionOptions;
+static VALUE rb_cFbIdAllocator;
 static VALUE rb_cFbSqlType;
 /* static VALUE rb_cFbGlobal; */
 static VALUE rb_eFbError;
+static VALUE rb_eFbTimeoutError;
 static VALUE rb_sFbField;
 static VALUE rb_sFbIndex;
 static VALUE rb_sFbColumn;
+static VALUE rb_sFbPackedColumn;
+static VALUE rb_sFbBatchResult;
 static VALUE rb_cDate;
 
 static ID id_matches;
@@ -102,6 +153,14 @@ static ID id_downcase_bang;
 static VALUE re_lowercase;
 static ID id_rstrip_bang;
 static ID id_sub_bang;
+static ID id_BigDecimal;
+static ID id_mult;
+static ID id_jd;
+static ID id_round;
+static ID id_read;
+static VALUE decimal_divisors;	/* [10 ** 0, 10 ** 1, ...] as Integers */
+static ISC_INT64 decimal_pow10[DECIMAL_SCALE_MAX + 1];	/* the same as ISC_INT64s */
+static VALUE decimal_factors;	/* [1E0, 1E-1, ...] as BigDecimals, filled on first use */
 
 /* static char isc_info_stmt[] = { isc_info_sql_stmt_type }; */
 /* static char isc_info_buff[16]; */
@@ -127,6 +186,22 @@ typedef	struct
 	char  vary_string[1];
 } VARY;
 
+/* Prepared statement parked in a connection's statement cache */
+struct FbStmtCacheEntry {
+	char *sql;
+	long statement_type;
+	isc_stmt_handle stmt;
+	XSQLDA *i_sqlda;
+	XSQLDA *o_sqlda;
+	char *i_buffer;
+	long  i_buffer_size;
+	char *o_buffer;
+	long  o_buffer_size;
+	struct FbBinder *binders;
+	struct FbStmtCacheEntry *prev;
+	struct FbStmtCacheEntry *next;
+};
+
 struct FbConnection {
 	isc_db_handle db;		/* DB handle */
 	isc_tr_handle transact; /* transaction handle */
@@ -134,26 +209,90 @@ struct FbConnection {
 	unsigned short dialect;
 	unsigned short db_dialect;
 	short downcase_names;
+	short decimal_mode;
+	short timestamp_format;
+	short blob_format;
+	long blob_segment_size;
+	long statement_timeout;	/* milliseconds, 0 for none */
+	int server_timeouts;	/* whether the server enforces statement timeouts, -1 until probed */
+	ISC_INT64 timer_deadline;	/* monotonic nanoseconds when the client timer fires, 0 when not in a timed call */
+	struct FbConnection *timer_next;	/* next connection on the client timer's list */
+	int timer_cancel;	/* the client timer fired: fail the next call with isc_cancelled */
+	int timed_out;	/* the client timer fired during the current timed call */
+	int cancel_pending;	/* the client timer's cancel may still be pending on the attachment */
+	unsigned long call_generation;	/* fb_call invocations made on this connection */
+	unsigned long timer_generation;	/* call_generation when the client timer cancelled */
 	int dropped;
+	int count_rows;	/* whether execute reports rows affected, which costs an info request */
+	unsigned long round_trips;	/* fbclient calls that wait on the server, see fb_call_round_trip */
 	ISC_STATUS isc_status[20];
+	VALUE self;	/* the Fb::Connection wrapping this struct, not marked */
+	VALUE lock;	/* Mutex serializing fbclient calls made without the GVL */
+	VALUE row_structs;	/* frozen Array of member Symbols => Struct class, in order of use */
+	VALUE charsets;	/* character set id => [name, bytes per character], read on demand */
+	VALUE transaction_options;	/* Fb::TransactionOptions for transactions started without any, or nil */
+	unsigned long transactions;	/* transactions started, numbering the current one */
+	st_table *stmt_cache;	/* SQL text -> struct FbStmtCacheEntry */
+	struct FbStmtCacheEntry *stmt_cache_head;	/* most recently used */
+	struct FbStmtCacheEntry *stmt_cache_tail;	/* least recently used */
+	long stmt_cache_size;
+	long stmt_cache_max;
+	long stmt_cache_hits;
+	long stmt_cache_misses;
+	long stmt_cache_evictions;
 	/* struct FbConnection *next; */
 };
 
 /* static struct FbConnection *fb_connection_list; */
 
+struct FbDecoder;
+typedef VALUE (*fb_decode_func)(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder);
+
+struct FbBinder;
+typedef void (*fb_bind_func)(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder);
+
+/* Parameter binder compiled from the input SQLDA when a statement is prepared */
+struct FbBinder {
+	fb_bind_func bind;
+	int nullable;
+	int scale;	/* -sqlscale, for scaled numerics */
+	ISC_INT64 max;	/* largest unscaled value of a scaled numeric */
+};
+
+/* Column decoder compiled from the output SQLDA when a cursor is opened */
+struct FbDecoder {
+	fb_decode_func decode;
+	int nullable;
+	double ratio;	/* 10 ** -sqlscale, for scaled numerics */
+};
+
 struct FbCursor {
 	int open;
 	int eof;
 	isc_tr_handle auto_transact;
 	isc_stmt_handle stmt;
+	long statement_type;
+	char *sql;	/* statement text, kept when the statement may be cached */
 	XSQLDA *i_sqlda;
 	XSQLDA *o_sqlda;
 	char *i_buffer;
 	long  i_buffer_size;
 	char *o_buffer;
 	long  o_buffer_size;
+	struct FbBinder *binders;
+	struct FbDecoder *decoders;
+	short decimal_mode;
+	short timestamp_format;
+	short blob_format;
+	long timeout;	/* statement timeout in milliseconds, 0 for none */
 	VALUE fields_ary;
 	VALUE fields_hash;
+	VALUE row_fields;	/* the fields_ary the row_* members below were built for */
+	VALUE row_keys;
+	VALUE row_symbols;
+	VALUE row_struct;
+	VALUE row_layout;	/* FbRowLayout shared by the lazy rows of this result set */
+	VALUE batch;	/* rows per block => Cursor running the statement as EXECUTE BLOCK, false if it can't */
 	VALUE connection;
 };
 
@@ -471,6 +610,32 @@ static VALUE sql_type_from_code(VALUE self, VALUE code, VALUE subtype)
 	return fb_sql_type_from_code(NUM2INT(code), NUM2INT(subtype));
 }
 
+/* Statement timeouts raise Fb::TimeoutError; Firebird reports them after isc_cancelled. */
+static VALUE fb_error_class(ISC_STATUS *isc_status)
+{
+#ifdef isc_req_stmt_timeout
+	ISC_STATUS *p = isc_status;
+
+	while (*p != isc_arg_end) {
+		switch (*p++) {
+		case isc_arg_gds:
+			if (*p == isc_req_stmt_timeout || *p == isc_att_stmt_timeout || *p == isc_cfg_stmt_timeout) {
+				return rb_eFbTimeoutError;
+			}
+			p++;
+			break;
+		case isc_arg_cstring:
+			p += 2;
+			break;
+		default:
+			p++;
+			break;
+		}
+	}
+#endif
+	return rb_eFbError;
+}
+
 static void fb_error_check(ISC_STATUS *isc_status)
 {
 	if (isc_status[0] == 1 && isc_status[1]) {
@@ -484,7 +649,12 @@ static void fb_error_check(ISC_STATUS *isc_status)
 		msg = rb_str_cat(msg1, "\n", strlen("\n"));
 		msg = rb_str_concat(msg, msg2);
 
-		exc = rb_exc_new3(rb_eFbError, msg);
+		/* A call cancelled on behalf of Timeout, Thread#raise or a signal reports that instead */
+		if (isc_status[1] == isc_cancelled) {
+			rb_thread_check_ints();
+		}
+
+		exc = rb_exc_new3(fb_error_class(isc_status), msg);
 		rb_iv_set(exc, "error_code", INT2FIX(code));
 		rb_exc_raise(exc);
 	}
@@ -519,6 +689,8 @@ static VALUE cursor_close _((VALUE));
 static VALUE cursor_drop _((VALUE));
 static VALUE cursor_execute _((int, VALUE*, VALUE));
 static VALUE cursor_fetchall _((int, VALUE*, VALUE));
+static VALUE statement_close _((VALUE));
+static VALUE fb_cursor_singleton_rows _((VALUE, VALUE, VALUE));
 
 static void fb_cursor_mark();
 static void fb_cursor_free();
@@ -531,830 +703,5093 @@ static void fb_connection_check(struct FbConnection *fb_connection)
 	}
 }
 
-/*
-static void global_close_cursors()
+/* fbclient calls made without the GVL
+ *
+ * Each fb_isc_* function takes the same arguments as its isc_* counterpart, preceded by the
+ * connection it runs on (NULL before one exists).  The call is made with the GVL released,
+ * so other Ruby threads keep running while it waits on the server.  Calls on one connection
+ * are serialized by its lock; they must not be made from GC free functions.
+ *
+ * If the thread is interrupted while the call runs, the statement is cancelled on the server
+ * and the call fails with isc_cancelled; fb_error_check then raises the pending interrupt.
+ */
+struct FbCall {
+	ISC_STATUS (*func)(struct FbCall *call);
+	ISC_STATUS *status;
+	void *p[6];
+	long n[3];
+	ISC_STATUS result;
+	int done;
+};
+
+static void *fb_call_nogvl(void *data)
 {
-	struct FbConnection *list = fb_connection_list;
-	int i;
+	struct FbCall *call = (struct FbCall *)data;
+	call->result = call->func(call);
+	call->done = 1;
+	return NULL;
+}
 
-	while (list) {
-		for (i = 0; i < RARRAY(list->cursor)->len; i++) {
-			cursor_close(RARRAY(list->cursor)->ptr[i]);
-		}
-		list = list->next;
+#ifdef HAVE_FB_CANCEL_OPERATION
+/* Unblocking function: may run on another thread, so it uses its own status vector. */
+static void fb_call_cancel(void *data)
+{
+	struct FbConnection *fb_connection = (struct FbConnection *)data;
+	ISC_STATUS isc_status[20];
+
+	if (fb_connection->db) {
+		fb_cancel_operation(isc_status, &fb_connection->db, fb_cancel_raise);
 	}
 }
-*/
+#endif
 
-static void fb_connection_close_cursors(struct FbConnection *fb_connection)
+/* Calls made from a fiber with an active Fiber.scheduler are handed to a small pool of worker
+ * threads, so only the calling fiber waits: it blocks on a Queue, which the scheduler handles. */
+static long fb_worker_max = 4;
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+static VALUE fb_worker_queue = Qnil;	/* Thread::Queue of pending struct FbOffload jobs */
+static long fb_worker_count;
+static long fb_worker_pid;	/* process that started the workers; they do not survive fork */
+
+struct FbOffload {
+	struct FbConnection *fb_connection;
+	struct FbCall *call;
+	VALUE done;	/* Thread::Queue the worker pushes to once the call has returned */
+};
+
+static ISC_STATUS fb_call(struct FbConnection *fb_connection, struct FbCall *call);
+
+static void fb_offload_mark(struct FbOffload *job)
 {
-	int i;
-	long len = RARRAY_LEN(fb_connection->cursor);
-	for (i = 0; i < len; i++) {
-		cursor_close(RARRAY_PTR(fb_connection->cursor)[i]);
-	}
+	rb_gc_mark(job->done);
 }
 
-static void fb_connection_drop_cursors(struct FbConnection *fb_connection)
+#ifdef HAVE_FB_CANCEL_OPERATION
+static void *fb_offload_cancel(void *data)
 {
-	int i;
-	long len = RARRAY_LEN(fb_connection->cursor);
-	for (i = 0; i < len; i++) {
-		cursor_drop(RARRAY_PTR(fb_connection->cursor)[i]);
+	fb_call_cancel(data);
+	return NULL;
+}
+#endif
+
+static VALUE fb_offload_run(VALUE data)
+{
+	struct FbOffload *job = (struct FbOffload *)DATA_PTR(data);
+	fb_call(job->fb_connection, job->call);
+	return Qnil;
+}
+
+static VALUE fb_worker_run(void *unused)
+{
+	struct FbOffload *job;
+	VALUE data;
+	int state;
+
+	for (;;) {
+		data = rb_funcall(fb_worker_queue, rb_intern("pop"), 0);
+		job = (struct FbOffload *)DATA_PTR(data);
+		state = 0;
+		rb_protect(fb_offload_run, data, &state);
+		if (!job->call->done) {
+			/* The worker was interrupted before making the call */
+			job->call->status[0] = isc_arg_gds;
+			job->call->status[1] = isc_cancelled;
+			job->call->status[2] = isc_arg_end;
+			job->call->result = isc_cancelled;
+		}
+		rb_funcall(job->done, rb_intern("push"), 1, Qtrue);
+		if (state) {
+			fb_worker_count--;
+			rb_jump_tag(state);
+		}
 	}
-  rb_ary_clear(fb_connection->cursor);
+	return Qnil;
 }
 
-/*
-static void fb_connection_remove(struct FbConnection *fb_connection)
+static VALUE fb_offload_wait(VALUE done)
 {
-	if (fb_connection_list != NULL) {
-		if (fb_connection_list == fb_connection) {
-			fb_connection_list = fb_connection_list->next;
-		} else {
-			struct FbConnection *list = fb_connection_list;
-			while (list->next) {
-				if (list->next == fb_connection) {
-					list->next = fb_connection->next;
-					break;
-				}
-				list = list->next;
+	return rb_funcall(done, rb_intern("pop"), 0);
+}
+
+static ISC_STATUS fb_call_offload(struct FbConnection *fb_connection, struct FbCall *call)
+{
+	struct FbOffload job;
+	VALUE data, error = Qnil;
+	int state, interrupted = 0;
+
+	if (NIL_P(fb_worker_queue) || fb_worker_pid != (long)getpid()) {
+		fb_worker_queue = rb_class_new_instance(0, NULL, rb_path2class("Thread::Queue"));
+		fb_worker_count = 0;
+		fb_worker_pid = (long)getpid();
+	}
+	while (fb_worker_count < fb_worker_max) {
+		rb_thread_create(fb_worker_run, NULL);
+		fb_worker_count++;
+	}
+
+	job.fb_connection = fb_connection;
+	job.call = call;
+	job.done = rb_class_new_instance(0, NULL, rb_path2class("Thread::Queue"));
+	call->done = 0;
+	data = Data_Wrap_Struct(0, fb_offload_mark, NULL, &job);
+	rb_funcall(fb_worker_queue, rb_intern("push"), 1, data);
+	for (;;) {
+		state = 0;
+		rb_protect(fb_offload_wait, job.done, &state);
+		if (!state) break;
+		/* The fiber was interrupted, but the worker still uses call and its buffers:
+		 * cancel the statement and wait for the worker before unwinding. */
+		if (!interrupted) {
+			interrupted = state;
+			error = rb_errinfo();
+#ifdef HAVE_FB_CANCEL_OPERATION
+			/* The cancel request is a round trip of its own: let other threads run meanwhile */
+			if (fb_connection) {
+				rb_thread_call_without_gvl(fb_offload_cancel, fb_connection, RUBY_UBF_IO, NULL);
 			}
+#endif
 		}
-		fb_connection->db = 0;
-		connection_count--;
+		rb_set_errinfo(Qnil);
+	}
+	RB_GC_GUARD(data);
+	if (interrupted) {
+		rb_set_errinfo(error);
+		rb_jump_tag(interrupted);
 	}
+	return call->result;
 }
-*/
+#endif
 
-static void fb_connection_disconnect(struct FbConnection *fb_connection)
+static ISC_STATUS fb_call_dsql_fetch(struct FbCall *c);
+static ISC_STATUS fb_call_dsql_alloc_statement2(struct FbCall *c);
+static ISC_STATUS fb_call_dsql_free_statement(struct FbCall *c);
+static ISC_STATUS fb_call_get_segment(struct FbCall *c);
+
+/* Whether a call waits for a reply from the server.  The remote client (Firebird 2.1 and later)
+ * sends statement allocations and frees along with the next request, and serves fetches and
+ * blob segments from what it read ahead. */
+static int fb_call_round_trip(struct FbCall *call)
 {
-	if (fb_connection->transact) {
-		isc_commit_transaction(fb_connection->isc_status, &fb_connection->transact);
-		fb_error_check(fb_connection->isc_status);
+	return call->func != fb_call_dsql_fetch && call->func != fb_call_get_segment
+		&& call->func != fb_call_dsql_alloc_statement2 && call->func != fb_call_dsql_free_statement;
+}
+
+static ISC_STATUS fb_call(struct FbConnection *fb_connection, struct FbCall *call)
+{
+	unsigned long generation = 0;
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+	rb_unblock_function_t *ubf = RUBY_UBF_IO;
+	void *ubf_data = NULL;
+#endif
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+	if (!NIL_P(rb_fiber_scheduler_current())) {
+		return fb_call_offload(fb_connection, call);
 	}
-	if (fb_connection->dropped) {
-		isc_drop_database(fb_connection->isc_status, &fb_connection->db);
-	} else {
-		isc_detach_database(fb_connection->isc_status, &fb_connection->db);
+#endif
+	if (fb_connection) generation = ++fb_connection->call_generation;
+	/* The client timer fired between calls, so its cancel request found nothing to cancel */
+	if (fb_connection && fb_connection->timer_cancel) {
+		fb_connection->timer_cancel = 0;
+		call->status[0] = isc_arg_gds;
+		call->status[1] = isc_cancelled;
+		call->status[2] = isc_arg_end;
+		return isc_cancelled;
 	}
-	fb_error_check(fb_connection->isc_status);
-	/* fb_connection_remove(fb_connection); */
+	if (fb_connection && fb_call_round_trip(call)) {
+		fb_connection->round_trips++;
+	}
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+
+#ifdef HAVE_FB_CANCEL_OPERATION
+	if (fb_connection) {
+		ubf = fb_call_cancel;
+		ubf_data = fb_connection;
+	}
+#endif
+	call->done = 0;
+	for (;;) {
+		if (fb_connection) rb_mutex_lock(fb_connection->lock);
+		/* Unlike rb_thread_call_without_gvl, this does not run interrupts (and possibly other
+		 * threads) before returning, so the caller can read the status vector undisturbed. */
+		rb_thread_call_without_gvl2(fb_call_nogvl, call, ubf, ubf_data);
+		if (fb_connection) rb_mutex_unlock(fb_connection->lock);
+		if (call->done) break;
+		/* Interrupted before the call was made */
+		rb_thread_check_ints();
+	}
+#else
+	call->result = call->func(call);
+#endif
+	if (fb_connection && call->status[0] == isc_arg_gds && call->status[1] == isc_cancelled) {
+		fb_connection->timer_cancel = 0;
+		/* Made no earlier than the call the timer cancelled, so the cancel was delivered */
+		if (generation >= fb_connection->timer_generation) {
+			fb_connection->cancel_pending = 0;
+		}
+	}
+	return call->result;
 }
 
-static void fb_connection_disconnect_warn(struct FbConnection *fb_connection)
+static ISC_STATUS fb_call_attach_database(struct FbCall *c)
 {
-	if (fb_connection->transact) {
-		isc_commit_transaction(fb_connection->isc_status, &fb_connection->transact);
-		fb_error_check_warn(fb_connection->isc_status);
-	}
-	isc_detach_database(fb_connection->isc_status, &fb_connection->db);
-	fb_error_check_warn(fb_connection->isc_status);
-	/* fb_connection_remove(fb_connection); */
+	return isc_attach_database(c->status, (short)c->n[0], (char *)c->p[0], (isc_db_handle *)c->p[1], (short)c->n[1], (char *)c->p[2]);
 }
 
-static void fb_connection_mark(struct FbConnection *fb_connection)
+static ISC_STATUS fb_isc_attach_database(struct FbConnection *fb_connection, ISC_STATUS *status, short name_length, char *name, isc_db_handle *db, short dpb_length, char *dpb)
 {
-	rb_gc_mark(fb_connection->cursor);
+	struct FbCall c;
+	c.func = fb_call_attach_database; c.status = status;
+	c.n[0] = name_length; c.p[0] = name; c.p[1] = db; c.n[1] = dpb_length; c.p[2] = dpb;
+	return fb_call(fb_connection, &c);
 }
 
-static void fb_connection_free(struct FbConnection *fb_connection)
+static ISC_STATUS fb_call_detach_database(struct FbCall *c)
 {
-	if (fb_connection->db) {
-		fb_connection_disconnect_warn(fb_connection);
-	}
-	xfree(fb_connection);
+	return isc_detach_database(c->status, (isc_db_handle *)c->p[0]);
 }
 
-/*
-static struct FbConnection* fb_connection_check_retrieve(VALUE data)
+static ISC_STATUS fb_isc_detach_database(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db)
 {
-	if (TYPE(data) != T_DATA || RDATA(data)->dfree != (void *)fb_connection_free) {
-		rb_raise(rb_eTypeError,
-			"Wrong argument type %s (expected Fb::Connection)",
-			rb_class2name(CLASS_OF(data)));
-	}
-	return (struct FbConnection*)RDATA(data)->data;
+	struct FbCall c;
+	c.func = fb_call_detach_database; c.status = status;
+	c.p[0] = db;
+	return fb_call(fb_connection, &c);
 }
-*/
 
-static unsigned short fb_connection_db_SQL_Dialect(struct FbConnection *fb_connection)
+static ISC_STATUS fb_call_drop_database(struct FbCall *c)
 {
-	long dialect;
-	long length;
-	char db_info_command = isc_info_db_SQL_dialect;
-	char isc_info_buff[16];
+	return isc_drop_database(c->status, (isc_db_handle *)c->p[0]);
+}
 
-	/* Get the db SQL Dialect */
-	isc_database_info(fb_connection->isc_status, &fb_connection->db,
-			1, &db_info_command,
-			sizeof(isc_info_buff), isc_info_buff);
-	fb_error_check(fb_connection->isc_status);
+static ISC_STATUS fb_isc_drop_database(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db)
+{
+	struct FbCall c;
+	c.func = fb_call_drop_database; c.status = status;
+	c.p[0] = db;
+	return fb_call(fb_connection, &c);
+}
 
-	if (isc_info_buff[0] == isc_info_db_SQL_dialect) {
-		length = isc_vax_integer(&isc_info_buff[1], 2);
-		dialect = isc_vax_integer(&isc_info_buff[3], (short)length);
-	} else {
-		dialect = 1;
-	}
-	return dialect;
+static ISC_STATUS fb_call_database_info(struct FbCall *c)
+{
+	return isc_database_info(c->status, (isc_db_handle *)c->p[0], (short)c->n[0], (char *)c->p[1], (short)c->n[1], (char *)c->p[2]);
 }
 
-static unsigned short fb_connection_dialect(struct FbConnection *fb_connection)
+static ISC_STATUS fb_isc_database_info(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db, short item_length, char *items, short buffer_length, char *buffer)
 {
-	return fb_connection->dialect;
+	struct FbCall c;
+	c.func = fb_call_database_info; c.status = status;
+	c.p[0] = db; c.n[0] = item_length; c.p[1] = items; c.n[1] = buffer_length; c.p[2] = buffer;
+	return fb_call(fb_connection, &c);
 }
 
-/*
-static unsigned short fb_connection_db_dialect(struct FbConnection *fb_connection)
+static ISC_STATUS fb_call_start_transaction(struct FbCall *c)
 {
-	return fb_connection->db_dialect;
+	return isc_start_transaction(c->status, (isc_tr_handle *)c->p[0], 1, (isc_db_handle *)c->p[1], (short)c->n[0], (char *)c->p[2]);
 }
-*/
 
-/* Transaction option list */
+/* Starts a transaction on a single database */
+static ISC_STATUS fb_isc_start_transaction(struct FbConnection *fb_connection, ISC_STATUS *status, isc_tr_handle *tr, isc_db_handle *db, short tpb_length, char *tpb)
+{
+	struct FbCall c;
+	c.func = fb_call_start_transaction; c.status = status;
+	c.p[0] = tr; c.p[1] = db; c.n[0] = tpb_length; c.p[2] = tpb;
+	return fb_call(fb_connection, &c);
+}
 
-static trans_opts	rcom_opt_S[] =
+static ISC_STATUS fb_call_commit_transaction(struct FbCall *c)
 {
-	{"NO",			"RECORD_VERSION",	isc_tpb_no_rec_version,	-1,	0},
-	{"RECORD_VERSION",	0,			isc_tpb_rec_version,	-1,	0},
-	{"*",			0,			isc_tpb_no_rec_version,	-1,	0},
-	{0,			0,			0,			0,	0}
-};
+	return isc_commit_transaction(c->status, (isc_tr_handle *)c->p[0]);
+}
 
+static ISC_STATUS fb_isc_commit_transaction(struct FbConnection *fb_connection, ISC_STATUS *status, isc_tr_handle *tr)
+{
+	struct FbCall c;
+	c.func = fb_call_commit_transaction; c.status = status;
+	c.p[0] = tr;
+	return fb_call(fb_connection, &c);
+}
 
-static trans_opts	read_opt_S[] =
+static ISC_STATUS fb_call_rollback_transaction(struct FbCall *c)
 {
-	{"WRITE",	0,	isc_tpb_write,		1,	0},
-	{"ONLY",		0,	isc_tpb_read,		1,	0},
-	{"COMMITTED",	0,	isc_tpb_read_committed,	2,	rcom_opt_S},
-	{0,		0,	0,			0,	0}
-};
+	return isc_rollback_transaction(c->status, (isc_tr_handle *)c->p[0]);
+}
 
+static ISC_STATUS fb_isc_rollback_transaction(struct FbConnection *fb_connection, ISC_STATUS *status, isc_tr_handle *tr)
+{
+	struct FbCall c;
+	c.func = fb_call_rollback_transaction; c.status = status;
+	c.p[0] = tr;
+	return fb_call(fb_connection, &c);
+}
 
-static trans_opts	snap_opt_S[] =
+static ISC_STATUS fb_call_dsql_execute_immediate(struct FbCall *c)
 {
-	{"TABLE",	"STABILITY",	isc_tpb_consistency,	2,	0},
-	{"*",		0,		isc_tpb_concurrency,	2,	0},
-	{0,			0,	0,			0,	0}
-};
+	return isc_dsql_execute_immediate(c->status, (isc_db_handle *)c->p[0], (isc_tr_handle *)c->p[1], (unsigned short)c->n[0], (char *)c->p[2], (unsigned short)c->n[1], (XSQLDA *)c->p[3]);
+}
 
+static ISC_STATUS fb_isc_dsql_execute_immediate(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db, isc_tr_handle *tr, unsigned short length, char *sql, unsigned short dialect, XSQLDA *sqlda)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_execute_immediate; c.status = status;
+	c.p[0] = db; c.p[1] = tr; c.n[0] = length; c.p[2] = sql; c.n[1] = dialect; c.p[3] = sqlda;
+	return fb_call(fb_connection, &c);
+}
 
-static trans_opts	isol_opt_S[] =
+static ISC_STATUS fb_call_dsql_alloc_statement2(struct FbCall *c)
 {
-	{"SNAPSHOT",	0,		0,			0,	snap_opt_S},
-	{"READ",		"COMMITTED",	isc_tpb_read_committed,	2,	rcom_opt_S},
-	{0,		0,		0,			0,	0}
-};
+	return isc_dsql_alloc_statement2(c->status, (isc_db_handle *)c->p[0], (isc_stmt_handle *)c->p[1]);
+}
 
+static ISC_STATUS fb_isc_dsql_alloc_statement2(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db, isc_stmt_handle *stmt)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_alloc_statement2; c.status = status;
+	c.p[0] = db; c.p[1] = stmt;
+	return fb_call(fb_connection, &c);
+}
 
-static trans_opts	trans_opt_S[] =
+static ISC_STATUS fb_call_dsql_prepare(struct FbCall *c)
 {
-	{"READ",		0,		0,		0,	read_opt_S},
-	{"WAIT",		0,		isc_tpb_wait,	3,	0},
-	{"NO",		"WAIT",		isc_tpb_nowait,	3,	0},
-	{"ISOLATION",	"LEVEL",	0,		0,	isol_opt_S},
-	{"SNAPSHOT",	0,		0,		0,	snap_opt_S},
-	{"RESERVING",	0,		-1,		0,	0},
-	{0,		0,		0,		0,	0}
-};
+	return isc_dsql_prepare(c->status, (isc_tr_handle *)c->p[0], (isc_stmt_handle *)c->p[1], (unsigned short)c->n[0], (char *)c->p[2], (unsigned short)c->n[1], (XSQLDA *)c->p[3]);
+}
 
-/* Name1	Name2		Option value	    Position	Sub-option */
+static ISC_STATUS fb_isc_dsql_prepare(struct FbConnection *fb_connection, ISC_STATUS *status, isc_tr_handle *tr, isc_stmt_handle *stmt, unsigned short length, char *sql, unsigned short dialect, XSQLDA *sqlda)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_prepare; c.status = status;
+	c.p[0] = tr; c.p[1] = stmt; c.n[0] = length; c.p[2] = sql; c.n[1] = dialect; c.p[3] = sqlda;
+	return fb_call(fb_connection, &c);
+}
 
-#define	RESV_TABLEEND	"FOR"
-#define	RESV_SHARED	"SHARED"
-#define	RESV_PROTECTD	"PROTECTED"
-#define	RESV_READ	"READ"
-#define	RESV_WRITE	"WRITE"
-#define	RESV_CONTINUE	','
+static ISC_STATUS fb_call_dsql_describe(struct FbCall *c)
+{
+	return isc_dsql_describe(c->status, (isc_stmt_handle *)c->p[0], (unsigned short)c->n[0], (XSQLDA *)c->p[1]);
+}
 
-static char* trans_parseopts(VALUE opt, long *tpb_len)
+static ISC_STATUS fb_isc_dsql_describe(struct FbConnection *fb_connection, ISC_STATUS *status, isc_stmt_handle *stmt, unsigned short version, XSQLDA *sqlda)
 {
-	char *s, *trans;
-	long used;
-	long size;
-	char *tpb;
-	trans_opts *curr_p;
-	trans_opts *target_p;
-	char *check1_p;
-	char *check2_p;
-	int count;
-	int next_c;
-	char check_f[4];
-	char *resv_p;
-	char *resend_p;
-	char *tblend_p = 0;
-	long tbl_len;
-	long res_first;
-	int res_count;
-	long ofs;
-	char sp_prm;
-	char rw_prm;
-	int cont_f;
-	const char *desc = 0;
+	struct FbCall c;
+	c.func = fb_call_dsql_describe; c.status = status;
+	c.p[0] = stmt; c.n[0] = version; c.p[1] = sqlda;
+	return fb_call(fb_connection, &c);
+}
 
-	/* Initialize */
-	s = StringValuePtr(opt);
-	trans = ALLOCA_N(char, strlen(s)+1);
-	strcpy(trans, s);
-	s = trans;
-	while (*s) {
-		*s = UPPER(*s);
-		s++;
-	}
+static ISC_STATUS fb_call_dsql_describe_bind(struct FbCall *c)
+{
+	return isc_dsql_describe_bind(c->status, (isc_stmt_handle *)c->p[0], (unsigned short)c->n[0], (XSQLDA *)c->p[1]);
+}
 
-	used = 0;
-	size = 0;
-	tpb = NULL;
-	memset((void *)check_f, 0, sizeof(check_f));
+static ISC_STATUS fb_isc_dsql_describe_bind(struct FbConnection *fb_connection, ISC_STATUS *status, isc_stmt_handle *stmt, unsigned short version, XSQLDA *sqlda)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_describe_bind; c.status = status;
+	c.p[0] = stmt; c.n[0] = version; c.p[1] = sqlda;
+	return fb_call(fb_connection, &c);
+}
 
-	/* Set the default transaction option */
-	tpb = (char*)xmalloc(TPBBUFF_ALLOC);
-	size = TPBBUFF_ALLOC;
-	memcpy((void*)tpb, (void*)isc_tpb_0, sizeof(isc_tpb_0));
-	used = sizeof(isc_tpb_0);
+static ISC_STATUS fb_call_dsql_sql_info(struct FbCall *c)
+{
+	return isc_dsql_sql_info(c->status, (isc_stmt_handle *)c->p[0], (short)c->n[0], (char *)c->p[1], (short)c->n[1], (char *)c->p[2]);
+}
 
-	/* Analize the transaction option strings */
-	curr_p = trans_opt_S;
-	check1_p = strtok(trans, CMND_DELIMIT);
-	if (check1_p) {
-		check2_p = strtok(0, CMND_DELIMIT);
-	} else {
-		check2_p = 0;
+static ISC_STATUS fb_isc_dsql_sql_info(struct FbConnection *fb_connection, ISC_STATUS *status, isc_stmt_handle *stmt, short item_length, char *items, short buffer_length, char *buffer)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_sql_info; c.status = status;
+	c.p[0] = stmt; c.n[0] = item_length; c.p[1] = items; c.n[1] = buffer_length; c.p[2] = buffer;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_dsql_execute2(struct FbCall *c)
+{
+	return isc_dsql_execute2(c->status, (isc_tr_handle *)c->p[0], (isc_stmt_handle *)c->p[1], (unsigned short)c->n[0], (XSQLDA *)c->p[2], (XSQLDA *)c->p[3]);
+}
+
+static ISC_STATUS fb_isc_dsql_execute2(struct FbConnection *fb_connection, ISC_STATUS *status, isc_tr_handle *tr, isc_stmt_handle *stmt, unsigned short version, XSQLDA *in_sqlda, XSQLDA *out_sqlda)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_execute2; c.status = status;
+	c.p[0] = tr; c.p[1] = stmt; c.n[0] = version; c.p[2] = in_sqlda; c.p[3] = out_sqlda;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_dsql_fetch(struct FbCall *c)
+{
+	return isc_dsql_fetch(c->status, (isc_stmt_handle *)c->p[0], (unsigned short)c->n[0], (XSQLDA *)c->p[1]);
+}
+
+static ISC_STATUS fb_isc_dsql_fetch(struct FbConnection *fb_connection, ISC_STATUS *status, isc_stmt_handle *stmt, unsigned short version, XSQLDA *sqlda)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_fetch; c.status = status;
+	c.p[0] = stmt; c.n[0] = version; c.p[1] = sqlda;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_dsql_free_statement(struct FbCall *c)
+{
+	return isc_dsql_free_statement(c->status, (isc_stmt_handle *)c->p[0], (unsigned short)c->n[0]);
+}
+
+static ISC_STATUS fb_isc_dsql_free_statement(struct FbConnection *fb_connection, ISC_STATUS *status, isc_stmt_handle *stmt, unsigned short option)
+{
+	struct FbCall c;
+	c.func = fb_call_dsql_free_statement; c.status = status;
+	c.p[0] = stmt; c.n[0] = option;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_create_blob2(struct FbCall *c)
+{
+	return isc_create_blob2(c->status, (isc_db_handle *)c->p[0], (isc_tr_handle *)c->p[1], (isc_blob_handle *)c->p[2], (ISC_QUAD *)c->p[3], (short)c->n[0], (char *)c->p[4]);
+}
+
+static ISC_STATUS fb_isc_create_blob2(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db, isc_tr_handle *tr, isc_blob_handle *blob, ISC_QUAD *blob_id, short bpb_length, char *bpb)
+{
+	struct FbCall c;
+	c.func = fb_call_create_blob2; c.status = status;
+	c.p[0] = db; c.p[1] = tr; c.p[2] = blob; c.p[3] = blob_id; c.n[0] = bpb_length; c.p[4] = bpb;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_open_blob2(struct FbCall *c)
+{
+	return isc_open_blob2(c->status, (isc_db_handle *)c->p[0], (isc_tr_handle *)c->p[1], (isc_blob_handle *)c->p[2], (ISC_QUAD *)c->p[3], (ISC_USHORT)c->n[0], (ISC_UCHAR *)c->p[4]);
+}
+
+static ISC_STATUS fb_isc_open_blob2(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db, isc_tr_handle *tr, isc_blob_handle *blob, ISC_QUAD *blob_id, ISC_USHORT bpb_length, ISC_UCHAR *bpb)
+{
+	struct FbCall c;
+	c.func = fb_call_open_blob2; c.status = status;
+	c.p[0] = db; c.p[1] = tr; c.p[2] = blob; c.p[3] = blob_id; c.n[0] = bpb_length; c.p[4] = bpb;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_blob_info(struct FbCall *c)
+{
+	return isc_blob_info(c->status, (isc_blob_handle *)c->p[0], (short)c->n[0], (char *)c->p[1], (short)c->n[1], (char *)c->p[2]);
+}
+
+static ISC_STATUS fb_isc_blob_info(struct FbConnection *fb_connection, ISC_STATUS *status, isc_blob_handle *blob, short item_length, char *items, short buffer_length, char *buffer)
+{
+	struct FbCall c;
+	c.func = fb_call_blob_info; c.status = status;
+	c.p[0] = blob; c.n[0] = item_length; c.p[1] = items; c.n[1] = buffer_length; c.p[2] = buffer;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_get_segment(struct FbCall *c)
+{
+	return isc_get_segment(c->status, (isc_blob_handle *)c->p[0], (unsigned short *)c->p[1], (unsigned short)c->n[0], (char *)c->p[2]);
+}
+
+static ISC_STATUS fb_isc_get_segment(struct FbConnection *fb_connection, ISC_STATUS *status, isc_blob_handle *blob, unsigned short *actual, unsigned short length, char *buffer)
+{
+	struct FbCall c;
+	c.func = fb_call_get_segment; c.status = status;
+	c.p[0] = blob; c.p[1] = actual; c.n[0] = length; c.p[2] = buffer;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_put_segment(struct FbCall *c)
+{
+	return isc_put_segment(c->status, (isc_blob_handle *)c->p[0], (unsigned short)c->n[0], (char *)c->p[1]);
+}
+
+static ISC_STATUS fb_isc_put_segment(struct FbConnection *fb_connection, ISC_STATUS *status, isc_blob_handle *blob, unsigned short length, const char *buffer)
+{
+	struct FbCall c;
+	c.func = fb_call_put_segment; c.status = status;
+	c.p[0] = blob; c.n[0] = length; c.p[1] = (void *)buffer;
+	return fb_call(fb_connection, &c);
+}
+
+static ISC_STATUS fb_call_close_blob(struct FbCall *c)
+{
+	return isc_close_blob(c->status, (isc_blob_handle *)c->p[0]);
+}
+
+static ISC_STATUS fb_isc_close_blob(struct FbConnection *fb_connection, ISC_STATUS *status, isc_blob_handle *blob)
+{
+	struct FbCall c;
+	c.func = fb_call_close_blob; c.status = status;
+	c.p[0] = blob;
+	return fb_call(fb_connection, &c);
+}
+
+#ifdef HAVE_FB_CANCEL_OPERATION
+static ISC_STATUS fb_call_cancel_operation(struct FbCall *c)
+{
+	return fb_cancel_operation(c->status, (isc_db_handle *)c->p[0], (ISC_USHORT)c->n[0]);
+}
+
+/* Not serialized with the connection's other calls: it is meant to interrupt them. */
+static ISC_STATUS fb_isc_cancel_operation(ISC_STATUS *status, isc_db_handle *db, ISC_USHORT option)
+{
+	struct FbCall c;
+	c.func = fb_call_cancel_operation; c.status = status;
+	c.p[0] = db; c.n[0] = option;
+	return fb_call(NULL, &c);
+}
+#endif
+
+static ISC_STATUS fb_call_seek_blob(struct FbCall *c)
+{
+	return isc_seek_blob(c->status, (isc_blob_handle *)c->p[0], (short)c->n[0], (ISC_LONG)c->n[1], (ISC_LONG *)c->p[1]);
+}
+
+static ISC_STATUS fb_isc_seek_blob(struct FbConnection *fb_connection, ISC_STATUS *status, isc_blob_handle *blob, short mode, ISC_LONG offset, ISC_LONG *result)
+{
+	struct FbCall c;
+	c.func = fb_call_seek_blob; c.status = status;
+	c.p[0] = blob; c.n[0] = mode; c.n[1] = offset; c.p[1] = result;
+	return fb_call(fb_connection, &c);
+}
+
+#ifdef HAVE_FB_PING
+static ISC_STATUS fb_call_ping(struct FbCall *c)
+{
+	return fb_ping(c->status, (isc_db_handle *)c->p[0]);
+}
+
+static ISC_STATUS fb_isc_ping(struct FbConnection *fb_connection, ISC_STATUS *status, isc_db_handle *db)
+{
+	struct FbCall c;
+	c.func = fb_call_ping; c.status = status;
+	c.p[0] = db;
+	return fb_call(fb_connection, &c);
+}
+#endif
+
+/* statement timeouts
+ *
+ * From Firebird 4 the server enforces a statement's timeout itself, set with fb_dsql_set_timeout
+ * before each execution.  Against older servers a client timer thread cancels the connection's
+ * running statement instead.
+ */
+
+static long fb_statement_timeout(VALUE timeout)
+{
+	long ms;
+
+	if (NIL_P(timeout)) return 0;
+	ms = NUM2LONG(timeout);
+	if (ms < 0) {
+		rb_raise(rb_eArgError, "statement timeout must not be negative");
 	}
-	while (curr_p) {
-		target_p = 0;
-		next_c = 0;
-		for (count = 0; curr_p[count].option1; count++) {
-			if (!strcmp(curr_p[count].option1, "*")) {
-				target_p = &curr_p[count];
-				break;
-			} else if (check1_p && !strcmp(check1_p, curr_p[count].option1)) {
-				if (!curr_p[count].option2) {
-					next_c = 1;
-					target_p = &curr_p[count];
-					break;
-				} else if (check2_p && !strcmp(check2_p, curr_p[count].option2)) {
-					next_c = 2;
-					target_p = &curr_p[count];
-					break;
-				}
-			}
-		}
+	return ms;
+}
 
-		if (!target_p) {
-			desc = "Illegal transaction option was specified";
-			goto error;
+/* Returns whether the server enforces statement timeouts, asking it the first time. */
+static int fb_connection_server_timeouts(struct FbConnection *fb_connection)
+{
+#ifdef HAVE_FB_DSQL_SET_TIMEOUT
+	if (fb_connection->server_timeouts < 0) {
+		ISC_STATUS isc_status[20];
+		char db_info_command = isc_info_ods_version;
+		char isc_info_buff[16];
+		long ods = 0;
+
+		/* Ask the server rather than the client library: statement timeouts came with
+		 * Firebird 4, whose databases have on-disk structure 13 or later. */
+		fb_isc_database_info(fb_connection, isc_status, &fb_connection->db,
+				1, &db_info_command,
+				sizeof(isc_info_buff), isc_info_buff);
+		fb_error_check(isc_status);
+		if (isc_info_buff[0] == isc_info_ods_version) {
+			short length = (short)isc_vax_integer(&isc_info_buff[1], 2);
+			ods = isc_vax_integer(&isc_info_buff[3], length);
 		}
+		fb_connection->server_timeouts = ods >= 13;
+	}
+	return fb_connection->server_timeouts;
+#else
+	return 0;
+#endif
+}
 
-		/* Set the transaction option */
-		if (target_p->optval > '\0') {
-			if (target_p->position > 0) {
-				if (check_f[target_p->position]) {
-					desc = "Duplicate transaction option was specified";
-					goto error;
-				}
-				tpb[target_p->position] = target_p->optval;
-				check_f[target_p->position] = 1;
-			} else {
-				if (used + 1 > size) {
-					tpb = (char *)realloc(tpb, size + TPBBUFF_ALLOC);
-					size += TPBBUFF_ALLOC;
+/* Monotonic clock in nanoseconds */
+static ISC_INT64 fb_monotonic_nsec(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ISC_INT64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (ISC_INT64)tv.tv_sec * 1000000000 + (ISC_INT64)tv.tv_usec * 1000;
+#endif
+}
+
+#ifdef HAVE_FB_CANCEL_OPERATION
+/* One timer thread per process serves every connection in a timed call.  Such connections
+ * are linked on fb_timer_list only while their call runs, so the thread never sees a freed one.
+ * It sleeps until the earliest deadline and is woken whenever a connection is added.
+ * It holds fb_timer_lock while a cancel request is in flight. */
+static VALUE fb_timer_thread = Qnil;
+static VALUE fb_timer_lock = Qnil;
+static long fb_timer_pid;
+static struct FbConnection *fb_timer_list;
+
+static VALUE fb_timer_run(void *unused)
+{
+	struct FbConnection *fb_connection;
+	ISC_INT64 now, next;
+	struct timeval tv;
+
+	for (;;) {
+		now = fb_monotonic_nsec();
+		next = 0;
+		for (fb_connection = fb_timer_list; fb_connection; fb_connection = fb_connection->timer_next) {
+			if (fb_connection->timed_out) continue;
+			if (fb_connection->timer_deadline <= now) {
+				ISC_STATUS isc_status[20];
+				isc_db_handle db = fb_connection->db;
+
+				fb_connection->timed_out = 1;
+				fb_connection->timer_cancel = 1;
+				fb_connection->cancel_pending = 1;
+				fb_connection->timer_generation = fb_connection->call_generation;
+				/* The timed call may return while the cancel runs: only use the copied handle.
+				 * fb_connection_timer_stop waits on the lock before the connection moves on. */
+				if (db) {
+					rb_mutex_lock(fb_timer_lock);
+					fb_isc_cancel_operation(isc_status, &db, fb_cancel_raise);
+					rb_mutex_unlock(fb_timer_lock);
 				}
-				tpb[used] = target_p->optval;
-				used++;
-			}
-		} else if (target_p->optval) {		/* RESERVING ... FOR */
-			if (check_f[0]) {
-				desc = "Duplicate transaction option was specified";
-				goto error;
+				break;
 			}
-			resv_p = check2_p;
-			if (!resv_p || !strcmp(resv_p, RESV_TABLEEND)) {
-				desc = "RESERVING needs table name list";
-				goto error;
+			if (!next || fb_connection->timer_deadline < next) {
+				next = fb_connection->timer_deadline;
 			}
-			while (resv_p) {
-				res_first = used;
-				res_count = 0;
-				resend_p = strtok(0, CMND_DELIMIT);
-				while (resend_p) {
-					if (!strcmp(resend_p, RESV_TABLEEND)) {
-						break;
-					}
-					resend_p = strtok(0, CMND_DELIMIT);
-				}
+		}
+		if (fb_connection) continue;	/* the list may have changed: scan it again */
+		if (!next) {
+			rb_thread_sleep_forever();
+		} else {
+			next -= now;
+			tv.tv_sec = (long)(next / 1000000000);
+			tv.tv_usec = (long)(next % 1000000000 / 1000) + 1;
+			rb_thread_wait_for(tv);
+		}
+	}
+	return Qnil;
+}
+#endif
 
-				if (!resend_p) {
-					desc = "Illegal transaction option was specified";
-					goto error;
-				}
+static void fb_connection_timer_start(struct FbConnection *fb_connection, long timeout)
+{
+#ifdef HAVE_FB_CANCEL_OPERATION
+	if (fb_timer_pid != (long)getpid()) {
+		/* The timer thread does not survive fork */
+		fb_timer_thread = Qnil;
+		fb_timer_lock = rb_mutex_new();
+		fb_timer_list = NULL;
+		fb_timer_pid = (long)getpid();
+	}
+	fb_connection->timed_out = 0;
+	fb_connection->timer_cancel = 0;
+	fb_connection->cancel_pending = 0;
+	fb_connection->timer_deadline = fb_monotonic_nsec() + (ISC_INT64)timeout * 1000000;
+	fb_connection->timer_next = fb_timer_list;
+	fb_timer_list = fb_connection;
+	if (NIL_P(fb_timer_thread) || NIL_P(rb_thread_wakeup_alive(fb_timer_thread))) {
+		fb_timer_thread = rb_thread_create(fb_timer_run, NULL);
+	}
+#else
+	rb_raise(rb_eNotImpError, "statement timeouts need a Firebird 4 server or a Firebird 2.5 or later client library");
+#endif
+}
 
-				while (resv_p < resend_p) {
-					if (*resv_p == '\0' || (ofs = strspn(resv_p, LIST_DELIMIT)) < 0) {
-						resv_p++;
-					} else {
-						resv_p = &resv_p[ofs];
-						tblend_p = strpbrk(resv_p, LIST_DELIMIT);
-						if (tblend_p) {
-							tbl_len = tblend_p - resv_p;
-						} else {
-							tbl_len = strlen(resv_p);
-						}
-						if (tbl_len > META_NAME_MAX) {
-							desc = "Illegal table name was specified";
-							goto error;
-						}
+static void fb_connection_timer_stop(struct FbConnection *fb_connection)
+{
+#ifdef HAVE_FB_CANCEL_OPERATION
+	struct FbConnection **link;
 
-						if (tbl_len > 0) {
-							if (used + tbl_len + 3 > size) {
-								tpb = (char*)xrealloc(tpb, size+TPBBUFF_ALLOC);
-								size += TPBBUFF_ALLOC;
-							}
-							tpb[used+1] = (char)tbl_len;
-							memcpy((void *)&tpb[used+2],resv_p, tbl_len);
-							used += tbl_len + 3;
-							res_count++;
-						}
-						resv_p += tbl_len;
-					}
-				}
+	for (link = &fb_timer_list; *link; link = &(*link)->timer_next) {
+		if (*link == fb_connection) {
+			*link = fb_connection->timer_next;
+			break;
+		}
+	}
+	if (fb_connection->timed_out) {
+		/* Wait for a cancel request still in flight, so it cannot reach a later statement */
+		rb_mutex_lock(fb_timer_lock);
+		rb_mutex_unlock(fb_timer_lock);
+		/* No call reported the cancel: it arrived after the timed call returned and would
+		 * fail the next one.  Disabling and re-enabling cancellation drops it. */
+		if (fb_connection->cancel_pending && fb_connection->db) {
+			ISC_STATUS isc_status[20];
+			fb_isc_cancel_operation(isc_status, &fb_connection->db, fb_cancel_disable);
+			fb_isc_cancel_operation(isc_status, &fb_connection->db, fb_cancel_enable);
+		}
+		fb_connection->cancel_pending = 0;
+	}
+#endif
+	fb_connection->timer_next = NULL;
+	fb_connection->timer_deadline = 0;
+	fb_connection->timer_cancel = 0;
+}
 
-				resv_p = strtok(0, CMND_DELIMIT);
-				if (resv_p && !strcmp(resv_p, RESV_SHARED)) {
-					sp_prm = isc_tpb_shared;
-				} else if (resv_p && !strcmp(resv_p, RESV_PROTECTD)) {
-					sp_prm = isc_tpb_protected;
-				} else {
-					desc = "RESERVING needs {SHARED|PROTECTED} {READ|WRITE}";
-					goto error;
-				}
+/* Runs func(arg) within timeout milliseconds, raising Fb::TimeoutError if the client timer
+ * cancels it.  Server-enforced timeouts are set on the statement by fb_cursor_execute_prepared. */
+static VALUE fb_connection_timed(struct FbConnection *fb_connection, long timeout, VALUE (*func)(VALUE), VALUE arg)
+{
+	VALUE result, error;
+	int state = 0;
 
-				cont_f = 0;
-				resv_p = strtok(0, CMND_DELIMIT);
-				if (resv_p) {
-					if (resv_p[strlen(resv_p)-1] == RESV_CONTINUE) {
-						cont_f = 1;
-						resv_p[strlen(resv_p)-1] = '\0';
-					} else {
-						tblend_p = strpbrk(resv_p, LIST_DELIMIT);
-						if (tblend_p) {
-							cont_f = 2;
-							*tblend_p = '\0';
-						}
-					}
+	if (timeout <= 0 || fb_connection_server_timeouts(fb_connection)) {
+		return func(arg);
+	}
+	fb_connection_timer_start(fb_connection, timeout);
+	result = rb_protect(func, arg, &state);
+	fb_connection_timer_stop(fb_connection);
+	if (state) {
+		error = rb_gv_get("$!");
+		if (fb_connection->timed_out && rb_obj_is_kind_of(error, rb_eFbError) && !rb_obj_is_kind_of(error, rb_eFbTimeoutError)) {
+			rb_raise(rb_eFbTimeoutError, "statement timeout of %ld ms expired", timeout);
+		}
+		rb_jump_tag(state);
+	}
+	return result;
+}
+
+/*
+static void global_close_cursors()
+{
+	struct FbConnection *list = fb_connection_list;
+	int i;
+
+	while (list) {
+		for (i = 0; i < RARRAY(list->cursor)->len; i++) {
+			cursor_close(RARRAY(list->cursor)->ptr[i]);
+		}
+		list = list->next;
+	}
+}
+*/
+
+static void fb_connection_close_cursors(struct FbConnection *fb_connection)
+{
+	int i;
+	long len = RARRAY_LEN(fb_connection->cursor);
+	for (i = 0; i < len; i++) {
+		cursor_close(RARRAY_PTR(fb_connection->cursor)[i]);
+	}
+}
+
+static void fb_connection_drop_cursors(struct FbConnection *fb_connection)
+{
+	int i;
+	long len = RARRAY_LEN(fb_connection->cursor);
+	for (i = 0; i < len; i++) {
+		cursor_drop(RARRAY_PTR(fb_connection->cursor)[i]);
+	}
+  rb_ary_clear(fb_connection->cursor);
+}
+
+/* statement cache utilities */
+
+static void fb_stmt_cache_unlink(struct FbConnection *fb_connection, struct FbStmtCacheEntry *entry)
+{
+	st_data_t key = (st_data_t)entry->sql;
+
+	st_delete(fb_connection->stmt_cache, &key, 0);
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		fb_connection->stmt_cache_head = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		fb_connection->stmt_cache_tail = entry->prev;
+	}
+	entry->prev = entry->next = NULL;
+	fb_connection->stmt_cache_size--;
+}
+
+static void fb_stmt_cache_entry_free(struct FbStmtCacheEntry *entry)
+{
+	xfree(entry->sql);
+	xfree(entry->i_sqlda);
+	xfree(entry->o_sqlda);
+	xfree(entry->i_buffer);
+	xfree(entry->o_buffer);
+	xfree(entry->binders);
+	xfree(entry);
+}
+
+static void fb_stmt_cache_remove(struct FbConnection *fb_connection, struct FbStmtCacheEntry *entry)
+{
+	ISC_STATUS isc_status[20];
+
+	fb_stmt_cache_unlink(fb_connection, entry);
+	if (entry->stmt && fb_connection->db) {
+		fb_isc_dsql_free_statement(fb_connection, isc_status, &entry->stmt, DSQL_drop);
+		fb_error_check_warn(isc_status);
+	}
+	fb_stmt_cache_entry_free(entry);
+}
+
+static void fb_stmt_cache_clear(struct FbConnection *fb_connection)
+{
+	while (fb_connection->stmt_cache_head) {
+		fb_stmt_cache_remove(fb_connection, fb_connection->stmt_cache_head);
+	}
+}
+
+/* Like fb_stmt_cache_clear, but calls fbclient directly, for use from GC free functions. */
+static void fb_stmt_cache_clear_warn(struct FbConnection *fb_connection)
+{
+	ISC_STATUS isc_status[20];
+	struct FbStmtCacheEntry *entry;
+
+	while ((entry = fb_connection->stmt_cache_head)) {
+		fb_stmt_cache_unlink(fb_connection, entry);
+		if (entry->stmt && fb_connection->db) {
+			isc_dsql_free_statement(isc_status, &entry->stmt, DSQL_drop);
+			fb_error_check_warn(isc_status);
+		}
+		fb_stmt_cache_entry_free(entry);
+	}
+}
+
+/* Hands a cached, already described statement for +sql+ over to a cursor that has no statement yet. */
+static int fb_stmt_cache_checkout(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, const char *sql)
+{
+	st_data_t data;
+	struct FbStmtCacheEntry *entry;
+
+	if (fb_connection->stmt_cache_max <= 0 || fb_cursor->stmt) {
+		return 0;
+	}
+	if (!st_lookup(fb_connection->stmt_cache, (st_data_t)sql, &data)) {
+		fb_connection->stmt_cache_misses++;
+		return 0;
+	}
+	entry = (struct FbStmtCacheEntry *)data;
+	fb_stmt_cache_unlink(fb_connection, entry);
+	fb_connection->stmt_cache_hits++;
+
+	xfree(fb_cursor->sql);
+	xfree(fb_cursor->i_sqlda);
+	xfree(fb_cursor->o_sqlda);
+	xfree(fb_cursor->i_buffer);
+	xfree(fb_cursor->o_buffer);
+	xfree(fb_cursor->binders);
+	fb_cursor->sql = entry->sql;
+	fb_cursor->statement_type = entry->statement_type;
+	fb_cursor->stmt = entry->stmt;
+	fb_cursor->i_sqlda = entry->i_sqlda;
+	fb_cursor->o_sqlda = entry->o_sqlda;
+	fb_cursor->i_buffer = entry->i_buffer;
+	fb_cursor->i_buffer_size = entry->i_buffer_size;
+	fb_cursor->o_buffer = entry->o_buffer;
+	fb_cursor->o_buffer_size = entry->o_buffer_size;
+	fb_cursor->binders = entry->binders;
+	xfree(entry);
+	return 1;
+}
+
+/* Parks a closed cursor's statement in the cache instead of dropping it.  Returns 0 if the caller must drop it. */
+static int fb_stmt_cache_checkin(struct FbConnection *fb_connection, struct FbCursor *fb_cursor)
+{
+	struct FbStmtCacheEntry *entry;
+
+	if (!fb_cursor->sql || !fb_cursor->stmt || !fb_connection->db || fb_connection->stmt_cache_max <= 0) {
+		return 0;
+	}
+	/* Another cursor running the same SQL has already returned its statement. */
+	if (st_is_member(fb_connection->stmt_cache, (st_data_t)fb_cursor->sql)) {
+		return 0;
+	}
+	while (fb_connection->stmt_cache_size >= fb_connection->stmt_cache_max) {
+		fb_stmt_cache_remove(fb_connection, fb_connection->stmt_cache_tail);
+		fb_connection->stmt_cache_evictions++;
+	}
+
+	entry = ALLOC(struct FbStmtCacheEntry);
+	entry->sql = fb_cursor->sql;
+	entry->statement_type = fb_cursor->statement_type;
+	entry->stmt = fb_cursor->stmt;
+	entry->i_sqlda = fb_cursor->i_sqlda;
+	entry->o_sqlda = fb_cursor->o_sqlda;
+	entry->i_buffer = fb_cursor->i_buffer;
+	entry->i_buffer_size = fb_cursor->i_buffer_size;
+	entry->o_buffer = fb_cursor->o_buffer;
+	entry->o_buffer_size = fb_cursor->o_buffer_size;
+	entry->binders = fb_cursor->binders;
+	fb_cursor->sql = NULL;
+	fb_cursor->stmt = 0;
+	fb_cursor->i_sqlda = NULL;
+	fb_cursor->o_sqlda = NULL;
+	fb_cursor->i_buffer = NULL;
+	fb_cursor->i_buffer_size = 0;
+	fb_cursor->o_buffer = NULL;
+	fb_cursor->o_buffer_size = 0;
+	fb_cursor->binders = NULL;
+
+	entry->prev = NULL;
+	entry->next = fb_connection->stmt_cache_head;
+	if (entry->next) {
+		entry->next->prev = entry;
+	} else {
+		fb_connection->stmt_cache_tail = entry;
+	}
+	fb_connection->stmt_cache_head = entry;
+	st_insert(fb_connection->stmt_cache, (st_data_t)entry->sql, (st_data_t)entry);
+	fb_connection->stmt_cache_size++;
+	return 1;
+}
+
+/*
+static void fb_connection_remove(struct FbConnection *fb_connection)
+{
+	if (fb_connection_list != NULL) {
+		if (fb_connection_list == fb_connection) {
+			fb_connection_list = fb_connection_list->next;
+		} else {
+			struct FbConnection *list = fb_connection_list;
+			while (list->next) {
+				if (list->next == fb_connection) {
+					list->next = fb_connection->next;
+					break;
 				}
+				list = list->next;
+			}
+		}
+		fb_connection->db = 0;
+		connection_count--;
+	}
+}
+*/
+
+static void fb_connection_disconnect(struct FbConnection *fb_connection)
+{
+	fb_stmt_cache_clear(fb_connection);
+	if (fb_connection->transact) {
+		fb_isc_commit_transaction(fb_connection, fb_connection->isc_status, &fb_connection->transact);
+		fb_error_check(fb_connection->isc_status);
+	}
+	if (fb_connection->dropped) {
+		fb_isc_drop_database(fb_connection, fb_connection->isc_status, &fb_connection->db);
+	} else {
+		fb_isc_detach_database(fb_connection, fb_connection->isc_status, &fb_connection->db);
+	}
+	fb_error_check(fb_connection->isc_status);
+	/* fb_connection_remove(fb_connection); */
+}
+
+static void fb_connection_disconnect_warn(struct FbConnection *fb_connection)
+{
+	fb_stmt_cache_clear_warn(fb_connection);
+	if (fb_connection->transact) {
+		isc_commit_transaction(fb_connection->isc_status, &fb_connection->transact);
+		fb_error_check_warn(fb_connection->isc_status);
+	}
+	isc_detach_database(fb_connection->isc_status, &fb_connection->db);
+	fb_error_check_warn(fb_connection->isc_status);
+	/* fb_connection_remove(fb_connection); */
+}
+
+static void fb_connection_mark(struct FbConnection *fb_connection)
+{
+	rb_gc_mark(fb_connection->cursor);
+	rb_gc_mark(fb_connection->row_structs);
+	rb_gc_mark(fb_connection->lock);
+	rb_gc_mark(fb_connection->charsets);
+	rb_gc_mark(fb_connection->transaction_options);
+}
+
+static void fb_connection_free(struct FbConnection *fb_connection)
+{
+	if (fb_connection->db) {
+		fb_connection_disconnect_warn(fb_connection);
+	}
+	fb_stmt_cache_clear_warn(fb_connection);
+	st_free_table(fb_connection->stmt_cache);
+	xfree(fb_connection);
+}
+
+/*
+static struct FbConnection* fb_connection_check_retrieve(VALUE data)
+{
+	if (TYPE(data) != T_DATA || RDATA(data)->dfree != (void *)fb_connection_free) {
+		rb_raise(rb_eTypeError,
+			"Wrong argument type %s (expected Fb::Connection)",
+			rb_class2name(CLASS_OF(data)));
+	}
+	return (struct FbConnection*)RDATA(data)->data;
+}
+*/
+
+static unsigned short fb_connection_db_SQL_Dialect(struct FbConnection *fb_connection)
+{
+	long dialect;
+	long length;
+	char db_info_command = isc_info_db_SQL_dialect;
+	char isc_info_buff[16];
+
+	/* Get the db SQL Dialect */
+	fb_isc_database_info(fb_connection, fb_connection->isc_status, &fb_connection->db,
+			1, &db_info_command,
+			sizeof(isc_info_buff), isc_info_buff);
+	fb_error_check(fb_connection->isc_status);
+
+	if (isc_info_buff[0] == isc_info_db_SQL_dialect) {
+		length = isc_vax_integer(&isc_info_buff[1], 2);
+		dialect = isc_vax_integer(&isc_info_buff[3], (short)length);
+	} else {
+		dialect = 1;
+	}
+	return dialect;
+}
+
+static unsigned short fb_connection_dialect(struct FbConnection *fb_connection)
+{
+	return fb_connection->dialect;
+}
+
+/*
+static unsigned short fb_connection_db_dialect(struct FbConnection *fb_connection)
+{
+	return fb_connection->db_dialect;
+}
+*/
+
+/* Transaction option list */
+
+static trans_opts	rcom_opt_S[] =
+{
+	{"NO",			"RECORD_VERSION",	isc_tpb_no_rec_version,	-1,	0},
+	{"RECORD_VERSION",	0,			isc_tpb_rec_version,	-1,	0},
+	{"*",			0,			isc_tpb_no_rec_version,	-1,	0},
+	{0,			0,			0,			0,	0}
+};
+
+
+static trans_opts	read_opt_S[] =
+{
+	{"WRITE",	0,	isc_tpb_write,		1,	0},
+	{"ONLY",		0,	isc_tpb_read,		1,	0},
+	{"COMMITTED",	0,	isc_tpb_read_committed,	2,	rcom_opt_S},
+	{0,		0,	0,			0,	0}
+};
+
+
+static trans_opts	snap_opt_S[] =
+{
+	{"TABLE",	"STABILITY",	isc_tpb_consistency,	2,	0},
+	{"*",		0,		isc_tpb_concurrency,	2,	0},
+	{0,			0,	0,			0,	0}
+};
+
+
+static trans_opts	isol_opt_S[] =
+{
+	{"SNAPSHOT",	0,		0,			0,	snap_opt_S},
+	{"READ",		"COMMITTED",	isc_tpb_read_committed,	2,	rcom_opt_S},
+	{0,		0,		0,			0,	0}
+};
+
+
+static trans_opts	trans_opt_S[] =
+{
+	{"READ",		0,		0,		0,	read_opt_S},
+	{"WAIT",		0,		isc_tpb_wait,	3,	0},
+	{"NO",		"WAIT",		isc_tpb_nowait,	3,	0},
+	{"ISOLATION",	"LEVEL",	0,		0,	isol_opt_S},
+	{"SNAPSHOT",	0,		0,		0,	snap_opt_S},
+	{"RESERVING",	0,		-1,		0,	0},
+	{0,		0,		0,		0,	0}
+};
+
+/* Name1	Name2		Option value	    Position	Sub-option */
+
+#define	RESV_TABLEEND	"FOR"
+#define	RESV_SHARED	"SHARED"
+#define	RESV_PROTECTD	"PROTECTED"
+#define	RESV_READ	"READ"
+#define	RESV_WRITE	"WRITE"
+#define	RESV_CONTINUE	','
+
+static char* trans_parseopts(VALUE opt, long *tpb_len)
+{
+	char *s, *trans;
+	long used;
+	long size;
+	char *tpb;
+	trans_opts *curr_p;
+	trans_opts *target_p;
+	char *check1_p;
+	char *check2_p;
+	int count;
+	int next_c;
+	char check_f[4];
+	char *resv_p;
+	char *resend_p;
+	char *tblend_p = 0;
+	long tbl_len;
+	long res_first;
+	int res_count;
+	long ofs;
+	char sp_prm;
+	char rw_prm;
+	int cont_f;
+	const char *desc = 0;
+
+	/* Initialize */
+	s = StringValuePtr(opt);
+	trans = ALLOCA_N(char, strlen(s)+1);
+	strcpy(trans, s);
+	s = trans;
+	while (*s) {
+		*s = UPPER(*s);
+		s++;
+	}
+
+	used = 0;
+	size = 0;
+	tpb = NULL;
+	memset((void *)check_f, 0, sizeof(check_f));
+
+	/* Set the default transaction option */
+	tpb = (char*)xmalloc(TPBBUFF_ALLOC);
+	size = TPBBUFF_ALLOC;
+	memcpy((void*)tpb, (void*)isc_tpb_0, sizeof(isc_tpb_0));
+	used = sizeof(isc_tpb_0);
+
+	/* Analize the transaction option strings */
+	curr_p = trans_opt_S;
+	check1_p = strtok(trans, CMND_DELIMIT);
+	if (check1_p) {
+		check2_p = strtok(0, CMND_DELIMIT);
+	} else {
+		check2_p = 0;
+	}
+	while (curr_p) {
+		target_p = 0;
+		next_c = 0;
+		for (count = 0; curr_p[count].option1; count++) {
+			if (!strcmp(curr_p[count].option1, "*")) {
+				target_p = &curr_p[count];
+				break;
+			} else if (check1_p && !strcmp(check1_p, curr_p[count].option1)) {
+				if (!curr_p[count].option2) {
+					next_c = 1;
+					target_p = &curr_p[count];
+					break;
+				} else if (check2_p && !strcmp(check2_p, curr_p[count].option2)) {
+					next_c = 2;
+					target_p = &curr_p[count];
+					break;
+				}
+			}
+		}
+
+		if (!target_p) {
+			desc = "Illegal transaction option was specified";
+			goto error;
+		}
+
+		/* Set the transaction option */
+		if (target_p->optval > '\0') {
+			if (target_p->position > 0) {
+				if (check_f[target_p->position]) {
+					desc = "Duplicate transaction option was specified";
+					goto error;
+				}
+				tpb[target_p->position] = target_p->optval;
+				check_f[target_p->position] = 1;
+			} else {
+				if (used + 1 > size) {
+					tpb = (char *)realloc(tpb, size + TPBBUFF_ALLOC);
+					size += TPBBUFF_ALLOC;
+				}
+				tpb[used] = target_p->optval;
+				used++;
+			}
+		} else if (target_p->optval) {		/* RESERVING ... FOR */
+			if (check_f[0]) {
+				desc = "Duplicate transaction option was specified";
+				goto error;
+			}
+			resv_p = check2_p;
+			if (!resv_p || !strcmp(resv_p, RESV_TABLEEND)) {
+				desc = "RESERVING needs table name list";
+				goto error;
+			}
+			while (resv_p) {
+				res_first = used;
+				res_count = 0;
+				resend_p = strtok(0, CMND_DELIMIT);
+				while (resend_p) {
+					if (!strcmp(resend_p, RESV_TABLEEND)) {
+						break;
+					}
+					resend_p = strtok(0, CMND_DELIMIT);
+				}
+
+				if (!resend_p) {
+					desc = "Illegal transaction option was specified";
+					goto error;
+				}
+
+				while (resv_p < resend_p) {
+					if (*resv_p == '\0' || (ofs = strspn(resv_p, LIST_DELIMIT)) < 0) {
+						resv_p++;
+					} else {
+						resv_p = &resv_p[ofs];
+						tblend_p = strpbrk(resv_p, LIST_DELIMIT);
+						if (tblend_p) {
+							tbl_len = tblend_p - resv_p;
+						} else {
+							tbl_len = strlen(resv_p);
+						}
+						if (tbl_len > META_NAME_MAX) {
+							desc = "Illegal table name was specified";
+							goto error;
+						}
+
+						if (tbl_len > 0) {
+							if (used + tbl_len + 3 > size) {
+								tpb = (char*)xrealloc(tpb, size+TPBBUFF_ALLOC);
+								size += TPBBUFF_ALLOC;
+							}
+							tpb[used+1] = (char)tbl_len;
+							memcpy((void *)&tpb[used+2],resv_p, tbl_len);
+							used += tbl_len + 3;
+							res_count++;
+						}
+						resv_p += tbl_len;
+					}
+				}
+
+				resv_p = strtok(0, CMND_DELIMIT);
+				if (resv_p && !strcmp(resv_p, RESV_SHARED)) {
+					sp_prm = isc_tpb_shared;
+				} else if (resv_p && !strcmp(resv_p, RESV_PROTECTD)) {
+					sp_prm = isc_tpb_protected;
+				} else {
+					desc = "RESERVING needs {SHARED|PROTECTED} {READ|WRITE}";
+					goto error;
+				}
+
+				cont_f = 0;
+				resv_p = strtok(0, CMND_DELIMIT);
+				if (resv_p) {
+					if (resv_p[strlen(resv_p)-1] == RESV_CONTINUE) {
+						cont_f = 1;
+						resv_p[strlen(resv_p)-1] = '\0';
+					} else {
+						tblend_p = strpbrk(resv_p, LIST_DELIMIT);
+						if (tblend_p) {
+							cont_f = 2;
+							*tblend_p = '\0';
+						}
+					}
+				}
+
+				if (resv_p && !strcmp(resv_p, RESV_READ)) {
+					rw_prm = isc_tpb_lock_read;
+				} else if (resv_p && !strcmp(resv_p, RESV_WRITE)) {
+					rw_prm = isc_tpb_lock_write;
+				} else {
+					desc = "RESERVING needs {SHARED|PROTECTED} {READ|WRITE}";
+					goto error;
+				}
+
+				ofs = res_first;
+				for (count = 0; count < res_count; count++) {
+					tpb[ofs++] = rw_prm;
+					ofs += tpb[ofs] + 1;
+					tpb[ofs++] = sp_prm;
+				}
+
+				if (cont_f == 1) {
+					resv_p = strtok(0, CMND_DELIMIT);
+					if (!resv_p) {
+						desc = "Unexpected end of command";
+						goto error;
+					}
+				}
+				if (cont_f == 2) {
+					resv_p = tblend_p + 1;
+				} else {
+					resv_p = strtok(0, CMND_DELIMIT);
+					if (resv_p) {
+						if ((int)strlen(resv_p) == 1 && resv_p[0] == RESV_CONTINUE) {
+							resv_p = strtok(0, CMND_DELIMIT);
+							if (!resv_p) {
+								desc = "Unexpected end of command";
+								goto error;
+							}
+						} else if (resv_p[0] == RESV_CONTINUE) {
+							resv_p++;
+						} else {
+							next_c = 1;
+							check2_p = resv_p;
+							resv_p = 0;
+						}
+					} else {
+						next_c = 0;
+						check1_p = check2_p = 0;
+					}
+				}
+			}
+
+			check_f[0] = 1;
+		}
+
+
+		/* Set the next check list */
+		curr_p = target_p->sub_opts;
+
+		for (count = 0; count < next_c; count++) {
+			check1_p = check2_p;
+			if (check2_p) {
+				check2_p = strtok(0, CMND_DELIMIT);
+			}
+		}
+
+		if (check1_p && !curr_p) {
+			curr_p = trans_opt_S;
+		}
+	}
+
+	/* Set the results */
+	*tpb_len = used;
+	return tpb;
+
+error:
+	xfree(tpb);
+	rb_raise(rb_eFbError, "%s", desc);
+}
+
+/*
+static void set_teb_vec(ISC_TEB *vec, struct FbConnection *fb_connection, char *tpb, int len)
+{
+	vec->dbb_ptr = &fb_connection->db;
+	if (tpb) {
+		vec->tpb_ptr = tpb;
+		vec->tpb_len = len;
+	} else {
+		vec->tpb_ptr = 0;
+		vec->tpb_len = 0;
+	}
+}
+*/
+
+/*
+static void global_transaction_start(VALUE opt, int argc, VALUE *argv)
+{
+	ISC_STATUS isc_status[20];
+	struct FbConnection *fb_connection;
+	ISC_TEB *teb_vec = ALLOCA_N(ISC_TEB, connection_count);
+	ISC_TEB *vec = teb_vec;
+	char *tpb = 0;
+	short n;
+	int tpb_len;
+
+	if (global_transact) {
+		rb_raise(rb_eFbError, "The transaction has been already started");
+	}
+
+	if (!NIL_P(opt)) {
+		tpb = trans_parseopts(opt, &tpb_len);
+	}
+
+	if (argc > connection_count) {
+		rb_raise(rb_eFbError, "Too many databases specified for the transaction");
+	}
+	if (argc == 0) {
+		n = connection_count;
+		for (fb_connection = fb_connection_list; fb_connection; fb_connection = fb_connection->next) {
+			set_teb_vec(vec, fb_connection, tpb, tpb_len);
+			vec++;
+		}
+	} else {
+		for (n = 0; n < argc; n++) {
+			fb_connection = fb_connection_check_retrieve(argv[n]);
+			set_teb_vec(vec, fb_connection, tpb, tpb_len);
+			vec++;
+		}
+	}
+
+	isc_start_multiple(isc_status, &global_transact, n, teb_vec);
+	xfree(tpb);
+	fb_error_check(isc_status);
+}
+*/
+
+/* call-seq:
+ *   commit() -> nil
+ *
+ * Commit the current (global) transaction.
+ */
+/*
+static VALUE global_commit()
+{
+	ISC_STATUS isc_status[20];
+
+	if (global_transact) {
+		global_close_cursors();
+		isc_commit_transaction(isc_status, &global_transact);
+		fb_error_check(isc_status);
+	}
+	return Qnil;
+}
+*/
+
+/* call-seq:
+ *   rollback() -> nil
+ *
+ * Rollback the current (global) transaction.
+ */
+/*
+static VALUE global_rollback()
+{
+	ISC_STATUS isc_status[20];
+
+	if (global_transact) {
+		global_close_cursors();
+		isc_rollback_transaction(isc_status, &global_transact);
+		fb_error_check(isc_status);
+	}
+	return Qnil;
+}
+*/
+
+/* call-seq:
+ *   transaction(options, *connections) -> true
+ *   transaction(options, *connections) { } -> block result
+ *
+ * Start a (global) transaction.
+ */
+/*
+static VALUE global_transaction(int argc, VALUE *argv, VALUE self)
+{
+	VALUE opt = Qnil;
+
+	if (argc > 0) {
+		opt = *argv++;
+		argc--;
+	}
+	global_transaction_start(opt, argc, argv);
+
+	if (rb_block_given_p()) {
+		int state;
+		VALUE result = rb_protect(rb_yield, 0, &state);
+		if (state) {
+			global_rollback();
+			return rb_funcall(rb_mKernel, rb_intern("raise"), 0);
+		} else {
+			global_commit();
+			return result;
+		}
+	} else {
+		return Qtrue;
+   	}
+}
+*/
+
+/* call-seq:
+ *   transaction_started()? -> true or false
+ *
+ * Returns true if a transaction is currently active.
+ */
+/*
+static VALUE global_transaction_started()
+{
+	return global_transact ? Qtrue : Qfalse;
+}
+*/
+
+/* Fb::TransactionOptions
+ *
+ * A transaction parameter block compiled once from a Hash (or a transaction option string)
+ * and reused by every transaction started with it.
+ */
+
+struct FbTransactionOptions {
+	char *tpb;
+	long tpb_len;
+	VALUE options;	/* frozen Hash the TPB was compiled from, or the option String */
+};
+
+static void fb_transaction_options_mark(struct FbTransactionOptions *fb_options)
+{
+	rb_gc_mark(fb_options->options);
+}
+
+static void fb_transaction_options_free(struct FbTransactionOptions *fb_options)
+{
+	xfree(fb_options->tpb);
+	xfree(fb_options);
+}
+
+static VALUE transaction_options_alloc(VALUE klass)
+{
+	struct FbTransactionOptions *fb_options;
+	VALUE obj = Data_Make_Struct(klass, struct FbTransactionOptions, fb_transaction_options_mark, fb_transaction_options_free, fb_options);
+
+	fb_options->tpb = NULL;
+	fb_options->tpb_len = 0;
+	fb_options->options = Qnil;
+	return obj;
+}
+
+static int fb_transaction_options_check_key(VALUE key, VALUE value, VALUE known)
+{
+	if (!RTEST(rb_ary_includes(known, key))) {
+		rb_raise(rb_eArgError, "unknown transaction option: %"PRIsVALUE, rb_inspect(key));
+	}
+	return ST_CONTINUE;
+}
+
+/* Returns the option +name+ of +options+ that must be true, false or nil (for +def+). */
+static int fb_transaction_options_flag(VALUE options, const char *name, int def)
+{
+	VALUE value = rb_hash_aref(options, ID2SYM(rb_intern(name)));
+
+	if (NIL_P(value)) return def;
+	if (value != Qtrue && value != Qfalse) {
+		rb_raise(rb_eArgError, ":%s must be true or false", name);
+	}
+	return value == Qtrue;
+}
+
+/* Compiles +options+ into a TPB of at most TPBBUFF_ALLOC bytes, returning its length. */
+static long fb_transaction_options_compile(VALUE options, char *tpb)
+{
+	VALUE known = rb_ary_new();
+	VALUE isolation, record_version, lock_timeout;
+	ID isolation_id;
+	int read_only, wait, auto_undo;
+	long used = 0;
+
+	rb_ary_push(known, ID2SYM(rb_intern("isolation")));
+	rb_ary_push(known, ID2SYM(rb_intern("record_version")));
+	rb_ary_push(known, ID2SYM(rb_intern("read_only")));
+	rb_ary_push(known, ID2SYM(rb_intern("wait")));
+	rb_ary_push(known, ID2SYM(rb_intern("lock_timeout")));
+	rb_ary_push(known, ID2SYM(rb_intern("auto_undo")));
+	rb_hash_foreach(options, fb_transaction_options_check_key, known);
+
+	read_only = fb_transaction_options_flag(options, "read_only", 0);
+	auto_undo = fb_transaction_options_flag(options, "auto_undo", 1);
+	lock_timeout = rb_hash_aref(options, ID2SYM(rb_intern("lock_timeout")));
+	wait = fb_transaction_options_flag(options, "wait", 1);
+	if (!NIL_P(lock_timeout) && !wait) {
+		rb_raise(rb_eArgError, ":lock_timeout needs :wait");
+	}
+
+	tpb[used++] = isc_tpb_version1;
+	tpb[used++] = read_only ? isc_tpb_read : isc_tpb_write;
+
+	isolation = rb_hash_aref(options, ID2SYM(rb_intern("isolation")));
+	isolation_id = NIL_P(isolation) ? rb_intern("snapshot") : rb_to_id(isolation);
+	record_version = rb_hash_aref(options, ID2SYM(rb_intern("record_version")));
+	if (isolation_id == rb_intern("read_committed")) {
+		tpb[used++] = isc_tpb_read_committed;
+		tpb[used++] = fb_transaction_options_flag(options, "record_version", 0) ? isc_tpb_rec_version : isc_tpb_no_rec_version;
+#ifdef isc_tpb_read_consistency
+	} else if (isolation_id == rb_intern("read_consistency")) {
+		tpb[used++] = isc_tpb_read_committed;
+		tpb[used++] = isc_tpb_read_consistency;
+#endif
+	} else if (isolation_id == rb_intern("snapshot") || isolation_id == rb_intern("table_stability")) {
+		tpb[used++] = isolation_id == rb_intern("snapshot") ? isc_tpb_concurrency : isc_tpb_consistency;
+	} else {
+		rb_raise(rb_eArgError, "unknown isolation: %"PRIsVALUE, rb_inspect(isolation));
+	}
+	if (!NIL_P(record_version) && isolation_id != rb_intern("read_committed")) {
+		rb_raise(rb_eArgError, ":record_version applies to :read_committed only");
+	}
+
+	tpb[used++] = wait ? isc_tpb_wait : isc_tpb_nowait;
+	if (!NIL_P(lock_timeout)) {
+		long seconds = NUM2LONG(lock_timeout);
+		if (seconds < 1 || seconds > 0x7fff) {
+			rb_raise(rb_eRangeError, ":lock_timeout must be between 1 and 32767 seconds");
+		}
+		tpb[used++] = isc_tpb_lock_timeout;
+		tpb[used++] = 4;
+		tpb[used++] = (char)(seconds & 0xff);
+		tpb[used++] = (char)((seconds >> 8) & 0xff);
+		tpb[used++] = 0;
+		tpb[used++] = 0;
+	}
+	if (!auto_undo) {
+		tpb[used++] = isc_tpb_no_auto_undo;
+	}
+	return used;
+}
+
+/* call-seq:
+ *   TransactionOptions.new(options = {}) -> TransactionOptions
+ *   TransactionOptions.new(string) -> TransactionOptions
+ *
+ * Compiles transaction options once, for use with Connection#transaction,
+ * as Connection#transaction_options or as the :transaction_options of a Database.
+ * The +options+ and their defaults, which are Firebird's:
+ * :isolation:: :snapshot, :table_stability, :read_committed, or :read_consistency with Firebird 4 (default: :snapshot)
+ * :record_version:: for :read_committed, whether to read the last committed version of rows
+ *                   locked by other transactions instead of waiting for them (default: false)
+ * :read_only:: (default: false)
+ * :wait:: whether to wait for conflicting locks to be released (default: true)
+ * :lock_timeout:: seconds to wait for a conflicting lock before failing (default: nil, forever)
+ * :auto_undo:: whether to keep the undo log of savepoints; turn it off for bulk loads (default: true)
+ *
+ * A string holds options in the SQL syntax of SET TRANSACTION, as Connection#transaction accepts.
+ * The object is frozen.
+ */
+static VALUE transaction_options_initialize(int argc, VALUE *argv, VALUE self)
+{
+	struct FbTransactionOptions *fb_options;
+	VALUE options;
+
+	Data_Get_Struct(self, struct FbTransactionOptions, fb_options);
+	rb_scan_args(argc, argv, "01", &options);
+	if (fb_options->tpb) {
+		rb_raise(rb_eFbError, "transaction options are already compiled");
+	}
+	if (!NIL_P(options) && TYPE(options) == T_STRING) {
+		fb_options->tpb = trans_parseopts(options, &fb_options->tpb_len);
+		fb_options->options = rb_str_new_frozen(options);
+	} else {
+		char tpb[TPBBUFF_ALLOC];
+		long tpb_len;
+
+		options = NIL_P(options) ? rb_hash_new() : rb_hash_dup(rb_convert_type(options, T_HASH, "Hash", "to_hash"));
+		tpb_len = fb_transaction_options_compile(options, tpb);
+		fb_options->tpb = ALLOC_N(char, tpb_len);
+		memcpy(fb_options->tpb, tpb, tpb_len);
+		fb_options->tpb_len = tpb_len;
+		fb_options->options = rb_obj_freeze(options);
+	}
+	return rb_obj_freeze(self);
+}
+
+/* call-seq:
+ *   to_h() -> Hash
+ *
+ * Returns the options the object was created with (a String if it was created from one).
+ */
+static VALUE transaction_options_to_h(VALUE self)
+{
+	struct FbTransactionOptions *fb_options;
+
+	Data_Get_Struct(self, struct FbTransactionOptions, fb_options);
+	return fb_options->options;
+}
+
+/* call-seq:
+ *   tpb() -> String
+ *
+ * Returns the compiled transaction parameter block.
+ */
+static VALUE transaction_options_tpb(VALUE self)
+{
+	struct FbTransactionOptions *fb_options;
+
+	Data_Get_Struct(self, struct FbTransactionOptions, fb_options);
+	return rb_obj_freeze(rb_str_new(fb_options->tpb, fb_options->tpb_len));
+}
+
+/* Returns +options+ as TransactionOptions, compiling a Hash or String; nil stays nil. */
+static VALUE fb_transaction_options_coerce(VALUE options)
+{
+	if (NIL_P(options) || rb_obj_is_kind_of(options, rb_cFbTransactionOptions)) {
+		return options;
+	}
+	return rb_class_new_instance(1, &options, rb_cFbTransactionOptions);
+}
+
+static void fb_connection_transaction_start(struct FbConnection *fb_connection, VALUE opt)
+{
+	struct FbTransactionOptions *fb_options;
+
+	if (fb_connection->transact) {
+		rb_raise(rb_eFbError, "A transaction has been already started");
+	}
+
+	opt = fb_transaction_options_coerce(NIL_P(opt) ? fb_connection->transaction_options : opt);
+	if (NIL_P(opt)) {
+		fb_isc_start_transaction(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_connection->db, 0, NULL);
+	} else {
+		Data_Get_Struct(opt, struct FbTransactionOptions, fb_options);
+		fb_isc_start_transaction(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_connection->db, (short)fb_options->tpb_len, fb_options->tpb);
+	}
+	RB_GC_GUARD(opt);
+	fb_error_check(fb_connection->isc_status);
+	fb_connection->transactions++;
+}
+
+static void fb_connection_commit(struct FbConnection *fb_connection)
+{
+	if (fb_connection->transact) {
+		fb_connection_close_cursors(fb_connection);
+		fb_isc_commit_transaction(fb_connection, fb_connection->isc_status, &fb_connection->transact);
+		fb_error_check(fb_connection->isc_status);
+	}
+}
+
+static void fb_connection_rollback(struct FbConnection *fb_connection)
+{
+	if (fb_connection->transact) {
+		fb_connection_close_cursors(fb_connection);
+		fb_isc_rollback_transaction(fb_connection, fb_connection->isc_status, &fb_connection->transact);
+		fb_error_check(fb_connection->isc_status);
+	}
+}
+
+/* call-seq:
+ *   transaction(options) -> true
+ *   transaction(options) { } -> block result
+ *
+ * Start a transaction for this connection.  The +options+ are an Fb::TransactionOptions,
+ * a Hash or String to compile into one, or nil for the connection's #transaction_options.
+ */
+static VALUE connection_transaction(int argc, VALUE *argv, VALUE self)
+{
+	struct FbConnection *fb_connection;
+	VALUE opt = Qnil;
+
+	rb_scan_args(argc, argv, "01", &opt);
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+
+	fb_connection_transaction_start(fb_connection, opt);
+
+	if (rb_block_given_p()) {
+		int state;
+		VALUE result = rb_protect(rb_yield, 0, &state);
+		if (state) {
+			fb_connection_rollback(fb_connection);
+			rb_jump_tag(state);
+		} else {
+			fb_connection_commit(fb_connection);
+			return result;
+		}
+	} else {
+		return Qtrue;
+   	}
+}
+
+/* call-seq:
+ *   transaction_started()? -> true or false
+ *
+ * Returns true if a transaction is currently active.
+ */
+static VALUE connection_transaction_started(VALUE self)
+{
+	struct FbConnection *fb_connection;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+
+	return fb_connection->transact ? Qtrue : Qfalse;
+}
+
+/* call-seq:
+ *   commit() -> nil
+ *
+ * Commit the current transaction.
+ */
+static VALUE connection_commit(VALUE self)
+{
+	struct FbConnection *fb_connection;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+
+	fb_connection_commit(fb_connection);
+	return Qnil;
+}
+
+/* call-seq:
+ *   rollback() -> nil
+ *
+ * Rollback the current transaction.
+ */
+static VALUE connection_rollback(VALUE self)
+{
+	struct FbConnection *fb_connection;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+
+	fb_connection_rollback(fb_connection);
+	return Qnil;
+}
+
+/*
+ * call-seq:
+ *   open?() -> true or false
+ *
+ * Current connection status.
+ */
+
+static VALUE connection_is_open(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return (fb_connection->db == 0) ? Qfalse : Qtrue;
+}
+
+/* call-seq:
+ *   to_s() -> String
+ *
+ * Return current database connection string and either (OPEN) or (CLOSED).
+ */
+static VALUE connection_to_s(VALUE self)
+{
+	VALUE is_open = connection_is_open(self);
+	VALUE status = (is_open == Qtrue) ? rb_str_new2(" (OPEN)") : rb_str_new2(" (CLOSED)");
+	VALUE database = rb_iv_get(self, "@database");
+	VALUE s = rb_str_dup(database);
+	return rb_str_concat(s, status);
+}
+
+static VALUE fb_connection_new_cursor(VALUE self, VALUE klass)
+{
+	VALUE c;
+	struct FbConnection *fb_connection;
+	struct FbCursor *fb_cursor;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+
+	c = Data_Make_Struct(klass, struct FbCursor, fb_cursor_mark, fb_cursor_free, fb_cursor);
+	fb_cursor->connection = self;
+	fb_cursor->fields_ary = Qnil;
+	fb_cursor->fields_hash = Qnil;
+	fb_cursor->row_fields = Qnil;
+	fb_cursor->row_keys = Qnil;
+	fb_cursor->row_symbols = Qnil;
+	fb_cursor->row_struct = Qnil;
+	fb_cursor->row_layout = Qnil;
+	fb_cursor->batch = Qnil;
+	fb_cursor->open = Qfalse;
+	fb_cursor->eof = Qfalse;
+	fb_cursor->stmt = 0;
+	fb_cursor->statement_type = 0;
+	fb_cursor->sql = NULL;
+	fb_cursor->i_sqlda = sqlda_alloc(SQLDA_COLSINIT);
+	fb_cursor->o_sqlda = sqlda_alloc(SQLDA_COLSINIT);
+	fb_cursor->i_buffer = NULL;
+	fb_cursor->i_buffer_size = 0;
+	fb_cursor->o_buffer = NULL;
+	fb_cursor->o_buffer_size = 0;
+	fb_cursor->binders = NULL;
+	fb_cursor->decoders = NULL;
+	fb_cursor->decimal_mode = DECIMAL_INHERIT;
+	fb_cursor->timestamp_format = TIMESTAMP_INHERIT;
+	fb_cursor->blob_format = BLOB_INHERIT;
+	fb_cursor->timeout = fb_connection->statement_timeout;
+	/* The statement itself is allocated when it is prepared, unless a cached one is reused. */
+
+	return c;
+}
+
+/* call-seq:
+ *   cursor() -> Cursor
+ *
+ * Creates a +Cursor+ for the +Connection+.
+ * This function is no longer published.
+ */
+static VALUE connection_cursor(VALUE self)
+{
+	return fb_connection_new_cursor(self, rb_cFbCursor);
+}
+
+/* Removes a trailing {:timeout => ms} option from argv, returning the statement timeout for the call. */
+static long fb_connection_call_timeout(struct FbConnection *fb_connection, int *argc, VALUE *argv)
+{
+	VALUE opts, key;
+
+	if (*argc >= 2 && TYPE(argv[*argc - 1]) == T_HASH) {
+		opts = argv[*argc - 1];
+		key = ID2SYM(rb_intern("timeout"));
+		if (RTEST(rb_funcall(opts, rb_intern("key?"), 1, key))) {
+			(*argc)--;
+			return fb_statement_timeout(rb_hash_aref(opts, key));
+		}
+	}
+	return fb_connection->statement_timeout;
+}
+
+static VALUE connection_execute2(VALUE args)
+{
+	VALUE cursor = rb_ary_pop(args);
+	return cursor_execute((int)RARRAY_LEN(args), RARRAY_PTR(args), cursor);
+}
+
+/* call-seq:
+ *   execute(sql, *args) -> Cursor, Array or rows affected
+ *   execute(sql, *args) {|cursor| } -> block result
+ *   execute(sql, *args) {|row| } -> block result
+ *   execute(sql, *args, :timeout => ms) -> Cursor or rows affected
+ *
+ * Allocates a +Cursor+ and executes the +sql+ statement, matching up the
+ * parameters in +args+ with the place holders in the statement, represented by ?'s.
+ *
+ * If the sql statement returns a result set and a block is provided, the cursor is
+ * yielded to the block before being automatically closed.
+ *
+ * If the sql statement returns a result set and a block is not provided, a +Cursor+
+ * object is returned.
+ *
+ * EXECUTE PROCEDURE and INSERT, UPDATE or DELETE ... RETURNING statements return their
+ * output row as an Array, read in the same round trip as the execute; no cursor is opened.
+ * If a block is provided, it receives that row instead of a cursor.
+ *
+ * If the sql statement performs an INSERT, UPDATE or DELETE, the number of rows
+ * affected is returned.  Other statements, such as schema updates, return -1.
+ *
+ * +*args+ can be one or more tuples of parameters or an array of tuples (arrays),
+ * in which case the statement will be executed once for each tuple of parameters.
+ *
+ * If no transaction is currently active, a transaction is automatically started
+ * and is closed when the cursor is closed.  Note that if additional statements
+ * yielding cursors are started before the first cursor is closed, these cursors will
+ * also be closed when the first one is closed and its transaction committed.
+ *
+ * A :timeout in milliseconds overrides the connection's statement_timeout for this call.
+ * Fb::TimeoutError is raised if the statement runs out of time.
+ */
+static VALUE connection_execute(int argc, VALUE *argv, VALUE self)
+{
+	struct FbConnection *fb_connection;
+	struct FbCursor *fb_cursor;
+	VALUE cursor, val;
+	long timeout;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	timeout = fb_connection_call_timeout(fb_connection, &argc, argv);
+	cursor = connection_cursor(self);
+	Data_Get_Struct(cursor, struct FbCursor, fb_cursor);
+	fb_cursor->timeout = timeout;
+	val = fb_connection_timed(fb_connection, timeout, connection_execute2, rb_ary_push(rb_ary_new4(argc, argv), cursor));
+
+	if (NIL_P(val)) {
+		if (rb_block_given_p()) {
+			return rb_ensure(rb_yield,cursor,cursor_close,cursor);
+   		} else {
+				HERE("connection_execute Y");
+				return cursor;
+   		}
+	} else {
+		cursor_drop(cursor);
+		if (TYPE(val) == T_ARRAY && rb_block_given_p()) {
+			return rb_yield(val);
+		}
+	}
+	return val;
+}
+
+static VALUE connection_query2(VALUE args)
+{
+	VALUE format = rb_ary_shift(args);
+	VALUE cursor = rb_ary_pop(args);
+	VALUE result = cursor_execute((int)RARRAY_LEN(args), RARRAY_PTR(args), cursor);
+
+	if (NIL_P(result)) {
+		result = cursor_fetchall(1, &format, cursor);
+		cursor_close(cursor);
+	} else {
+		if (TYPE(result) == T_ARRAY) {
+			result = fb_cursor_singleton_rows(cursor, result, format);
+		}
+		cursor_drop(cursor);
+	}
+	return result;
+}
+
+/* call-seq:
+ *   query(:array, sql, *arg) -> Array of Arrays or nil
+ *   query(:hash, sql, *arg) -> Array of Hashes or nil
+ *   query(sql, *args) -> Array of Arrays or nil
+ *   query(sql, *args, :timeout => ms) -> Array of Arrays or nil
+ *
+ * For queries returning a result set, an array is returned, containing
+ * either a list of Arrays or Hashes, one for each row.  EXECUTE PROCEDURE and
+ * RETURNING statements return their output row in a list of one.
+ *
+ * If the sql statement performs an INSERT, UPDATE or DELETE, the number of rows
+ * affected is returned.  Other statements, such as schema updates, return -1.
+ *
+ * If no transaction is currently active, a transaction is automatically started
+ * and committed.  Otherwise, the statement executes within the context of the
+ * current transaction.
+ *
+ * A :timeout in milliseconds overrides the connection's statement_timeout, covering
+ * both execution and fetching.  Fb::TimeoutError is raised if the query runs out of time.
+ */
+static VALUE connection_query(int argc, VALUE *argv, VALUE self)
+{
+	struct FbConnection *fb_connection;
+	struct FbCursor *fb_cursor;
+	VALUE format;
+	VALUE cursor;
+	VALUE args;
+	long timeout;
+
+	if (argc >= 1 && TYPE(argv[0]) == T_SYMBOL) {
+		format = argv[0];
+		argc--; argv++;
+	} else {
+		format = ID2SYM(rb_intern("array"));
+	}
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	timeout = fb_connection_call_timeout(fb_connection, &argc, argv);
+	cursor = connection_cursor(self);
+	Data_Get_Struct(cursor, struct FbCursor, fb_cursor);
+	fb_cursor->timeout = timeout;
+	args = rb_ary_new4(argc, argv);
+	rb_ary_unshift(args, format);
+	rb_ary_push(args, cursor);
+	return fb_connection_timed(fb_connection, timeout, connection_query2, args);
+}
+
+/* call-seq:
+ *   close() -> nil
+ *
+ * Closes connection to database.  All open cursors are dropped.
+ */
+static VALUE connection_close(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+
+	if (fb_connection->dropped) return Qnil;
+
+	fb_connection_check(fb_connection);
+	fb_connection_disconnect(fb_connection);
+	fb_connection_drop_cursors(fb_connection);
+
+	return Qnil;
+}
+
+/* call-seq:
+ *   drop() -> nil
+ *
+ * Drops connected database.  All open cursors are dropped.
+ */
+static VALUE connection_drop(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->dropped = 1;
+	fb_connection_disconnect(fb_connection);
+	fb_connection_drop_cursors(fb_connection);
+
+	return Qnil;
+}
+
+/* call-seq:
+ *   cancel() -> true or false
+ *
+ * Cancels the statement the connection is currently running.  Meant to be called from
+ * another thread: the thread running the statement gets an Fb::Error, its cursor is closed
+ * and an automatic transaction is rolled back.  Returns false if nothing was running.
+ *
+ * Timeout.timeout, Thread#raise, Thread#kill and Ctrl-C cancel a running statement the same way.
+ * Requires a Firebird 2.5 or later client library.
+ */
+static VALUE connection_cancel(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+#ifdef HAVE_FB_CANCEL_OPERATION
+	{
+		ISC_STATUS isc_status[20];
+
+		fb_isc_cancel_operation(isc_status, &fb_connection->db, fb_cancel_raise);
+#ifdef isc_nothing_to_cancel
+		if (isc_status[0] == 1 && isc_status[1] == isc_nothing_to_cancel) {
+			return Qfalse;
+		}
+#endif
+		fb_error_check(isc_status);
+		return Qtrue;
+	}
+#else
+	rb_raise(rb_eNotImpError, "cancel requires a Firebird 2.5 or later client library");
+#endif
+}
+
+/* call-seq:
+ *   dialect() -> int
+ *
+ * Returns dialect of connection.
+ */
+static VALUE connection_dialect(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+
+	return INT2FIX(fb_connection->dialect);
+}
+
+/* call-seq:
+ *   db_dialect() -> int
+ *
+ * Returns database dialect.
+ */
+static VALUE connection_db_dialect(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+
+	return INT2FIX(fb_connection->db_dialect);
+}
+
+static void fb_cursor_check(struct FbCursor *fb_cursor)
+{
+	if (fb_cursor->stmt == 0) {
+		rb_raise(rb_eFbError, "dropped db cursor");
+	}
+	if (!fb_cursor->open) {
+		rb_raise(rb_eFbError, "closed db cursor");
+	}
+}
+
+static void fb_cursor_drop(struct FbCursor *fb_cursor)
+{
+	ISC_STATUS isc_status[20];
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	if (fb_cursor->open) {
+		fb_isc_dsql_free_statement(fb_connection, isc_status, &fb_cursor->stmt, DSQL_close);
+		fb_error_check(isc_status);
+		fb_cursor->open = Qfalse;
+	}
+	if (!fb_stmt_cache_checkin(fb_connection, fb_cursor)) {
+		fb_isc_dsql_free_statement(fb_connection, isc_status, &fb_cursor->stmt, DSQL_drop);
+		fb_error_check(isc_status);
+	}
+}
+
+static void fb_cursor_drop_warn(struct FbCursor *fb_cursor)
+{
+	ISC_STATUS isc_status[20];
+	if (fb_cursor->open) {
+		isc_dsql_free_statement(isc_status, &fb_cursor->stmt, DSQL_close);
+		fb_error_check_warn(isc_status);
+	}
+	isc_dsql_free_statement(isc_status, &fb_cursor->stmt, DSQL_drop);
+	fb_error_check_warn(isc_status);
+}
+
+static void fb_cursor_mark(struct FbCursor *fb_cursor)
+{
+	rb_gc_mark(fb_cursor->connection);
+	rb_gc_mark(fb_cursor->fields_ary);
+	rb_gc_mark(fb_cursor->fields_hash);
+	rb_gc_mark(fb_cursor->row_fields);
+	rb_gc_mark(fb_cursor->row_keys);
+	rb_gc_mark(fb_cursor->row_symbols);
+	rb_gc_mark(fb_cursor->row_struct);
+	rb_gc_mark(fb_cursor->row_layout);
+	rb_gc_mark(fb_cursor->batch);
+}
+
+static void fb_cursor_free(struct FbCursor *fb_cursor)
+{
+	if (fb_cursor->stmt) {
+		fb_cursor_drop_warn(fb_cursor);
+	}
+	xfree(fb_cursor->sql);
+	xfree(fb_cursor->i_sqlda);
+	xfree(fb_cursor->o_sqlda);
+	xfree(fb_cursor->i_buffer);
+	xfree(fb_cursor->o_buffer);
+	xfree(fb_cursor->binders);
+	xfree(fb_cursor->decoders);
+	xfree(fb_cursor);
+}
+
+/* Blob attributes from isc_blob_info */
+struct FbBlobInfo {
+	unsigned short max_segment;
+	ISC_LONG num_segments;
+	ISC_LONG total_length;
+	short type;	/* isc_bpb_type_segmented or isc_bpb_type_stream */
+};
+
+/* Fb::Blob: a blob id read on demand, through a handle opened on first use.
+ * The id is only good in the transaction that fetched it. */
+struct FbBlob {
+	VALUE connection;
+	ISC_QUAD blob_id;
+	unsigned long transaction;	/* the connection's transactions count when fetched */
+	isc_blob_handle handle;
+	struct FbBlobInfo info;
+	long pos;
+	int eof;
+};
+
+static void fb_blob_mark(struct FbBlob *fb_blob)
+{
+	rb_gc_mark(fb_blob->connection);
+}
+
+static void fb_blob_free(struct FbBlob *fb_blob)
+{
+	ISC_STATUS isc_status[20];
+
+	if (fb_blob->handle) {
+		isc_close_blob(isc_status, &fb_blob->handle);
+	}
+	xfree(fb_blob);
+}
+
+static VALUE fb_blob_new(VALUE connection, ISC_QUAD *blob_id)
+{
+	struct FbBlob *fb_blob;
+	struct FbConnection *fb_connection;
+	VALUE blob = Data_Make_Struct(rb_cFbBlob, struct FbBlob, fb_blob_mark, fb_blob_free, fb_blob);
+
+	Data_Get_Struct(connection, struct FbConnection, fb_connection);
+	fb_blob->connection = connection;
+	fb_blob->blob_id = *blob_id;
+	fb_blob->transaction = fb_connection->transactions;
+	fb_blob->handle = 0;
+	fb_blob->pos = 0;
+	fb_blob->eof = 0;
+	return blob;
+}
+
+static long fb_blob_segment_size(VALUE size)
+{
+	long segment_size = NUM2LONG(size);
+	if (segment_size < 1 || segment_size > USHRT_MAX) {
+		rb_raise(rb_eArgError, "blob segment size must be between 1 and %d", USHRT_MAX);
+	}
+	return segment_size;
+}
+
+/* Writes data to an open blob in segments of at most segment_size bytes. */
+static void fb_blob_put(struct FbConnection *fb_connection, isc_blob_handle *blob_handle, const char *p, long length, long segment_size)
+{
+	long n;
+
+	while (length > 0) {
+		n = length < segment_size ? length : segment_size;
+		fb_isc_put_segment(fb_connection, fb_connection->isc_status, blob_handle, (unsigned short)n, p);
+		fb_error_check(fb_connection->isc_status);
+		p += n;
+		length -= n;
+	}
+}
+
+struct FbBlobSource {
+	struct FbConnection *fb_connection;
+	isc_blob_handle *blob_handle;
+	VALUE source;
+};
+
+/* Copies a String, or anything that responds to #read, into an open blob. */
+static VALUE fb_blob_put_source(VALUE arg)
+{
+	struct FbBlobSource *src = (struct FbBlobSource *)arg;
+	long segment_size = src->fb_connection->blob_segment_size;
+	VALUE chunk;
+
+	if (TYPE(src->source) != T_STRING && rb_respond_to(src->source, id_read)) {
+		for (;;) {
+			chunk = rb_funcall(src->source, id_read, 1, LONG2NUM(segment_size));
+			if (NIL_P(chunk)) break;
+			StringValue(chunk);
+			if (RSTRING_LEN(chunk) == 0) break;
+			fb_blob_put(src->fb_connection, src->blob_handle, RSTRING_PTR(chunk), RSTRING_LEN(chunk), segment_size);
+		}
+	} else {
+		chunk = rb_obj_as_string(src->source);
+		fb_blob_put(src->fb_connection, src->blob_handle, RSTRING_PTR(chunk), RSTRING_LEN(chunk), segment_size);
+	}
+	return Qnil;
+}
+
+/* Creates a blob from a String or readable object and returns its id.  The blob is cancelled if writing fails. */
+static ISC_QUAD fb_blob_create_from(struct FbConnection *fb_connection, VALUE source)
+{
+	isc_blob_handle blob_handle = 0;
+	ISC_QUAD blob_id;
+	ISC_STATUS isc_status[20];
+	struct FbBlobSource src;
+	int state = 0;
+
+	fb_isc_create_blob2(fb_connection, fb_connection->isc_status,&fb_connection->db,&fb_connection->transact,
+		&blob_handle,&blob_id,0,NULL);
+	fb_error_check(fb_connection->isc_status);
+	src.fb_connection = fb_connection;
+	src.blob_handle = &blob_handle;
+	src.source = source;
+	rb_protect(fb_blob_put_source, (VALUE)&src, &state);
+	if (state) {
+		isc_cancel_blob(isc_status, &blob_handle);
+		rb_jump_tag(state);
+	}
+	fb_isc_close_blob(fb_connection, fb_connection->isc_status,&blob_handle);
+	fb_error_check(fb_connection->isc_status);
+	return blob_id;
+}
+
+/* parameter binders */
+
+/* Reads the wall clock time of a Time in its own zone as seconds since 1970-01-01, without method calls.
+ * Returns 0 for other objects, which go through tm_from_timestamp() or tm_from_date(). */
+static int fb_time_wall(VALUE obj, ISC_INT64 *wall)
+{
+#if defined(HAVE_RB_TIME_TIMESPEC) && defined(HAVE_RB_TIME_UTC_OFFSET)
+	if (rb_obj_is_kind_of(obj, rb_cTime)) {
+		struct timespec ts = rb_time_timespec(obj);
+		VALUE offset = rb_time_utc_offset(obj);
+		if (FIXNUM_P(offset)) {
+			*wall = (ISC_INT64)ts.tv_sec + FIX2LONG(offset);
+			return 1;
+		}
+	}
+#endif
+	return 0;
+}
+
+static ISC_INT64 fb_wall_days(ISC_INT64 wall)
+{
+	return wall >= 0 ? wall / 86400 : (wall - 86399) / 86400;
+}
+
+static void fb_bind_scaled_overflow(const struct FbBinder *binder)
+{
+	rb_raise(rb_eRangeError, binder->max == SHRT_MAX ? "short integer overflow" :
+		binder->max == 2147483647 ? "integer overflow" : "bigint overflow");
+}
+
+/* Reads a plain decimal String ([+-]digits[.digits]) as an integer scaled by 10 ** +scale+,
+ * rounding half away from zero.  Returns 0 if the text is in any other form. */
+static int fb_parse_scaled(const char *p, const char *end, const struct FbBinder *binder, ISC_INT64 *result)
+{
+	ISC_INT64 value = 0;
+	int negative = 0, digits = 0, fraction = -1, round = 0;
+
+	while (p < end && ISSPACE(*p)) p++;
+	while (end > p && ISSPACE(end[-1])) end--;
+	if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+	for (; p < end; p++) {
+		if (*p == '.' && fraction < 0) {
+			fraction = 0;
+			continue;
+		}
+		if (!ISDIGIT(*p)) return 0;
+		digits++;
+		if (fraction >= binder->scale) {
+			/* Past the scale only the first digit matters, for rounding */
+			if (fraction++ == binder->scale) round = *p >= '5';
+			continue;
+		}
+		if (value > (binder->max - (*p - '0')) / 10) fb_bind_scaled_overflow(binder);
+		value = value * 10 + (*p - '0');
+		if (fraction >= 0) fraction++;
+	}
+	if (!digits) return 0;
+	for (fraction = fraction < 0 ? 0 : fraction; fraction < binder->scale; fraction++) {
+		if (value > binder->max / 10) fb_bind_scaled_overflow(binder);
+		value *= 10;
+	}
+	if (round) {
+		if (value == binder->max) fb_bind_scaled_overflow(binder);
+		value++;
+	}
+	*result = negative ? -value : value;
+	return 1;
+}
+
+/* Converts a parameter for a scaled SMALLINT/INTEGER/BIGINT to its unscaled value, exactly for
+ * Integer, BigDecimal, Rational and decimal String values.  Floats are rounded to the scale. */
+static ISC_INT64 fb_bind_scaled_value(VALUE obj, const struct FbBinder *binder)
+{
+	ISC_INT64 factor = decimal_pow10[binder->scale];
+	ISC_INT64 value;
+	double dvalue;
+
+	switch (TYPE(obj)) {
+		case T_FIXNUM:
+		case T_BIGNUM:
+			value = NUM2LL(obj);
+			if (value > binder->max / factor || value < -(binder->max / factor)) fb_bind_scaled_overflow(binder);
+			return value * factor;
+
+		case T_FLOAT:
+			dvalue = RFLOAT_VALUE(obj);
+			break;
+
+		case T_STRING:
+			if (fb_parse_scaled(RSTRING_PTR(obj), RSTRING_END(obj), binder, &value)) return value;
+			dvalue = NUM2DBL(double_from_obj(obj));
+			break;
+
+		default:
+			if (rb_obj_is_kind_of(obj, rb_cNumeric)) {
+				/* BigDecimal, Rational: scale and round in their own exact arithmetic */
+				VALUE scaled = rb_funcall(rb_funcall(obj, id_mult, 1, RARRAY_PTR(decimal_divisors)[binder->scale]), id_round, 0);
+				value = NUM2LL(scaled);
+				if (value > binder->max || value < -binder->max) fb_bind_scaled_overflow(binder);
+				return value;
+			}
+			if (rb_respond_to(obj, rb_intern("to_str"))) {
+				return fb_bind_scaled_value(rb_funcall(obj, rb_intern("to_str"), 0), binder);
+			}
+			dvalue = NUM2DBL(obj);
+			break;
+	}
+	dvalue = dvalue * (double)factor;
+	dvalue += dvalue < 0 ? -0.5 : 0.5;
+	if (!(dvalue < (double)binder->max + 1.0 && dvalue > -((double)binder->max + 1.0))) fb_bind_scaled_overflow(binder);
+	return (ISC_INT64)dvalue;
+}
+
+static long fb_bind_long_value(VALUE obj, const struct FbBinder *binder)
+{
+	if (binder->scale) {
+		return (long)fb_bind_scaled_value(obj, binder);
+	}
+	return FIXNUM_P(obj) ? FIX2LONG(obj) : NUM2LONG(long_from_obj(obj));
+}
+
+static void fb_bind_text(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	obj = rb_obj_as_string(obj);
+	if (RSTRING_LEN(obj) > var->sqllen) {
+		rb_raise(rb_eRangeError, "CHAR overflow: %ld bytes exceeds %d byte(s) allowed.",
+			RSTRING_LEN(obj), var->sqllen);
+	}
+	/* Pad rather than shrink sqllen, so the described length survives re-execution. */
+	memcpy(var->sqldata, RSTRING_PTR(obj), RSTRING_LEN(obj));
+	memset(var->sqldata + RSTRING_LEN(obj), ((var->sqlsubtype & 0xff) == 1) ? 0 : ' ',
+		var->sqllen - RSTRING_LEN(obj));
+}
+
+static void fb_bind_varying(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	VARY *vary = (VARY *)var->sqldata;
+
+	obj = rb_obj_as_string(obj);
+	if (RSTRING_LEN(obj) > var->sqllen) {
+		rb_raise(rb_eRangeError, "VARCHAR overflow: %ld bytes exceeds %d byte(s) allowed.",
+			RSTRING_LEN(obj), var->sqllen);
+	}
+	memcpy(vary->vary_string, RSTRING_PTR(obj), RSTRING_LEN(obj));
+	vary->vary_length = RSTRING_LEN(obj);
+}
+
+static void fb_bind_short(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	long lvalue = fb_bind_long_value(obj, binder);
+
+	if (lvalue < SHRT_MIN || lvalue > SHRT_MAX) {
+		rb_raise(rb_eRangeError, "short integer overflow");
+	}
+	*(short *)var->sqldata = (short)lvalue;
+}
+
+static void fb_bind_long(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	long lvalue = fb_bind_long_value(obj, binder);
+
+	if (lvalue < -2147483647 || lvalue > 2147483647) {
+		rb_raise(rb_eRangeError, "integer overflow");
+	}
+	*(ISC_LONG *)var->sqldata = (ISC_LONG)lvalue;
+}
+
+#if HAVE_LONG_LONG
+static void fb_bind_int64(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	ISC_INT64 llvalue;
+
+	if (binder->scale) {
+		llvalue = fb_bind_scaled_value(obj, binder);
+	} else if (FIXNUM_P(obj)) {
+		llvalue = FIX2LONG(obj);
+	} else {
+		llvalue = NUM2LL(ll_from_obj(obj));
+	}
+	*(ISC_INT64 *)var->sqldata = llvalue;
+}
+#endif
+
+static double fb_bind_double_value(VALUE obj)
+{
+	if (TYPE(obj) == T_FLOAT) {
+		return RFLOAT_VALUE(obj);
+	}
+	if (FIXNUM_P(obj)) {
+		return (double)FIX2LONG(obj);
+	}
+	return NUM2DBL(double_from_obj(obj));
+}
+
+static void fb_bind_float(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	double dvalue = fb_bind_double_value(obj);
+	double dcheck = dvalue >= 0.0 ? dvalue : -dvalue;
+
+	if (dcheck != 0.0 && (dcheck < FLT_MIN || dcheck > FLT_MAX)) {
+		rb_raise(rb_eRangeError, "float overflow");
+	}
+	*(float *)var->sqldata = (float)dvalue;
+}
+
+static void fb_bind_double(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	*(double *)var->sqldata = fb_bind_double_value(obj);
+}
+
+static void fb_bind_blob(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	if (rb_obj_is_kind_of(obj, rb_cFbBlob)) {
+		struct FbBlob *fb_blob;
+		Data_Get_Struct(obj, struct FbBlob, fb_blob);
+		*(ISC_QUAD *)var->sqldata = fb_blob->blob_id;
+	} else {
+		*(ISC_QUAD *)var->sqldata = fb_blob_create_from(fb_connection, obj);
+	}
+}
+
+static void fb_bind_timestamp(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	ISC_TIMESTAMP *timestamp = (ISC_TIMESTAMP *)var->sqldata;
+	ISC_INT64 wall, days;
+	struct tm tms;
+
+	if (fb_time_wall(obj, &wall)) {
+		days = fb_wall_days(wall);
+		timestamp->timestamp_date = (ISC_DATE)(days + MJD_UNIX_EPOCH);
+		timestamp->timestamp_time = (ISC_TIME)((wall - days * 86400) * ISC_TIME_FRACTIONS);
+		return;
+	}
+	tm_from_timestamp(&tms, obj);
+	isc_encode_timestamp(&tms, timestamp);
+}
+
+static void fb_bind_time(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	ISC_INT64 wall;
+	struct tm tms;
+
+	if (fb_time_wall(obj, &wall)) {
+		*(ISC_TIME *)var->sqldata = (ISC_TIME)((wall - fb_wall_days(wall) * 86400) * ISC_TIME_FRACTIONS);
+		return;
+	}
+	tm_from_timestamp(&tms, obj);
+	isc_encode_sql_time(&tms, (ISC_TIME *)var->sqldata);
+}
+
+static void fb_bind_date(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	ISC_INT64 wall;
+	struct tm tms;
+
+	if (fb_time_wall(obj, &wall)) {
+		*(ISC_DATE *)var->sqldata = (ISC_DATE)(fb_wall_days(wall) + MJD_UNIX_EPOCH);
+		return;
+	}
+	/* One call to Date#jd instead of year, month and day; see fb_decode_date() for the Julian calendar. */
+	if (rb_obj_is_kind_of(obj, rb_cDate)) {
+		VALUE jd = rb_funcall(obj, id_jd, 0);
+		if (FIXNUM_P(jd) && FIX2LONG(jd) - JD_MJD_OFFSET >= MJD_GREGORIAN) {
+			*(ISC_DATE *)var->sqldata = (ISC_DATE)(FIX2LONG(jd) - JD_MJD_OFFSET);
+			return;
+		}
+	}
+	tm_from_date(&tms, obj);
+	isc_encode_sql_date(&tms, (ISC_DATE *)var->sqldata);
+}
+
+static void fb_bind_unsupported(struct FbConnection *fb_connection, XSQLVAR *var, VALUE obj, const struct FbBinder *binder)
+{
+	rb_raise(rb_eFbError, "Specified table includes unsupported datatype (%d)", var->sqltype & ~1);
+}
+
+/* Compiles the parameter shape into one binder per parameter, so executing does no per-value type dispatch.
+ * The input SQLVARs must already point into i_buffer. */
+static void fb_cursor_compile_binders(struct FbCursor *fb_cursor)
+{
+	long params = fb_cursor->i_sqlda->sqld;
+	long count;
+	XSQLVAR *var;
+	struct FbBinder *binder;
+
+	REALLOC_N(fb_cursor->binders, struct FbBinder, params > 0 ? params : 1);
+	for (count = 0; count < params; count++) {
+		var = &fb_cursor->i_sqlda->sqlvar[count];
+		binder = &fb_cursor->binders[count];
+		binder->nullable = var->sqltype & 1;
+		binder->scale = var->sqlscale < 0 ? -var->sqlscale : 0;
+		binder->max = (var->sqltype & ~1) == SQL_SHORT ? SHRT_MAX : (var->sqltype & ~1) == SQL_LONG ? 2147483647 : LLONG_MAX;
+
+		if (binder->scale > DECIMAL_SCALE_MAX) {
+			binder->bind = fb_bind_unsupported;
+			continue;
+		}
+		switch (var->sqltype & ~1) {
+			case SQL_TEXT:		binder->bind = fb_bind_text;	break;
+			case SQL_VARYING:	binder->bind = fb_bind_varying;	break;
+			case SQL_SHORT:		binder->bind = fb_bind_short;	break;
+			case SQL_LONG:		binder->bind = fb_bind_long;	break;
+			case SQL_FLOAT:		binder->bind = fb_bind_float;	break;
+			case SQL_DOUBLE:	binder->bind = fb_bind_double;	break;
+#if HAVE_LONG_LONG
+			case SQL_INT64:		binder->bind = fb_bind_int64;	break;
+#endif
+			case SQL_BLOB:		binder->bind = fb_bind_blob;	break;
+			case SQL_TIMESTAMP:	binder->bind = fb_bind_timestamp;	break;
+			case SQL_TYPE_TIME:	binder->bind = fb_bind_time;	break;
+			case SQL_TYPE_DATE:	binder->bind = fb_bind_date;	break;
+			default:		binder->bind = fb_bind_unsupported;	break;
+		}
+	}
+}
+
+/* Binds +obj+ to input parameter +index+. */
+static void fb_cursor_set_inputparam(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, long index, VALUE obj)
+{
+	XSQLVAR *var = &fb_cursor->i_sqlda->sqlvar[index];
+	const struct FbBinder *binder = &fb_cursor->binders[index];
+
+	if (!NIL_P(obj)) {
+		binder->bind(fb_connection, var, obj, binder);
+		if (binder->nullable) {
+			*var->sqlind = 0;
+		}
+	} else if (binder->nullable) {
+		*var->sqlind = -1;
+	} else {
+		rb_raise(rb_eFbError, "specified column is not permitted to be null");
+	}
+}
+
+static void fb_cursor_set_inputparams(struct FbCursor *fb_cursor, long argc, VALUE *argv)
+{
+	struct FbConnection *fb_connection;
+	long count;
+
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+
+	/* Check the number of parameters */
+	if (fb_cursor->i_sqlda->sqld != argc) {
+		rb_raise(rb_eFbError, "statement requires %d items; %ld given", fb_cursor->i_sqlda->sqld, argc);
+	}
+
+	/* Get the parameters */
+	for (count = 0; count < argc; count++) {
+		fb_cursor_set_inputparam(fb_connection, fb_cursor, count, argv[count]);
+	}
+}
+
+static void fb_cursor_execute_withparams(struct FbCursor *fb_cursor, long argc, VALUE *argv)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	/* Check the first object type of the parameters */
+	if (argc >= 1 && TYPE(argv[0]) == T_ARRAY) {
+		int i;
+		VALUE obj;
+		VALUE ary = argv[0];
+		if (RARRAY_LEN(ary) > 0 && TYPE(RARRAY_PTR(ary)[0]) == T_ARRAY) {
+			for (i = 0; i < RARRAY_LEN(ary); i++) {
+				obj = rb_ary_entry(ary, i);
+				fb_cursor_execute_withparams(fb_cursor, 1, &obj);
+			}
+		} else {
+			for (i = 0; i < argc; i++) {
+				obj = argv[i];
+
+				/* Set the input parameters */
+				Check_Type(obj, T_ARRAY);
+				fb_cursor_set_inputparams(fb_cursor, RARRAY_LEN(obj), RARRAY_PTR(obj));
+
+				/* Execute SQL statement */
+				fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, fb_cursor->i_sqlda, NULL);
+				fb_error_check(fb_connection->isc_status);
+			}
+		}
+	} else {
+		/* Set the input parameters */
+		fb_cursor_set_inputparams(fb_cursor, argc, argv);
+
+		/* Execute SQL statement */
+		fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, fb_cursor->i_sqlda, NULL);
+		fb_error_check(fb_connection->isc_status);
+	}
+}
+
+static VALUE precision_from_sqlvar(XSQLVAR *sqlvar)
+{
+	switch(sqlvar->sqltype & ~1) {
+		case SQL_TEXT:		return Qnil;
+		case SQL_VARYING:	return Qnil;
+		case SQL_SHORT:
+			switch (sqlvar->sqlsubtype) {
+				case 0:		return INT2FIX(0);
+				case 1:		return INT2FIX(4);
+				case 2:		return INT2FIX(4);
+			}
+			break;
+		case SQL_LONG:
+			switch (sqlvar->sqlsubtype) {
+				case 0:		return INT2FIX(0);
+				case 1:		return INT2FIX(9);
+				case 2:		return INT2FIX(9);
+			}
+			break;
+		case SQL_FLOAT:		return Qnil;
+		case SQL_DOUBLE:
+		case SQL_D_FLOAT:
+			switch (sqlvar->sqlsubtype) {
+				case 0:		return Qnil;
+				case 1:		return INT2FIX(15);
+				case 2:		return INT2FIX(15);
+			}
+			break;
+		case SQL_TIMESTAMP:	return Qnil;
+		case SQL_BLOB:		return Qnil;
+		case SQL_ARRAY:		return Qnil;
+		case SQL_QUAD:		return Qnil;
+		case SQL_TYPE_TIME:	return Qnil;
+		case SQL_TYPE_DATE:	return Qnil;
+		case SQL_INT64:
+			switch (sqlvar->sqlsubtype) {
+				case 0:		return INT2FIX(0);
+				case 1:		return INT2FIX(18);
+				case 2:		return INT2FIX(18);
+			}
+			break;
+	}
+	return Qnil;
+}
+
+static int no_lowercase(VALUE value)
+{
+	VALUE local_value = StringValue(value);
+	int result = rb_funcall(re_lowercase, id_matches, 1, local_value) == Qnil;
+	return result;
+}
+
+static VALUE fb_cursor_fields_ary(XSQLDA *sqlda, short downcase_names)
+{
+	long cols;
+	long count;
+	XSQLVAR *var;
+	short dtp;
+	VALUE ary;
+
+	cols = sqlda->sqld;
+	if (cols == 0) {
+		return Qnil;
+	}
+
+	ary = rb_ary_new();
+	for (count = 0; count < cols; count++) {
+		VALUE field;
+		VALUE name, type_code, sql_type, sql_subtype, display_size, internal_size, precision, scale, nullable;
+
+		var = &sqlda->sqlvar[count];
+		dtp = var->sqltype & ~1;
+
+		if (var->aliasname_length) { /* aliasname always present? */
+			name = rb_tainted_str_new(var->aliasname, var->aliasname_length);
+		} else {
+			name = rb_tainted_str_new(var->sqlname, var->sqlname_length);
+		}
+		if (downcase_names && no_lowercase(name)) {
+			rb_funcall(name, id_downcase_bang, 0);
+		}
+		rb_str_freeze(name);
+		type_code = INT2NUM((long)(var->sqltype & ~1));
+		sql_type = fb_sql_type_from_code(dtp, var->sqlsubtype);
+		sql_subtype = INT2FIX(var->sqlsubtype);
+		display_size = INT2NUM((long)var->sqllen);
+		if (dtp == SQL_VARYING) {
+			internal_size = INT2NUM((long)var->sqllen + sizeof(short));
+		} else {
+			internal_size = INT2NUM((long)var->sqllen);
+		}
+		precision = precision_from_sqlvar(var);
+		scale = INT2NUM((long)var->sqlscale);
+		nullable = (var->sqltype & 1) ? Qtrue : Qfalse;
+
+		field = rb_struct_new(rb_sFbField, name, sql_type, sql_subtype, display_size, internal_size, precision, scale, nullable, type_code);
+		rb_ary_push(ary, field);
+	}
+	rb_ary_freeze(ary);
+	return ary;
+}
+
+static VALUE fb_cursor_fields_hash(VALUE fields_ary)
+{
+	int i;
+	VALUE hash = rb_hash_new();
+
+	for (i = 0; i < RARRAY_LEN(fields_ary); i++) {
+		VALUE field = rb_ary_entry(fields_ary, i);
+		VALUE name = rb_struct_aref(field, LONG2NUM(0));
+		rb_hash_aset(hash, name, field);
+	}
+
+	return hash;
+}
+
+/* Points each SQLVAR of +sqlda+ into +buffer+, laid out as calculate_buffsize() sizes it.
+ * Done once per prepared statement, not per execute or fetch. */
+static void fb_sqlda_bind_buffer(XSQLDA *sqlda, char *buffer)
+{
+	long cols;
+	long count;
+	XSQLVAR *var;
+	short dtp;
+	long length;
+	long alignment;
+	long offset;
+
+	cols = sqlda->sqld;
+	for (var = sqlda->sqlvar, offset = 0, count = 0; count < cols; var++, count++) {
+		length = alignment = var->sqllen;
+		dtp = var->sqltype & ~1;
+
+		if (dtp == SQL_TEXT) {
+			alignment = 1;
+		} else if (dtp == SQL_VARYING) {
+			length += sizeof(short);
+			alignment = sizeof(short);
+		}
+		offset = FB_ALIGN(offset, alignment);
+		var->sqldata = (char*)(buffer + offset);
+		offset += length;
+		offset = FB_ALIGN(offset, sizeof(short));
+		var->sqlind = (short*)(buffer + offset);
+		offset += sizeof(short);
+	}
+}
+
+static void fb_cursor_fetch_prep(struct FbCursor *fb_cursor)
+{
+	struct FbConnection *fb_connection;
+
+	fb_cursor_check(fb_cursor);
+
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+
+	/* Check if open cursor */
+	if (!fb_cursor->open) {
+		rb_raise(rb_eFbError, "The cursor has not been opened. Use execute(query)");
+	}
+}
+
+/* column decoders */
+
+static VALUE fb_decode_text(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_tainted_str_new(var->sqldata, var->sqllen);
+}
+
+static VALUE fb_decode_varying(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	VARY *vary = (VARY*)var->sqldata;
+	return rb_tainted_str_new(vary->vary_string, vary->vary_length);
+}
+
+static VALUE fb_decode_short(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return INT2FIX(*(short*)var->sqldata);
+}
+
+static VALUE fb_decode_short_scaled(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_float_new((double)*(short*)var->sqldata / decoder->ratio);
+}
+
+static VALUE fb_decode_long(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return INT2NUM(*(ISC_LONG*)var->sqldata);
+}
+
+static VALUE fb_decode_long_scaled(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_float_new((double)*(ISC_LONG*)var->sqldata / decoder->ratio);
+}
+
+static VALUE fb_decode_float(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_float_new((double)*(float*)var->sqldata);
+}
+
+static VALUE fb_decode_double(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_float_new(*(double*)var->sqldata);
+}
+
+#if HAVE_LONG_LONG
+static VALUE fb_decode_int64(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return LL2NUM(*(ISC_INT64*)var->sqldata);
+}
+
+static VALUE fb_decode_int64_scaled(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_float_new((double)*(ISC_INT64*)var->sqldata / decoder->ratio);
+}
+#endif
+
+/* Unscaled integer of minor units behind a NUMERIC/DECIMAL column */
+static VALUE fb_decode_minor_units(XSQLVAR *var)
+{
+	switch (var->sqltype & ~1) {
+		case SQL_SHORT:
+			return INT2FIX(*(short*)var->sqldata);
+		case SQL_LONG:
+			return INT2NUM(*(ISC_LONG*)var->sqldata);
+#if HAVE_LONG_LONG
+		case SQL_INT64:
+			return LL2NUM(*(ISC_INT64*)var->sqldata);
+#endif
+	}
+	return Qnil;
+}
+
+static VALUE fb_decode_rational(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_Rational(fb_decode_minor_units(var), RARRAY_PTR(decimal_divisors)[-var->sqlscale]);
+}
+
+static VALUE fb_decode_bigdecimal(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	VALUE digits = rb_funcall(rb_mKernel, id_BigDecimal, 1, fb_decode_minor_units(var));
+	return rb_funcall(digits, id_mult, 1, RARRAY_PTR(decimal_factors)[-var->sqlscale]);
+}
+
+/* Offset of local time from UTC, cached per quarter hour of local wall-clock time */
+struct FbUtcOffset {
+	ISC_INT64 bucket;
+	long offset;
+	int valid;
+};
+
+static struct FbUtcOffset utc_offset_cache[UTC_OFFSET_CACHE_SIZE];
+static char utc_offset_zone[256];	/* TZ and tzname the cache was filled under */
+
+/* Empties the offset cache if the time zone changed since it was filled: ENV['TZ'] was set,
+ * or tzset() picked up another zone.  Checked once per execute rather than per value. */
+static void fb_utc_offset_cache_check(void)
+{
+	char zone[sizeof(utc_offset_zone)];
+	const char *tz = getenv("TZ");
+
+	snprintf(zone, sizeof(zone), "%c%s|%s|%s", tz ? '=' : '-', tz ? tz : "", tzname[0], tzname[1]);
+	if (strcmp(zone, utc_offset_zone)) {
+		memset(utc_offset_cache, 0, sizeof(utc_offset_cache));
+		strcpy(utc_offset_zone, zone);
+	}
+}
+
+/* Converts a local ISC_TIMESTAMP to seconds since the Unix epoch.
+ * Returns 0 when the value is out of range for time_t or mktime(),
+ * in which case the caller falls back to Time.local. */
+static int fb_timestamp_epoch(ISC_TIMESTAMP *timestamp, time_t *epoch)
+{
+	ISC_INT64 wall, bucket;
+	struct FbUtcOffset *slot;
+	struct tm tms;
+	time_t t;
+
+	wall = (ISC_INT64)(timestamp->timestamp_date - MJD_UNIX_EPOCH) * 86400 + timestamp->timestamp_time / ISC_TIME_FRACTIONS;
+	bucket = wall >= 0 ? wall / UTC_OFFSET_BUCKET : (wall - UTC_OFFSET_BUCKET + 1) / UTC_OFFSET_BUCKET;
+	slot = &utc_offset_cache[(unsigned long)bucket % UTC_OFFSET_CACHE_SIZE];
+	if (!slot->valid || slot->bucket != bucket) {
+		isc_decode_timestamp(timestamp, &tms);
+		tms.tm_isdst = -1;
+		t = mktime(&tms);
+		if (t == (time_t)-1) return 0;
+		slot->bucket = bucket;
+		slot->offset = (long)(wall - (ISC_INT64)t);
+		slot->valid = 1;
+	}
+	wall -= slot->offset;
+	if ((ISC_INT64)(time_t)wall != wall) return 0;
+	*epoch = (time_t)wall;
+	return 1;
+}
+
+static VALUE fb_time_new(time_t sec, long nsec, int utc)
+{
+#ifdef HAVE_RB_TIME_TIMESPEC_NEW
+	struct timespec ts;
+	ts.tv_sec = sec;
+	ts.tv_nsec = nsec;
+	return rb_time_timespec_new(&ts, utc ? INT_MAX - 1 : INT_MAX);
+#else
+	VALUE time = rb_time_nano_new(sec, nsec);
+	return utc ? rb_funcall(time, rb_intern("utc"), 0) : time;
+#endif
+}
+
+static VALUE fb_decode_timestamp(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	ISC_TIMESTAMP *timestamp = (ISC_TIMESTAMP *)var->sqldata;
+	struct tm tms;
+	time_t epoch;
+
+	if (fb_timestamp_epoch(timestamp, &epoch)) {
+		return fb_time_new(epoch, (long)(timestamp->timestamp_time % ISC_TIME_FRACTIONS) * 100000, 0);
+	}
+	isc_decode_timestamp(timestamp, &tms);
+	return fb_mktime(&tms, "local");
+}
+
+static VALUE fb_decode_timestamp_epoch_int(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	time_t epoch;
+
+	if (fb_timestamp_epoch((ISC_TIMESTAMP *)var->sqldata, &epoch)) {
+		return LONG2NUM((long)epoch);
+	}
+	return rb_funcall(fb_decode_timestamp(fb_connection, var, decoder), rb_intern("to_i"), 0);
+}
+
+static VALUE fb_decode_timestamp_epoch_float(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	ISC_TIMESTAMP *timestamp = (ISC_TIMESTAMP *)var->sqldata;
+	time_t epoch;
+
+	if (fb_timestamp_epoch(timestamp, &epoch)) {
+		return rb_float_new((double)epoch + (double)(timestamp->timestamp_time % ISC_TIME_FRACTIONS) / ISC_TIME_FRACTIONS);
+	}
+	return rb_funcall(fb_decode_timestamp(fb_connection, var, decoder), rb_intern("to_f"), 0);
+}
+
+/* TIME values are returned on 2000-01-01 UTC */
+static VALUE fb_decode_time(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	ISC_TIME time = *(ISC_TIME *)var->sqldata;
+	return fb_time_new(UNIX_Y2K + time / ISC_TIME_FRACTIONS, (long)(time % ISC_TIME_FRACTIONS) * 100000, 1);
+}
+
+static VALUE fb_decode_time_epoch_int(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return LONG2NUM(UNIX_Y2K + (long)(*(ISC_TIME *)var->sqldata / ISC_TIME_FRACTIONS));
+}
+
+static VALUE fb_decode_time_epoch_float(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return rb_float_new(UNIX_Y2K + (double)*(ISC_TIME *)var->sqldata / ISC_TIME_FRACTIONS);
+}
+
+static VALUE fb_decode_date(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	ISC_DATE date = *(ISC_DATE *)var->sqldata;
+	struct tm tms;
+
+	/* Date.jd skips the civil calendar validation; before the Gregorian reform
+	 * Date.civil reads y/m/d as Julian, so keep it there. */
+	if (date >= MJD_GREGORIAN) {
+		return rb_funcall(rb_cDate, id_jd, 1, INT2NUM(date + JD_MJD_OFFSET));
+	}
+	isc_decode_sql_date(&date, &tms);
+	return fb_mkdate(&tms);
+}
+
+static void fb_blob_info(struct FbConnection *fb_connection, isc_blob_handle *blob_handle, struct FbBlobInfo *info)
+{
+	static char blob_items[] = {
+		isc_info_blob_max_segment,
+		isc_info_blob_num_segments,
+		isc_info_blob_total_length,
+		isc_info_blob_type
+	};
+	char blob_info[32];
+	char *p, item;
+	short length;
+
+	memset(info, 0, sizeof(*info));
+	fb_isc_blob_info(fb_connection, fb_connection->isc_status, blob_handle,
+		sizeof(blob_items), blob_items,
+		sizeof(blob_info), blob_info);
+	fb_error_check(fb_connection->isc_status);
+	for (p = blob_info; *p != isc_info_end; p += length) {
+		item = *p++;
+		length = (short) isc_vax_integer(p,2);
+		p += 2;
+		switch (item) {
+			case isc_info_blob_max_segment:
+				info->max_segment = isc_vax_integer(p,length);
+				break;
+			case isc_info_blob_num_segments:
+				info->num_segments = isc_vax_integer(p,length);
+				break;
+			case isc_info_blob_total_length:
+				info->total_length = isc_vax_integer(p,length);
+				break;
+			case isc_info_blob_type:
+				info->type = isc_vax_integer(p,length);
+				break;
+		}
+	}
+}
+
+static VALUE fb_decode_blob(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	VALUE val;
+	isc_blob_handle blob_handle;
+	ISC_QUAD blob_id;
+	unsigned short actual_seg_len;
+	struct FbBlobInfo info;
+	char *p;
+
+	blob_handle = 0;
+	blob_id = *(ISC_QUAD *)var->sqldata;
+	fb_isc_open_blob2(fb_connection, fb_connection->isc_status, &fb_connection->db, &fb_connection->transact, &blob_handle, &blob_id, 0, NULL);
+	fb_error_check(fb_connection->isc_status);
+	fb_blob_info(fb_connection, &blob_handle, &info);
+	val = rb_tainted_str_new(NULL,info.total_length);
+	for (p = RSTRING_PTR(val); info.num_segments > 0; info.num_segments--, p += actual_seg_len) {
+		fb_isc_get_segment(fb_connection, fb_connection->isc_status, &blob_handle, &actual_seg_len, info.max_segment, p);
+		fb_error_check(fb_connection->isc_status);
+	}
+	fb_isc_close_blob(fb_connection, fb_connection->isc_status, &blob_handle);
+	fb_error_check(fb_connection->isc_status);
+	return val;
+}
+
+static VALUE fb_decode_blob_stream(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	return fb_blob_new(fb_connection->self, (ISC_QUAD *)var->sqldata);
+}
+
+static VALUE fb_decode_array(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	rb_warn("ARRAY not supported (yet)");
+	return Qnil;
+}
+
+static VALUE fb_decode_unsupported(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	rb_raise(rb_eFbError, "Specified table includes unsupported datatype (%d)", var->sqltype & ~1);
+	return Qnil;
+}
+
+static short fb_decimal_mode(VALUE mode)
+{
+	ID id;
+
+	if (NIL_P(mode)) return DECIMAL_FLOAT;
+	if (SYMBOL_P(mode) || TYPE(mode) == T_STRING) {
+		id = rb_to_id(mode);
+		if (id == rb_intern("float")) return DECIMAL_FLOAT;
+		if (id == rb_intern("bigdecimal")) return DECIMAL_BIGDECIMAL;
+		if (id == rb_intern("rational")) return DECIMAL_RATIONAL;
+		if (id == rb_intern("scaled_integer")) return DECIMAL_SCALED_INTEGER;
+	}
+	rb_raise(rb_eArgError, "decimal mode must be :float, :bigdecimal, :rational or :scaled_integer");
+	return DECIMAL_FLOAT;
+}
+
+static VALUE fb_decimal_mode_name(short decimal_mode)
+{
+	switch (decimal_mode) {
+		case DECIMAL_BIGDECIMAL:	return ID2SYM(rb_intern("bigdecimal"));
+		case DECIMAL_RATIONAL:		return ID2SYM(rb_intern("rational"));
+		case DECIMAL_SCALED_INTEGER:	return ID2SYM(rb_intern("scaled_integer"));
+	}
+	return ID2SYM(rb_intern("float"));
+}
+
+static short fb_timestamp_format(VALUE format)
+{
+	ID id;
+
+	if (NIL_P(format)) return TIMESTAMP_TIME;
+	if (SYMBOL_P(format) || TYPE(format) == T_STRING) {
+		id = rb_to_id(format);
+		if (id == rb_intern("time")) return TIMESTAMP_TIME;
+		if (id == rb_intern("epoch_float")) return TIMESTAMP_EPOCH_FLOAT;
+		if (id == rb_intern("epoch_int")) return TIMESTAMP_EPOCH_INT;
+	}
+	rb_raise(rb_eArgError, "timestamp format must be :time, :epoch_float or :epoch_int");
+	return TIMESTAMP_TIME;
+}
+
+static VALUE fb_timestamp_format_name(short timestamp_format)
+{
+	switch (timestamp_format) {
+		case TIMESTAMP_EPOCH_FLOAT:	return ID2SYM(rb_intern("epoch_float"));
+		case TIMESTAMP_EPOCH_INT:	return ID2SYM(rb_intern("epoch_int"));
+	}
+	return ID2SYM(rb_intern("time"));
+}
+
+static short fb_blob_format(VALUE format)
+{
+	ID id;
+
+	if (NIL_P(format)) return BLOB_STRING;
+	if (SYMBOL_P(format) || TYPE(format) == T_STRING) {
+		id = rb_to_id(format);
+		if (id == rb_intern("string")) return BLOB_STRING;
+		if (id == rb_intern("stream")) return BLOB_STREAM;
+	}
+	rb_raise(rb_eArgError, "blob format must be :string or :stream");
+	return BLOB_STRING;
+}
+
+static VALUE fb_blob_format_name(short blob_format)
+{
+	return ID2SYM(rb_intern(blob_format == BLOB_STREAM ? "stream" : "string"));
+}
+
+static void fb_decimal_factors_init(void)
+{
+	long scnt;
+	VALUE factor;
+
+	if (RARRAY_LEN(decimal_factors) > 0) return;
+	rb_require("bigdecimal");
+	factor = rb_funcall(rb_mKernel, id_BigDecimal, 1, INT2FIX(1));
+	for (scnt = 0; scnt <= DECIMAL_SCALE_MAX; scnt++) {
+		rb_ary_push(decimal_factors, factor);
+		factor = rb_funcall(factor, rb_intern("/"), 1, INT2FIX(10));
+	}
+}
+
+/* Picks the decoder for a scaled SMALLINT/INTEGER/BIGINT column according to the decimal mode. */
+static fb_decode_func fb_scaled_decoder(XSQLVAR *var, short decimal_mode, fb_decode_func float_decoder, fb_decode_func integer_decoder)
+{
+	if (var->sqlscale < -DECIMAL_SCALE_MAX) return float_decoder;
+	switch (decimal_mode) {
+		case DECIMAL_BIGDECIMAL:
+			fb_decimal_factors_init();
+			return fb_decode_bigdecimal;
+		case DECIMAL_RATIONAL:
+			return fb_decode_rational;
+		case DECIMAL_SCALED_INTEGER:
+			return integer_decoder;
+	}
+	return float_decoder;
+}
+
+/* Compiles the result shape into one decoder per column, so fetching does no per-value type dispatch. */
+static void fb_cursor_compile_decoders(struct FbConnection *fb_connection, struct FbCursor *fb_cursor)
+{
+	long cols;
+	long count;
+	long scnt;
+	XSQLVAR *var;
+	struct FbDecoder *decoder;
+	int scaled;
+	short decimal_mode;
+	short timestamp_format;
+	short blob_format;
+
+	decimal_mode = fb_cursor->decimal_mode == DECIMAL_INHERIT ? fb_connection->decimal_mode : fb_cursor->decimal_mode;
+	timestamp_format = fb_cursor->timestamp_format == TIMESTAMP_INHERIT ? fb_connection->timestamp_format : fb_cursor->timestamp_format;
+	blob_format = fb_cursor->blob_format == BLOB_INHERIT ? fb_connection->blob_format : fb_cursor->blob_format;
+	fb_utc_offset_cache_check();
+	cols = fb_cursor->o_sqlda->sqld;
+	REALLOC_N(fb_cursor->decoders, struct FbDecoder, cols > 0 ? cols : 1);
+	fb_cursor->row_layout = Qnil;
+	for (count = 0; count < cols; count++) {
+		var = &fb_cursor->o_sqlda->sqlvar[count];
+		decoder = &fb_cursor->decoders[count];
+		decoder->nullable = var->sqltype & 1;
+		decoder->ratio = 1;
+		for (scnt = 0; scnt > var->sqlscale; scnt--) decoder->ratio *= 10;
+		scaled = var->sqlscale < 0;
+
+		switch (var->sqltype & ~1) {
+			case SQL_TEXT:		decoder->decode = fb_decode_text;	break;
+			case SQL_VARYING:	decoder->decode = fb_decode_varying;	break;
+			case SQL_SHORT:		decoder->decode = scaled ? fb_scaled_decoder(var, decimal_mode, fb_decode_short_scaled, fb_decode_short) : fb_decode_short;	break;
+			case SQL_LONG:		decoder->decode = scaled ? fb_scaled_decoder(var, decimal_mode, fb_decode_long_scaled, fb_decode_long) : fb_decode_long;	break;
+			case SQL_FLOAT:		decoder->decode = fb_decode_float;	break;
+			case SQL_DOUBLE:	decoder->decode = fb_decode_double;	break;
+#if HAVE_LONG_LONG
+			case SQL_INT64:		decoder->decode = scaled ? fb_scaled_decoder(var, decimal_mode, fb_decode_int64_scaled, fb_decode_int64) : fb_decode_int64;	break;
+#endif
+			case SQL_TIMESTAMP:
+				decoder->decode = timestamp_format == TIMESTAMP_EPOCH_INT ? fb_decode_timestamp_epoch_int :
+					timestamp_format == TIMESTAMP_EPOCH_FLOAT ? fb_decode_timestamp_epoch_float : fb_decode_timestamp;
+				break;
+			case SQL_TYPE_TIME:
+				decoder->decode = timestamp_format == TIMESTAMP_EPOCH_INT ? fb_decode_time_epoch_int :
+					timestamp_format == TIMESTAMP_EPOCH_FLOAT ? fb_decode_time_epoch_float : fb_decode_time;
+				break;
+			case SQL_TYPE_DATE:	decoder->decode = fb_decode_date;	break;
+			case SQL_BLOB:		decoder->decode = blob_format == BLOB_STREAM ? fb_decode_blob_stream : fb_decode_blob;	break;
+			case SQL_ARRAY:		decoder->decode = fb_decode_array;	break;
+			default:		decoder->decode = fb_decode_unsupported;	break;
+		}
+	}
+}
+
+static VALUE fb_cursor_column_value(struct FbConnection *fb_connection, XSQLVAR *var, const struct FbDecoder *decoder)
+{
+	/* Check if column is null */
+	if (decoder->nullable && *var->sqlind < 0) {
+		return Qnil;
+	}
+	return decoder->decode(fb_connection, var, decoder);
+}
+
+/* Closes a cursor whose fetch was cancelled and rolls back its automatic transaction.
+ * Errors are ignored: the cancellation is what gets reported. */
+static void fb_cursor_abort(struct FbConnection *fb_connection, struct FbCursor *fb_cursor)
+{
+	ISC_STATUS isc_status[20];
+
+	if (fb_cursor->open) {
+		fb_isc_dsql_free_statement(fb_connection, isc_status, &fb_cursor->stmt, DSQL_close);
+		fb_cursor->open = Qfalse;
+	}
+	if (fb_connection->transact && fb_connection->transact == fb_cursor->auto_transact) {
+		fb_isc_rollback_transaction(fb_connection, isc_status, &fb_connection->transact);
+		fb_cursor->auto_transact = fb_connection->transact;
+	}
+}
+
+/* Fetches the next row into o_buffer.  Returns 0 and marks the cursor at end of data when there are no more rows. */
+static int fb_cursor_fetch_row(struct FbConnection *fb_connection, struct FbCursor *fb_cursor)
+{
+	if (fb_cursor->eof) {
+		rb_raise(rb_eFbError, "Cursor is past end of data.");
+	}
+	/* Fetch one row */
+	if (fb_isc_dsql_fetch(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->o_sqlda) == SQLCODE_NOMORE) {
+		fb_cursor->eof = Qtrue;
+		return 0;
+	}
+	if (fb_connection->isc_status[1] == isc_cancelled) {
+		fb_cursor_abort(fb_connection, fb_cursor);
+	}
+	fb_error_check(fb_connection->isc_status);
+	return 1;
+}
+
+/* Decodes the row held in the output SQLDA into an Array. */
+static VALUE fb_cursor_current_row(struct FbConnection *fb_connection, struct FbCursor *fb_cursor)
+{
+	long cols;
+	VALUE ary;
+	long count;
+	XSQLVAR *var;
+	const struct FbDecoder *decoder;
+
+	/* Create the result tuple object */
+	cols = fb_cursor->o_sqlda->sqld;
+	ary = rb_ary_new2(cols);
+
+	/* Create the result objects for each columns */
+	var = fb_cursor->o_sqlda->sqlvar;
+	decoder = fb_cursor->decoders;
+	for (count = 0; count < cols; count++, var++, decoder++) {
+		rb_ary_push(ary, fb_cursor_column_value(fb_connection, var, decoder));
+	}
+
+	return ary;
+}
+
+static VALUE fb_cursor_fetch(struct FbCursor *fb_cursor)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+
+	if (!fb_cursor_fetch_row(fb_connection, fb_cursor)) {
+		return Qnil;
+	}
+	return fb_cursor_current_row(fb_connection, fb_cursor);
+}
+
+static long cursor_rows_affected(struct FbCursor *fb_cursor, long statement_type)
+{
+	long inserted = 0, selected = 0, updated = 0, deleted = 0;
+	char request[] = { isc_info_sql_records };
+	char response[64], *r;
+	ISC_STATUS isc_status[20];
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_isc_dsql_sql_info(fb_connection, isc_status, &fb_cursor->stmt, sizeof(request), request, sizeof(response), response);
+	fb_error_check(isc_status);
+	if (response[0] != isc_info_sql_records) { return -1; }
+
+	r = response + 3; /* skip past first cluster */
+	while (*r != isc_info_end) {
+		char count_type = *r++;
+		short len = isc_vax_integer(r, sizeof(short));
+		r += sizeof(short);
+		switch (count_type) {
+			case isc_info_req_insert_count:
+				inserted = isc_vax_integer(r, len);
+				break;
+			case isc_info_req_select_count:
+				selected = isc_vax_integer(r, len);
+				break;
+			case isc_info_req_update_count:
+				updated = isc_vax_integer(r, len);
+				break;
+			case isc_info_req_delete_count:
+				deleted = isc_vax_integer(r, len);
+				break;
+		}
+		r += len;
+	}
+	switch (statement_type) {
+		case isc_info_sql_stmt_select: return selected;
+		case isc_info_sql_stmt_insert: return inserted;
+		case isc_info_sql_stmt_update: return updated;
+		case isc_info_sql_stmt_delete: return deleted;
+		default: return inserted + selected + updated + deleted;
+	}
+}
+
+/* Whether an execute of +statement_type+ asks the server for the rows it affected.
+ * Schema updates, SET GENERATOR and savepoints affect none, so they are never asked. */
+static int fb_statement_counts_rows(struct FbConnection *fb_connection, long statement_type)
+{
+	switch (statement_type) {
+		case isc_info_sql_stmt_ddl:
+		case isc_info_sql_stmt_set_generator:
+		case isc_info_sql_stmt_savepoint:
+			return 0;
+	}
+	return fb_connection->count_rows;
+}
+
+static void fb_cursor_prepare(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, char *sql)
+{
+	long length;
+	long in_params;
+	long cols;
+	char isc_info_buff[16];
+	char isc_info_stmt[] = { isc_info_sql_stmt_type };
+
+	if (!fb_cursor->stmt) {
+		fb_isc_dsql_alloc_statement2(fb_connection, fb_connection->isc_status, &fb_connection->db, &fb_cursor->stmt);
+		fb_error_check(fb_connection->isc_status);
+	}
+
+	/* Prepare query */
+	fb_isc_dsql_prepare(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, 0, sql, fb_connection_dialect(fb_connection), fb_cursor->o_sqlda);
+	fb_error_check(fb_connection->isc_status);
+
+	/* Get the statement type, kept with the statement (and its cache entry) for every later execute */
+	fb_isc_dsql_sql_info(fb_connection, fb_connection->isc_status, &fb_cursor->stmt,
+			sizeof(isc_info_stmt), isc_info_stmt,
+			sizeof(isc_info_buff), isc_info_buff);
+	fb_error_check(fb_connection->isc_status);
+
+	if (isc_info_buff[0] == isc_info_sql_stmt_type) {
+		length = isc_vax_integer(&isc_info_buff[1], 2);
+		fb_cursor->statement_type = isc_vax_integer(&isc_info_buff[3], (short)length);
+	} else {
+		fb_cursor->statement_type = 0;
+	}
+	/* Describe the parameters */
+	fb_isc_dsql_describe_bind(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->i_sqlda);
+	fb_error_check(fb_connection->isc_status);
+
+	fb_isc_dsql_describe(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->o_sqlda);
+	fb_error_check(fb_connection->isc_status);
+
+	/* Get the number of parameters and reallocate the SQLDA */
+	in_params = fb_cursor->i_sqlda->sqld;
+	if (fb_cursor->i_sqlda->sqln < in_params) {
+		xfree(fb_cursor->i_sqlda);
+		fb_cursor->i_sqlda = sqlda_alloc(in_params);
+		/* Describe again */
+		fb_isc_dsql_describe_bind(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->i_sqlda);
+		fb_error_check(fb_connection->isc_status);
+	}
+
+    /* Get the size of parameters buffer and reallocate it */
+	if (in_params) {
+		length = calculate_buffsize(fb_cursor->i_sqlda);
+		if (length > fb_cursor->i_buffer_size) {
+			fb_cursor->i_buffer = xrealloc(fb_cursor->i_buffer, length);
+			fb_cursor->i_buffer_size = length;
+		}
+		fb_sqlda_bind_buffer(fb_cursor->i_sqlda, fb_cursor->i_buffer);
+	}
+	fb_cursor_compile_binders(fb_cursor);
+
+	/* Get the number of columns and reallocate the SQLDA */
+	cols = fb_cursor->o_sqlda->sqld;
+	if (fb_cursor->o_sqlda->sqln < cols) {
+		xfree(fb_cursor->o_sqlda);
+		fb_cursor->o_sqlda = sqlda_alloc(cols);
+		/* Describe again */
+		fb_isc_dsql_describe(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->o_sqlda);
+		fb_error_check(fb_connection->isc_status);
+	}
+
+	/* Get the size of results buffer, reallocate it and bind the output layout */
+	if (cols) {
+		length = calculate_buffsize(fb_cursor->o_sqlda);
+		if (length > fb_cursor->o_buffer_size) {
+			fb_cursor->o_buffer = xrealloc(fb_cursor->o_buffer, length);
+			fb_cursor->o_buffer_size = length;
+		}
+		fb_sqlda_bind_buffer(fb_cursor->o_sqlda, fb_cursor->o_buffer);
+	}
+}
+
+static VALUE fb_cursor_execute_prepared(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, VALUE args)
+{
+	long statement = fb_cursor->statement_type;
+	long in_params = fb_cursor->i_sqlda->sqld;
+	VALUE result = Qnil;
+
+	/* Cached statements hold metadata locks that would block schema changes. */
+	if (statement == isc_info_sql_stmt_ddl) {
+		fb_stmt_cache_clear(fb_connection);
+	}
+
+#ifdef HAVE_FB_DSQL_SET_TIMEOUT
+	/* Set every time once timeouts are in use: the handle may be cached and reused */
+	if (fb_cursor->timeout > 0 ? fb_connection_server_timeouts(fb_connection) : fb_connection->server_timeouts > 0) {
+		fb_dsql_set_timeout(fb_connection->isc_status, &fb_cursor->stmt, (ISC_ULONG)fb_cursor->timeout);
+		fb_error_check(fb_connection->isc_status);
+	}
+#endif
+
+    /* Execute the SQL statement if it is not query */
+	if (!fb_cursor->o_sqlda->sqld) {
+		if (statement == isc_info_sql_stmt_start_trans) {
+			rb_raise(rb_eFbError, "use Fb::Connection#transaction()");
+		} else if (statement == isc_info_sql_stmt_commit) {
+			rb_raise(rb_eFbError, "use Fb::Connection#commit()");
+		} else if (statement == isc_info_sql_stmt_rollback) {
+			rb_raise(rb_eFbError, "use Fb::Connection#rollback()");
+		} else if (in_params) {
+			fb_cursor_execute_withparams(fb_cursor, RARRAY_LEN(args), RARRAY_PTR(args));
+		} else {
+			fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, NULL, NULL);
+			fb_error_check(fb_connection->isc_status);
+		}
+		result = LONG2NUM(fb_statement_counts_rows(fb_connection, statement) ? cursor_rows_affected(fb_cursor, statement) : -1);
+	} else if (statement == isc_info_sql_stmt_exec_procedure) {
+		/* EXECUTE PROCEDURE and singleton RETURNING: the output row comes back with the execute */
+		if (in_params) {
+			fb_cursor_set_inputparams(fb_cursor, RARRAY_LEN(args), RARRAY_PTR(args));
+		}
+		fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, in_params ? fb_cursor->i_sqlda : NULL, fb_cursor->o_sqlda);
+		fb_error_check(fb_connection->isc_status);
+		fb_cursor_compile_decoders(fb_connection, fb_cursor);
+		if (NIL_P(fb_cursor->fields_ary)) {
+			fb_cursor->fields_ary = fb_cursor_fields_ary(fb_cursor->o_sqlda, fb_connection->downcase_names);
+			fb_cursor->fields_hash = fb_cursor_fields_hash(fb_cursor->fields_ary);
+		}
+		result = fb_cursor_current_row(fb_connection, fb_cursor);
+	} else {
+		/* Open cursor if the SQL statement is query */
+		if (in_params) {
+			fb_cursor_set_inputparams(fb_cursor, RARRAY_LEN(args), RARRAY_PTR(args));
+		}
+
+		/* Open cursor */
+		fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, in_params ? fb_cursor->i_sqlda : NULL, NULL);
+		fb_error_check(fb_connection->isc_status);
+		fb_cursor->open = Qtrue;
+		fb_cursor_compile_decoders(fb_connection, fb_cursor);
+
+		/* Set the description attributes */
+		if (NIL_P(fb_cursor->fields_ary)) {
+			fb_cursor->fields_ary = fb_cursor_fields_ary(fb_cursor->o_sqlda, fb_connection->downcase_names);
+			fb_cursor->fields_hash = fb_cursor_fields_hash(fb_cursor->fields_ary);
+		}
+	}
+	return result;
+}
+
+/* call-seq:
+ *   execute2(sql, *args) -> nil or rows affected
+ *
+ * This function is not published.
+ */
+static VALUE cursor_execute2(VALUE args)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+	char *sql;
+	VALUE rb_sql;
+
+	VALUE self = rb_ary_pop(args);
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+
+	rb_sql = rb_ary_shift(args);
+	sql = StringValuePtr(rb_sql);
+
+	/* Reuse a cached statement or prepare a new one */
+	if (!fb_stmt_cache_checkout(fb_connection, fb_cursor, sql)) {
+		fb_cursor_prepare(fb_connection, fb_cursor, sql);
+		if (fb_connection->stmt_cache_max > 0 && fb_cursor->statement_type != isc_info_sql_stmt_ddl) {
+			fb_cursor->sql = ALLOC_N(char, strlen(sql) + 1);
+			strcpy(fb_cursor->sql, sql);
+		}
+	}
+	return fb_cursor_execute_prepared(fb_connection, fb_cursor, args);
+}
+
+/* Runs +execute2+ on +args+, wrapping it in an automatic transaction if none is active. */
+static VALUE fb_cursor_execute_transact(VALUE self, VALUE args, VALUE (*execute2)(VALUE))
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+
+	rb_ary_push(args, self);
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+
+	if (fb_cursor->open) {
+		fb_isc_dsql_free_statement(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, DSQL_close);
+		fb_error_check(fb_connection->isc_status);
+		fb_cursor->open = Qfalse;
+	}
+
+	if (!fb_connection->transact) {
+		VALUE result;
+		int state;
+
+		fb_connection_transaction_start(fb_connection, Qnil);
+		fb_cursor->auto_transact = fb_connection->transact;
+
+		result = rb_protect(execute2, args, &state);
+		if (state) {
+			fb_connection_rollback(fb_connection);
+			rb_jump_tag(state);
+		} else if (result != Qnil) {
+			fb_connection_commit(fb_connection);
+			return result;
+		} else {
+			return result;
+		}
+	} else {
+		fb_cursor->auto_transact = 0;
+		return execute2(args);
+	}
+}
+
+/* call-seq:
+ *   execute(sql, *args) -> nil or rows affected
+ *
+ * This function is no longer published.
+ */
+static VALUE cursor_execute(int argc, VALUE* argv, VALUE self)
+{
+	if (argc < 1) {
+		rb_raise(rb_eArgError, "At least 1 argument required.");
+	}
+
+	return fb_cursor_execute_transact(self, rb_ary_new4(argc, argv), cursor_execute2);
+}
+
+static int row_format(int argc, VALUE *argv)
+{
+	if (argc == 0 || argv[0] == ID2SYM(rb_intern("array"))) {
+		return ROW_ARRAY;
+	} else if (argv[0] == ID2SYM(rb_intern("hash"))) {
+		return ROW_HASH;
+	} else if (argv[0] == ID2SYM(rb_intern("symbol_hash"))) {
+		return ROW_SYMBOL_HASH;
+	} else if (argv[0] == ID2SYM(rb_intern("struct"))) {
+		return ROW_STRUCT;
+	} else if (argv[0] == ID2SYM(rb_intern("row"))) {
+		return ROW_LAZY;
+	} else {
+		rb_raise(rb_eFbError, "Unknown format");
+	}
+}
+
+/* Drops the row keys and Struct class when the cursor has moved on to another result shape. */
+static void fb_cursor_row_shape(struct FbCursor *fb_cursor)
+{
+	if (fb_cursor->row_fields != fb_cursor->fields_ary) {
+		fb_cursor->row_fields = fb_cursor->fields_ary;
+		fb_cursor->row_keys = Qnil;
+		fb_cursor->row_symbols = Qnil;
+		fb_cursor->row_struct = Qnil;
+		fb_cursor->row_layout = Qnil;
+	}
+}
+
+/* Column names as interned frozen Strings, or as Symbols, extracted once per result set. */
+static VALUE fb_cursor_row_keys(struct FbCursor *fb_cursor, int format)
+{
+	VALUE keys, name;
+	long i, cols;
+
+	fb_cursor_row_shape(fb_cursor);
+	keys = format == ROW_HASH ? fb_cursor->row_keys : fb_cursor->row_symbols;
+	if (NIL_P(keys)) {
+		cols = RARRAY_LEN(fb_cursor->fields_ary);
+		keys = rb_ary_new2(cols);
+		for (i = 0; i < cols; i++) {
+			name = rb_struct_aref(RARRAY_PTR(fb_cursor->fields_ary)[i], INT2FIX(0));
+			if (format == ROW_HASH) {
+				rb_ary_push(keys, rb_respond_to(name, rb_intern("-@")) ? rb_funcall(name, rb_intern("-@"), 0) : name);
+			} else {
+				rb_ary_push(keys, rb_str_intern(name));
+			}
+		}
+		rb_ary_freeze(keys);
+		if (format == ROW_HASH) {
+			fb_cursor->row_keys = keys;
+		} else {
+			fb_cursor->row_symbols = keys;
+		}
+	}
+	return keys;
+}
+
+/* Struct members for the column names, a repeated name (as a join gives) suffixed _2, _3, ... */
+static VALUE fb_row_struct_members(VALUE names)
+{
+	VALUE members, seen, name;
+	long i, n, cols = RARRAY_LEN(names);
+
+	members = rb_ary_new2(cols);
+	seen = rb_hash_new();
+	for (i = 0; i < cols; i++) {
+		rb_hash_aset(seen, RARRAY_PTR(names)[i], Qtrue);
+	}
+	for (i = 0; i < cols; i++) {
+		name = RARRAY_PTR(names)[i];
+		if (rb_ary_includes(members, name)) {
+			n = 2;
+			do {
+				name = rb_str_new2(rb_id2name(SYM2ID(RARRAY_PTR(names)[i])));
+				rb_str_catf(name, "_%ld", n++);
+				name = rb_str_intern(name);
+			} while (RTEST(rb_hash_aref(seen, name)));
+			rb_hash_aset(seen, name, Qtrue);
+		}
+		rb_ary_push(members, name);
+	}
+	return members;
+}
+
+/* One Struct class per result shape, shared by all cursors of the connection. */
+static VALUE fb_cursor_row_struct(struct FbCursor *fb_cursor)
+{
+	struct FbConnection *fb_connection;
+	VALUE names, members, klass;
+
+	fb_cursor_row_shape(fb_cursor);
+	if (NIL_P(fb_cursor->row_struct)) {
+		names = fb_cursor_row_keys(fb_cursor, ROW_SYMBOL_HASH);
+		Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+		/* Reinserted on every use, so the Hash's first entry is the least recently used */
+		klass = rb_hash_delete(fb_connection->row_structs, names);
+		if (NIL_P(klass)) {
+			members = fb_row_struct_members(names);
+			klass = rb_funcall2(rb_cStruct, rb_intern("new"), (int)RARRAY_LEN(members), RARRAY_PTR(members));
+			if (RHASH_SIZE(fb_connection->row_structs) >= ROW_STRUCTS_MAX) {
+				rb_funcall(fb_connection->row_structs, rb_intern("shift"), 0);
+			}
+		}
+		rb_hash_aset(fb_connection->row_structs, names, klass);
+		fb_cursor->row_struct = klass;
+	}
+	return fb_cursor->row_struct;
+}
+
+static VALUE fb_hash_from_keys(VALUE keys, VALUE row)
+{
+	long i, cols = RARRAY_LEN(keys);
+	VALUE hash = rb_hash_new();
+#ifdef HAVE_RB_HASH_BULK_INSERT
+	VALUE *pairs = ALLOCA_N(VALUE, cols * 2);
+	for (i = 0; i < cols; i++) {
+		pairs[i * 2] = RARRAY_PTR(keys)[i];
+		pairs[i * 2 + 1] = RARRAY_PTR(row)[i];
+	}
+	rb_hash_bulk_insert(cols * 2, pairs, hash);
+#else
+	for (i = 0; i < cols; i++) {
+		rb_hash_aset(hash, RARRAY_PTR(keys)[i], RARRAY_PTR(row)[i]);
+	}
+#endif
+	return hash;
+}
+
+/* Converts a decoded row Array into the requested row format. */
+static VALUE fb_cursor_format_row(struct FbCursor *fb_cursor, VALUE row, int format)
+{
+	if (NIL_P(row)) return row;
+	switch (format) {
+		case ROW_HASH:
+		case ROW_SYMBOL_HASH:
+			return fb_hash_from_keys(fb_cursor_row_keys(fb_cursor, format), row);
+		case ROW_STRUCT:
+			return rb_class_new_instance((int)RARRAY_LEN(row), RARRAY_PTR(row), fb_cursor_row_struct(fb_cursor));
+	}
+	return row;
+}
+
+/* Output layout of a result set, kept for the Fb::Row objects that outlive its cursor */
+struct FbRowLayout {
+	long cols;
+	long buffer_size;
+	XSQLVAR *vars;
+	long *offsets;	/* sqldata and sqlind of each column, relative to the row buffer */
+	struct FbDecoder *decoders;
+	VALUE keys;
+	VALUE index;	/* column name => position */
+};
+
+/* Raw output buffer of one row, decoded column by column on access */
+struct FbRow {
+	VALUE layout;
+	VALUE connection;
+	long cols;
+	char *buffer;
+	VALUE *values;	/* Qundef until decoded */
+};
+
+static void fb_row_layout_mark(struct FbRowLayout *fb_row_layout)
+{
+	rb_gc_mark(fb_row_layout->keys);
+	rb_gc_mark(fb_row_layout->index);
+}
+
+static void fb_row_layout_free(struct FbRowLayout *fb_row_layout)
+{
+	xfree(fb_row_layout->vars);
+	xfree(fb_row_layout->offsets);
+	xfree(fb_row_layout->decoders);
+	xfree(fb_row_layout);
+}
+
+static VALUE fb_cursor_row_layout(struct FbCursor *fb_cursor)
+{
+	struct FbRowLayout *fb_row_layout;
+	VALUE layout;
+	XSQLVAR *var;
+	long count, end;
+
+	fb_cursor_row_shape(fb_cursor);
+	if (NIL_P(fb_cursor->row_layout)) {
+		layout = Data_Make_Struct(0, struct FbRowLayout, fb_row_layout_mark, fb_row_layout_free, fb_row_layout);
+		fb_row_layout->keys = Qnil;
+		fb_row_layout->index = Qnil;
+		fb_row_layout->cols = fb_cursor->o_sqlda->sqld;
+		fb_row_layout->vars = ALLOC_N(XSQLVAR, fb_row_layout->cols);
+		fb_row_layout->offsets = ALLOC_N(long, fb_row_layout->cols * 2);
+		fb_row_layout->decoders = ALLOC_N(struct FbDecoder, fb_row_layout->cols);
+		fb_row_layout->buffer_size = 0;
+		MEMCPY(fb_row_layout->vars, fb_cursor->o_sqlda->sqlvar, XSQLVAR, fb_row_layout->cols);
+		MEMCPY(fb_row_layout->decoders, fb_cursor->decoders, struct FbDecoder, fb_row_layout->cols);
+		for (count = 0; count < fb_row_layout->cols; count++) {
+			var = &fb_cursor->o_sqlda->sqlvar[count];
+			fb_row_layout->offsets[count * 2] = var->sqldata - fb_cursor->o_buffer;
+			fb_row_layout->offsets[count * 2 + 1] = (char*)var->sqlind - fb_cursor->o_buffer;
+			end = fb_row_layout->offsets[count * 2 + 1] + sizeof(short);
+			if (end > fb_row_layout->buffer_size) fb_row_layout->buffer_size = end;
+		}
+		fb_row_layout->keys = fb_cursor_row_keys(fb_cursor, ROW_HASH);
+		fb_row_layout->index = rb_hash_new();
+		for (count = 0; count < fb_row_layout->cols; count++) {
+			rb_hash_aset(fb_row_layout->index, RARRAY_PTR(fb_row_layout->keys)[count], LONG2FIX(count));
+		}
+		fb_cursor->row_layout = layout;
+	}
+	return fb_cursor->row_layout;
+}
+
+static void fb_row_mark(struct FbRow *fb_row)
+{
+	long i;
+
+	rb_gc_mark(fb_row->layout);
+	rb_gc_mark(fb_row->connection);
+	for (i = 0; i < fb_row->cols; i++) {
+		rb_gc_mark(fb_row->values[i]);
+	}
+}
+
+static void fb_row_free(struct FbRow *fb_row)
+{
+	xfree(fb_row->buffer);
+	xfree(fb_row->values);
+	xfree(fb_row);
+}
+
+/* Copies the row held in the output buffer into a lazily decoded Fb::Row. */
+static VALUE fb_cursor_current_lazy(struct FbCursor *fb_cursor)
+{
+	struct FbRowLayout *fb_row_layout;
+	struct FbRow *fb_row;
+	VALUE layout, row;
+	long i;
+
+	layout = fb_cursor_row_layout(fb_cursor);
+	Data_Get_Struct(layout, struct FbRowLayout, fb_row_layout);
+	row = Data_Make_Struct(rb_cFbRow, struct FbRow, fb_row_mark, fb_row_free, fb_row);
+	fb_row->layout = layout;
+	fb_row->connection = fb_cursor->connection;
+	fb_row->cols = 0;
+	fb_row->values = ALLOC_N(VALUE, fb_row_layout->cols);
+	for (i = 0; i < fb_row_layout->cols; i++) {
+		fb_row->values[i] = Qundef;
+	}
+	fb_row->cols = fb_row_layout->cols;
+	fb_row->buffer = ALLOC_N(char, fb_row_layout->buffer_size > 0 ? fb_row_layout->buffer_size : 1);
+	memcpy(fb_row->buffer, fb_cursor->o_buffer, fb_row_layout->buffer_size);
+	return row;
+}
+
+static VALUE fb_cursor_fetch_lazy(struct FbCursor *fb_cursor)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+
+	if (!fb_cursor_fetch_row(fb_connection, fb_cursor)) {
+		return Qnil;
+	}
+	return fb_cursor_current_lazy(fb_cursor);
+}
+
+static VALUE fb_cursor_fetch_as(struct FbCursor *fb_cursor, int format)
+{
+	if (format == ROW_LAZY) {
+		return fb_cursor_fetch_lazy(fb_cursor);
+	}
+	return fb_cursor_format_row(fb_cursor, fb_cursor_fetch(fb_cursor), format);
+}
+
+/* Returns the output +row+ of an EXECUTE PROCEDURE or RETURNING statement as a one-row result set in +format+. */
+static VALUE fb_cursor_singleton_rows(VALUE cursor, VALUE row, VALUE format)
+{
+	struct FbCursor *fb_cursor;
+	int row_fmt = row_format(1, &format);
+
+	Data_Get_Struct(cursor, struct FbCursor, fb_cursor);
+	row = row_fmt == ROW_LAZY ? fb_cursor_current_lazy(fb_cursor) : fb_cursor_format_row(fb_cursor, row, row_fmt);
+	return rb_ary_new3(1, row);
+}
+
+static VALUE fb_row_value(struct FbRow *fb_row, long i)
+{
+	struct FbRowLayout *fb_row_layout;
+	struct FbConnection *fb_connection;
+	XSQLVAR var;
+
+	if (fb_row->values[i] == Qundef) {
+		Data_Get_Struct(fb_row->layout, struct FbRowLayout, fb_row_layout);
+		Data_Get_Struct(fb_row->connection, struct FbConnection, fb_connection);
+		var = fb_row_layout->vars[i];
+		var.sqldata = fb_row->buffer + fb_row_layout->offsets[i * 2];
+		var.sqlind = (short*)(fb_row->buffer + fb_row_layout->offsets[i * 2 + 1]);
+		fb_row->values[i] = fb_cursor_column_value(fb_connection, &var, &fb_row_layout->decoders[i]);
+	}
+	return fb_row->values[i];
+}
+
+/* call-seq:
+ *   [](index) -> value
+ *   [](name) -> value
+ *
+ * Returns the value of the column at +index+, or of the column named +name+ (a String
+ * or Symbol), decoding it on first access.  Returns nil for unknown columns.
+ * BLOB columns are read from the database when first accessed, which requires the
+ * transaction the row was fetched in to be still active.
+ */
+static VALUE row_aref(VALUE self, VALUE key)
+{
+	struct FbRow *fb_row;
+	struct FbRowLayout *fb_row_layout;
+	VALUE pos;
+	long i;
+
+	Data_Get_Struct(self, struct FbRow, fb_row);
+	if (FIXNUM_P(key)) {
+		i = FIX2LONG(key);
+		if (i < 0) i += fb_row->cols;
+	} else {
+		Data_Get_Struct(fb_row->layout, struct FbRowLayout, fb_row_layout);
+		if (SYMBOL_P(key)) {
+			key = rb_id2str(SYM2ID(key));
+		}
+		pos = rb_hash_aref(fb_row_layout->index, key);
+		if (NIL_P(pos)) return Qnil;
+		i = FIX2LONG(pos);
+	}
+	if (i < 0 || i >= fb_row->cols) return Qnil;
+	return fb_row_value(fb_row, i);
+}
+
+/* call-seq:
+ *   size() -> int
+ *
+ * Returns the number of columns in the row.
+ */
+static VALUE row_size(VALUE self)
+{
+	struct FbRow *fb_row;
+
+	Data_Get_Struct(self, struct FbRow, fb_row);
+	return LONG2NUM(fb_row->cols);
+}
+
+/* call-seq:
+ *   keys() -> Array
+ *
+ * Returns the column names or aliases of the row, as frozen Strings.
+ */
+static VALUE row_keys(VALUE self)
+{
+	struct FbRow *fb_row;
+	struct FbRowLayout *fb_row_layout;
+
+	Data_Get_Struct(self, struct FbRow, fb_row);
+	Data_Get_Struct(fb_row->layout, struct FbRowLayout, fb_row_layout);
+	return fb_row_layout->keys;
+}
+
+/* call-seq:
+ *   to_a() -> Array
+ *
+ * Decodes every column and returns the values as an Array.
+ */
+static VALUE row_to_a(VALUE self)
+{
+	struct FbRow *fb_row;
+	VALUE ary;
+	long i;
+
+	Data_Get_Struct(self, struct FbRow, fb_row);
+	ary = rb_ary_new2(fb_row->cols);
+	for (i = 0; i < fb_row->cols; i++) {
+		rb_ary_push(ary, fb_row_value(fb_row, i));
+	}
+	return ary;
+}
+
+/* call-seq:
+ *   to_h() -> Hash
+ *
+ * Decodes every column and returns the values in a Hash keyed by column name.
+ */
+static VALUE row_to_h(VALUE self)
+{
+	return fb_hash_from_keys(row_keys(self), row_to_a(self));
+}
+
+/* Whether the transaction that fetched the blob is still the connection's current one */
+static int fb_blob_live(struct FbConnection *fb_connection, struct FbBlob *fb_blob)
+{
+	return fb_connection->transact && fb_connection->transactions == fb_blob->transaction;
+}
+
+static struct FbBlob *fb_blob_open(VALUE self, struct FbConnection **fb_connection)
+{
+	struct FbBlob *fb_blob;
+
+	Data_Get_Struct(self, struct FbBlob, fb_blob);
+	Data_Get_Struct(fb_blob->connection, struct FbConnection, *fb_connection);
+	fb_connection_check(*fb_connection);
+	if (!fb_blob_live(*fb_connection, fb_blob)) {
+		fb_blob->handle = 0;	/* ended with its transaction */
+		rb_raise(rb_eFbError, "blob read after the transaction that fetched it ended; read :stream blobs within Connection#transaction");
+	}
+	if (!fb_blob->handle) {
+		fb_isc_open_blob2(*fb_connection, (*fb_connection)->isc_status, &(*fb_connection)->db, &(*fb_connection)->transact, &fb_blob->handle, &fb_blob->blob_id, 0, NULL);
+		fb_error_check((*fb_connection)->isc_status);
+		fb_blob->pos = 0;
+		fb_blob->eof = 0;
+		fb_blob_info(*fb_connection, &fb_blob->handle, &fb_blob->info);
+	}
+	return fb_blob;
+}
+
+/* Reads up to len bytes into dst, one isc_get_segment call per at most 64KB.  Returns the bytes read. */
+static long fb_blob_read_into(struct FbConnection *fb_connection, struct FbBlob *fb_blob, char *dst, long len)
+{
+	long total = 0;
+	long want;
+	unsigned short actual;
+
+	while (total < len && !fb_blob->eof) {
+		want = len - total;
+		if (want > USHRT_MAX) want = USHRT_MAX;
+		actual = 0;
+		fb_isc_get_segment(fb_connection, fb_connection->isc_status, &fb_blob->handle, &actual, (unsigned short)want, dst + total);
+		if (fb_connection->isc_status[1] == isc_segstr_eof) {
+			fb_blob->eof = 1;
+			break;
+		}
+		if (fb_connection->isc_status[1] != isc_segment) {
+			fb_error_check(fb_connection->isc_status);
+		}
+		total += actual;
+	}
+	fb_blob->pos += total;
+	return total;
+}
+
+/* call-seq:
+ *   read() -> String
+ *   read(length, outbuf = nil) -> String or nil
+ *
+ * Reads +length+ bytes from the current position, or the rest of the blob when
+ * +length+ is omitted.  Like IO#read, returns nil at the end of the blob when a
+ * length is given, and an empty String when it is not.  When +outbuf+ is given
+ * the bytes replace its contents and it is returned, sparing an allocation per read.
+ */
+static VALUE blob_read(int argc, VALUE *argv, VALUE self)
+{
+	struct FbConnection *fb_connection;
+	struct FbBlob *fb_blob;
+	VALUE length, str, outbuf;
+	long len, got;
+
+	rb_scan_args(argc, argv, "02", &length, &outbuf);
+	fb_blob = fb_blob_open(self, &fb_connection);
+	if (NIL_P(length)) {
+		len = fb_blob->info.total_length - fb_blob->pos;
+		if (len < 0) len = 0;
+	} else {
+		len = NUM2LONG(length);
+		if (len < 0) {
+			rb_raise(rb_eArgError, "negative length %ld given", len);
+		}
+	}
+	if (NIL_P(outbuf)) {
+		str = rb_tainted_str_new(NULL, len);
+	} else {
+		str = outbuf;
+		StringValue(str);
+		rb_str_modify(str);
+		rb_str_resize(str, len);
+	}
+	got = fb_blob_read_into(fb_connection, fb_blob, RSTRING_PTR(str), len);
+	if (got == 0 && len > 0 && !NIL_P(length)) {
+		if (!NIL_P(outbuf)) rb_str_resize(str, 0);
+		return Qnil;
+	}
+	rb_str_resize(str, got);
+	return str;
+}
+
+/* call-seq:
+ *   each_chunk(size = 65535) {|String| } -> self
+ *
+ * Reads the rest of the blob in chunks of up to +size+ bytes, passing each to the block.
+ * Only one chunk is held at a time, whatever the size of the blob.
+ */
+static VALUE blob_each_chunk(int argc, VALUE *argv, VALUE self)
+{
+	struct FbConnection *fb_connection;
+	struct FbBlob *fb_blob;
+	VALUE size, chunk;
+	long len, got;
+
+	rb_scan_args(argc, argv, "01", &size);
+	len = NIL_P(size) ? USHRT_MAX : NUM2LONG(size);
+	if (len < 1) {
+		rb_raise(rb_eArgError, "chunk size must be positive");
+	}
+	for (;;) {
+		fb_blob = fb_blob_open(self, &fb_connection);
+		chunk = rb_tainted_str_new(NULL, len);
+		got = fb_blob_read_into(fb_connection, fb_blob, RSTRING_PTR(chunk), len);
+		if (got == 0) break;
+		rb_str_resize(chunk, got);
+		rb_yield(chunk);
+	}
+	return self;
+}
+
+/* call-seq:
+ *   size() -> int
+ *
+ * Returns the length of the blob in bytes.
+ */
+static VALUE blob_size(VALUE self)
+{
+	struct FbConnection *fb_connection;
+	struct FbBlob *fb_blob = fb_blob_open(self, &fb_connection);
+	return LONG2NUM(fb_blob->info.total_length);
+}
+
+/* call-seq:
+ *   pos() -> int
+ *
+ * Returns the current read position.
+ */
+static VALUE blob_pos(VALUE self)
+{
+	struct FbBlob *fb_blob;
+
+	Data_Get_Struct(self, struct FbBlob, fb_blob);
+	return LONG2NUM(fb_blob->pos);
+}
+
+/* call-seq:
+ *   close() -> nil
+ *
+ * Closes the blob handle.  The blob is reopened from the start if read again.
+ */
+static VALUE blob_close(VALUE self)
+{
+	struct FbBlob *fb_blob;
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbBlob, fb_blob);
+	Data_Get_Struct(fb_blob->connection, struct FbConnection, fb_connection);
+	if (fb_blob->handle && !fb_blob_live(fb_connection, fb_blob)) {
+		fb_blob->handle = 0;	/* ended with its transaction */
+	}
+	if (fb_blob->handle) {
+		fb_isc_close_blob(fb_connection, fb_connection->isc_status, &fb_blob->handle);
+		fb_blob->handle = 0;
+		fb_error_check(fb_connection->isc_status);
+	}
+	fb_blob->pos = 0;
+	fb_blob->eof = 0;
+	return Qnil;
+}
+
+/* call-seq:
+ *   rewind() -> 0
+ *
+ * Moves back to the start of the blob.
+ */
+static VALUE blob_rewind(VALUE self)
+{
+	blob_close(self);
+	return INT2FIX(0);
+}
+
+/* call-seq:
+ *   seek(offset, whence = IO::SEEK_SET) -> 0
+ *
+ * Moves the read position of a stream blob.  Segmented blobs can only be read
+ * sequentially and rewound.
+ */
+static VALUE blob_seek(int argc, VALUE *argv, VALUE self)
+{
+	struct FbConnection *fb_connection;
+	struct FbBlob *fb_blob;
+	VALUE offset, whence;
+	ISC_LONG result;
+
+	rb_scan_args(argc, argv, "11", &offset, &whence);
+	fb_blob = fb_blob_open(self, &fb_connection);
+	if (fb_blob->info.type != isc_bpb_type_stream) {
+		rb_raise(rb_eFbError, "seek is only supported on stream blobs");
+	}
+	fb_isc_seek_blob(fb_connection, fb_connection->isc_status, &fb_blob->handle, (short)(NIL_P(whence) ? SEEK_SET : NUM2INT(whence)), (ISC_LONG)NUM2LONG(offset), &result);
+	fb_error_check(fb_connection->isc_status);
+	fb_blob->pos = result;
+	fb_blob->eof = 0;
+	return INT2FIX(0);
+}
+
+/* Fb::BlobWriter: the open blob yielded by Connection#create_blob */
+struct FbBlobWriter {
+	VALUE connection;
+	isc_blob_handle handle;
+	char *buffer;	/* coalesces small writes into full segments */
+	long length;
+	long segment_size;
+};
+
+static void fb_blob_writer_mark(struct FbBlobWriter *fb_blob_writer)
+{
+	rb_gc_mark(fb_blob_writer->connection);
+}
+
+static void fb_blob_writer_free(struct FbBlobWriter *fb_blob_writer)
+{
+	xfree(fb_blob_writer->buffer);
+	xfree(fb_blob_writer);
+}
+
+static struct FbBlobWriter *fb_blob_writer_check(VALUE self, struct FbConnection **fb_connection)
+{
+	struct FbBlobWriter *fb_blob_writer;
+
+	Data_Get_Struct(self, struct FbBlobWriter, fb_blob_writer);
+	if (!fb_blob_writer->handle) {
+		rb_raise(rb_eFbError, "closed blob writer");
+	}
+	Data_Get_Struct(fb_blob_writer->connection, struct FbConnection, *fb_connection);
+	fb_connection_check(*fb_connection);
+	return fb_blob_writer;
+}
+
+static void fb_blob_writer_flush(struct FbConnection *fb_connection, struct FbBlobWriter *fb_blob_writer)
+{
+	if (fb_blob_writer->length > 0) {
+		fb_blob_put(fb_connection, &fb_blob_writer->handle, fb_blob_writer->buffer, fb_blob_writer->length, fb_blob_writer->segment_size);
+		fb_blob_writer->length = 0;
+	}
+}
+
+/* call-seq:
+ *   write(data) -> int
+ *
+ * Appends +data+ to the blob and returns the number of bytes written.
+ * Writes smaller than the segment size are gathered into full segments.
+ */
+static VALUE blob_writer_write(VALUE self, VALUE data)
+{
+	struct FbConnection *fb_connection;
+	struct FbBlobWriter *fb_blob_writer = fb_blob_writer_check(self, &fb_connection);
+	const char *p;
+	long length, total, n;
+
+	data = rb_obj_as_string(data);
+	p = RSTRING_PTR(data);
+	length = total = RSTRING_LEN(data);
+
+	/* Top up a partly filled segment first */
+	if (fb_blob_writer->length > 0) {
+		n = fb_blob_writer->segment_size - fb_blob_writer->length;
+		if (n > length) n = length;
+		memcpy(fb_blob_writer->buffer + fb_blob_writer->length, p, n);
+		fb_blob_writer->length += n;
+		p += n;
+		length -= n;
+		if (fb_blob_writer->length == fb_blob_writer->segment_size) {
+			fb_blob_writer_flush(fb_connection, fb_blob_writer);
+		}
+	}
+	/* Whole segments go straight to the blob, the remainder waits in the buffer */
+	n = length / fb_blob_writer->segment_size * fb_blob_writer->segment_size;
+	fb_blob_put(fb_connection, &fb_blob_writer->handle, p, n, fb_blob_writer->segment_size);
+	p += n;
+	length -= n;
+	memcpy(fb_blob_writer->buffer + fb_blob_writer->length, p, length);
+	fb_blob_writer->length += length;
+	return LONG2NUM(total);
+}
+
+/* call-seq:
+ *   <<(data) -> self
+ *
+ * Appends +data+ to the blob.
+ */
+static VALUE blob_writer_append(VALUE self, VALUE data)
+{
+	blob_writer_write(self, data);
+	return self;
+}
+
+static VALUE fb_blob_writer_yield(VALUE writer)
+{
+	return rb_yield(writer);
+}
+
+static VALUE fb_blob_writer_finish(VALUE writer)
+{
+	struct FbConnection *fb_connection;
+	struct FbBlobWriter *fb_blob_writer = fb_blob_writer_check(writer, &fb_connection);
+
+	fb_blob_writer_flush(fb_connection, fb_blob_writer);
+	return Qnil;
+}
+
+/* call-seq:
+ *   fetch() -> Array
+ *   fetch(:array) -> Array
+ *   fetch(:hash) -> Hash
+ *   fetch(:symbol_hash) -> Hash
+ *   fetch(:struct) -> Struct
+ *   fetch(:row) -> Fb::Row
+ *
+ * Reads and returns a single row from the open cursor in either an Array or a Hash,
+ * where the column names or aliases from the query form the keys.
+ * If the +downcase_names+ attribute of the associated connection evaluates to true,
+ * the keys are lower case, except where the column name was mixed case to begin with.
+ *
+ * <tt>:symbol_hash</tt> keys the Hash by Symbols instead of Strings.  <tt>:struct</tt> returns
+ * an instance of a Struct class with one member per column; the connection defines
+ * one such class per distinct list of column names and reuses it.
+ * <tt>:row</tt> returns an Fb::Row, which keeps a copy of the row's raw bytes and decodes
+ * each column only when it is read, so BLOB columns that are never read are never fetched.
+ * These formats are accepted wherever a row format is, e.g. by fetchall, each and query.
+ */
+static VALUE cursor_fetch(int argc, VALUE* argv, VALUE self)
+{
+	struct FbCursor *fb_cursor;
+
+	int format = row_format(argc, argv);
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor_fetch_prep(fb_cursor);
+
+	return fb_cursor_fetch_as(fb_cursor, format);
+}
+
+/* call-seq:
+ *   fetchall() -> Array of Arrays
+ *   fetchall(:array) -> Array of Arrays
+ *   fetchall(:hash) -> Array of Hashes
+ *   fetchall(:struct) -> Array of Structs
+ *
+ * Returns the remainder of the rows from the open cursor, with each row represented
+ * by either an Array or a Hash, where the column names or aliases from the query form the keys.
+ * If the +downcase_names+ attribute of the associated connection evaluates to true,
+ * the keys are lower case, except where the column name was mixed case to begin with.
+ */
+static VALUE cursor_fetchall(int argc, VALUE* argv, VALUE self)
+{
+	VALUE ary, row;
+	struct FbCursor *fb_cursor;
+
+	int format = row_format(argc, argv);
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor_fetch_prep(fb_cursor);
+
+	ary = rb_ary_new();
+	for (;;) {
+		row = fb_cursor_fetch_as(fb_cursor, format);
+		if (NIL_P(row)) break;
+		rb_ary_push(ary, row);
+	}
 
-				if (resv_p && !strcmp(resv_p, RESV_READ)) {
-					rw_prm = isc_tpb_lock_read;
-				} else if (resv_p && !strcmp(resv_p, RESV_WRITE)) {
-					rw_prm = isc_tpb_lock_write;
-				} else {
-					desc = "RESERVING needs {SHARED|PROTECTED} {READ|WRITE}";
-					goto error;
-				}
+	return ary;
+}
 
-				ofs = res_first;
-				for (count = 0; count < res_count; count++) {
-					tpb[ofs++] = rw_prm;
-					ofs += tpb[ofs] + 1;
-					tpb[ofs++] = sp_prm;
-				}
+static VALUE fb_cursor_fetch_many(struct FbCursor *fb_cursor, long n, int format)
+{
+	VALUE ary, row;
+	long i;
 
-				if (cont_f == 1) {
-					resv_p = strtok(0, CMND_DELIMIT);
-					if (!resv_p) {
-						desc = "Unexpected end of command";
-						goto error;
-					}
-				}
-				if (cont_f == 2) {
-					resv_p = tblend_p + 1;
-				} else {
-					resv_p = strtok(0, CMND_DELIMIT);
-					if (resv_p) {
-						if ((int)strlen(resv_p) == 1 && resv_p[0] == RESV_CONTINUE) {
-							resv_p = strtok(0, CMND_DELIMIT);
-							if (!resv_p) {
-								desc = "Unexpected end of command";
-								goto error;
-							}
-						} else if (resv_p[0] == RESV_CONTINUE) {
-							resv_p++;
-						} else {
-							next_c = 1;
-							check2_p = resv_p;
-							resv_p = 0;
-						}
-					} else {
-						next_c = 0;
-						check1_p = check2_p = 0;
-					}
-				}
-			}
+	/* n may be far more than the rows left: let the Array grow past the first 1024 */
+	ary = rb_ary_new2(n < 1024 ? n : 1024);
+	for (i = 0; i < n && !fb_cursor->eof; i++) {
+		row = fb_cursor_fetch_as(fb_cursor, format);
+		if (NIL_P(row)) break;
+		rb_ary_push(ary, row);
+	}
+	return ary;
+}
 
-			check_f[0] = 1;
-		}
+static long batch_size(VALUE n)
+{
+	long size = NUM2LONG(n);
+	if (size < 1) {
+		rb_raise(rb_eArgError, "batch size must be positive");
+	}
+	return size;
+}
+
+/* call-seq:
+ *   fetch_many(n) -> Array of Arrays
+ *   fetch_many(n, :array) -> Array of Arrays
+ *   fetch_many(n, :hash) -> Array of Hashes
+ *
+ * Reads up to +n+ rows from the open cursor in a single call, with each row represented
+ * by either an Array or a Hash, where the column names or aliases from the query form the keys.
+ * Returns an empty Array once the cursor is past the end of data.
+ */
+static VALUE cursor_fetch_many(int argc, VALUE* argv, VALUE self)
+{
+	struct FbCursor *fb_cursor;
+	long n;
+	int format;
 
+	if (argc < 1) {
+		rb_raise(rb_eArgError, "At least 1 argument required.");
+	}
+	n = batch_size(argv[0]);
+	format = row_format(argc - 1, argv + 1);
 
-		/* Set the next check list */
-		curr_p = target_p->sub_opts;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor_fetch_prep(fb_cursor);
 
-		for (count = 0; count < next_c; count++) {
-			check1_p = check2_p;
-			if (check2_p) {
-				check2_p = strtok(0, CMND_DELIMIT);
-			}
-		}
+	return fb_cursor_fetch_many(fb_cursor, n, format);
+}
 
-		if (check1_p && !curr_p) {
-			curr_p = trans_opt_S;
-		}
+/* call-seq:
+ *   each_batch(n) {|rows| } -> nil
+ *   each_batch(n, :array) {|rows| } -> nil
+ *   each_batch(n, :hash) {|rows| } -> nil
+ *
+ * Iterates the rows from the open cursor in batches of up to +n+, passing each batch
+ * to the block as an Array of Arrays or Hashes.  Memory use is bounded by the batch size.
+ */
+static VALUE cursor_each_batch(int argc, VALUE* argv, VALUE self)
+{
+	VALUE rows;
+	struct FbCursor *fb_cursor;
+	long n;
+	int format;
+
+	if (argc < 1) {
+		rb_raise(rb_eArgError, "At least 1 argument required.");
 	}
+	n = batch_size(argv[0]);
+	format = row_format(argc - 1, argv + 1);
 
-	/* Set the results */
-	*tpb_len = used;
-	return tpb;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor_fetch_prep(fb_cursor);
 
-error:
-	xfree(tpb);
-	rb_raise(rb_eFbError, "%s", desc);
+	for (;;) {
+		rows = fb_cursor_fetch_many(fb_cursor, n, format);
+		if (RARRAY_LEN(rows) == 0) break;
+		rb_yield(rows);
+	}
+
+	return Qnil;
 }
 
-/*
-static void set_teb_vec(ISC_TEB *vec, struct FbConnection *fb_connection, char *tpb, int len)
+/* Returns the String#unpack directive for columns that can be returned packed, or NULL. */
+static const char* packed_directive(XSQLVAR *var)
 {
-	vec->dbb_ptr = &fb_connection->db;
-	if (tpb) {
-		vec->tpb_ptr = tpb;
-		vec->tpb_len = len;
-	} else {
-		vec->tpb_ptr = 0;
-		vec->tpb_len = 0;
+	switch (var->sqltype & ~1) {
+		case SQL_SHORT:		return "s";
+		case SQL_LONG:		return "l";
+		case SQL_FLOAT:		return "f";
+		case SQL_DOUBLE:	return "d";
+#if HAVE_LONG_LONG
+		case SQL_INT64:		return "q";
+#endif
 	}
+	return NULL;
 }
-*/
 
-/*
-static void global_transaction_start(VALUE opt, int argc, VALUE *argv)
+/* call-seq:
+ *   fetch_columns(limit = nil) -> Array
+ *   fetch_columns(limit, :format => :hash) -> Hash
+ *   fetch_columns(limit, :packed => true) -> Array
+ *
+ * Reads up to +limit+ rows (all remaining rows when +limit+ is nil) from the open cursor
+ * and returns them column by column: an Array with one vector per column, or with
+ * <tt>:format => :hash</tt> a Hash of vectors keyed by column name.
+ *
+ * Each vector is an Array of values.  With <tt>:packed => true</tt>, SMALLINT, INTEGER,
+ * BIGINT, FLOAT and DOUBLE PRECISION columns are instead returned as an FbPackedColumn
+ * holding the raw native-endian values in a binary String (+data+, to be read with
+ * <tt>data.unpack(directive)</tt>), a null bitmap String (+nulls+, bit i set when row i is NULL,
+ * least significant bit first), the row +count+ and the column +scale+.  NULL values are
+ * stored as zero in +data+.  Packed columns allocate no per-row objects.
+ */
+static VALUE cursor_fetch_columns(int argc, VALUE* argv, VALUE self)
 {
-	ISC_STATUS isc_status[20];
+	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
-	ISC_TEB *teb_vec = ALLOCA_N(ISC_TEB, connection_count);
-	ISC_TEB *vec = teb_vec;
-	char *tpb = 0;
-	short n;
-	int tpb_len;
+	VALUE limit, opts, format, vectors;
+	const char **directives;
+	int col_format, packed;
+	long max_rows, rows, cols, count;
+	XSQLVAR *var;
 
-	if (global_transact) {
-		rb_raise(rb_eFbError, "The transaction has been already started");
+	rb_scan_args(argc, argv, "02", &limit, &opts);
+	max_rows = NIL_P(limit) ? -1 : NUM2LONG(limit);
+	format = Qnil;
+	packed = 0;
+	if (!NIL_P(opts)) {
+		Check_Type(opts, T_HASH);
+		format = rb_hash_aref(opts, ID2SYM(rb_intern("format")));
+		packed = RTEST(rb_hash_aref(opts, ID2SYM(rb_intern("packed"))));
 	}
-
-	if (!NIL_P(opt)) {
-		tpb = trans_parseopts(opt, &tpb_len);
+	col_format = row_format(NIL_P(format) ? 0 : 1, &format);
+	if (col_format == ROW_STRUCT || col_format == ROW_LAZY) {
+		rb_raise(rb_eFbError, "Unknown format");
 	}
 
-	if (argc > connection_count) {
-		rb_raise(rb_eFbError, "Too many databases specified for the transaction");
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor_fetch_prep(fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+
+	cols = fb_cursor->o_sqlda->sqld;
+	directives = ALLOCA_N(const char*, cols);
+	vectors = rb_ary_new2(cols);
+	for (count = 0; count < cols; count++) {
+		var = &fb_cursor->o_sqlda->sqlvar[count];
+		directives[count] = packed ? packed_directive(var) : NULL;
+		if (directives[count]) {
+			rb_ary_push(vectors, rb_assoc_new(rb_str_buf_new(0), rb_str_buf_new(0)));
+		} else {
+			rb_ary_push(vectors, rb_ary_new());
+		}
 	}
-	if (argc == 0) {
-		n = connection_count;
-		for (fb_connection = fb_connection_list; fb_connection; fb_connection = fb_connection->next) {
-			set_teb_vec(vec, fb_connection, tpb, tpb_len);
-			vec++;
+
+	for (rows = 0; (max_rows < 0 || rows < max_rows) && !fb_cursor->eof; rows++) {
+		if (!fb_cursor_fetch_row(fb_connection, fb_cursor)) break;
+		for (count = 0; count < cols; count++) {
+			VALUE vector = RARRAY_PTR(vectors)[count];
+			var = &fb_cursor->o_sqlda->sqlvar[count];
+			if (directives[count]) {
+				VALUE data = RARRAY_PTR(vector)[0];
+				VALUE nulls = RARRAY_PTR(vector)[1];
+				if (rows % 8 == 0) {
+					rb_str_buf_cat(nulls, "", 1);
+				}
+				if ((var->sqltype & 1) && (*var->sqlind < 0)) {
+					static const char zero[sizeof(double) > sizeof(ISC_INT64) ? sizeof(double) : sizeof(ISC_INT64)];
+					RSTRING_PTR(nulls)[rows / 8] |= (char)(1 << (rows % 8));
+					rb_str_buf_cat(data, zero, var->sqllen);
+				} else {
+					rb_str_buf_cat(data, var->sqldata, var->sqllen);
+				}
+			} else {
+				rb_ary_push(vector, fb_cursor_column_value(fb_connection, var, &fb_cursor->decoders[count]));
+			}
 		}
-	} else {
-		for (n = 0; n < argc; n++) {
-			fb_connection = fb_connection_check_retrieve(argv[n]);
-			set_teb_vec(vec, fb_connection, tpb, tpb_len);
-			vec++;
+	}
+
+	for (count = 0; count < cols; count++) {
+		if (directives[count]) {
+			VALUE vector = RARRAY_PTR(vectors)[count];
+			var = &fb_cursor->o_sqlda->sqlvar[count];
+			rb_ary_store(vectors, count, rb_struct_new(rb_sFbPackedColumn,
+				rb_str_new2(directives[count]), RARRAY_PTR(vector)[0], RARRAY_PTR(vector)[1],
+				LONG2NUM(rows), INT2FIX(var->sqlscale)));
 		}
 	}
 
-	isc_start_multiple(isc_status, &global_transact, n, teb_vec);
-	xfree(tpb);
-	fb_error_check(isc_status);
+	if (col_format == ROW_ARRAY) {
+		return vectors;
+	}
+	return fb_hash_from_keys(fb_cursor_row_keys(fb_cursor, col_format), vectors);
 }
-*/
 
 /* call-seq:
- *   commit() -> nil
+ *   each() {|Array| } -> nil
+ *   each(:array) {|Array| } -> nil
+ *   each(:hash) {|Hash| } -> nil
+ *   each(:struct) {|Struct| } -> nil
  *
- * Commit the current (global) transaction.
+ * Iterates the rows from the open cursor, passing each one to a block in either
+ * an Array or a Hash, where the column names or aliases from the query form the keys.
+ * If the +downcase_names+ attribute of the associated connection evaluates to true,
+ * the keys are lower case, except where the column name was mixed case to begin with.
  */
-/*
-static VALUE global_commit()
+static VALUE cursor_each(int argc, VALUE* argv, VALUE self)
 {
-	ISC_STATUS isc_status[20];
+	VALUE row;
+	struct FbCursor *fb_cursor;
 
-	if (global_transact) {
-		global_close_cursors();
-		isc_commit_transaction(isc_status, &global_transact);
-		fb_error_check(isc_status);
+	int format = row_format(argc, argv);
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor_fetch_prep(fb_cursor);
+
+	for (;;) {
+		row = fb_cursor_fetch_as(fb_cursor, format);
+		if (NIL_P(row)) break;
+		rb_yield(row);
 	}
+
 	return Qnil;
 }
-*/
 
 /* call-seq:
- *   rollback() -> nil
+ *   close(sql, *args) -> nil
  *
- * Rollback the current (global) transaction.
+ * Closes the cursor.  If a transaction was automatically started for this cursor, the transaction is commited.
  */
-/*
-static VALUE global_rollback()
+static VALUE cursor_close(VALUE self)
 {
-	ISC_STATUS isc_status[20];
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-	if (global_transact) {
-		global_close_cursors();
-		isc_rollback_transaction(isc_status, &global_transact);
-		fb_error_check(isc_status);
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_cursor_check(fb_cursor);
+
+	/* Close the cursor */
+	if (fb_cursor->stmt) {
+		if (fb_cursor->open) {
+			fb_isc_dsql_free_statement(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, DSQL_close);
+			fb_error_check_warn(fb_connection->isc_status);
+		}
+		if (!fb_stmt_cache_checkin(fb_connection, fb_cursor)) {
+			fb_isc_dsql_free_statement(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, DSQL_drop);
+			fb_error_check(fb_connection->isc_status);
+		}
+		fb_cursor->open = Qfalse;
+		if (fb_connection->transact && fb_connection->transact == fb_cursor->auto_transact) {
+			fb_isc_commit_transaction(fb_connection, fb_connection->isc_status, &fb_connection->transact);
+			fb_cursor->auto_transact = fb_connection->transact;
+			fb_error_check(fb_connection->isc_status);
+		}
+	}
+	fb_cursor->fields_ary = Qnil;
+	fb_cursor->fields_hash = Qnil;
+	return Qnil;
+}
+
+/* call-seq:
+ *   drop() -> nil
+ *
+ * Drops the cursor.
+ *
+ * TODO: How is this different from close()?
+ */
+static VALUE cursor_drop(VALUE self)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+	int i;
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor_drop(fb_cursor);
+	fb_cursor->fields_ary = Qnil;
+	fb_cursor->fields_hash = Qnil;
+
+	/* reset the reference from connection */
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	for (i = 0; i < RARRAY_LEN(fb_connection->cursor); i++) {
+		if (RARRAY_PTR(fb_connection->cursor)[i] == self) {
+			RARRAY_PTR(fb_connection->cursor)[i] = Qnil;
+		}
 	}
+
 	return Qnil;
 }
-*/
 
 /* call-seq:
- *   transaction(options, *connections) -> true
- *   transaction(options, *connections) { } -> block result
+ *   decimal() -> symbol
  *
- * Start a (global) transaction.
+ * Returns how NUMERIC and DECIMAL columns are decoded by this cursor:
+ * :float, :bigdecimal, :rational or :scaled_integer.
  */
-/*
-static VALUE global_transaction(int argc, VALUE *argv, VALUE self)
+static VALUE cursor_decimal(VALUE self)
 {
-	VALUE opt = Qnil;
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-	if (argc > 0) {
-		opt = *argv++;
-		argc--;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	if (fb_cursor->decimal_mode != DECIMAL_INHERIT) {
+		return fb_decimal_mode_name(fb_cursor->decimal_mode);
 	}
-	global_transaction_start(opt, argc, argv);
-
-	if (rb_block_given_p()) {
-		int state;
-		VALUE result = rb_protect(rb_yield, 0, &state);
-		if (state) {
-			global_rollback();
-			return rb_funcall(rb_mKernel, rb_intern("raise"), 0);
-		} else {
-			global_commit();
-			return result;
-		}
-	} else {
-		return Qtrue;
-   	}
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	return fb_decimal_mode_name(fb_connection->decimal_mode);
 }
-*/
 
 /* call-seq:
- *   transaction_started()? -> true or false
+ *   decimal = mode
  *
- * Returns true if a transaction is currently active.
+ * Overrides the connection's decimal mode for this cursor.  Takes effect on the
+ * next row fetched; +nil+ reverts to the connection setting.
  */
-/*
-static VALUE global_transaction_started()
-{
-	return global_transact ? Qtrue : Qfalse;
-}
-*/
-
-static void fb_connection_transaction_start(struct FbConnection *fb_connection, VALUE opt)
+static VALUE cursor_set_decimal(VALUE self, VALUE mode)
 {
-	char *tpb = 0;
-	long tpb_len;
-
-	if (fb_connection->transact) {
-		rb_raise(rb_eFbError, "A transaction has been already started");
-	}
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-	if (!NIL_P(opt)) {
-		tpb = trans_parseopts(opt, &tpb_len);
-	} else {
-		tpb_len = 0;
-		tpb = NULL;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor->decimal_mode = NIL_P(mode) ? DECIMAL_INHERIT : fb_decimal_mode(mode);
+	if (fb_cursor->open) {
+		Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+		fb_cursor_compile_decoders(fb_connection, fb_cursor);
 	}
-
-	isc_start_transaction(fb_connection->isc_status, &fb_connection->transact, 1, &fb_connection->db, tpb_len, tpb);
-	xfree(tpb);
-	fb_error_check(fb_connection->isc_status);
+	return mode;
 }
 
-static void fb_connection_commit(struct FbConnection *fb_connection)
+/* call-seq:
+ *   timestamp_format() -> symbol
+ *
+ * Returns how TIMESTAMP and TIME columns are decoded by this cursor:
+ * :time, :epoch_float or :epoch_int.
+ */
+static VALUE cursor_timestamp_format(VALUE self)
 {
-	if (fb_connection->transact) {
-		fb_connection_close_cursors(fb_connection);
-		isc_commit_transaction(fb_connection->isc_status, &fb_connection->transact);
-		fb_error_check(fb_connection->isc_status);
-	}
-}
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-static void fb_connection_rollback(struct FbConnection *fb_connection)
-{
-	if (fb_connection->transact) {
-		fb_connection_close_cursors(fb_connection);
-		isc_rollback_transaction(fb_connection->isc_status, &fb_connection->transact);
-		fb_error_check(fb_connection->isc_status);
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	if (fb_cursor->timestamp_format != TIMESTAMP_INHERIT) {
+		return fb_timestamp_format_name(fb_cursor->timestamp_format);
 	}
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	return fb_timestamp_format_name(fb_connection->timestamp_format);
 }
 
 /* call-seq:
- *   transaction(options) -> true
- *   transaction(options) { } -> block result
+ *   timestamp_format = format
  *
- * Start a transaction for this connection.
+ * Overrides the connection's timestamp format for this cursor.  Takes effect on the
+ * next row fetched; +nil+ reverts to the connection setting.
  */
-static VALUE connection_transaction(int argc, VALUE *argv, VALUE self)
+static VALUE cursor_set_timestamp_format(VALUE self, VALUE format)
 {
+	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
-	VALUE opt = Qnil;
-
-	rb_scan_args(argc, argv, "01", &opt);
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
-
-	fb_connection_transaction_start(fb_connection, opt);
 
-	if (rb_block_given_p()) {
-		int state;
-		VALUE result = rb_protect(rb_yield, 0, &state);
-		if (state) {
-			fb_connection_rollback(fb_connection);
-			return rb_funcall(rb_mKernel, rb_intern("raise"), 0);
-		} else {
-			fb_connection_commit(fb_connection);
-			return result;
-		}
-	} else {
-		return Qtrue;
-   	}
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor->timestamp_format = NIL_P(format) ? TIMESTAMP_INHERIT : fb_timestamp_format(format);
+	if (fb_cursor->open) {
+		Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+		fb_cursor_compile_decoders(fb_connection, fb_cursor);
+	}
+	return format;
 }
 
 /* call-seq:
- *   transaction_started()? -> true or false
+ *   blob_format() -> symbol
  *
- * Returns true if a transaction is currently active.
+ * Returns how BLOB columns are decoded by this cursor: :string or :stream.
  */
-static VALUE connection_transaction_started(VALUE self)
+static VALUE cursor_blob_format(VALUE self)
 {
+	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
 
-	return fb_connection->transact ? Qtrue : Qfalse;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	if (fb_cursor->blob_format != BLOB_INHERIT) {
+		return fb_blob_format_name(fb_cursor->blob_format);
+	}
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	return fb_blob_format_name(fb_connection->blob_format);
 }
 
 /* call-seq:
- *   commit() -> nil
+ *   blob_format = format
  *
- * Commit the current transaction.
+ * Overrides the connection's blob format for this cursor.  Takes effect on the
+ * next row fetched; +nil+ reverts to the connection setting.
  */
-static VALUE connection_commit(VALUE self)
+static VALUE cursor_set_blob_format(VALUE self, VALUE format)
 {
+	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
 
-	fb_connection_commit(fb_connection);
-	return Qnil;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_cursor->blob_format = NIL_P(format) ? BLOB_INHERIT : fb_blob_format(format);
+	if (fb_cursor->open) {
+		Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+		fb_cursor_compile_decoders(fb_connection, fb_cursor);
+	}
+	return format;
 }
 
 /* call-seq:
- *   rollback() -> nil
+ *   fields() -> Array
+ *   fields(:array) -> Array
+ *   fields(:hash) -> Hash
  *
- * Rollback the current transaction.
+ * Return an array of Field Structs or a hash indexed by field name.
+ * If the +downcase_names+ attribute of the associated connection evaluates to true,
+ * the keys are lower case, except where the column name was mixed case to begin with.
  */
-static VALUE connection_rollback(VALUE self)
+static VALUE cursor_fields(int argc, VALUE* argv, VALUE self)
+{
+	struct FbCursor *fb_cursor;
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	if (argc == 0 || argv[0] == ID2SYM(rb_intern("array"))) {
+		return fb_cursor->fields_ary;
+	} else if (argv[0] == ID2SYM(rb_intern("hash"))) {
+		return fb_cursor->fields_hash;
+	} else {
+		rb_raise(rb_eFbError, "Unknown format");
+	}
+}
+
+static void fb_statement_check(struct FbCursor *fb_cursor)
+{
+	if (fb_cursor->stmt == 0) {
+		rb_raise(rb_eFbError, "closed db statement");
+	}
+}
+
+/* Closes the statement's open result set, committing its automatic transaction. */
+static void fb_statement_close_cursor(struct FbConnection *fb_connection, struct FbCursor *fb_cursor)
+{
+	if (fb_cursor->open) {
+		fb_isc_dsql_free_statement(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, DSQL_close);
+		fb_error_check_warn(fb_connection->isc_status);
+		fb_cursor->open = Qfalse;
+	}
+	if (fb_connection->transact && fb_connection->transact == fb_cursor->auto_transact) {
+		fb_isc_commit_transaction(fb_connection, fb_connection->isc_status, &fb_connection->transact);
+		fb_cursor->auto_transact = fb_connection->transact;
+		fb_error_check(fb_connection->isc_status);
+	}
+}
+
+static VALUE statement_close_cursor(VALUE self)
 {
+	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
 
-	fb_connection_rollback(fb_connection);
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_statement_close_cursor(fb_connection, fb_cursor);
 	return Qnil;
 }
 
-/*
- * call-seq:
- *   open?() -> true or false
- *
- * Current connection status.
- */
-
-static VALUE connection_is_open(VALUE self)
+static VALUE statement_prepare2(VALUE args)
 {
+	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
+	VALUE self = rb_ary_entry(args, 0);
+	VALUE sql = rb_ary_entry(args, 1);
 
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
-	return (fb_connection->db == 0) ? Qfalse : Qtrue;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+
+	fb_cursor_prepare(fb_connection, fb_cursor, StringValuePtr(sql));
+	if (fb_cursor->o_sqlda->sqld) {
+		fb_cursor->fields_ary = fb_cursor_fields_ary(fb_cursor->o_sqlda, fb_connection->downcase_names);
+		fb_cursor->fields_hash = fb_cursor_fields_hash(fb_cursor->fields_ary);
+	}
+	return self;
 }
 
-/* call-seq:
- *   to_s() -> String
- *
- * Return current database connection string and either (OPEN) or (CLOSED).
- */
-static VALUE connection_to_s(VALUE self)
+static VALUE statement_execute2(VALUE args)
 {
-	VALUE is_open = connection_is_open(self);
-	VALUE status = (is_open == Qtrue) ? rb_str_new2(" (OPEN)") : rb_str_new2(" (CLOSED)");
-	VALUE database = rb_iv_get(self, "@database");
-	VALUE s = rb_str_dup(database);
-	return rb_str_concat(s, status);
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+
+	VALUE self = rb_ary_pop(args);
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+
+	return fb_cursor_execute_prepared(fb_connection, fb_cursor, args);
 }
 
 /* call-seq:
- *   cursor() -> Cursor
+ *   prepare(sql) -> Statement
+ *   prepare(sql) {|statement| } -> block result
  *
- * Creates a +Cursor+ for the +Connection+ and allocates a statement.
- * This function is no longer published.
+ * Prepares the +sql+ statement once, returning a +Statement+ that can be executed
+ * any number of times with different parameters.
+ *
+ * If a block is provided, the statement is yielded to the block before being automatically closed.
  */
-static VALUE connection_cursor(VALUE self)
+static VALUE connection_prepare(VALUE self, VALUE sql)
 {
-	VALUE c;
 	struct FbConnection *fb_connection;
-	struct FbCursor *fb_cursor;
+	VALUE statement = fb_connection_new_cursor(self, rb_cFbStatement);
+	VALUE args = rb_ary_new3(2, statement, StringValue(sql));
 
 	Data_Get_Struct(self, struct FbConnection, fb_connection);
-	fb_connection_check(fb_connection);
+	rb_iv_set(statement, "@sql", rb_str_new_frozen(sql));
 
-	c = Data_Make_Struct(rb_cFbCursor, struct FbCursor, fb_cursor_mark, fb_cursor_free, fb_cursor);
-	fb_cursor->connection = self;
-	fb_cursor->fields_ary = Qnil;
-	fb_cursor->fields_hash = Qnil;
-	fb_cursor->open = Qfalse;
-	fb_cursor->eof = Qfalse;
-	fb_cursor->stmt = 0;
-	fb_cursor->i_sqlda = sqlda_alloc(SQLDA_COLSINIT);
-	fb_cursor->o_sqlda = sqlda_alloc(SQLDA_COLSINIT);
-	fb_cursor->i_buffer = NULL;
-	fb_cursor->i_buffer_size = 0;
-	fb_cursor->o_buffer = NULL;
-	fb_cursor->o_buffer_size = 0;
-	isc_dsql_alloc_statement2(fb_connection->isc_status, &fb_connection->db, &fb_cursor->stmt);
-	fb_error_check(fb_connection->isc_status);
+	if (!fb_connection->transact) {
+		int state;
 
-	return c;
+		fb_connection_transaction_start(fb_connection, Qnil);
+		rb_protect(statement_prepare2, args, &state);
+		if (state) {
+			fb_connection_rollback(fb_connection);
+			rb_jump_tag(state);
+		}
+		fb_connection_commit(fb_connection);
+	} else {
+		statement_prepare2(args);
+	}
+
+	if (rb_block_given_p()) {
+		return rb_ensure(rb_yield, statement, statement_close, statement);
+	}
+	return statement;
+}
+
+/* Executes the statement for execute, query and each, which handle a block themselves. */
+static VALUE fb_statement_execute(int argc, VALUE *argv, VALUE self)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+	VALUE result;
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_statement_check(fb_cursor);
+	fb_statement_close_cursor(fb_connection, fb_cursor);
+
+	result = fb_cursor_execute_transact(self, rb_ary_new4(argc, argv), statement_execute2);
+	return NIL_P(result) ? self : result;
 }
 
 /* call-seq:
- *   execute(sql, *args) -> Cursor or rows affected
- *   execute(sql, *args) {|cursor| } -> block result
- *
- * Allocates a +Cursor+ and executes the +sql+ statement, matching up the
- * parameters in +args+ with the place holders in the statement, represented by ?'s.
- *
- * If the sql statement returns a result set and a block is provided, the cursor is
- * yielded to the block before being automatically closed.
+ *   execute(*args) -> Statement, Array or rows affected
+ *   execute(*args) {|statement| } -> block result
+ *   execute(*args) {|row| } -> block result
  *
- * If the sql statement returns a result set and a block is not provided, a +Cursor+
- * object is returned.
+ * Executes the prepared statement, matching up the parameters in +args+ with the place holders.
+ * Any result set still open from a previous execution is closed first; the statement is not prepared again.
  *
- * If the sql statement performs an INSERT, UPDATE or DELETE, the number of rows
- * affected is returned.  Other statements, such as schema updates, return -1.
+ * If the statement returns a result set, the statement itself is returned, opened for fetching like a +Cursor+.
+ * If a block is provided, the open statement is yielded to the block and its result set is closed afterwards.
+ * EXECUTE PROCEDURE and RETURNING statements instead return their output row as an Array,
+ * read in the same round trip as the execute, or yield it to the block.
  *
- * +*args+ can be one or more tuples of parameters or an array of tuples (arrays),
- * in which case the statement will be executed once for each tuple of parameters.
+ * If the statement performs an INSERT, UPDATE or DELETE, the number of rows
+ * affected is returned.  Other statements, such as schema updates, return -1.
+ * So do all statements when Connection#count_rows is off; #rows_affected asks for the count instead.
  *
  * If no transaction is currently active, a transaction is automatically started
- * and is closed when the cursor is closed.  Note that if additional statements
- * yielding cursors are started before the first cursor is closed, these cursors will
- * also be closed when the first one is closed and its transaction committed.
+ * and is committed when the result set is closed.
  */
-static VALUE connection_execute(int argc, VALUE *argv, VALUE self)
+static VALUE statement_execute(int argc, VALUE *argv, VALUE self)
 {
-	VALUE cursor = connection_cursor(self);
-	VALUE val = cursor_execute(argc, argv, cursor);
+	VALUE result = fb_statement_execute(argc, argv, self);
 
-	if (NIL_P(val)) {
-		if (rb_block_given_p()) {
-			return rb_ensure(rb_yield,cursor,cursor_close,cursor);
-   		} else {
-				HERE("connection_execute Y");
-				return cursor;
-   		}
-	} else {
-		cursor_drop(cursor);
+	if (rb_block_given_p()) {
+		if (result == self) {
+			return rb_ensure(rb_yield, self, statement_close_cursor, self);
+		}
+		if (TYPE(result) == T_ARRAY) {
+			return rb_yield(result);
+		}
 	}
-	return val;
+	return result;
+}
+
+static VALUE statement_fetchall2(VALUE args)
+{
+	VALUE self = rb_ary_entry(args, 0);
+	VALUE format = rb_ary_entry(args, 1);
+	return cursor_fetchall(1, &format, self);
+}
+
+static VALUE statement_each2(VALUE args)
+{
+	VALUE self = rb_ary_entry(args, 0);
+	VALUE format = rb_ary_entry(args, 1);
+	return cursor_each(1, &format, self);
 }
 
 /* call-seq:
- *   query(:array, sql, *arg) -> Array of Arrays or nil
- *   query(:hash, sql, *arg) -> Array of Hashes or nil
- *   query(sql, *args) -> Array of Arrays or nil
+ *   query(:array, *args) -> Array of Arrays or rows affected
+ *   query(:hash, *args) -> Array of Hashes or rows affected
+ *   query(*args) -> Array of Arrays or rows affected
  *
- * For queries returning a result set, an array is returned, containing
- * either a list of Arrays or Hashes, one for each row.
- *
- * If the sql statement performs an INSERT, UPDATE or DELETE, the number of rows
- * affected is returned.  Other statements, such as schema updates, return -1.
+ * Executes the prepared statement and returns all rows of its result set,
+ * as a list of Arrays or Hashes, closing the result set afterwards.
  *
- * If no transaction is currently active, a transaction is automatically started
- * and committed.  Otherwise, the statement executes within the context of the
- * current transaction.
+ * If the statement performs an INSERT, UPDATE or DELETE, the number of rows
+ * affected is returned.
  */
-static VALUE connection_query(int argc, VALUE *argv, VALUE self)
+static VALUE statement_query(int argc, VALUE *argv, VALUE self)
 {
 	VALUE format;
-	VALUE cursor;
 	VALUE result;
 
 	if (argc >= 1 && TYPE(argv[0]) == T_SYMBOL) {
@@ -1363,1764 +5798,2486 @@ static VALUE connection_query(int argc, VALUE *argv, VALUE self)
 	} else {
 		format = ID2SYM(rb_intern("array"));
 	}
-	cursor = connection_cursor(self);
-	result = cursor_execute(argc, argv, cursor);
-	if (NIL_P(result)) {
-		result = cursor_fetchall(1, &format, cursor);
-		cursor_close(cursor);
+	result = fb_statement_execute(argc, argv, self);
+	if (result == self) {
+		result = rb_ensure(statement_fetchall2, rb_ary_new3(2, self, format), statement_close_cursor, self);
+	} else if (TYPE(result) == T_ARRAY) {
+		result = fb_cursor_singleton_rows(self, result, format);
 	}
-
 	return result;
 }
 
 /* call-seq:
- *   close() -> nil
+ *   each(:array, *args) {|Array| } -> nil
+ *   each(:hash, *args) {|Hash| } -> nil
+ *   each(*args) {|Array| } -> nil
  *
- * Closes connection to database.  All open cursors are dropped.
+ * Executes the prepared statement and passes each row of its result set to the block,
+ * in either an Array or a Hash, closing the result set afterwards.
  */
-static VALUE connection_close(VALUE self)
+static VALUE statement_each(int argc, VALUE *argv, VALUE self)
 {
-	struct FbConnection *fb_connection;
-
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
-
-	if (fb_connection->dropped) return Qnil;
-
-	fb_connection_check(fb_connection);
-	fb_connection_disconnect(fb_connection);
-	fb_connection_drop_cursors(fb_connection);
+	VALUE format;
+	VALUE result;
 
-	return Qnil;
+	if (argc >= 1 && TYPE(argv[0]) == T_SYMBOL) {
+		format = argv[0];
+		argc--; argv++;
+	} else {
+		format = ID2SYM(rb_intern("array"));
+	}
+	result = fb_statement_execute(argc, argv, self);
+	if (result == self) {
+		result = rb_ensure(statement_each2, rb_ary_new3(2, self, format), statement_close_cursor, self);
+	} else if (TYPE(result) == T_ARRAY) {
+		rb_yield(RARRAY_PTR(fb_cursor_singleton_rows(self, result, format))[0]);
+		result = Qnil;
+	}
+	return result;
 }
 
-/* call-seq:
- *   drop() -> nil
+/* Statement#execute_batch
  *
- * Drops connected database.  All open cursors are dropped.
+ * Rows are sent to the server several at a time, packed into one EXECUTE BLOCK whose
+ * parameters are the statement's parameters repeated for each row.  The block adds up
+ * ROW_COUNT after each copy of the statement and returns the total, so a block of rows
+ * costs one round trip instead of one per row plus one to count the rows affected.
  */
-static VALUE connection_drop(VALUE self)
-{
-	struct FbConnection *fb_connection;
 
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
-	fb_connection->dropped = 1;
-	fb_connection_disconnect(fb_connection);
-	fb_connection_drop_cursors(fb_connection);
+#define BATCH_BLOCK_MAX 60000	/* bytes of SQL text or parameter message per block */
+#define BATCH_SIZE_DEFAULT 100
 
-	return Qnil;
+/* Returns [name, bytes per character] for a character set id, reading RDB$CHARACTER_SETS once. */
+static VALUE fb_connection_charset(struct FbConnection *fb_connection, long id)
+{
+	VALUE key = LONG2NUM(id);
+	VALUE charset = rb_hash_aref(fb_connection->charsets, key);
+
+	if (NIL_P(charset)) {
+		VALUE args[2];
+		VALUE rows;
+
+		args[0] = rb_str_new2("SELECT TRIM(RDB$CHARACTER_SET_NAME), RDB$BYTES_PER_CHARACTER FROM RDB$CHARACTER_SETS WHERE RDB$CHARACTER_SET_ID = ?");
+		args[1] = key;
+		rows = connection_query(2, args, fb_connection->self);
+		if (TYPE(rows) != T_ARRAY || RARRAY_LEN(rows) != 1) {
+			rb_raise(rb_eFbError, "unknown character set id %ld", id);
+		}
+		charset = rb_ary_entry(rows, 0);
+		rb_hash_aset(fb_connection->charsets, key, charset);
+	}
+	return charset;
 }
 
-/* call-seq:
- *   dialect() -> int
- *
- * Returns dialect of connection.
- */
-static VALUE connection_dialect(VALUE self)
+/* Returns the PSQL declaration of a parameter's type, or nil if it can't be declared. */
+static VALUE fb_sqlvar_declaration(struct FbConnection *fb_connection, XSQLVAR *var)
 {
-	struct FbConnection *fb_connection;
+	short dtp = var->sqltype & ~1;
+	VALUE charset;
+	long bytes;
 
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
-	fb_connection_check(fb_connection);
+	switch (dtp) {
+		case SQL_TEXT:
+		case SQL_VARYING:
+			charset = fb_connection_charset(fb_connection, var->sqlsubtype & 0xFF);
+			bytes = NUM2LONG(rb_ary_entry(charset, 1));
+			if (bytes < 1) bytes = 1;
+			return rb_sprintf("%s(%ld) CHARACTER SET %"PRIsVALUE,
+				dtp == SQL_TEXT ? "CHAR" : "VARCHAR", var->sqllen / bytes, rb_ary_entry(charset, 0));
 
-	return INT2FIX(fb_connection->dialect);
-}
+		case SQL_SHORT:
+			return var->sqlscale ? rb_sprintf("NUMERIC(4,%d)", -var->sqlscale) : rb_str_new2("SMALLINT");
+		case SQL_LONG:
+			return var->sqlscale ? rb_sprintf("NUMERIC(9,%d)", -var->sqlscale) : rb_str_new2("INTEGER");
+		case SQL_INT64:
+			return var->sqlscale ? rb_sprintf("NUMERIC(18,%d)", -var->sqlscale) : rb_str_new2("BIGINT");
 
-/* call-seq:
- *   db_dialect() -> int
- *
- * Returns database dialect.
- */
-static VALUE connection_db_dialect(VALUE self)
-{
-	struct FbConnection *fb_connection;
+		case SQL_FLOAT:
+			return rb_str_new2("FLOAT");
+		case SQL_DOUBLE:
+		case SQL_D_FLOAT:
+			return rb_str_new2("DOUBLE PRECISION");
 
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
-	fb_connection_check(fb_connection);
+		case SQL_TIMESTAMP:
+			return rb_str_new2("TIMESTAMP");
+		case SQL_TYPE_DATE:
+			return rb_str_new2("DATE");
+		case SQL_TYPE_TIME:
+			return rb_str_new2("TIME");
 
-	return INT2FIX(fb_connection->db_dialect);
+		case SQL_BLOB:
+			if (var->sqlsubtype == 1) {
+				charset = fb_connection_charset(fb_connection, var->sqlscale & 0xFF);
+				return rb_sprintf("BLOB SUB_TYPE 1 CHARACTER SET %"PRIsVALUE, rb_ary_entry(charset, 0));
+			}
+			return rb_sprintf("BLOB SUB_TYPE %d", var->sqlsubtype);
+	}
+	return Qnil;
 }
 
-static void fb_cursor_check(struct FbCursor *fb_cursor)
+/* Appends +sql+ to +block+ with each place holder replaced by :P<row>_<n>. */
+static void fb_batch_append_statement(VALUE block, const char *sql, long len, long row)
 {
-	if (fb_cursor->stmt == 0) {
-		rb_raise(rb_eFbError, "dropped db cursor");
+	long i = 0, start = 0, param = 0;
+
+	while (i < len) {
+		char c = sql[i];
+		if (c == '\'' || c == '"') {
+			for (i++; i < len && sql[i] != c; i++);
+			i++;
+		} else if (c == '-' && i + 1 < len && sql[i + 1] == '-') {
+			for (i += 2; i < len && sql[i] != '\n'; i++);
+		} else if (c == '/' && i + 1 < len && sql[i + 1] == '*') {
+			for (i += 2; i + 1 < len && !(sql[i] == '*' && sql[i + 1] == '/'); i++);
+			i += 2;
+		} else if (c == '?') {
+			rb_str_cat(block, sql + start, i - start);
+			rb_str_catf(block, ":P%ld_%ld", row, param++);
+			start = ++i;
+		} else {
+			i++;
+		}
 	}
-	if (!fb_cursor->open) {
-		rb_raise(rb_eFbError, "closed db cursor");
+	if (start < len) {
+		rb_str_cat(block, sql + start, (i < len ? i : len) - start);
 	}
 }
 
-static void fb_cursor_drop(struct FbCursor *fb_cursor)
+/* Builds the EXECUTE BLOCK running +sql+ once for each of +rows+ rows of parameters. */
+static VALUE fb_batch_block_sql(VALUE sql, VALUE declarations, long rows)
 {
-	ISC_STATUS isc_status[20];
-	if (fb_cursor->open) {
-		isc_dsql_free_statement(isc_status, &fb_cursor->stmt, DSQL_close);
-		fb_error_check(isc_status);
+	long params = RARRAY_LEN(declarations);
+	const char *text = RSTRING_PTR(sql);
+	long len = RSTRING_LEN(sql);
+	VALUE block = rb_str_new2("EXECUTE BLOCK (");
+	long row, param;
+
+	/* A trailing terminator would end the statement early inside the block */
+	while (len > 0 && (ISSPACE(text[len - 1]) || text[len - 1] == ';')) len--;
+
+	for (row = 0; row < rows; row++) {
+		for (param = 0; param < params; param++) {
+			rb_str_catf(block, "%sP%ld_%ld %"PRIsVALUE" = ?", (row || param) ? ", " : "",
+				row, param, rb_ary_entry(declarations, param));
+		}
 	}
-	isc_dsql_free_statement(isc_status, &fb_cursor->stmt, DSQL_drop);
-	fb_error_check(isc_status);
+	rb_str_cat2(block, ") RETURNS (ROWS_AFFECTED INTEGER) AS BEGIN ROWS_AFFECTED = 0; ");
+	for (row = 0; row < rows; row++) {
+		fb_batch_append_statement(block, text, len, row);
+		rb_str_cat2(block, "; ROWS_AFFECTED = ROWS_AFFECTED + ROW_COUNT; ");
+	}
+	rb_str_cat2(block, "END");
+	return block;
 }
 
-static void fb_cursor_drop_warn(struct FbCursor *fb_cursor)
+/* Returns how many rows fit in one block, or 0 if the statement can't be batched. */
+static long fb_statement_batch_rows(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, VALUE self, long batch_size)
 {
-	ISC_STATUS isc_status[20];
-	if (fb_cursor->open) {
-		isc_dsql_free_statement(isc_status, &fb_cursor->stmt, DSQL_close);
-		fb_error_check_warn(isc_status);
+	long params = fb_cursor->i_sqlda->sqld;
+	long statement = fb_cursor->statement_type;
+	VALUE declarations;
+	long text, message, rows;
+	long i;
+
+	if (fb_cursor->batch == Qfalse || batch_size < 2 || params == 0 || fb_cursor->o_sqlda->sqld
+		|| fb_connection->dialect < 3
+		|| (statement != isc_info_sql_stmt_insert && statement != isc_info_sql_stmt_update && statement != isc_info_sql_stmt_delete)) {
+		return 0;
 	}
-	isc_dsql_free_statement(isc_status, &fb_cursor->stmt, DSQL_drop);
-	fb_error_check_warn(isc_status);
+	if (NIL_P(fb_cursor->batch)) {
+		declarations = rb_ary_new2(params);
+		for (i = 0; i < params; i++) {
+			VALUE declaration = fb_sqlvar_declaration(fb_connection, &fb_cursor->i_sqlda->sqlvar[i]);
+			if (NIL_P(declaration)) {
+				fb_cursor->batch = Qfalse;
+				return 0;
+			}
+			rb_ary_push(declarations, declaration);
+		}
+		fb_cursor->batch = rb_hash_new();
+		rb_iv_set(self, "@batch_declarations", declarations);
+	}
+	declarations = rb_iv_get(self, "@batch_declarations");
+
+	/* Estimate the SQL text and message sizes of each row */
+	text = RSTRING_LEN(rb_iv_get(self, "@sql")) + params * 12 + 60;
+	for (i = 0; i < params; i++) {
+		text += RSTRING_LEN(rb_ary_entry(declarations, i)) + 16;
+	}
+	message = calculate_buffsize(fb_cursor->i_sqlda);
+
+	rows = BATCH_BLOCK_MAX / text;
+	if (rows > BATCH_BLOCK_MAX / message) rows = BATCH_BLOCK_MAX / message;
+	if (rows > batch_size) rows = batch_size;
+	return rows < 2 ? 0 : rows;
 }
 
-static void fb_cursor_mark(struct FbCursor *fb_cursor)
+/* Returns the Cursor running the statement for +rows+ rows at once, or nil if it won't prepare. */
+static VALUE fb_statement_batch_cursor(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, VALUE self, long rows)
 {
-	rb_gc_mark(fb_cursor->connection);
-	rb_gc_mark(fb_cursor->fields_ary);
-	rb_gc_mark(fb_cursor->fields_hash);
+	VALUE key = LONG2NUM(rows);
+	VALUE cursor = rb_hash_aref(fb_cursor->batch, key);
+
+	if (NIL_P(cursor)) {
+		struct FbCursor *block_cursor;
+		VALUE sql = fb_batch_block_sql(rb_iv_get(self, "@sql"), rb_iv_get(self, "@batch_declarations"), rows);
+		int state;
+
+		cursor = fb_connection_new_cursor(fb_cursor->connection, rb_cFbCursor);
+		Data_Get_Struct(cursor, struct FbCursor, block_cursor);
+		rb_protect(statement_prepare2, rb_ary_new3(2, cursor, sql), &state);
+		if (state) {
+			/* e.g. the server's limits on blocks are lower than estimated: don't try this size again */
+			rb_set_errinfo(Qnil);
+			if (block_cursor->stmt) {
+				cursor_drop(cursor);
+			}
+			cursor = Qfalse;
+		}
+		rb_hash_aset(fb_cursor->batch, key, cursor);
+	}
+	return RTEST(cursor) ? cursor : Qnil;
 }
 
-static void fb_cursor_free(struct FbCursor *fb_cursor)
+/* Returns the block cursor for the next group of at most +left+ rows, its row count in *n, or nil
+ * to run the rest row by row.  Groups are *per_block rows, and a tail is split into powers of two,
+ * so a statement prepares only a few block sizes however long its batches.  When a block fails
+ * to prepare, *per_block is halved and the group retried. */
+static VALUE fb_statement_batch_block(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, VALUE self, long *per_block, long left, long *n)
 {
-	if (fb_cursor->stmt) {
-		fb_cursor_drop_warn(fb_cursor);
+	VALUE cursor;
+	long size;
+
+	while (*per_block >= 2) {
+		if (left >= *per_block) {
+			size = *per_block;
+		} else {
+			for (size = 1; size * 2 <= left; size *= 2);
+		}
+		if (size < 2) break;
+		cursor = fb_statement_batch_cursor(fb_connection, fb_cursor, self, size);
+		if (!NIL_P(cursor)) {
+			*n = size;
+			return cursor;
+		}
+		*per_block = size / 2;
 	}
-	xfree(fb_cursor->i_sqlda);
-	xfree(fb_cursor->o_sqlda);
-	xfree(fb_cursor->i_buffer);
-	xfree(fb_cursor->o_buffer);
-	xfree(fb_cursor);
+	return Qnil;
 }
 
-static void fb_cursor_set_inputparams(struct FbCursor *fb_cursor, long argc, VALUE *argv)
+/* Executes a block cursor whose parameters are bound, returning its ROWS_AFFECTED. */
+static long fb_batch_block_run(struct FbConnection *fb_connection, struct FbCursor *fb_cursor)
 {
-	struct FbConnection *fb_connection;
-	long count;
-	long offset;
-	long type;
-	short dtp;
-	VALUE obj;
-	long lvalue;
-	ISC_INT64 llvalue;
-	long alignment;
-	double ratio;
-	double dvalue;
-	long scnt;
-	double dcheck;
-	VARY *vary;
 	XSQLVAR *var;
 
-	isc_blob_handle blob_handle;
-	ISC_QUAD blob_id;
-	/* static char blob_items[] = { isc_info_blob_max_segment }; */
-	/* char blob_info[16]; */
-	char *p;
-	long length;
-	/* struct time_object *tobj; */
-	struct tm tms;
+	fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, fb_cursor->i_sqlda, fb_cursor->o_sqlda);
+	fb_error_check(fb_connection->isc_status);
+
+	var = fb_cursor->o_sqlda->sqlvar;
+	return (var->sqltype & 1) && *var->sqlind < 0 ? 0 : *(ISC_LONG*)var->sqldata;
+}
+
+static VALUE fb_batch_block_execute(VALUE args)
+{
+	VALUE cursor = rb_ary_entry(args, 0);
+	VALUE params = rb_ary_entry(args, 1);
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
+	Data_Get_Struct(cursor, struct FbCursor, fb_cursor);
 	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
 
-	/* Check the number of parameters */
-	if (fb_cursor->i_sqlda->sqld != argc) {
-		rb_raise(rb_eFbError, "statement requires %d items; %ld given", fb_cursor->i_sqlda->sqld, argc);
+	fb_cursor_set_inputparams(fb_cursor, RARRAY_LEN(params), RARRAY_PTR(params));
+	return LONG2NUM(fb_batch_block_run(fb_connection, fb_cursor));
+}
+
+static VALUE fb_batch_row_execute(VALUE args)
+{
+	VALUE self = rb_ary_entry(args, 0);
+	VALUE row = rb_ary_entry(args, 1);
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+
+	Check_Type(row, T_ARRAY);
+	fb_cursor_set_inputparams(fb_cursor, RARRAY_LEN(row), RARRAY_PTR(row));
+	fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, fb_cursor->i_sqlda, NULL);
+	fb_error_check(fb_connection->isc_status);
+	return LONG2NUM(cursor_rows_affected(fb_cursor, fb_cursor->statement_type));
+}
+
+/* Returns the :batch_size option, BATCH_SIZE_DEFAULT if it is not given. */
+static long fb_batch_size(VALUE opts)
+{
+	long batch_size = BATCH_SIZE_DEFAULT;
+
+	if (!NIL_P(opts)) {
+		VALUE size;
+		Check_Type(opts, T_HASH);
+		size = rb_hash_aref(opts, ID2SYM(rb_intern("batch_size")));
+		if (!NIL_P(size)) {
+			batch_size = NUM2LONG(size);
+			if (batch_size < 1) {
+				rb_raise(rb_eArgError, "batch_size must be positive");
+			}
+		}
 	}
+	return batch_size;
+}
 
-	/* Get the parameters */
-	for (count = 0,offset = 0; count < argc; count++) {
-		obj = argv[count];
+/* Executes rows [from, to) one at a time, adding to the total and collecting errors. */
+static long fb_statement_execute_rows(VALUE self, VALUE rows, long from, long to, VALUE errors)
+{
+	long affected = 0;
+	long i;
 
-		type = TYPE(obj);
+	for (i = from; i < to; i++) {
+		int state;
+		VALUE count = rb_protect(fb_batch_row_execute, rb_ary_new3(2, self, rb_ary_entry(rows, i)), &state);
+		if (state) {
+			VALUE error = rb_errinfo();
+			if (!rb_obj_is_kind_of(error, rb_eStandardError)) {
+				rb_jump_tag(state);
+			}
+			rb_set_errinfo(Qnil);
+			rb_ary_push(errors, rb_ary_new3(2, LONG2NUM(i), error));
+		} else {
+			affected += NUM2LONG(count);
+		}
+	}
+	return affected;
+}
 
-		/* Convert the data type for InterBase */
-		var = &fb_cursor->i_sqlda->sqlvar[count];
-		if (!NIL_P(obj)) {
-			dtp = var->sqltype & ~1;		/* Erase null flag */
-			alignment = var->sqllen;
-
-			switch (dtp) {
-				case SQL_TEXT :
-					alignment = 1;
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					obj = rb_obj_as_string(obj);
-					if (RSTRING_LEN(obj) > var->sqllen) {
-						rb_raise(rb_eRangeError, "CHAR overflow: %ld bytes exceeds %d byte(s) allowed.",
-							RSTRING_LEN(obj), var->sqllen);
-					}
-					memcpy(var->sqldata, RSTRING_PTR(obj), RSTRING_LEN(obj));
-					var->sqllen = RSTRING_LEN(obj);
-					offset += var->sqllen + 1;
-					break;
+static VALUE statement_execute_batch2(VALUE args)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+	VALUE self = rb_ary_pop(args);
+	VALUE rows = rb_ary_entry(args, 0);
+	long batch_size = NUM2LONG(rb_ary_entry(args, 1));
+	long count = RARRAY_LEN(rows);
+	long params, per_block;
+	long affected = 0;
+	VALUE errors = rb_ary_new();
+	long i = 0;
 
-				case SQL_VARYING :
-					alignment = sizeof(short);
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					vary = (VARY *)var->sqldata;
-					obj = rb_obj_as_string(obj);
-					if (RSTRING_LEN(obj) > var->sqllen) {
-						rb_raise(rb_eRangeError, "VARCHAR overflow: %ld bytes exceeds %d byte(s) allowed.",
-							RSTRING_LEN(obj), var->sqllen);
-					}
-					memcpy(vary->vary_string, RSTRING_PTR(obj), RSTRING_LEN(obj));
-					vary->vary_length = RSTRING_LEN(obj);
-					offset += vary->vary_length + sizeof(short);
-					break;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	params = fb_cursor->i_sqlda->sqld;
 
-				case SQL_SHORT :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					if (var->sqlscale < 0) {
-						ratio = 1;
-						for (scnt = 0; scnt > var->sqlscale; scnt--)
-							ratio *= 10;
-						obj = double_from_obj(obj);
-						dvalue = NUM2DBL(obj) * ratio;
-						lvalue = (ISC_LONG)(dvalue + 0.5);
-					} else {
-						obj = long_from_obj(obj);
-						lvalue = NUM2LONG(obj);
-					}
-					if (lvalue < SHRT_MIN || lvalue > SHRT_MAX) {
-						rb_raise(rb_eRangeError, "short integer overflow");
-					}
-					*(short *)var->sqldata = lvalue;
-					offset += alignment;
-					break;
+	per_block = count > 1 ? fb_statement_batch_rows(fb_connection, fb_cursor, self, batch_size) : 0;
+	while (i < count) {
+		VALUE cursor, flat;
+		long n, j;
+		int state;
 
-				case SQL_LONG :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					if (var->sqlscale < 0) {
-						ratio = 1;
-						for (scnt = 0; scnt > var->sqlscale; scnt--)
-							ratio *= 10;
-						obj = double_from_obj(obj);
-						dvalue = NUM2DBL(obj) * ratio;
-						lvalue = (ISC_LONG)(dvalue + 0.5);
-					} else {
-						obj = long_from_obj(obj);
-						lvalue = NUM2LONG(obj);
-					}
-					if (lvalue < -2147483647 || lvalue > 2147483647) {
-                        rb_raise(rb_eRangeError, "integer overflow");
-					}
-					*(ISC_LONG *)var->sqldata = (ISC_LONG)lvalue;
-					offset += alignment;
-					break;
+		cursor = fb_statement_batch_block(fb_connection, fb_cursor, self, &per_block, count - i, &n);
+		if (NIL_P(cursor)) break;
 
-				case SQL_FLOAT :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					obj = double_from_obj(obj);
-					dvalue = NUM2DBL(obj);
-					if (dvalue >= 0.0) {
-						dcheck = dvalue;
-					} else {
-						dcheck = dvalue * -1;
-					}
-					if (dcheck != 0.0 && (dcheck < FLT_MIN || dcheck > FLT_MAX)) {
-						rb_raise(rb_eRangeError, "float overflow");
-					}
-					*(float *)var->sqldata = (float)dvalue;
-					offset += alignment;
-					break;
+		flat = rb_ary_new2(n * params);
+		for (j = i; j < i + n; j++) {
+			VALUE row = rb_ary_entry(rows, j);
+			if (TYPE(row) != T_ARRAY || RARRAY_LEN(row) != params) break;
+			rb_ary_concat(flat, row);
+		}
+		if (j == i + n) {
+			VALUE block_affected = rb_protect(fb_batch_block_execute, rb_ary_new3(2, cursor, flat), &state);
+			if (!state) {
+				affected += NUM2LONG(block_affected);
+				i += n;
+				continue;
+			}
+			if (!rb_obj_is_kind_of(rb_errinfo(), rb_eStandardError)) {
+				rb_jump_tag(state);
+			}
+			rb_set_errinfo(Qnil);
+		}
+		/* Nothing in a failed block took effect: run its rows one by one to find the bad ones */
+		affected += fb_statement_execute_rows(self, rows, i, i + n, errors);
+		i += n;
+	}
+	affected += fb_statement_execute_rows(self, rows, i, count, errors);
 
-				case SQL_DOUBLE :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					obj = double_from_obj(obj);
-					dvalue = NUM2DBL(obj);
-					*(double *)var->sqldata = dvalue;
-					offset += alignment;
-					break;
-#if HAVE_LONG_LONG
-				case SQL_INT64 :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-
-					if (var->sqlscale < 0) {
-						ratio = 1;
-						for (scnt = 0; scnt > var->sqlscale; scnt--)
-							ratio *= 10;
-						obj = double_from_obj(obj);
-						dvalue = NUM2DBL(obj) * ratio;
-						llvalue = (ISC_INT64)(dvalue + 0.5);
-					} else {
-						obj = ll_from_obj(obj);
-						llvalue = NUM2LL(obj);
-					}
+	return rb_struct_new(rb_sFbBatchResult, LONG2NUM(affected), errors);
+}
+
+/* call-seq:
+ *   execute_batch(rows) -> Struct::FbBatchResult
+ *   execute_batch(rows, :batch_size => 100) -> Struct::FbBatchResult
+ *
+ * Executes the prepared INSERT, UPDATE or DELETE once for each Array of parameters in +rows+.
+ * Rows are sent to the server up to +batch_size+ at a time, each group packed into a single
+ * EXECUTE BLOCK, which saves a round trip per row.  Statements that can't be packed
+ * (other statement types, dialect 1 databases, ARRAY parameters) run one row at a time.
+ *
+ * Returns a Struct with the total +rows_affected+ and a list of +errors+, one
+ * [row index, exception] pair for each row that failed.  A failing row does not stop
+ * the rows after it; the group containing it is run again row by row, so only the
+ * failed rows are left out.
+ *
+ * If no transaction is currently active, a transaction is automatically started
+ * and committed, even when some rows failed.
+ */
+static VALUE statement_execute_batch(int argc, VALUE *argv, VALUE self)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+	VALUE rows, opts;
 
-					*(ISC_INT64 *)var->sqldata = llvalue;
-					offset += alignment;
-					break;
-#endif
-				case SQL_BLOB :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					obj = rb_obj_as_string(obj);
-
-					blob_handle = 0;
-					isc_create_blob2(
-						fb_connection->isc_status,&fb_connection->db,&fb_connection->transact,
-						&blob_handle,&blob_id,0,NULL);
-					fb_error_check(fb_connection->isc_status);
-					length = RSTRING_LEN(obj);
-					p = RSTRING_PTR(obj);
-					while (length >= 4096) {
-						isc_put_segment(fb_connection->isc_status,&blob_handle,4096,p);
-						fb_error_check(fb_connection->isc_status);
-						p += 4096;
-						length -= 4096;
-					}
-					if (length) {
-						isc_put_segment(fb_connection->isc_status,&blob_handle,length,p);
-						fb_error_check(fb_connection->isc_status);
-					}
-					isc_close_blob(fb_connection->isc_status,&blob_handle);
-					fb_error_check(fb_connection->isc_status);
+	rb_scan_args(argc, argv, "11", &rows, &opts);
+	Check_Type(rows, T_ARRAY);
 
-					*(ISC_QUAD *)var->sqldata = blob_id;
-					offset += alignment;
-					break;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_statement_check(fb_cursor);
+	fb_statement_close_cursor(fb_connection, fb_cursor);
 
-				case SQL_TIMESTAMP :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					tm_from_timestamp(&tms, obj);
-					isc_encode_timestamp(&tms, (ISC_TIMESTAMP *)var->sqldata);
-					offset += alignment;
-					break;
+	return fb_cursor_execute_transact(self, rb_ary_new3(2, rows, LONG2NUM(fb_batch_size(opts))), statement_execute_batch2);
+}
 
-				case SQL_TYPE_TIME :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					tm_from_timestamp(&tms, obj);
-					isc_encode_sql_time(&tms, (ISC_TIME *)var->sqldata);
-					offset += alignment;
-					break;
+/* Statement#execute_columns
+ *
+ * Parameters are read from one vector per column and written straight into the input
+ * buffer, so no Array is built for each row.  Vectors are Arrays of values, or the raw
+ * native values of numeric columns in a binary String or an FbPackedColumn, as returned
+ * by Cursor#fetch_columns(:packed => true).
+ */
 
-				case SQL_TYPE_DATE :
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					tm_from_date(&tms, obj);
-					isc_encode_sql_date(&tms, (ISC_DATE *)var->sqldata);
-					offset += alignment;
-					break;
+struct FbInputColumn {
+	VALUE values;	/* Array of values, or nil for packed data */
+	VALUE data;	/* packed native values */
+	VALUE nulls;	/* null bitmap, least significant bit first, or nil */
+};
 
-#if 0
-				case SQL_ARRAY :
-					/* Not supported now
-					offset = FB_ALIGN(offset, alignment);
-					var->sqldata = (char *)(fb_cursor->i_buffer + offset);
-					if (get_arrayvalue(self, type, obj, var))
-						return(STATUS_ABNORMAL);
-					offset += alignment;
-					break;
-					*/
-					rb_raise(rb_eArgError, "Arrays not supported");
-					break;
-#endif
+/* Reads the vectors in +columns+ into +input+, returning the number of rows they hold. */
+static long fb_input_columns(struct FbCursor *fb_cursor, VALUE columns, struct FbInputColumn *input)
+{
+	long params = fb_cursor->i_sqlda->sqld;
+	long rows = -1;
+	long count;
 
-				default :
-					rb_raise(rb_eFbError, "Specified table includes unsupported datatype (%d)", dtp);
+	if (RARRAY_LEN(columns) != params) {
+		rb_raise(rb_eFbError, "statement requires %ld columns; %ld given", params, RARRAY_LEN(columns));
+	}
+	for (count = 0; count < params; count++) {
+		XSQLVAR *var = &fb_cursor->i_sqlda->sqlvar[count];
+		VALUE column = rb_ary_entry(columns, count);
+		long n;
+
+		input[count].values = input[count].data = input[count].nulls = Qnil;
+		if (TYPE(column) == T_ARRAY) {
+			input[count].values = column;
+			n = RARRAY_LEN(column);
+		} else {
+			const char *directive = packed_directive(var);
+			if (!directive) {
+				rb_raise(rb_eArgError, "column %ld does not take packed data", count);
+			}
+			if (rb_obj_is_kind_of(column, rb_sFbPackedColumn)) {
+				VALUE column_directive = rb_struct_aref(column, INT2FIX(0));
+				if (strcmp(StringValueCStr(column_directive), directive) != 0 ||
+					NUM2INT(rb_struct_aref(column, INT2FIX(4))) != var->sqlscale) {
+					rb_raise(rb_eArgError, "column %ld needs packed '%s' data with scale %d", count, directive, var->sqlscale);
+				}
+				input[count].data = rb_struct_aref(column, INT2FIX(1));
+				StringValue(input[count].data);
+				input[count].nulls = rb_struct_aref(column, INT2FIX(2));
+				n = NUM2LONG(rb_struct_aref(column, INT2FIX(3)));
+				if (!NIL_P(input[count].nulls) && RSTRING_LEN(StringValue(input[count].nulls)) < (n + 7) / 8) {
+					rb_raise(rb_eArgError, "column %ld has a short null bitmap", count);
+				}
+			} else {
+				input[count].data = StringValue(column);
+				n = RSTRING_LEN(column) / var->sqllen;
 			}
+			if (RSTRING_LEN(input[count].data) != n * var->sqllen) {
+				rb_raise(rb_eArgError, "column %ld: packed data is not a whole number of '%s' values", count, directive);
+			}
+		}
+		if (rows >= 0 && n != rows) {
+			rb_raise(rb_eArgError, "column %ld holds %ld rows; expected %ld", count, n, rows);
+		}
+		rows = n;
+	}
+	return rows < 0 ? 0 : rows;
+}
+
+/* Binds row +row+ of +input+ to the parameters starting at index +first+. */
+static void fb_cursor_set_inputcolumns(struct FbConnection *fb_connection, struct FbCursor *fb_cursor, long first, struct FbInputColumn *input, long params, long row)
+{
+	long count;
 
+	for (count = 0; count < params; count++, input++) {
+		XSQLVAR *var = &fb_cursor->i_sqlda->sqlvar[first + count];
+		if (!NIL_P(input->values)) {
+			fb_cursor_set_inputparam(fb_connection, fb_cursor, first + count, rb_ary_entry(input->values, row));
+		} else if (!NIL_P(input->nulls) && (RSTRING_PTR(input->nulls)[row / 8] & (1 << (row % 8)))) {
+			fb_cursor_set_inputparam(fb_connection, fb_cursor, first + count, Qnil);
+		} else {
+			memcpy(var->sqldata, RSTRING_PTR(input->data) + row * var->sqllen, var->sqllen);
 			if (var->sqltype & 1) {
-				offset = FB_ALIGN(offset, sizeof(short));
-				var->sqlind = (short *)(fb_cursor->i_buffer + offset);
 				*var->sqlind = 0;
-				offset += sizeof(short);
 			}
-		} else if (var->sqltype & 1) {
-			var->sqldata = 0;
-			offset = FB_ALIGN(offset, sizeof(short));
-			var->sqlind = (short *)(fb_cursor->i_buffer + offset);
-			*var->sqlind = -1;
-			offset += sizeof(short);
-		} else {
-			rb_raise(rb_eFbError, "specified column is not permitted to be null");
 		}
 	}
 }
 
-static void fb_cursor_execute_withparams(struct FbCursor *fb_cursor, long argc, VALUE *argv)
+/* Whether packed data for the statement's parameters can be copied as is into a block's parameters. */
+static int fb_batch_block_takes_packed(struct FbCursor *fb_cursor, struct FbCursor *block_cursor, struct FbInputColumn *input)
 {
-	struct FbConnection *fb_connection;
+	long count;
 
-	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
-	/* Check the first object type of the parameters */
-	if (argc >= 1 && TYPE(argv[0]) == T_ARRAY) {
-		int i;
-		VALUE obj;
-		VALUE ary = argv[0];
-		if (RARRAY_LEN(ary) > 0 && TYPE(RARRAY_PTR(ary)[0]) == T_ARRAY) {
-			for (i = 0; i < RARRAY_LEN(ary); i++) {
-				obj = rb_ary_entry(ary, i);
-				fb_cursor_execute_withparams(fb_cursor, 1, &obj);
-			}
-		} else {
-			for (i = 0; i < argc; i++) {
-				obj = argv[i];
+	for (count = 0; count < fb_cursor->i_sqlda->sqld; count++) {
+		XSQLVAR *var = &fb_cursor->i_sqlda->sqlvar[count];
+		XSQLVAR *block_var = &block_cursor->i_sqlda->sqlvar[count];
+		if (NIL_P(input[count].values) &&
+			((var->sqltype & ~1) != (block_var->sqltype & ~1) || var->sqllen != block_var->sqllen || var->sqlscale != block_var->sqlscale)) {
+			return 0;
+		}
+	}
+	return 1;
+}
 
-				/* Set the input parameters */
-				Check_Type(obj, T_ARRAY);
-				fb_cursor_set_inputparams(fb_cursor, RARRAY_LEN(obj), RARRAY_PTR(obj));
+static VALUE statement_execute_columns2(VALUE args)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+	struct FbInputColumn *input;
+	VALUE self = rb_ary_pop(args);
+	VALUE columns = rb_ary_entry(args, 0);
+	long batch_size = NUM2LONG(rb_ary_entry(args, 1));
+	long params, count, per_block;
+	long affected = 0;
+	long i = 0;
 
-				/* Execute SQL statement */
-				isc_dsql_execute2(fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, fb_cursor->i_sqlda, NULL);
-				fb_error_check(fb_connection->isc_status);
-			}
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	params = fb_cursor->i_sqlda->sqld;
+	input = ALLOCA_N(struct FbInputColumn, params);
+	count = fb_input_columns(fb_cursor, columns, input);
+
+	per_block = count > 1 ? fb_statement_batch_rows(fb_connection, fb_cursor, self, batch_size) : 0;
+	while (i < count) {
+		struct FbCursor *block_cursor;
+		VALUE cursor;
+		long n, row;
+
+		cursor = fb_statement_batch_block(fb_connection, fb_cursor, self, &per_block, count - i, &n);
+		if (NIL_P(cursor)) break;
+		Data_Get_Struct(cursor, struct FbCursor, block_cursor);
+		if (!fb_batch_block_takes_packed(fb_cursor, block_cursor, input)) break;
+
+		for (row = 0; row < n; row++) {
+			fb_cursor_set_inputcolumns(fb_connection, block_cursor, row * params, input, params, i + row);
 		}
-	} else {
-		/* Set the input parameters */
-		fb_cursor_set_inputparams(fb_cursor, argc, argv);
-
-		/* Execute SQL statement */
-		isc_dsql_execute2(fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, fb_cursor->i_sqlda, NULL);
+		affected += fb_batch_block_run(fb_connection, block_cursor);
+		i += n;
+	}
+	for (; i < count; i++) {
+		fb_cursor_set_inputcolumns(fb_connection, fb_cursor, 0, input, params, i);
+		fb_isc_dsql_execute2(fb_connection, fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, fb_cursor->i_sqlda, NULL);
 		fb_error_check(fb_connection->isc_status);
+		affected += cursor_rows_affected(fb_cursor, fb_cursor->statement_type);
 	}
+	return LONG2NUM(affected);
 }
 
-static VALUE precision_from_sqlvar(XSQLVAR *sqlvar)
+/* call-seq:
+ *   execute_columns(columns) -> rows affected
+ *   execute_columns(columns, :batch_size => 100) -> rows affected
+ *
+ * Executes the prepared INSERT, UPDATE or DELETE once for each row of +columns+, a list
+ * with one vector per parameter, and returns the total number of rows affected.
+ * A vector is an Array of values, or for SMALLINT, INTEGER, BIGINT, FLOAT and DOUBLE PRECISION
+ * parameters a binary String of native values (<tt>Array#pack("s*")</tt>, "l*", "q*", "f*" or "d*";
+ * scaled numerics take the unscaled integers) or an FbPackedColumn from Cursor#fetch_columns.
+ * Values are copied from the vectors as each row is sent, without building an Array per row.
+ *
+ * Rows are grouped into EXECUTE BLOCKs as with execute_batch, but the first failing row
+ * raises an error, as execute would.
+ *
+ * If no transaction is currently active, a transaction is automatically started
+ * and is committed if all rows succeed.
+ */
+static VALUE statement_execute_columns(int argc, VALUE *argv, VALUE self)
 {
-	switch(sqlvar->sqltype & ~1) {
-		case SQL_TEXT:		return Qnil;
-		case SQL_VARYING:	return Qnil;
-		case SQL_SHORT:
-			switch (sqlvar->sqlsubtype) {
-				case 0:		return INT2FIX(0);
-				case 1:		return INT2FIX(4);
-				case 2:		return INT2FIX(4);
-			}
-			break;
-		case SQL_LONG:
-			switch (sqlvar->sqlsubtype) {
-				case 0:		return INT2FIX(0);
-				case 1:		return INT2FIX(9);
-				case 2:		return INT2FIX(9);
-			}
-			break;
-		case SQL_FLOAT:		return Qnil;
-		case SQL_DOUBLE:
-		case SQL_D_FLOAT:
-			switch (sqlvar->sqlsubtype) {
-				case 0:		return Qnil;
-				case 1:		return INT2FIX(15);
-				case 2:		return INT2FIX(15);
-			}
-			break;
-		case SQL_TIMESTAMP:	return Qnil;
-		case SQL_BLOB:		return Qnil;
-		case SQL_ARRAY:		return Qnil;
-		case SQL_QUAD:		return Qnil;
-		case SQL_TYPE_TIME:	return Qnil;
-		case SQL_TYPE_DATE:	return Qnil;
-		case SQL_INT64:
-			switch (sqlvar->sqlsubtype) {
-				case 0:		return INT2FIX(0);
-				case 1:		return INT2FIX(18);
-				case 2:		return INT2FIX(18);
-			}
-			break;
-	}
-	return Qnil;
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+	VALUE columns, opts;
+
+	rb_scan_args(argc, argv, "11", &columns, &opts);
+	Check_Type(columns, T_ARRAY);
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_statement_check(fb_cursor);
+	fb_statement_close_cursor(fb_connection, fb_cursor);
+
+	return fb_cursor_execute_transact(self, rb_ary_new3(2, columns, LONG2NUM(fb_batch_size(opts))), statement_execute_columns2);
 }
 
-static int no_lowercase(VALUE value)
+/* call-seq:
+ *   param_count() -> int
+ *
+ * Returns the number of parameters (place holders) in the prepared statement.
+ */
+static VALUE statement_param_count(VALUE self)
 {
-	VALUE local_value = StringValue(value);
-	int result = rb_funcall(re_lowercase, id_matches, 1, local_value) == Qnil;
-	return result;
+	struct FbCursor *fb_cursor;
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_statement_check(fb_cursor);
+	return INT2FIX(fb_cursor->i_sqlda->sqld);
 }
 
-static VALUE fb_cursor_fields_ary(XSQLDA *sqlda, short downcase_names)
+/* call-seq:
+ *   statement_type() -> int
+ *
+ * Returns the isc_info_sql_stmt_* type code reported by the server when the statement was prepared.
+ */
+static VALUE statement_statement_type(VALUE self)
 {
-	long cols;
-	long count;
-	XSQLVAR *var;
-	short dtp;
-	VALUE ary;
+	struct FbCursor *fb_cursor;
 
-	cols = sqlda->sqld;
-	if (cols == 0) {
-		return Qnil;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_statement_check(fb_cursor);
+	return INT2FIX(fb_cursor->statement_type);
+}
+
+/* call-seq:
+ *   rows_affected() -> int
+ *
+ * Asks the server how many rows the cursor's statement affected, or for a SELECT
+ * how many it has fetched so far.  The count costs a round trip, taken only when asked.
+ */
+static VALUE cursor_get_rows_affected(VALUE self)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	if (fb_cursor->stmt == 0) {
+		rb_raise(rb_eFbError, "dropped db cursor");
 	}
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+	return LONG2NUM(cursor_rows_affected(fb_cursor, fb_cursor->statement_type));
+}
 
-	ary = rb_ary_new();
-	for (count = 0; count < cols; count++) {
-		VALUE field;
-		VALUE name, type_code, sql_type, sql_subtype, display_size, internal_size, precision, scale, nullable;
+/* call-seq:
+ *   rows_affected() -> int
+ *
+ * Asks the server how many rows the last #execute affected, whether or not
+ * Connection#count_rows had it counted then.
+ */
+static VALUE statement_rows_affected(VALUE self)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-		var = &sqlda->sqlvar[count];
-		dtp = var->sqltype & ~1;
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	fb_statement_check(fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+	return LONG2NUM(cursor_rows_affected(fb_cursor, fb_cursor->statement_type));
+}
 
-		if (var->aliasname_length) { /* aliasname always present? */
-			name = rb_tainted_str_new(var->aliasname, var->aliasname_length);
-		} else {
-			name = rb_tainted_str_new(var->sqlname, var->sqlname_length);
-		}
-		if (downcase_names && no_lowercase(name)) {
-			rb_funcall(name, id_downcase_bang, 0);
+/* call-seq:
+ *   close() -> nil
+ *
+ * Closes any open result set and drops the prepared statement.
+ */
+static VALUE statement_close(VALUE self)
+{
+	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbCursor, fb_cursor);
+	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+
+	if (RTEST(fb_cursor->batch)) {
+		VALUE cursors = rb_funcall(fb_cursor->batch, rb_intern("values"), 0);
+		long i;
+		fb_cursor->batch = Qnil;
+		for (i = 0; i < RARRAY_LEN(cursors); i++) {
+			if (RTEST(rb_ary_entry(cursors, i)) && fb_connection->db) {
+				cursor_drop(rb_ary_entry(cursors, i));
+			}
 		}
-		rb_str_freeze(name);
-		type_code = INT2NUM((long)(var->sqltype & ~1));
-		sql_type = fb_sql_type_from_code(dtp, var->sqlsubtype);
-		sql_subtype = INT2FIX(var->sqlsubtype);
-		display_size = INT2NUM((long)var->sqllen);
-		if (dtp == SQL_VARYING) {
-			internal_size = INT2NUM((long)var->sqllen + sizeof(short));
-		} else {
-			internal_size = INT2NUM((long)var->sqllen);
+	}
+	if (fb_cursor->stmt) {
+		fb_statement_close_cursor(fb_connection, fb_cursor);
+		if (fb_connection->db) {
+			fb_isc_dsql_free_statement(fb_connection, fb_connection->isc_status, &fb_cursor->stmt, DSQL_drop);
+			fb_error_check(fb_connection->isc_status);
 		}
-		precision = precision_from_sqlvar(var);
-		scale = INT2NUM((long)var->sqlscale);
-		nullable = (var->sqltype & 1) ? Qtrue : Qfalse;
-
-		field = rb_struct_new(rb_sFbField, name, sql_type, sql_subtype, display_size, internal_size, precision, scale, nullable, type_code);
-		rb_ary_push(ary, field);
+		fb_cursor->stmt = 0;
 	}
-	rb_ary_freeze(ary);
-	return ary;
+	return Qnil;
+}
+
+/* call-seq:
+ *   error_code -> int
+ *
+ * Returns the sqlcode associated with the error.
+ */
+static VALUE error_error_code(VALUE error)
+{
+	rb_p(error);
+	return rb_iv_get(error, "error_code");
+}
+
+static char* dbp_create(long *length)
+{
+	char *dbp = ALLOC_N(char, 1);
+	*dbp = isc_dpb_version1;
+	*length = 1;
+	return dbp;
+}
+
+static char* dbp_add_string(char *dbp, char isc_dbp_code, char *s, long *length)
+{
+	char *buf;
+	long old_length = *length;
+	long s_len = strlen(s);
+	*length += 2 + s_len;
+	REALLOC_N(dbp, char, *length);
+	buf = dbp + old_length;
+	*buf++ = isc_dbp_code;
+	*buf++ = (char)s_len;
+	memcpy(buf, s, s_len);
+	return dbp;
 }
 
-static VALUE fb_cursor_fields_hash(VALUE fields_ary)
+static char* connection_create_dbp(VALUE self, long *length)
 {
-	int i;
-	VALUE hash = rb_hash_new();
+	char *dbp;
+	VALUE username, password, charset, role;
 
-	for (i = 0; i < RARRAY_LEN(fields_ary); i++) {
-		VALUE field = rb_ary_entry(fields_ary, i);
-		VALUE name = rb_struct_aref(field, LONG2NUM(0));
-		rb_hash_aset(hash, name, field);
-	}
+	username = rb_iv_get(self, "@username");
+	Check_Type(username, T_STRING);
+	password = rb_iv_get(self, "@password");
+	Check_Type(password, T_STRING);
+	role = rb_iv_get(self, "@role");
+	charset = rb_iv_get(self, "@charset");
 
-	return hash;
+	dbp = dbp_create(length);
+	dbp = dbp_add_string(dbp, isc_dpb_user_name, StringValuePtr(username), length);
+	dbp = dbp_add_string(dbp, isc_dpb_password, StringValuePtr(password), length);
+	if (!NIL_P(charset)) {
+		dbp = dbp_add_string(dbp, isc_dpb_lc_ctype, StringValuePtr(charset), length);
+	}
+	if (!NIL_P(role)) {
+		dbp = dbp_add_string(dbp, isc_dpb_sql_role_name, StringValuePtr(role), length);
+	}
+	return dbp;
 }
 
-static void fb_cursor_fetch_prep(struct FbCursor *fb_cursor)
+static const char* CONNECTION_PARMS[] = {
+	"@database",
+	"@username",
+	"@password",
+	"@charset",
+	"@role",
+	"@downcase_names",
+	(char *)0
+};
+
+static VALUE connection_create(isc_db_handle handle, VALUE db)
 {
+	unsigned short dialect;
+	unsigned short db_dialect;
+	VALUE downcase_names;
+	VALUE stmt_cache_size, count_rows;
+	VALUE segment_size;
+	const char *parm;
+	int i;
 	struct FbConnection *fb_connection;
-	long cols;
-	long count;
-	XSQLVAR *var;
-	short dtp;
-	long length;
-	long alignment;
-	long offset;
+	VALUE connection = Data_Make_Struct(rb_cFbConnection, struct FbConnection, fb_connection_mark, fb_connection_free, fb_connection);
+	fb_connection->db = handle;
+	fb_connection->transact = 0;
+	fb_connection->cursor = rb_ary_new();
+	fb_connection->self = connection;
+	fb_connection->lock = rb_mutex_new();
+	fb_connection->server_timeouts = -1;
+	fb_connection->timer_next = NULL;
+	fb_connection->timer_deadline = 0;
+	fb_connection->timer_cancel = 0;
+	fb_connection->timed_out = 0;
+	fb_connection->cancel_pending = 0;
+	fb_connection->call_generation = 0;
+	fb_connection->timer_generation = 0;
+	fb_connection->row_structs = rb_hash_new();
+	fb_connection->charsets = rb_hash_new();
+	fb_connection->transaction_options = Qnil;
+	fb_connection->transactions = 0;
+	fb_connection->stmt_cache = st_init_strtable();
+	fb_connection->stmt_cache_head = NULL;
+	fb_connection->stmt_cache_tail = NULL;
+	fb_connection->stmt_cache_size = 0;
+	fb_connection->stmt_cache_hits = 0;
+	fb_connection->stmt_cache_misses = 0;
+	fb_connection->stmt_cache_evictions = 0;
+	fb_connection->round_trips = 0;
+	count_rows = rb_iv_get(db, "@count_rows");
+	fb_connection->count_rows = NIL_P(count_rows) || RTEST(count_rows);
+	stmt_cache_size = rb_iv_get(db, "@statement_cache_size");
+	fb_connection->stmt_cache_max = NIL_P(stmt_cache_size) ? 0 : NUM2LONG(rb_funcall(stmt_cache_size, rb_intern("to_i"), 0));
+/*
+	connection_count++;
+	fb_connection->next = fb_connection_list;
+	fb_connection_list = fb_connection;
+*/
+	dialect = SQL_DIALECT_CURRENT;
+	db_dialect = fb_connection_db_SQL_Dialect(fb_connection);
 
-	fb_cursor_check(fb_cursor);
+	if (db_dialect < dialect) {
+		dialect = db_dialect;
+		/* TODO: downgrade warning */
+	}
 
-	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
-	fb_connection_check(fb_connection);
+	fb_connection->dialect = dialect;
+	fb_connection->db_dialect = db_dialect;
+	downcase_names = rb_iv_get(db, "@downcase_names");
+	fb_connection->downcase_names = RTEST(downcase_names);
+	fb_connection->decimal_mode = fb_decimal_mode(rb_iv_get(db, "@decimal"));
+	fb_connection->timestamp_format = fb_timestamp_format(rb_iv_get(db, "@timestamp_format"));
+	fb_connection->blob_format = fb_blob_format(rb_iv_get(db, "@blob_format"));
+	segment_size = rb_iv_get(db, "@blob_segment_size");
+	fb_connection->blob_segment_size = NIL_P(segment_size) ? USHRT_MAX : fb_blob_segment_size(segment_size);
+	fb_connection->statement_timeout = fb_statement_timeout(rb_iv_get(db, "@statement_timeout"));
+	fb_connection->transaction_options = fb_transaction_options_coerce(rb_iv_get(db, "@transaction_options"));
 
-	/* Check if open cursor */
-	if (!fb_cursor->open) {
-		rb_raise(rb_eFbError, "The cursor has not been opened. Use execute(query)");
+	for (i = 0; (parm = CONNECTION_PARMS[i]); i++) {
+		rb_iv_set(connection, parm, rb_iv_get(db, parm));
 	}
-	/* Describe output SQLDA */
-	isc_dsql_describe(fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->o_sqlda);
-	fb_error_check(fb_connection->isc_status);
 
-	/* Set the output SQLDA */
-	cols = fb_cursor->o_sqlda->sqld;
-	for (var = fb_cursor->o_sqlda->sqlvar, offset = 0, count = 0; count < cols; var++, count++) {
-		length = alignment = var->sqllen;
-		dtp = var->sqltype & ~1;
+	return connection;
+}
 
-		if (dtp == SQL_TEXT) {
-			alignment = 1;
-		} else if (dtp == SQL_VARYING) {
-			length += sizeof(short);
-			alignment = sizeof(short);
+static VALUE connection_names(VALUE self, const char *sql)
+{
+	VALUE row;
+	VALUE query = rb_str_new2(sql);
+	VALUE cursor = connection_execute(1, &query, self);
+	VALUE names = rb_ary_new();
+	struct FbConnection *fb_connection;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+
+	while ((row = cursor_fetch(0, NULL, cursor)) != Qnil) {
+		VALUE name = rb_ary_entry(row, 0);
+		if (fb_connection->downcase_names && no_lowercase(name)) {
+			rb_funcall(name, id_downcase_bang, 0);
 		}
-		offset = FB_ALIGN(offset, alignment);
-		var->sqldata = (char*)(fb_cursor->o_buffer + offset);
-		offset += length;
-		offset = FB_ALIGN(offset, sizeof(short));
-		var->sqlind = (short*)(fb_cursor->o_buffer + offset);
-		offset += sizeof(short);
+		rb_funcall(name, id_rstrip_bang, 0);
+		rb_ary_push(names, name);
 	}
+
+	cursor_close(cursor);
+	return names;
 }
 
-static VALUE fb_cursor_fetch(struct FbCursor *fb_cursor)
+/* call-seq:
+ *   table_names() -> array
+ *
+ * Returns sorted array of table names in connected database.
+ */
+static VALUE connection_table_names(VALUE self)
 {
-	struct FbConnection *fb_connection;
-	long cols;
-	VALUE ary;
-	long count;
-	XSQLVAR *var;
-	long dtp;
-	VALUE val;
-	VARY *vary;
-	double ratio;
-	double dval;
-	long scnt;
-	struct tm tms;
-
-	isc_blob_handle blob_handle;
-	ISC_QUAD blob_id;
-	unsigned short actual_seg_len;
-	static char blob_items[] = {
-		isc_info_blob_max_segment,
-		isc_info_blob_num_segments,
-		isc_info_blob_total_length
-	};
-	char blob_info[32];
-	char *p, item;
-	short length;
-	unsigned short max_segment = 0;
-	ISC_LONG num_segments = 0;
-	ISC_LONG total_length = 0;
+	const char *sql = "SELECT RDB$RELATION_NAME FROM RDB$RELATIONS "
+				"WHERE (RDB$SYSTEM_FLAG <> 1 OR RDB$SYSTEM_FLAG IS NULL) AND RDB$VIEW_BLR IS NULL "
+				"ORDER BY RDB$RELATION_NAME";
+	return connection_names(self, sql);
+}
 
-	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
-	fb_connection_check(fb_connection);
+/* call-seq:
+ *   generator_names() -> array
+ *
+ * Returns sorted array of generator names in connected database.
+ */
+static VALUE connection_generator_names(VALUE self)
+{
+	const char *sql = "SELECT RDB$GENERATOR_NAME FROM RDB$GENERATORS "
+				"WHERE (RDB$SYSTEM_FLAG IS NULL OR RDB$SYSTEM_FLAG <> 1) "
+				"ORDER BY RDB$GENERATOR_NAME";
+	return connection_names(self, sql);
+}
 
-	if (fb_cursor->eof) {
-		rb_raise(rb_eFbError, "Cursor is past end of data.");
+/* Returns the statement reserving a block of values from +generator+, taking the block size as its parameter.
+ * A name spelled as the server stores an unquoted identifier (upper case) is sent as it is,
+ * as is an all lower case one when generator_names reports names downcased;
+ * any other, such as a mixed case one, is quoted. */
+static VALUE fb_generator_reserve_sql(struct FbConnection *fb_connection, VALUE generator)
+{
+	VALUE name = rb_obj_as_string(generator);
+	const char *p = RSTRING_PTR(name);
+	long i, len = RSTRING_LEN(name);
+	int upper = len > 0 && ISALPHA(p[0]);
+	int lower = upper && fb_connection->downcase_names;
+	VALUE ident;
+
+	for (i = 0; (upper || lower) && i < len; i++) {
+		int other = ISDIGIT(p[i]) || p[i] == '_' || p[i] == '$';
+		upper = upper && (ISUPPER(p[i]) || other);
+		lower = lower && (ISLOWER(p[i]) || other);
 	}
-	/* Fetch one row */
-	if (isc_dsql_fetch(fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->o_sqlda) == SQLCODE_NOMORE) {
-		fb_cursor->eof = Qtrue;
-		return Qnil;
+	if (upper || lower) {
+		ident = name;
+	} else {
+		ident = rb_str_new2("\"");
+		for (i = 0; i < len; i++) {
+			rb_str_cat(ident, p[i] == '"' ? "\"\"" : p + i, p[i] == '"' ? 2 : 1);
+		}
+		rb_str_cat2(ident, "\"");
 	}
-	fb_error_check(fb_connection->isc_status);
-
-	/* Create the result tuple object */
-	cols = fb_cursor->o_sqlda->sqld;
-	ary = rb_ary_new2(cols);
-
-	/* Create the result objects for each columns */
-	for (count = 0; count < cols; count++) {
-		var = &fb_cursor->o_sqlda->sqlvar[count];
-		dtp = var->sqltype & ~1;
+	/* A singleton EXECUTE BLOCK returns its value in the execute's round trip */
+	if (fb_connection->dialect >= 3) {
+		return rb_sprintf("EXECUTE BLOCK (N BIGINT = ?) RETURNS (ID BIGINT) AS BEGIN ID = GEN_ID(%"PRIsVALUE", :N); END", ident);
+	}
+	return rb_sprintf("SELECT GEN_ID(%"PRIsVALUE", CAST(? AS INTEGER)) FROM RDB$DATABASE", ident);
+}
 
-		/* Check if column is null */
+/* Returns the +n+ values ending at +last+ as an Array of Integers. */
+static VALUE fb_id_range(ISC_INT64 last, long n)
+{
+	VALUE ids = rb_ary_new2(n);
+	long i;
 
-		if ((var->sqltype & 1) && (*var->sqlind < 0)) {
-			val = Qnil;
-		} else {
-			/* Set the column value to the result tuple */
+	for (i = n - 1; i >= 0; i--) {
+		rb_ary_push(ids, LL2NUM(last - i));
+	}
+	return ids;
+}
 
-			switch (dtp) {
-				case SQL_TEXT:
-					val = rb_tainted_str_new(var->sqldata, var->sqllen);
-					break;
+static long fb_id_count(VALUE n)
+{
+	long count = NUM2LONG(n);
 
-				case SQL_VARYING:
-					vary = (VARY*)var->sqldata;
-					val = rb_tainted_str_new(vary->vary_string, vary->vary_length);
-					break;
+	if (count < 1) {
+		rb_raise(rb_eArgError, "number of ids must be positive");
+	}
+	return count;
+}
 
-				case SQL_SHORT:
-					if (var->sqlscale < 0) {
-						ratio = 1;
-						for (scnt = 0; scnt > var->sqlscale; scnt--) ratio *= 10;
-						dval = (double)*(short*)var->sqldata/ratio;
-						val = rb_float_new(dval);
-					} else {
-						val = INT2NUM((long)*(short*)var->sqldata);
-					}
-					break;
+/* call-seq:
+ *   next_ids(generator, n) -> Array
+ *
+ * Reserves +n+ consecutive values of +generator+ with one GEN_ID(generator, n) and returns them,
+ * in ascending order.  Generator values are not transactional: they stay used even if the
+ * current transaction is rolled back.  See also Fb::IdAllocator.
+ */
+static VALUE connection_next_ids(VALUE self, VALUE generator, VALUE n)
+{
+	struct FbConnection *fb_connection;
+	long count = fb_id_count(n);
+	VALUE args[2];
+	VALUE rows;
 
-				case SQL_LONG:
-					if (var->sqlscale < 0) {
-						ratio = 1;
-						for (scnt = 0; scnt > var->sqlscale; scnt--) ratio *= 10;
-						dval = (double)*(ISC_LONG*)var->sqldata/ratio;
-						val = rb_float_new(dval);
-					} else {
-						val = INT2NUM(*(ISC_LONG*)var->sqldata);
-					}
-					break;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+	args[0] = fb_generator_reserve_sql(fb_connection, generator);
+	args[1] = LONG2NUM(count);
+	rows = connection_query(2, args, self);
+	return fb_id_range(NUM2LL(rb_ary_entry(rb_ary_entry(rows, 0), 0)), count);
+}
 
-				case SQL_FLOAT:
-					val = rb_float_new((double)*(float*)var->sqldata);
-					break;
+/* call-seq:
+ *   view_names() -> array
+ *
+ * Returns sorted array of view names in connected database.
+ */
+static VALUE connection_view_names(VALUE self)
+{
+	const char *sql = "SELECT RDB$RELATION_NAME, RDB$OWNER_NAME, RDB$VIEW_SOURCE FROM RDB$RELATIONS "
+				"WHERE (RDB$SYSTEM_FLAG <> 1 OR RDB$SYSTEM_FLAG IS NULL) AND NOT RDB$VIEW_BLR IS NULL AND RDB$FLAGS = 1 "
+				"ORDER BY RDB$RELATION_ID";
+	return connection_names(self, sql);
+}
 
-				case SQL_DOUBLE:
-					val = rb_float_new(*(double*)var->sqldata);
-					break;
-#if HAVE_LONG_LONG
-				case SQL_INT64:
-        				if (var->sqlscale < 0) {
-        					ratio = 1;
-        					for (scnt = 0; scnt > var->sqlscale; scnt--) ratio *= 10;
-        					dval = (double)*(long*)var->sqldata/ratio;
-        					val = rb_float_new(dval);
-        				} else {
-        					val = LL2NUM(*(LONG_LONG*)var->sqldata);
-        				}
-					break;
-#endif
-				case SQL_TIMESTAMP:
-					isc_decode_timestamp((ISC_TIMESTAMP *)var->sqldata, &tms);
-					val = fb_mktime(&tms, "local");
-					break;
+/* call-seq:
+ *   role_names() -> array
+ *
+ * Returns sorted array of role names in connected database.
+ */
+static VALUE connection_role_names(VALUE self)
+{
+	const char *sql = "SELECT * FROM RDB$ROLES WHERE RDB$SYSTEM_FLAG = 0 ORDER BY RDB$ROLE_NAME";
+	return connection_names(self, sql);
+}
 
-				case SQL_TYPE_TIME:
-					isc_decode_sql_time((ISC_TIME *)var->sqldata, &tms);
-					tms.tm_year = 100;
-					tms.tm_mon = 0;
-					tms.tm_mday = 1;
-					val = fb_mktime(&tms, "utc");
-					break;
+/* call-seq:
+ *   procedure_names() -> array
+ *
+ * Returns sorted array of stored procedure names in connected database.
+ */
+static VALUE connection_procedure_names(VALUE self)
+{
+	const char *sql = "SELECT RDB$PROCEDURE_NAME FROM RDB$PROCEDURES "
+				"ORDER BY RDB$PROCEDURE_NAME";
+	return connection_names(self, sql);
+}
 
-				case SQL_TYPE_DATE:
-					isc_decode_sql_date((ISC_DATE *)var->sqldata, &tms);
-					val = fb_mkdate(&tms);
-					break;
+/* call-seq:
+ *   trigger_names() -> array
+ *
+ * Returns sorted array of trigger names in connected database.
+ */
+static VALUE connection_trigger_names(VALUE self)
+{
+	const char *sql = "SELECT RDB$TRIGGER_NAME FROM RDB$TRIGGERS "
+				"ORDER BY RDB$TRIGGER_NAME";
+	return connection_names(self, sql);
+}
 
-				case SQL_BLOB:
-					blob_handle = 0;
-					blob_id = *(ISC_QUAD *)var->sqldata;
-					isc_open_blob2(fb_connection->isc_status, &fb_connection->db, &fb_connection->transact, &blob_handle, &blob_id, 0, NULL);
-					fb_error_check(fb_connection->isc_status);
-					isc_blob_info(
-						fb_connection->isc_status, &blob_handle,
-						sizeof(blob_items), blob_items,
-						sizeof(blob_info), blob_info);
-					fb_error_check(fb_connection->isc_status);
-					for (p = blob_info; *p != isc_info_end; p += length) {
-						item = *p++;
-						length = (short) isc_vax_integer(p,2);
-						p += 2;
-						switch (item) {
-							case isc_info_blob_max_segment:
-								max_segment = isc_vax_integer(p,length);
-								break;
-							case isc_info_blob_num_segments:
-								num_segments = isc_vax_integer(p,length);
-								break;
-							case isc_info_blob_total_length:
-								total_length = isc_vax_integer(p,length);
-								break;
-						}
-					}
-					val = rb_tainted_str_new(NULL,total_length);
-					for (p = RSTRING_PTR(val); num_segments > 0; num_segments--, p += actual_seg_len) {
-						isc_get_segment(fb_connection->isc_status, &blob_handle, &actual_seg_len, max_segment, p);
-						fb_error_check(fb_connection->isc_status);
-					}
-					isc_close_blob(fb_connection->isc_status, &blob_handle);
-					fb_error_check(fb_connection->isc_status);
-					break;
+/* call-seq:
+ *   columns(table_name) -> array
+ *
+ * Returns array of objects describing each column of table_name.
+ */
 
-				case SQL_ARRAY:
-					rb_warn("ARRAY not supported (yet)");
-					val = Qnil;
-					break;
+static VALUE connection_columns(VALUE self, VALUE table_name)
+{
+    int i;
+    struct FbConnection *fb_connection;
+    VALUE re_default = rb_reg_new("^\\s*DEFAULT\\s+", strlen("^\\s*DEFAULT\\s+"), IGNORECASE);
+    VALUE re_rdb = rb_reg_new("^RDB\\$", strlen("^RDB\\$"), 0);
+    VALUE empty = rb_str_new(NULL, 0);
+    VALUE columns = rb_ary_new();
+    const char *sql = "SELECT r.rdb$field_name NAME, r.rdb$field_source, f.rdb$field_type, f.rdb$field_sub_type, "
+                "f.rdb$field_length, f.rdb$field_precision, f.rdb$field_scale SCALE, "
+                "COALESCE(r.rdb$default_source, f.rdb$default_source), "
+                "COALESCE(r.rdb$null_flag, f.rdb$null_flag) "
+                "FROM rdb$relation_fields r "
+                "JOIN rdb$fields f ON r.rdb$field_source = f.rdb$field_name "
+                "WHERE UPPER(r.rdb$relation_name) = ? "
+                "ORDER BY r.rdb$field_position";
+    VALUE query = rb_str_new2(sql);
+    VALUE upcase_table_name = rb_funcall(table_name, rb_intern("upcase"), 0);
+    VALUE query_parms[] = { query, upcase_table_name };
+    VALUE rs = connection_query(2, query_parms, self);
+    Data_Get_Struct(self, struct FbConnection, fb_connection);
+    for (i = 0; i < RARRAY_LEN(rs); i++) {
+        VALUE row = rb_ary_entry(rs, i);
+        VALUE name = rb_ary_entry(row, 0);
+        VALUE domain = rb_ary_entry(row, 1);
+        VALUE sql_type = rb_ary_entry(row, 2);
+        VALUE sql_subtype = rb_ary_entry(row, 3);
+        VALUE length = rb_ary_entry(row, 4);
+        VALUE precision = rb_ary_entry(row, 5);
+        VALUE scale = rb_ary_entry(row, 6);
+        VALUE dflt = rb_ary_entry(row, 7);
+        VALUE not_null = rb_ary_entry(row, 8);
+        VALUE nullable;
+        VALUE column;
+        rb_funcall(name, id_rstrip_bang, 0);
+        rb_funcall(domain, id_rstrip_bang, 0);
+        if (fb_connection->downcase_names && no_lowercase(name)) {
+          rb_funcall(name, id_downcase_bang, 0);
+        }
+        if (rb_funcall(re_rdb, rb_intern("match"), 1, domain) != Qnil) {
+            domain = Qnil;
+        }
+        if (sql_subtype == Qnil) {
+            sql_subtype = INT2NUM(0);
+        }
+        sql_type = sql_type_from_code(self, sql_type, sql_subtype);
+        if (dflt != Qnil) {
+            rb_funcall(dflt, id_sub_bang, 2, re_default, empty);
+        }
+        nullable = RTEST(not_null) ? Qfalse : Qtrue;
+        column = rb_struct_new(rb_sFbColumn, name, domain, sql_type, sql_subtype, length, precision, scale, dflt, nullable);
+        rb_ary_push(columns, column);
+    }
+    rb_ary_freeze(columns);
+    return columns;
+}
 
-				default:
-					rb_raise(rb_eFbError, "Specified table includes unsupported datatype (%ld)", dtp);
-					break;
-			}
-		}
-		rb_ary_push(ary, val);
+char *p(char *prompt, VALUE s)
+{
+	char *sz;
+	if (TYPE(s) != T_STRING) {
+		s = rb_funcall(s, rb_intern("to_s"), 0);
 	}
-
-	return ary;
+	sz = StringValuePtr(s);
+	printf("%s: %s\n", prompt, sz);
+	return sz;
 }
 
-static long cursor_rows_affected(struct FbCursor *fb_cursor, long statement_type)
+static VALUE connection_index_columns(VALUE self, VALUE index_name)
 {
-	long inserted = 0, selected = 0, updated = 0, deleted = 0;
-	char request[] = { isc_info_sql_records };
-	char response[64], *r;
-	ISC_STATUS isc_status[20];
-
-	isc_dsql_sql_info(isc_status, &fb_cursor->stmt, sizeof(request), request, sizeof(response), response);
-	fb_error_check(isc_status);
-	if (response[0] != isc_info_sql_records) { return -1; }
+	const char *sql_columns = "SELECT * "
+						"FROM RDB$INDEX_SEGMENTS "
+						"WHERE RDB$INDEX_SEGMENTS.RDB$INDEX_NAME = ? "
+						"ORDER BY RDB$INDEX_SEGMENTS.RDB$FIELD_POSITION";
+	VALUE query_columns = rb_str_new2(sql_columns);
+	VALUE query_parms[] = { query_columns, index_name };
+	VALUE result = connection_query(2, query_parms, self);
+	VALUE columns = rb_ary_new();
+	int i;
+	struct FbConnection *fb_connection;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
 
-	r = response + 3; /* skip past first cluster */
-	while (*r != isc_info_end) {
-		char count_type = *r++;
-		short len = isc_vax_integer(r, sizeof(short));
-		r += sizeof(short);
-		switch (count_type) {
-			case isc_info_req_insert_count:
-				inserted = isc_vax_integer(r, len);
-				break;
-			case isc_info_req_select_count:
-				selected = isc_vax_integer(r, len);
-				break;
-			case isc_info_req_update_count:
-				updated = isc_vax_integer(r, len);
-				break;
-			case isc_info_req_delete_count:
-				deleted = isc_vax_integer(r, len);
-				break;
+	for (i = 0; i < RARRAY_LEN(result); i++) {
+		VALUE row = rb_ary_entry(result, i);
+		VALUE name = rb_ary_entry(row, 1);
+		rb_funcall(name, id_rstrip_bang, 0);
+		if (fb_connection->downcase_names && no_lowercase(name)) {
+			rb_funcall(name, id_downcase_bang, 0);
 		}
-		r += len;
-	}
-	switch (statement_type) {
-		case isc_info_sql_stmt_select: return selected;
-		case isc_info_sql_stmt_insert: return inserted;
-		case isc_info_sql_stmt_update: return updated;
-		case isc_info_sql_stmt_delete: return deleted;
-		default: return inserted + selected + updated + deleted;
+		rb_ary_push(columns, name);
 	}
+	return columns;
 }
 
 /* call-seq:
- *   execute2(sql, *args) -> nil or rows affected
+ *   indexes() -> Hash
  *
- * This function is not published.
+ * Returns a hash of indexes, keyed by index name.
  */
-static VALUE cursor_execute2(VALUE args)
+static VALUE connection_indexes(VALUE self)
 {
-	struct FbCursor *fb_cursor;
+	const char *sql_indexes = "SELECT RDB$INDICES.RDB$RELATION_NAME, RDB$INDICES.RDB$INDEX_NAME, RDB$INDICES.RDB$UNIQUE_FLAG, RDB$INDICES.RDB$INDEX_TYPE "
+						"FROM RDB$INDICES "
+						"  JOIN RDB$RELATIONS ON RDB$INDICES.RDB$RELATION_NAME = RDB$RELATIONS.RDB$RELATION_NAME "
+						"WHERE (RDB$RELATIONS.RDB$SYSTEM_FLAG <> 1 OR RDB$RELATIONS.RDB$SYSTEM_FLAG IS NULL) ";
+	VALUE query_indexes = rb_str_new2(sql_indexes);
+	VALUE ary_indexes = connection_query(1, &query_indexes, self);
+	VALUE indexes = rb_hash_new();
+	int i;
 	struct FbConnection *fb_connection;
-	char *sql;
-	VALUE rb_sql;
-	long statement;
-	long length;
-	long in_params;
-	long cols;
-	long rows_affected;
-	VALUE result = Qnil;
-	char isc_info_buff[16];
-	char isc_info_stmt[] = { isc_info_sql_stmt_type };
-
-	VALUE self = rb_ary_pop(args);
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
 
-	rb_sql = rb_ary_shift(args);
-	sql = StringValuePtr(rb_sql);
+	for (i = 0; i < RARRAY_LEN(ary_indexes); i++) {
+		VALUE index_struct;
+		VALUE row = rb_ary_entry(ary_indexes, i);
+		VALUE table_name = rb_ary_entry(row, 0);
+		VALUE index_name = rb_ary_entry(row, 1);
+		VALUE unique = rb_ary_entry(row, 2);
+		VALUE descending = rb_ary_entry(row, 3);
+		VALUE columns = connection_index_columns(self, index_name);
 
-	/* Prepare query */
-	isc_dsql_prepare(fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, 0, sql, fb_connection_dialect(fb_connection), fb_cursor->o_sqlda);
-	fb_error_check(fb_connection->isc_status);
+		rb_funcall(table_name, id_rstrip_bang, 0);
+		rb_funcall(index_name, id_rstrip_bang, 0);
 
-	/* Get the statement type */
-	isc_dsql_sql_info(fb_connection->isc_status, &fb_cursor->stmt,
-			sizeof(isc_info_stmt), isc_info_stmt,
-			sizeof(isc_info_buff), isc_info_buff);
-	fb_error_check(fb_connection->isc_status);
+		if (fb_connection->downcase_names) {
+			if (no_lowercase(table_name)) {
+				rb_funcall(table_name, id_downcase_bang, 0);
+			}
+			if (no_lowercase(index_name)) {
+				rb_funcall(index_name, id_downcase_bang, 0);
+			}
+		}
 
-	if (isc_info_buff[0] == isc_info_sql_stmt_type) {
-		length = isc_vax_integer(&isc_info_buff[1], 2);
-		statement = isc_vax_integer(&isc_info_buff[3], (short)length);
-	} else {
-		statement = 0;
-	}
-	/* Describe the parameters */
-	isc_dsql_describe_bind(fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->i_sqlda);
-	fb_error_check(fb_connection->isc_status);
+		rb_str_freeze(table_name);
+		rb_str_freeze(index_name);
 
-	isc_dsql_describe(fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->o_sqlda);
-	fb_error_check(fb_connection->isc_status);
+		unique = RTEST(unique) ? Qtrue : Qfalse;
+		descending = RTEST(descending) ? Qtrue : Qfalse;
 
-	/* Get the number of parameters and reallocate the SQLDA */
-	in_params = fb_cursor->i_sqlda->sqld;
-	if (fb_cursor->i_sqlda->sqln < in_params) {
-		xfree(fb_cursor->i_sqlda);
-		fb_cursor->i_sqlda = sqlda_alloc(in_params);
-		/* Describe again */
-		isc_dsql_describe_bind(fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->i_sqlda);
-		fb_error_check(fb_connection->isc_status);
+		index_struct = rb_struct_new(rb_sFbIndex, table_name, index_name, unique, descending, columns);
+		rb_hash_aset(indexes, index_name, index_struct);
 	}
+	return indexes;
+}
 
-    /* Get the size of parameters buffer and reallocate it */
-	if (in_params) {
-		length = calculate_buffsize(fb_cursor->i_sqlda);
-		if (length > fb_cursor->i_buffer_size) {
-			fb_cursor->i_buffer = xrealloc(fb_cursor->i_buffer, length);
-			fb_cursor->i_buffer_size = length;
-		}
-	}
+/* call-seq:
+ *   statement_cache_stats() -> Hash
+ *
+ * Returns a hash describing the prepared statement cache, with the keys
+ * :size, :capacity, :hits, :misses and :evictions.
+ */
+static VALUE connection_statement_cache_stats(VALUE self)
+{
+	struct FbConnection *fb_connection;
+	VALUE stats = rb_hash_new();
 
-    /* Execute the SQL statement if it is not query */
-	if (!fb_cursor->o_sqlda->sqld) {
-		if (statement == isc_info_sql_stmt_start_trans) {
-			rb_raise(rb_eFbError, "use Fb::Connection#transaction()");
-		} else if (statement == isc_info_sql_stmt_commit) {
-			rb_raise(rb_eFbError, "use Fb::Connection#commit()");
-		} else if (statement == isc_info_sql_stmt_rollback) {
-			rb_raise(rb_eFbError, "use Fb::Connection#rollback()");
-		} else if (in_params) {
-			fb_cursor_execute_withparams(fb_cursor, RARRAY_LEN(args), RARRAY_PTR(args));
-		} else {
-			isc_dsql_execute2(fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, NULL, NULL);
-			fb_error_check(fb_connection->isc_status);
-		}
-		rows_affected = cursor_rows_affected(fb_cursor, statement);
-		result = INT2NUM(rows_affected);
-	} else {
-		/* Open cursor if the SQL statement is query */
-		/* Get the number of columns and reallocate the SQLDA */
-		cols = fb_cursor->o_sqlda->sqld;
-		if (fb_cursor->o_sqlda->sqln < cols) {
-			xfree(fb_cursor->o_sqlda);
-			fb_cursor->o_sqlda = sqlda_alloc(cols);
-			/* Describe again */
-			isc_dsql_describe(fb_connection->isc_status, &fb_cursor->stmt, 1, fb_cursor->o_sqlda);
-			fb_error_check(fb_connection->isc_status);
-		}
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	rb_hash_aset(stats, ID2SYM(rb_intern("size")), LONG2NUM(fb_connection->stmt_cache_size));
+	rb_hash_aset(stats, ID2SYM(rb_intern("capacity")), LONG2NUM(fb_connection->stmt_cache_max));
+	rb_hash_aset(stats, ID2SYM(rb_intern("hits")), LONG2NUM(fb_connection->stmt_cache_hits));
+	rb_hash_aset(stats, ID2SYM(rb_intern("misses")), LONG2NUM(fb_connection->stmt_cache_misses));
+	rb_hash_aset(stats, ID2SYM(rb_intern("evictions")), LONG2NUM(fb_connection->stmt_cache_evictions));
+	return stats;
+}
 
-		if (in_params) {
-			fb_cursor_set_inputparams(fb_cursor, RARRAY_LEN(args), RARRAY_PTR(args));
-		}
+/* call-seq:
+ *   clear_statement_cache() -> nil
+ *
+ * Drops every prepared statement held in the statement cache.
+ * The cache is also cleared before DDL statements and when the connection is closed.
+ */
+static VALUE connection_clear_statement_cache(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_stmt_cache_clear(fb_connection);
+	return Qnil;
+}
 
-		/* Open cursor */
-		isc_dsql_execute2(fb_connection->isc_status, &fb_connection->transact, &fb_cursor->stmt, SQLDA_VERSION1, in_params ? fb_cursor->i_sqlda : NULL, NULL);
-		fb_error_check(fb_connection->isc_status);
-		fb_cursor->open = Qtrue;
+/* call-seq:
+ *   decimal() -> symbol
+ *
+ * Returns how NUMERIC and DECIMAL columns are decoded:
+ * :float, :bigdecimal, :rational or :scaled_integer.
+ */
+static VALUE connection_decimal(VALUE self)
+{
+	struct FbConnection *fb_connection;
 
-		/* Get the size of results buffer and reallocate it */
-		length = calculate_buffsize(fb_cursor->o_sqlda);
-		if (length > fb_cursor->o_buffer_size) {
-			fb_cursor->o_buffer = xrealloc(fb_cursor->o_buffer, length);
-			fb_cursor->o_buffer_size = length;
-		}
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return fb_decimal_mode_name(fb_connection->decimal_mode);
+}
 
-		/* Set the description attributes */
-		fb_cursor->fields_ary = fb_cursor_fields_ary(fb_cursor->o_sqlda, fb_connection->downcase_names);
-		fb_cursor->fields_hash = fb_cursor_fields_hash(fb_cursor->fields_ary);
-	}
-	return result;
+/* call-seq:
+ *   decimal = mode
+ *
+ * Sets how NUMERIC and DECIMAL columns are decoded by cursors opened from now on.
+ */
+static VALUE connection_set_decimal(VALUE self, VALUE mode)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->decimal_mode = fb_decimal_mode(mode);
+	return mode;
 }
 
 /* call-seq:
- *   execute(sql, *args) -> nil or rows affected
+ *   timestamp_format() -> symbol
  *
- * This function is no longer published.
+ * Returns how TIMESTAMP and TIME columns are decoded: :time, :epoch_float or :epoch_int.
  */
-static VALUE cursor_execute(int argc, VALUE* argv, VALUE self)
+static VALUE connection_timestamp_format(VALUE self)
 {
-	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
-	VALUE args;
 
-	if (argc < 1) {
-		rb_raise(rb_eArgError, "At least 1 argument required.");
-	}
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return fb_timestamp_format_name(fb_connection->timestamp_format);
+}
 
-	args = rb_ary_new4(argc, argv);
-	rb_ary_push(args, self);
+/* call-seq:
+ *   timestamp_format = format
+ *
+ * Sets how TIMESTAMP and TIME columns are decoded by cursors opened from now on.
+ */
+static VALUE connection_set_timestamp_format(VALUE self, VALUE format)
+{
+	struct FbConnection *fb_connection;
 
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
-	fb_connection_check(fb_connection);
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->timestamp_format = fb_timestamp_format(format);
+	return format;
+}
 
-	if (fb_cursor->open) {
-		isc_dsql_free_statement(fb_connection->isc_status, &fb_cursor->stmt, DSQL_close);
-		fb_error_check(fb_connection->isc_status);
-		fb_cursor->open = Qfalse;
-	}
+/* call-seq:
+ *   transaction_options() -> Fb::TransactionOptions or nil
+ *
+ * Returns the options of transactions started without any, including automatic transactions.
+ */
+static VALUE connection_transaction_options(VALUE self)
+{
+	struct FbConnection *fb_connection;
 
-	if (!fb_connection->transact) {
-		VALUE result;
-		int state;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return fb_connection->transaction_options;
+}
 
-		fb_connection_transaction_start(fb_connection, Qnil);
-		fb_cursor->auto_transact = fb_connection->transact;
+/* call-seq:
+ *   transaction_options = options
+ *
+ * Sets the options of transactions started without any from now on: an Fb::TransactionOptions,
+ * a Hash or String compiled into one here, or nil for Firebird's defaults.
+ */
+static VALUE connection_set_transaction_options(VALUE self, VALUE options)
+{
+	struct FbConnection *fb_connection;
 
-		result = rb_protect(cursor_execute2, args, &state);
-		if (state) {
-			fb_connection_rollback(fb_connection);
-			return rb_funcall(rb_mKernel, rb_intern("raise"), 0);
-		} else if (result != Qnil) {
-			fb_connection_commit(fb_connection);
-			return result;
-		} else {
-			return result;
-		}
-	} else {
-		return cursor_execute2(args);
-	}
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->transaction_options = fb_transaction_options_coerce(options);
+	return options;
 }
 
-static VALUE fb_hash_from_ary(VALUE fields, VALUE row)
+/* call-seq:
+ *   count_rows() -> true or false
+ *
+ * Returns whether #execute and Statement#execute report the rows affected by
+ * INSERT, UPDATE and DELETE statements.
+ */
+static VALUE connection_count_rows(VALUE self)
 {
-	VALUE hash = rb_hash_new();
-	int i;
-	for (i = 0; i < RARRAY_LEN(fields); i++) {
-		VALUE field = rb_ary_entry(fields, i);
-		VALUE name = rb_struct_aref(field, LONG2NUM(0));
-		VALUE v = rb_ary_entry(row, i);
-		rb_hash_aset(hash, name, v);
-	}
-	return hash;
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return fb_connection->count_rows ? Qtrue : Qfalse;
 }
 
-static int hash_format(int argc, VALUE *argv)
+/* call-seq:
+ *   count_rows = true or false
+ *
+ * Counting the rows affected costs a round trip after every execute.  With it off,
+ * executes return -1 and Statement#rows_affected asks for the count only when it is wanted.
+ */
+static VALUE connection_set_count_rows(VALUE self, VALUE count_rows)
 {
-	if (argc == 0 || argv[0] == ID2SYM(rb_intern("array"))) {
-		return 0;
-	} else if (argv[0] == ID2SYM(rb_intern("hash"))) {
-		return 1;
-	} else {
-		rb_raise(rb_eFbError, "Unknown format");
-	}
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->count_rows = RTEST(count_rows);
+	return count_rows;
 }
 
 /* call-seq:
- *   fetch() -> Array
- *   fetch(:array) -> Array
- *   fetch(:hash) -> Hash
+ *   round_trips() -> int
  *
- * Reads and returns a single row from the open cursor in either an Array or a Hash,
- * where the column names or aliases from the query form the keys.
- * If the +downcase_names+ attribute of the associated connection evaluates to true,
- * the keys are lower case, except where the column name was mixed case to begin with.
+ * Returns how many requests this connection has sent to the server and waited on:
+ * attaches, prepares, describes, info requests, executes, transaction calls and blob opens,
+ * creates, writes and closes.  Not counted are fetches and blob reads, which the client serves
+ * from data it read ahead (it does go back to the server every so many rows), statement
+ * allocations and frees, which it sends along with the next request, and statement timeouts,
+ * sent with the execute.  Neither are the statements and blobs released when the garbage
+ * collector frees their objects, nor cancel requests.  Clients older than Firebird 2.1 send
+ * allocations and frees on their own, so with them the count runs low.
  */
-static VALUE cursor_fetch(int argc, VALUE* argv, VALUE self)
+static VALUE connection_round_trips(VALUE self)
 {
-	VALUE ary;
-	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-	int hash_row = hash_format(argc, argv);
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return ULONG2NUM(fb_connection->round_trips);
+}
 
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	fb_cursor_fetch_prep(fb_cursor);
+/* call-seq:
+ *   blob_format() -> symbol
+ *
+ * Returns how BLOB columns are decoded: :string or :stream.
+ * A :stream blob raises Fb::Error if read after the transaction that fetched it.
+ */
+static VALUE connection_blob_format(VALUE self)
+{
+	struct FbConnection *fb_connection;
 
-	ary = fb_cursor_fetch(fb_cursor);
-	return hash_row ? fb_hash_from_ary(fb_cursor->fields_ary, ary) : ary;
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return fb_blob_format_name(fb_connection->blob_format);
 }
 
 /* call-seq:
- *   fetchall() -> Array of Arrays
- *   fetchall(:array) -> Array of Arrays
- *   fetchall(:hash) -> Array of Hashes
+ *   blob_format = format
  *
- * Returns the remainder of the rows from the open cursor, with each row represented
- * by either an Array or a Hash, where the column names or aliases from the query form the keys.
- * If the +downcase_names+ attribute of the associated connection evaluates to true,
- * the keys are lower case, except where the column name was mixed case to begin with.
+ * Sets how BLOB columns are decoded by cursors opened from now on.
  */
-static VALUE cursor_fetchall(int argc, VALUE* argv, VALUE self)
+static VALUE connection_set_blob_format(VALUE self, VALUE format)
 {
-	VALUE ary, row;
-	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-	int hash_rows = hash_format(argc, argv);
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->blob_format = fb_blob_format(format);
+	return format;
+}
 
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	fb_cursor_fetch_prep(fb_cursor);
+/* call-seq:
+ *   create_blob {|writer| } -> Fb::Blob
+ *
+ * Creates a blob and yields an Fb::BlobWriter to fill it with <tt>writer << data</tt>
+ * or <tt>writer.write(data)</tt>.  Returns an Fb::Blob for the new blob, which can be
+ * passed as a BLOB parameter without copying the data again.
+ *
+ * Blobs are created in the current transaction and must be bound before it ends.
+ * If the block raises, the blob is cancelled.
+ */
+static VALUE connection_create_blob(VALUE self)
+{
+	struct FbConnection *fb_connection;
+	struct FbBlobWriter *fb_blob_writer;
+	ISC_STATUS isc_status[20];
+	ISC_QUAD blob_id;
+	VALUE writer;
+	int state = 0;
 
-	ary = rb_ary_new();
-	for (;;) {
-		row = fb_cursor_fetch(fb_cursor);
-		if (NIL_P(row)) break;
-		if (hash_rows) {
-			rb_ary_push(ary, fb_hash_from_ary(fb_cursor->fields_ary, row));
-		} else {
-			rb_ary_push(ary, row);
-		}
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection_check(fb_connection);
+	if (!fb_connection->transact) {
+		rb_raise(rb_eFbError, "create_blob requires a transaction");
 	}
+	writer = Data_Make_Struct(rb_cFbBlobWriter, struct FbBlobWriter, fb_blob_writer_mark, fb_blob_writer_free, fb_blob_writer);
+	fb_blob_writer->connection = self;
+	fb_blob_writer->handle = 0;
+	fb_blob_writer->length = 0;
+	fb_blob_writer->segment_size = fb_connection->blob_segment_size;
+	fb_blob_writer->buffer = ALLOC_N(char, fb_blob_writer->segment_size);
+
+	fb_isc_create_blob2(fb_connection, fb_connection->isc_status,&fb_connection->db,&fb_connection->transact,
+		&fb_blob_writer->handle,&blob_id,0,NULL);
+	fb_error_check(fb_connection->isc_status);
 
-	return ary;
+	rb_protect(fb_blob_writer_yield, writer, &state);
+	if (!state) {
+		rb_protect(fb_blob_writer_finish, writer, &state);
+	}
+	if (state) {
+		isc_cancel_blob(isc_status, &fb_blob_writer->handle);
+		fb_blob_writer->handle = 0;
+		rb_jump_tag(state);
+	}
+	fb_isc_close_blob(fb_connection, fb_connection->isc_status, &fb_blob_writer->handle);
+	fb_blob_writer->handle = 0;
+	fb_error_check(fb_connection->isc_status);
+	return fb_blob_new(self, &blob_id);
 }
 
 /* call-seq:
- *   each() {|Array| } -> nil
- *   each(:array) {|Array| } -> nil
- *   each(:hash) {|Hash| } -> nil
+ *   blob_segment_size() -> int
  *
- * Iterates the rows from the open cursor, passing each one to a block in either
- * an Array or a Hash, where the column names or aliases from the query form the keys.
- * If the +downcase_names+ attribute of the associated connection evaluates to true,
- * the keys are lower case, except where the column name was mixed case to begin with.
+ * Returns the segment size used when writing BLOB parameters.
  */
-static VALUE cursor_each(int argc, VALUE* argv, VALUE self)
+static VALUE connection_blob_segment_size(VALUE self)
 {
-	VALUE row;
-	struct FbCursor *fb_cursor;
+	struct FbConnection *fb_connection;
 
-	int hash_rows = hash_format(argc, argv);
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return LONG2NUM(fb_connection->blob_segment_size);
+}
 
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	fb_cursor_fetch_prep(fb_cursor);
+/* call-seq:
+ *   blob_segment_size = size
+ *
+ * Sets the segment size used when writing BLOB parameters, from 1 to 65535 bytes.
+ */
+static VALUE connection_set_blob_segment_size(VALUE self, VALUE size)
+{
+	struct FbConnection *fb_connection;
 
-	for (;;) {
-		row = fb_cursor_fetch(fb_cursor);
-		if (NIL_P(row)) break;
-		if (hash_rows) {
-			rb_yield(fb_hash_from_ary(fb_cursor->fields_ary, row));
-		} else {
-			rb_yield(row);
-		}
-	}
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->blob_segment_size = fb_blob_segment_size(size);
+	return size;
+}
 
-	return Qnil;
+/* call-seq:
+ *   statement_timeout() -> int
+ *
+ * Returns the default statement timeout of execute and query in milliseconds, 0 for none.
+ */
+static VALUE connection_statement_timeout(VALUE self)
+{
+	struct FbConnection *fb_connection;
+
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	return LONG2NUM(fb_connection->statement_timeout);
 }
 
 /* call-seq:
- *   close(sql, *args) -> nil
+ *   statement_timeout = ms
  *
- * Closes the cursor.  If a transaction was automatically started for this cursor, the transaction is commited.
+ * Sets the default statement timeout in milliseconds; 0 or nil disables it.
+ * Statements already prepared with Connection#prepare keep the timeout they were created with.
  */
-static VALUE cursor_close(VALUE self)
+static VALUE connection_set_statement_timeout(VALUE self, VALUE timeout)
 {
-	struct FbCursor *fb_cursor;
 	struct FbConnection *fb_connection;
 
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
-	fb_cursor_check(fb_cursor);
+	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	fb_connection->statement_timeout = fb_statement_timeout(timeout);
+	return timeout;
+}
 
-	/* Close the cursor */
-	if (fb_cursor->stmt) {
-		isc_dsql_free_statement(fb_connection->isc_status, &fb_cursor->stmt, DSQL_close);
-		fb_error_check_warn(fb_connection->isc_status);
-		isc_dsql_free_statement(fb_connection->isc_status, &fb_cursor->stmt, DSQL_drop);
-		fb_error_check(fb_connection->isc_status);
-		fb_cursor->open = Qfalse;
-		if (fb_connection->transact == fb_cursor->auto_transact) {
-			isc_commit_transaction(fb_connection->isc_status, &fb_connection->transact);
-			fb_cursor->auto_transact = fb_connection->transact;
-			fb_error_check(fb_connection->isc_status);
+/*
+static void define_attrs(VALUE klass, char **attrs)
+{
+	char *parm;
+	while ((parm = *attrs))
+	{
+		rb_define_attr(klass, parm+1, 1, 1);
+		attrs++;
+	}
+}
+*/
+
+static VALUE default_string(VALUE hash, const char *key, const char *def)
+{
+	VALUE sym = ID2SYM(rb_intern(key));
+	VALUE val = rb_hash_aref(hash, sym);
+	return NIL_P(val) ? rb_str_new2(def) : StringValue(val);
+}
+
+static VALUE default_int(VALUE hash, const char *key, int def)
+{
+	VALUE sym = ID2SYM(rb_intern(key));
+	VALUE val = rb_hash_aref(hash, sym);
+	return NIL_P(val) ? INT2NUM(def) : val;
+}
+
+static VALUE database_allocate_instance(VALUE klass)
+{
+    NEWOBJ(obj, struct RObject);
+    OBJSETUP(obj, klass, T_OBJECT);
+    return (VALUE)obj;
+}
+
+static VALUE hash_from_connection_string(VALUE cs)
+{
+	VALUE hash = rb_hash_new();
+	VALUE re_SemiColon = rb_reg_regcomp(rb_str_new2("\\s*;\\s*"));
+	VALUE re_Equal = rb_reg_regcomp(rb_str_new2("\\s*=\\s*"));
+	ID id_split = rb_intern("split");
+	VALUE pairs = rb_funcall(cs, id_split, 1, re_SemiColon);
+	int i;
+	for (i = 0; i < RARRAY_LEN(pairs); i++) {
+		VALUE pair = rb_ary_entry(pairs, i);
+		VALUE keyValue = rb_funcall(pair, id_split, 1, re_Equal);
+		if (RARRAY_LEN(keyValue) == 2) {
+			VALUE key = rb_ary_entry(keyValue, 0);
+			VALUE val = rb_ary_entry(keyValue, 1);
+			rb_hash_aset(hash, rb_str_intern(key), val);
 		}
 	}
-	fb_cursor->fields_ary = Qnil;
-	fb_cursor->fields_hash = Qnil;
-	return Qnil;
+	return hash;
 }
 
-/* call-seq:
- *   drop() -> nil
- *
- * Drops the cursor.
- *
- * TODO: How is this different from close()?
- */
-static VALUE cursor_drop(VALUE self)
+static void check_page_size(int page_size)
 {
-	struct FbCursor *fb_cursor;
-	struct FbConnection *fb_connection;
-	int i;
-
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	fb_cursor_drop(fb_cursor);
-	fb_cursor->fields_ary = Qnil;
-	fb_cursor->fields_hash = Qnil;
-
-	/* reset the reference from connection */
-	Data_Get_Struct(fb_cursor->connection, struct FbConnection, fb_connection);
-	for (i = 0; i < RARRAY_LEN(fb_connection->cursor); i++) {
-		if (RARRAY_PTR(fb_connection->cursor)[i] == self) {
-			RARRAY_PTR(fb_connection->cursor)[i] = Qnil;
-		}
+	if (page_size != 1024 && page_size != 2048 && page_size != 4096 && page_size != 8192 && page_size != 16384) {
+		rb_raise(rb_eFbError, "Invalid page size: %d", page_size);
 	}
-
-	return Qnil;
 }
 
 /* call-seq:
- *   fields() -> Array
- *   fields(:array) -> Array
- *   fields(:hash) -> Hash
+ *   Database.new(options) -> Database
  *
- * Return an array of Field Structs or a hash indexed by field name.
- * If the +downcase_names+ attribute of the associated connection evaluates to true,
- * the keys are lower case, except where the column name was mixed case to begin with.
+ * Initialize Database with Hash of values:
+ * :database:: Full Firebird connection string, e.g. 'localhost:/var/fbdata/drivertest.fdb' (required)
+ * :username:: database username (default: 'sysdba')
+ * :password:: database password (default: 'masterkey')
+ * :charset:: character set to be used with the connection (default: 'NONE')
+ * :role:: database role to connect using (default: nil)
+ * :downcase_names:: Column names are reported in lowercase, unless they were originally mixed case (default: nil).
+ * :page_size:: page size to use when creating a database (default: 1024)
+ * :statement_cache_size:: number of prepared statements each connection keeps for reuse, keyed by SQL text (default: 0, disabled)
+ * :decimal:: how NUMERIC and DECIMAL columns are returned: :float, :bigdecimal, :rational or :scaled_integer, the unscaled integer of minor units (default: :float)
+ * :timestamp_format:: how TIMESTAMP and TIME columns are returned: :time, or seconds since the epoch as :epoch_float or :epoch_int (default: :time).
+ *                     A change of local time zone applies to statements executed after it.
+ * :blob_format:: how BLOB columns are returned: :string, or :stream for an Fb::Blob read on demand (default: :string).
+ *                An Fb::Blob can only be read in the transaction that fetched it, so fetch :stream
+ *                blobs within Connection#transaction: an automatic transaction ends with its statement.
+ * :blob_segment_size:: bytes per segment when writing BLOB parameters, up to 65535 (default: 65535)
+ * :statement_timeout:: milliseconds a statement may run before Fb::TimeoutError is raised; enforced by Firebird 4 servers, otherwise by a client timer (default: 0, none)
+ * :count_rows:: whether executes report the rows affected, at the cost of a round trip each; see Connection#count_rows= (default: true)
+ * :transaction_options:: Fb::TransactionOptions, or a Hash or String to compile into one, for transactions started without options, including automatic ones (default: nil, Firebird's defaults)
  */
-static VALUE cursor_fields(int argc, VALUE* argv, VALUE self)
+static VALUE database_initialize(int argc, VALUE *argv, VALUE self)
 {
-	struct FbCursor *fb_cursor;
+	VALUE parms, database;
 
-	Data_Get_Struct(self, struct FbCursor, fb_cursor);
-	if (argc == 0 || argv[0] == ID2SYM(rb_intern("array"))) {
-		return fb_cursor->fields_ary;
-	} else if (argv[0] == ID2SYM(rb_intern("hash"))) {
-		return fb_cursor->fields_hash;
-	} else {
-		rb_raise(rb_eFbError, "Unknown format");
+	if (argc >= 1) {
+		parms = argv[0];
+		if (TYPE(parms) == T_STRING) {
+			parms = hash_from_connection_string(parms);
+		} else {
+			Check_Type(parms, T_HASH);
+		}
+		database = rb_hash_aref(parms, ID2SYM(rb_intern("database")));
+		if (NIL_P(database)) rb_raise(rb_eFbError, "Database must be specified.");
+		rb_iv_set(self, "@database", database);
+		rb_iv_set(self, "@username", default_string(parms, "username", "sysdba"));
+		rb_iv_set(self, "@password", default_string(parms, "password", "masterkey"));
+		rb_iv_set(self, "@charset", default_string(parms, "charset", "NONE"));
+		rb_iv_set(self, "@role", rb_hash_aref(parms, ID2SYM(rb_intern("role"))));
+		rb_iv_set(self, "@downcase_names", rb_hash_aref(parms, ID2SYM(rb_intern("downcase_names"))));
+		rb_iv_set(self, "@page_size", default_int(parms, "page_size", 1024));
+		rb_iv_set(self, "@statement_cache_size", default_int(parms, "statement_cache_size", 0));
+		rb_iv_set(self, "@decimal", rb_hash_aref(parms, ID2SYM(rb_intern("decimal"))));
+		fb_decimal_mode(rb_iv_get(self, "@decimal"));
+		rb_iv_set(self, "@timestamp_format", rb_hash_aref(parms, ID2SYM(rb_intern("timestamp_format"))));
+		fb_timestamp_format(rb_iv_get(self, "@timestamp_format"));
+		rb_iv_set(self, "@blob_format", rb_hash_aref(parms, ID2SYM(rb_intern("blob_format"))));
+		fb_blob_format(rb_iv_get(self, "@blob_format"));
+		rb_iv_set(self, "@blob_segment_size", default_int(parms, "blob_segment_size", USHRT_MAX));
+		fb_blob_segment_size(rb_iv_get(self, "@blob_segment_size"));
+		rb_iv_set(self, "@statement_timeout", default_int(parms, "statement_timeout", 0));
+		fb_statement_timeout(rb_iv_get(self, "@statement_timeout"));
+		rb_iv_set(self, "@count_rows", rb_hash_aref(parms, ID2SYM(rb_intern("count_rows"))));
+		rb_iv_set(self, "@transaction_options", fb_transaction_options_coerce(rb_hash_aref(parms, ID2SYM(rb_intern("transaction_options")))));
 	}
+	return self;
 }
 
 /* call-seq:
- *   error_code -> int
+ *   create() -> Database
+ *   create() {|connection| } -> Database
  *
- * Returns the sqlcode associated with the error.
+ * Create a database using the current database options.
+ * If a block is provided, an open connection to the new database is passed to it
+ * before being automatically closed.
  */
-static VALUE error_error_code(VALUE error)
+static VALUE database_create(VALUE self)
 {
-	rb_p(error);
-	return rb_iv_get(error, "error_code");
-}
+	ISC_STATUS isc_status[20];
+	isc_db_handle handle = 0;
+	isc_tr_handle local_transact = 0;
+	VALUE parms, fmt, stmt;
+	char *sql;
 
-static char* dbp_create(long *length)
-{
-	char *dbp = ALLOC_N(char, 1);
-	*dbp = isc_dpb_version1;
-	*length = 1;
-	return dbp;
-}
+	VALUE database = rb_iv_get(self, "@database");
+	VALUE username = rb_iv_get(self, "@username");
+	VALUE password = rb_iv_get(self, "@password");
+	VALUE page_size = rb_iv_get(self, "@page_size");
+	VALUE charset = rb_iv_get(self, "@charset");
 
-static char* dbp_add_string(char *dbp, char isc_dbp_code, char *s, long *length)
-{
-	char *buf;
-	long old_length = *length;
-	long s_len = strlen(s);
-	*length += 2 + s_len;
-	REALLOC_N(dbp, char, *length);
-	buf = dbp + old_length;
-	*buf++ = isc_dbp_code;
-	*buf++ = (char)s_len;
-	memcpy(buf, s, s_len);
-	return dbp;
-}
+	check_page_size(NUM2INT(page_size));
 
-static char* connection_create_dbp(VALUE self, long *length)
-{
-	char *dbp;
-	VALUE username, password, charset, role;
+	parms = rb_ary_new3(5, database, username, password, page_size, charset);
 
-	username = rb_iv_get(self, "@username");
-	Check_Type(username, T_STRING);
-	password = rb_iv_get(self, "@password");
-	Check_Type(password, T_STRING);
-	role = rb_iv_get(self, "@role");
-	charset = rb_iv_get(self, "@charset");
+	fmt = rb_str_new2("CREATE DATABASE '%s' USER '%s' PASSWORD '%s' PAGE_SIZE = %d DEFAULT CHARACTER SET %s;");
+	stmt = rb_funcall(fmt, rb_intern("%"), 1, parms);
+	sql = StringValuePtr(stmt);
 
-	dbp = dbp_create(length);
-	dbp = dbp_add_string(dbp, isc_dpb_user_name, StringValuePtr(username), length);
-	dbp = dbp_add_string(dbp, isc_dpb_password, StringValuePtr(password), length);
-	if (!NIL_P(charset)) {
-		dbp = dbp_add_string(dbp, isc_dpb_lc_ctype, StringValuePtr(charset), length);
+	if (fb_isc_dsql_execute_immediate(NULL, isc_status, &handle, &local_transact, 0, sql, 3, NULL) != 0) {
+		fb_error_check(isc_status);
 	}
-	if (!NIL_P(role)) {
-		dbp = dbp_add_string(dbp, isc_dpb_sql_role_name, StringValuePtr(role), length);
+	if (handle) {
+		if (rb_block_given_p()) {
+			VALUE connection = connection_create(handle, self);
+			rb_ensure(rb_yield,connection,connection_close,connection);
+		} else {
+			fb_isc_detach_database(NULL, isc_status, &handle);
+			fb_error_check(isc_status);
+		}
 	}
-	return dbp;
-}
 
-static const char* CONNECTION_PARMS[] = {
-	"@database",
-	"@username",
-	"@password",
-	"@charset",
-	"@role",
-	"@downcase_names",
-	(char *)0
-};
+	return self;
+}
 
-static VALUE connection_create(isc_db_handle handle, VALUE db)
+/* call-seq:
+ *   Database.create(options) -> Database
+ *   Database.create(options) {|connection| } -> Database
+ *
+ * Create a database using the specified options (see: Database.new for details of options Hash).
+ * If a block is provided, an open connection to the new database is passed to it
+ * before being automatically closed.
+ */
+static VALUE database_s_create(int argc, VALUE *argv, VALUE klass)
 {
-	unsigned short dialect;
-	unsigned short db_dialect;
-	VALUE downcase_names;
-	const char *parm;
-	int i;
-	struct FbConnection *fb_connection;
-	VALUE connection = Data_Make_Struct(rb_cFbConnection, struct FbConnection, fb_connection_mark, fb_connection_free, fb_connection);
-	fb_connection->db = handle;
-	fb_connection->transact = 0;
-	fb_connection->cursor = rb_ary_new();
-/*
-	connection_count++;
-	fb_connection->next = fb_connection_list;
-	fb_connection_list = fb_connection;
-*/
-	dialect = SQL_DIALECT_CURRENT;
-	db_dialect = fb_connection_db_SQL_Dialect(fb_connection);
-
-	if (db_dialect < dialect) {
-		dialect = db_dialect;
-		/* TODO: downgrade warning */
-	}
-
-	fb_connection->dialect = dialect;
-	fb_connection->db_dialect = db_dialect;
-	downcase_names = rb_iv_get(db, "@downcase_names");
-	fb_connection->downcase_names = RTEST(downcase_names);
-
-	for (i = 0; (parm = CONNECTION_PARMS[i]); i++) {
-		rb_iv_set(connection, parm, rb_iv_get(db, parm));
-	}
-
-	return connection;
+	VALUE obj = database_allocate_instance(klass);
+	database_initialize(argc, argv, obj);
+	return database_create(obj);
 }
 
-static VALUE connection_names(VALUE self, const char *sql)
+/* call-seq:
+ *   connect() -> Connection
+ *   connect() {|connection| } -> nil
+ *
+ * Connect to the database specified by the current database options.
+ *
+ * If a block is provided, the open connection is passed to it before being
+ * automatically closed.
+ */
+static VALUE database_connect(VALUE self)
 {
-	VALUE row;
-	VALUE query = rb_str_new2(sql);
-	VALUE cursor = connection_execute(1, &query, self);
-	VALUE names = rb_ary_new();
-	struct FbConnection *fb_connection;
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
-
-	while ((row = cursor_fetch(0, NULL, cursor)) != Qnil) {
-		VALUE name = rb_ary_entry(row, 0);
-		if (fb_connection->downcase_names && no_lowercase(name)) {
-			rb_funcall(name, id_downcase_bang, 0);
-		}
-		rb_funcall(name, id_rstrip_bang, 0);
-		rb_ary_push(names, name);
-	}
+	ISC_STATUS isc_status[20];
+	char *dbp;
+	long length;
+	isc_db_handle handle = 0;
+	VALUE database = rb_iv_get(self, "@database");
 
-	cursor_close(cursor);
-	return names;
+	Check_Type(database, T_STRING);
+	dbp = connection_create_dbp(self, &length);
+	fb_isc_attach_database(NULL, isc_status, 0, StringValuePtr(database), &handle, (short)length, dbp);
+	xfree(dbp);
+	fb_error_check(isc_status);
+	{
+		VALUE connection = connection_create(handle, self);
+		if (rb_block_given_p()) {
+			return rb_ensure(rb_yield, connection, connection_close, connection);
+			return Qnil;
+		} else {
+			return connection;
+		}
+	}
 }
 
 /* call-seq:
- *   table_names() -> array
+ *   Database.connect(options) -> Connection
+ *   Database.connect(options) {|connection| } -> nil
  *
- * Returns sorted array of table names in connected database.
+ * Connect to a database using the options given (see: Database.new for details of options Hash).
+ *
+ * If a block is provided, the open connection is passed to it before being
+ * automatically closed.
  */
-static VALUE connection_table_names(VALUE self)
+static VALUE database_s_connect(int argc, VALUE *argv, VALUE klass)
 {
-	const char *sql = "SELECT RDB$RELATION_NAME FROM RDB$RELATIONS "
-				"WHERE (RDB$SYSTEM_FLAG <> 1 OR RDB$SYSTEM_FLAG IS NULL) AND RDB$VIEW_BLR IS NULL "
-				"ORDER BY RDB$RELATION_NAME";
-	return connection_names(self, sql);
+	VALUE obj = database_allocate_instance(klass);
+	database_initialize(argc, argv, obj);
+	return database_connect(obj);
 }
 
 /* call-seq:
- *   generator_names() -> array
+ *   drop() -> nil
  *
- * Returns sorted array of generator names in connected database.
+ * Drop the database specified by the current database options.
  */
-static VALUE connection_generator_names(VALUE self)
+static VALUE database_drop(VALUE self)
 {
-	const char *sql = "SELECT RDB$GENERATOR_NAME FROM RDB$GENERATORS "
-				"WHERE (RDB$SYSTEM_FLAG IS NULL OR RDB$SYSTEM_FLAG <> 1) "
-				"ORDER BY RDB$GENERATOR_NAME";
-	return connection_names(self, sql);
+	struct FbConnection *fb_connection;
+
+	VALUE connection = database_connect(self);
+	Data_Get_Struct(connection, struct FbConnection, fb_connection);
+	fb_isc_drop_database(fb_connection, fb_connection->isc_status, &fb_connection->db);
+	fb_error_check(fb_connection->isc_status);
+	/* fb_connection_remove(fb_connection); */
+	return Qnil;
 }
 
 /* call-seq:
- *   view_names() -> array
+ *   Database.drop(options) -> nil
  *
- * Returns sorted array of view names in connected database.
+ * Drop the database specified by the options given (see: Database.new for details of options Hash).
  */
-static VALUE connection_view_names(VALUE self)
+static VALUE database_s_drop(int argc, VALUE *argv, VALUE klass)
 {
-	const char *sql = "SELECT RDB$RELATION_NAME, RDB$OWNER_NAME, RDB$VIEW_SOURCE FROM RDB$RELATIONS "
-				"WHERE (RDB$SYSTEM_FLAG <> 1 OR RDB$SYSTEM_FLAG IS NULL) AND NOT RDB$VIEW_BLR IS NULL AND RDB$FLAGS = 1 "
-				"ORDER BY RDB$RELATION_ID";
-	return connection_names(self, sql);
+	VALUE obj = database_allocate_instance(klass);
+	database_initialize(argc, argv, obj);
+	return database_drop(obj);
 }
 
 /* call-seq:
- *   role_names() -> array
+ *   Fb.worker_threads -> int
  *
- * Returns sorted array of role names in connected database.
+ * Returns the number of worker threads that run fbclient calls for fibers under a Fiber.scheduler.
  */
-static VALUE connection_role_names(VALUE self)
+static VALUE fb_s_worker_threads(VALUE self)
 {
-	const char *sql = "SELECT * FROM RDB$ROLES WHERE RDB$SYSTEM_FLAG = 0 ORDER BY RDB$ROLE_NAME";
-	return connection_names(self, sql);
+	return LONG2NUM(fb_worker_max);
 }
 
 /* call-seq:
- *   procedure_names() -> array
+ *   Fb.worker_threads = n
  *
- * Returns sorted array of stored procedure names in connected database.
+ * Sets the number of worker threads used for fibers under a Fiber.scheduler (default: 4).
+ * Each runs one fbclient call at a time.  Workers already started keep running, so the pool only grows.
  */
-static VALUE connection_procedure_names(VALUE self)
+static VALUE fb_s_set_worker_threads(VALUE self, VALUE n)
 {
-	const char *sql = "SELECT RDB$PROCEDURE_NAME FROM RDB$PROCEDURES "
-				"ORDER BY RDB$PROCEDURE_NAME";
-	return connection_names(self, sql);
+	long count = NUM2LONG(n);
+
+	if (count < 1) {
+		rb_raise(rb_eArgError, "worker_threads must be at least 1");
+	}
+	fb_worker_max = count;
+	return n;
 }
 
-/* call-seq:
- *   trigger_names() -> array
- *
- * Returns sorted array of trigger names in connected database.
- */
-static VALUE connection_trigger_names(VALUE self)
+/* connection pool */
+
+#define POOL_PING_AFTER 1.0	/* seconds idle before a connection is pinged on checkout */
+
+struct FbPool {
+	VALUE database;
+	VALUE lock;	/* Mutex guarding idle, busy and open */
+	VALUE cond;	/* ConditionVariable signalled when a connection is returned or discarded */
+	VALUE idle;	/* Array of [connection, checkin time], most recently returned last */
+	VALUE busy;	/* Hash of checked out connections */
+	long size;
+	long open;	/* connections attached or being attached */
+	double timeout;
+	double idle_timeout;
+	int closed;
+	long peak;
+	long checkouts;
+	long waits;
+	long timeouts;
+	long reaped;
+	long discarded;
+	double wait_time;
+	double max_wait;
+};
+
+enum FbPoolTake { POOL_TAKE_IDLE, POOL_TAKE_NEW, POOL_TAKE_WAIT, POOL_TAKE_TIMEOUT };
+
+struct FbPoolCheckout {
+	struct FbPool *fb_pool;
+	enum FbPoolTake take;
+	VALUE connection;
+	double idle_since;
+	double start;
+	VALUE reaped;	/* idle connections to close once the lock is released */
+};
+
+static void fb_pool_mark(struct FbPool *fb_pool)
 {
-	const char *sql = "SELECT RDB$TRIGGER_NAME FROM RDB$TRIGGERS "
-				"ORDER BY RDB$TRIGGER_NAME";
-	return connection_names(self, sql);
+	rb_gc_mark(fb_pool->database);
+	rb_gc_mark(fb_pool->lock);
+	rb_gc_mark(fb_pool->cond);
+	rb_gc_mark(fb_pool->idle);
+	rb_gc_mark(fb_pool->busy);
 }
 
-/* call-seq:
- *   columns(table_name) -> array
- *
- * Returns array of objects describing each column of table_name.
- */
+static void fb_pool_free(struct FbPool *fb_pool)
+{
+	xfree(fb_pool);
+}
 
-static VALUE connection_columns(VALUE self, VALUE table_name)
+static VALUE pool_alloc(VALUE klass)
 {
-    int i;
-    struct FbConnection *fb_connection;
-    VALUE re_default = rb_reg_new("^\\s*DEFAULT\\s+", strlen("^\\s*DEFAULT\\s+"), IGNORECASE);
-    VALUE re_rdb = rb_reg_new("^RDB\\$", strlen("^RDB\\$"), 0);
-    VALUE empty = rb_str_new(NULL, 0);
-    VALUE columns = rb_ary_new();
-    const char *sql = "SELECT r.rdb$field_name NAME, r.rdb$field_source, f.rdb$field_type, f.rdb$field_sub_type, "
-                "f.rdb$field_length, f.rdb$field_precision, f.rdb$field_scale SCALE, "
-                "COALESCE(r.rdb$default_source, f.rdb$default_source), "
-                "COALESCE(r.rdb$null_flag, f.rdb$null_flag) "
-                "FROM rdb$relation_fields r "
-                "JOIN rdb$fields f ON r.rdb$field_source = f.rdb$field_name "
-                "WHERE UPPER(r.rdb$relation_name) = ? "
-                "ORDER BY r.rdb$field_position";
-    VALUE query = rb_str_new2(sql);
-    VALUE upcase_table_name = rb_funcall(table_name, rb_intern("upcase"), 0);
-    VALUE query_parms[] = { query, upcase_table_name };
-    VALUE rs = connection_query(2, query_parms, self);
-    Data_Get_Struct(self, struct FbConnection, fb_connection);
-    for (i = 0; i < RARRAY_LEN(rs); i++) {
-        VALUE row = rb_ary_entry(rs, i);
-        VALUE name = rb_ary_entry(row, 0);
-        VALUE domain = rb_ary_entry(row, 1);
-        VALUE sql_type = rb_ary_entry(row, 2);
-        VALUE sql_subtype = rb_ary_entry(row, 3);
-        VALUE length = rb_ary_entry(row, 4);
-        VALUE precision = rb_ary_entry(row, 5);
-        VALUE scale = rb_ary_entry(row, 6);
-        VALUE dflt = rb_ary_entry(row, 7);
-        VALUE not_null = rb_ary_entry(row, 8);
-        VALUE nullable;
-        VALUE column;
-        rb_funcall(name, id_rstrip_bang, 0);
-        rb_funcall(domain, id_rstrip_bang, 0);
-        if (fb_connection->downcase_names && no_lowercase(name)) {
-          rb_funcall(name, id_downcase_bang, 0);
-        }
-        if (rb_funcall(re_rdb, rb_intern("match"), 1, domain) != Qnil) {
-            domain = Qnil;
-        }
-        if (sql_subtype == Qnil) {
-            sql_subtype = INT2NUM(0);
-        }
-        sql_type = sql_type_from_code(self, sql_type, sql_subtype);
-        if (dflt != Qnil) {
-            rb_funcall(dflt, id_sub_bang, 2, re_default, empty);
-        }
-        nullable = RTEST(not_null) ? Qfalse : Qtrue;
-        column = rb_struct_new(rb_sFbColumn, name, domain, sql_type, sql_subtype, length, precision, scale, dflt, nullable);
-        rb_ary_push(columns, column);
-    }
-    rb_ary_freeze(columns);
-    return columns;
+	struct FbPool *fb_pool;
+	VALUE obj = Data_Make_Struct(klass, struct FbPool, fb_pool_mark, fb_pool_free, fb_pool);
+
+	fb_pool->database = Qnil;
+	fb_pool->lock = Qnil;
+	fb_pool->cond = Qnil;
+	fb_pool->idle = Qnil;
+	fb_pool->busy = Qnil;
+	fb_pool->closed = 1;
+	return obj;
 }
 
-char *p(char *prompt, VALUE s)
+static struct FbPool *fb_pool_check_retrieve(VALUE self)
 {
-	char *sz;
-	if (TYPE(s) != T_STRING) {
-		s = rb_funcall(s, rb_intern("to_s"), 0);
+	struct FbPool *fb_pool;
+
+	Data_Get_Struct(self, struct FbPool, fb_pool);
+	if (NIL_P(fb_pool->database)) {
+		rb_raise(rb_eFbError, "uninitialized pool");
 	}
-	sz = StringValuePtr(s);
-	printf("%s: %s\n", prompt, sz);
-	return sz;
+	return fb_pool;
 }
 
-static VALUE connection_index_columns(VALUE self, VALUE index_name)
+/* Closes a connection, ignoring errors from one that is already broken. */
+static void fb_pool_discard(VALUE connection)
 {
-	const char *sql_columns = "SELECT * "
-						"FROM RDB$INDEX_SEGMENTS "
-						"WHERE RDB$INDEX_SEGMENTS.RDB$INDEX_NAME = ? "
-						"ORDER BY RDB$INDEX_SEGMENTS.RDB$FIELD_POSITION";
-	VALUE query_columns = rb_str_new2(sql_columns);
-	VALUE query_parms[] = { query_columns, index_name };
-	VALUE result = connection_query(2, query_parms, self);
-	VALUE columns = rb_ary_new();
-	int i;
-	struct FbConnection *fb_connection;
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
+	int state = 0;
 
-	for (i = 0; i < RARRAY_LEN(result); i++) {
-		VALUE row = rb_ary_entry(result, i);
-		VALUE name = rb_ary_entry(row, 1);
-		rb_funcall(name, id_rstrip_bang, 0);
-		if (fb_connection->downcase_names && no_lowercase(name)) {
-			rb_funcall(name, id_downcase_bang, 0);
+	rb_protect(connection_close, connection, &state);
+	if (state) rb_set_errinfo(Qnil);
+}
+
+/* Moves connections idle longer than idle_timeout to reaped.  Called with the lock held. */
+static long fb_pool_reap_locked(struct FbPool *fb_pool, double now, VALUE reaped)
+{
+	long n = 0;
+	VALUE entry;
+
+	while (RARRAY_LEN(fb_pool->idle) > 0) {
+		entry = rb_ary_entry(fb_pool->idle, 0);
+		if (now - NUM2DBL(rb_ary_entry(entry, 1)) < fb_pool->idle_timeout) break;
+		rb_ary_shift(fb_pool->idle);
+		rb_ary_push(reaped, rb_ary_entry(entry, 0));
+		fb_pool->open--;
+		n++;
+	}
+	fb_pool->reaped += n;
+	return n;
+}
+
+static VALUE fb_pool_take(VALUE arg)
+{
+	struct FbPoolCheckout *co = (struct FbPoolCheckout *)arg;
+	struct FbPool *fb_pool = co->fb_pool;
+	double now = fb_monotonic_nsec() / 1e9;
+	double remaining;
+	VALUE entry;
+
+	if (fb_pool->closed) {
+		rb_raise(rb_eFbError, "pool is closed");
+	}
+	fb_pool_reap_locked(fb_pool, now, co->reaped);
+	if (RARRAY_LEN(fb_pool->idle) > 0) {
+		entry = rb_ary_pop(fb_pool->idle);
+		co->connection = rb_ary_entry(entry, 0);
+		co->idle_since = NUM2DBL(rb_ary_entry(entry, 1));
+		rb_hash_aset(fb_pool->busy, co->connection, Qtrue);
+		co->take = POOL_TAKE_IDLE;
+	} else if (fb_pool->open < fb_pool->size) {
+		fb_pool->open++;
+		co->take = POOL_TAKE_NEW;
+	} else {
+		remaining = fb_pool->timeout - (now - co->start);
+		if (remaining <= 0) {
+			fb_pool->timeouts++;
+			co->take = POOL_TAKE_TIMEOUT;
+		} else {
+			rb_funcall(fb_pool->cond, rb_intern("wait"), 2, fb_pool->lock, rb_float_new(remaining));
+			co->take = POOL_TAKE_WAIT;
 		}
-		rb_ary_push(columns, name);
 	}
-	return columns;
+	return Qnil;
+}
+
+/* Gives up a connection slot: the connection was discarded or never attached. */
+static VALUE fb_pool_release_slot(VALUE arg)
+{
+	struct FbPoolCheckout *co = (struct FbPoolCheckout *)arg;
+
+	if (!NIL_P(co->connection)) {
+		rb_hash_delete(co->fb_pool->busy, co->connection);
+	}
+	co->fb_pool->open--;
+	rb_funcall(co->fb_pool->cond, rb_intern("signal"), 0);
+	return Qnil;
+}
+
+static VALUE fb_pool_add_busy(VALUE arg)
+{
+	struct FbPoolCheckout *co = (struct FbPoolCheckout *)arg;
+
+	rb_hash_aset(co->fb_pool->busy, co->connection, Qtrue);
+	return Qnil;
+}
+
+/* A cheap round trip to make sure an idle connection still works. */
+static int fb_pool_alive(VALUE connection)
+{
+	struct FbConnection *fb_connection;
+	ISC_STATUS isc_status[20];
+
+	Data_Get_Struct(connection, struct FbConnection, fb_connection);
+	if (!fb_connection->db) return 0;
+#ifdef HAVE_FB_PING
+	fb_isc_ping(fb_connection, isc_status, &fb_connection->db);
+#else
+	{
+		char item = isc_info_db_SQL_dialect;
+		char buffer[16];
+		fb_isc_database_info(fb_connection, isc_status, &fb_connection->db, 1, &item, sizeof(buffer), buffer);
+	}
+#endif
+	return !(isc_status[0] == 1 && isc_status[1]);
+}
+
+static VALUE fb_pool_connect(VALUE database)
+{
+	return database_connect(database);
 }
 
 /* call-seq:
- *   indexes() -> Hash
+ *   checkout() -> Connection
  *
- * Returns a hash of indexes, keyed by index name.
+ * Takes a connection from the pool, attaching a new one while fewer than +size+ are open.
+ * Otherwise waits up to +timeout+ seconds for one to be checked in, then raises Fb::TimeoutError.
+ * Connections idle for more than a second are pinged first and replaced if they have gone bad.
  */
-static VALUE connection_indexes(VALUE self)
+static VALUE pool_checkout(VALUE self)
+{
+	struct FbPool *fb_pool = fb_pool_check_retrieve(self);
+	struct FbPoolCheckout co;
+	double waited;
+	int state = 0;
+	int waiting = 0;
+	long i, in_use;
+
+	co.fb_pool = fb_pool;
+	co.start = fb_monotonic_nsec() / 1e9;
+	co.reaped = rb_ary_new();
+	for (;;) {
+		co.connection = Qnil;
+		rb_mutex_synchronize(fb_pool->lock, fb_pool_take, (VALUE)&co);
+		for (i = 0; i < RARRAY_LEN(co.reaped); i++) {
+			fb_pool_discard(rb_ary_entry(co.reaped, i));
+		}
+		rb_ary_clear(co.reaped);
+
+		if (co.take == POOL_TAKE_IDLE) {
+			if (fb_monotonic_nsec() / 1e9 - co.idle_since < POOL_PING_AFTER || fb_pool_alive(co.connection)) break;
+			fb_pool->discarded++;
+			fb_pool_discard(co.connection);
+			rb_mutex_synchronize(fb_pool->lock, fb_pool_release_slot, (VALUE)&co);
+		} else if (co.take == POOL_TAKE_NEW) {
+			co.connection = rb_protect(fb_pool_connect, fb_pool->database, &state);
+			if (state) {
+				co.connection = Qnil;
+				rb_mutex_synchronize(fb_pool->lock, fb_pool_release_slot, (VALUE)&co);
+				rb_jump_tag(state);
+			}
+			rb_mutex_synchronize(fb_pool->lock, fb_pool_add_busy, (VALUE)&co);
+			break;
+		} else if (co.take == POOL_TAKE_WAIT) {
+			waiting = 1;
+		} else {
+			rb_raise(rb_eFbTimeoutError, "could not obtain a connection from the pool within %g seconds", fb_pool->timeout);
+		}
+	}
+
+	fb_pool->checkouts++;
+	if (waiting) {
+		waited = fb_monotonic_nsec() / 1e9 - co.start;
+		fb_pool->waits++;
+		fb_pool->wait_time += waited;
+		if (waited > fb_pool->max_wait) fb_pool->max_wait = waited;
+	}
+	in_use = (long)RHASH_SIZE(fb_pool->busy);
+	if (in_use > fb_pool->peak) {
+		fb_pool->peak = in_use;
+	}
+	return co.connection;
+}
+
+static VALUE fb_pool_rollback(VALUE connection)
 {
-	const char *sql_indexes = "SELECT RDB$INDICES.RDB$RELATION_NAME, RDB$INDICES.RDB$INDEX_NAME, RDB$INDICES.RDB$UNIQUE_FLAG, RDB$INDICES.RDB$INDEX_TYPE "
-						"FROM RDB$INDICES "
-						"  JOIN RDB$RELATIONS ON RDB$INDICES.RDB$RELATION_NAME = RDB$RELATIONS.RDB$RELATION_NAME "
-						"WHERE (RDB$RELATIONS.RDB$SYSTEM_FLAG <> 1 OR RDB$RELATIONS.RDB$SYSTEM_FLAG IS NULL) ";
-	VALUE query_indexes = rb_str_new2(sql_indexes);
-	VALUE ary_indexes = connection_query(1, &query_indexes, self);
-	VALUE indexes = rb_hash_new();
-	int i;
 	struct FbConnection *fb_connection;
-	Data_Get_Struct(self, struct FbConnection, fb_connection);
 
-	for (i = 0; i < RARRAY_LEN(ary_indexes); i++) {
-		VALUE index_struct;
-		VALUE row = rb_ary_entry(ary_indexes, i);
-		VALUE table_name = rb_ary_entry(row, 0);
-		VALUE index_name = rb_ary_entry(row, 1);
-		VALUE unique = rb_ary_entry(row, 2);
-		VALUE descending = rb_ary_entry(row, 3);
-		VALUE columns = connection_index_columns(self, index_name);
+	Data_Get_Struct(connection, struct FbConnection, fb_connection);
+	fb_connection_rollback(fb_connection);
+	return Qnil;
+}
 
-		rb_funcall(table_name, id_rstrip_bang, 0);
-		rb_funcall(index_name, id_rstrip_bang, 0);
+struct FbPoolCheckin {
+	struct FbPool *fb_pool;
+	VALUE connection;
+	int keep;
+};
+
+static VALUE fb_pool_put(VALUE arg)
+{
+	struct FbPoolCheckin *ci = (struct FbPoolCheckin *)arg;
+	struct FbPool *fb_pool = ci->fb_pool;
+
+	rb_hash_delete(fb_pool->busy, ci->connection);
+	if (ci->keep) {
+		rb_ary_push(fb_pool->idle, rb_ary_new3(2, ci->connection, rb_float_new(fb_monotonic_nsec() / 1e9)));
+	} else {
+		fb_pool->open--;
+	}
+	rb_funcall(fb_pool->cond, rb_intern("signal"), 0);
+	return Qnil;
+}
+
+/* call-seq:
+ *   checkin(connection) -> nil
+ *
+ * Returns a connection to the pool.  An open transaction is rolled back first; a connection
+ * that was closed or fails to roll back is discarded, freeing its slot.
+ */
+static VALUE pool_checkin(VALUE self, VALUE connection)
+{
+	struct FbPool *fb_pool = fb_pool_check_retrieve(self);
+	struct FbConnection *fb_connection;
+	struct FbPoolCheckin ci;
+	int state = 0;
 
-		if (fb_connection->downcase_names) {
-			if (no_lowercase(table_name)) {
-				rb_funcall(table_name, id_downcase_bang, 0);
-			}
-			if (no_lowercase(index_name)) {
-				rb_funcall(index_name, id_downcase_bang, 0);
-			}
+	if (!RTEST(rb_hash_aref(fb_pool->busy, connection))) {
+		rb_raise(rb_eArgError, "connection is not checked out of this pool");
+	}
+	Data_Get_Struct(connection, struct FbConnection, fb_connection);
+	ci.fb_pool = fb_pool;
+	ci.connection = connection;
+	ci.keep = !fb_pool->closed && fb_connection->db != 0;
+	if (ci.keep && fb_connection->transact) {
+		rb_protect(fb_pool_rollback, connection, &state);
+		if (state) {
+			rb_set_errinfo(Qnil);
+			ci.keep = 0;
 		}
+	}
+	if (!ci.keep) {
+		fb_pool->discarded++;
+		fb_pool_discard(connection);
+	}
+	rb_mutex_synchronize(fb_pool->lock, fb_pool_put, (VALUE)&ci);
+	return Qnil;
+}
 
-		rb_str_freeze(table_name);
-		rb_str_freeze(index_name);
+static VALUE fb_pool_checkin_ensure(VALUE args)
+{
+	return pool_checkin(rb_ary_entry(args, 0), rb_ary_entry(args, 1));
+}
 
-		unique = RTEST(unique) ? Qtrue : Qfalse;
-		descending = RTEST(descending) ? Qtrue : Qfalse;
+/* call-seq:
+ *   with {|connection| } -> block result
+ *
+ * Checks out a connection, yields it and checks it back in, even if the block raises.
+ */
+static VALUE pool_with(VALUE self)
+{
+	VALUE connection = pool_checkout(self);
+	return rb_ensure(rb_yield, connection, fb_pool_checkin_ensure, rb_ary_new3(2, self, connection));
+}
 
-		index_struct = rb_struct_new(rb_sFbIndex, table_name, index_name, unique, descending, columns);
-		rb_hash_aset(indexes, index_name, index_struct);
+static VALUE fb_pool_reap(VALUE arg)
+{
+	struct FbPoolCheckout *co = (struct FbPoolCheckout *)arg;
+	return LONG2NUM(fb_pool_reap_locked(co->fb_pool, fb_monotonic_nsec() / 1e9, co->reaped));
+}
+
+/* call-seq:
+ *   reap() -> int
+ *
+ * Closes connections that have been idle for longer than +idle_timeout+ and returns how many.
+ * Checkout reaps as well, so calling this is only needed to release idle attachments sooner.
+ */
+static VALUE pool_reap(VALUE self)
+{
+	struct FbPool *fb_pool = fb_pool_check_retrieve(self);
+	struct FbPoolCheckout co;
+	VALUE n;
+	long i;
+
+	co.fb_pool = fb_pool;
+	co.reaped = rb_ary_new();
+	n = rb_mutex_synchronize(fb_pool->lock, fb_pool_reap, (VALUE)&co);
+	for (i = 0; i < RARRAY_LEN(co.reaped); i++) {
+		fb_pool_discard(rb_ary_entry(co.reaped, i));
 	}
-	return indexes;
+	return n;
 }
 
-/*
-static void define_attrs(VALUE klass, char **attrs)
+static VALUE fb_pool_close(VALUE arg)
 {
-	char *parm;
-	while ((parm = *attrs))
-	{
-		rb_define_attr(klass, parm+1, 1, 1);
-		attrs++;
+	struct FbPoolCheckout *co = (struct FbPoolCheckout *)arg;
+	struct FbPool *fb_pool = co->fb_pool;
+	VALUE entry;
+
+	fb_pool->closed = 1;
+	while (!NIL_P(entry = rb_ary_shift(fb_pool->idle))) {
+		rb_ary_push(co->reaped, rb_ary_entry(entry, 0));
+		fb_pool->open--;
 	}
+	rb_funcall(fb_pool->cond, rb_intern("broadcast"), 0);
+	return Qnil;
 }
-*/
 
-static VALUE default_string(VALUE hash, const char *key, const char *def)
+/* call-seq:
+ *   close() -> nil
+ *
+ * Closes the idle connections and stops handing out new ones.
+ * Connections still checked out are closed when they are checked in.
+ */
+static VALUE pool_close(VALUE self)
 {
-	VALUE sym = ID2SYM(rb_intern(key));
-	VALUE val = rb_hash_aref(hash, sym);
-	return NIL_P(val) ? rb_str_new2(def) : StringValue(val);
+	struct FbPool *fb_pool = fb_pool_check_retrieve(self);
+	struct FbPoolCheckout co;
+	long i;
+
+	co.fb_pool = fb_pool;
+	co.reaped = rb_ary_new();
+	rb_mutex_synchronize(fb_pool->lock, fb_pool_close, (VALUE)&co);
+	for (i = 0; i < RARRAY_LEN(co.reaped); i++) {
+		fb_pool_discard(rb_ary_entry(co.reaped, i));
+	}
+	return Qnil;
 }
 
-static VALUE default_int(VALUE hash, const char *key, int def)
+/* call-seq:
+ *   stats() -> Hash
+ *
+ * Returns pool metrics: :size, :open, :idle and :in_use connections, :peak_in_use,
+ * :utilization (in_use / size), :checkouts, :waits (checkouts that had to wait),
+ * :wait_time and :max_wait in seconds, :timeouts, :reaped and :discarded connections.
+ */
+static VALUE pool_stats(VALUE self)
 {
-	VALUE sym = ID2SYM(rb_intern(key));
-	VALUE val = rb_hash_aref(hash, sym);
-	return NIL_P(val) ? INT2NUM(def) : val;
+	struct FbPool *fb_pool = fb_pool_check_retrieve(self);
+	VALUE stats = rb_hash_new();
+	long in_use = (long)RHASH_SIZE(fb_pool->busy);
+
+	rb_hash_aset(stats, ID2SYM(rb_intern("size")), LONG2NUM(fb_pool->size));
+	rb_hash_aset(stats, ID2SYM(rb_intern("open")), LONG2NUM(fb_pool->open));
+	rb_hash_aset(stats, ID2SYM(rb_intern("idle")), LONG2NUM(RARRAY_LEN(fb_pool->idle)));
+	rb_hash_aset(stats, ID2SYM(rb_intern("in_use")), LONG2NUM(in_use));
+	rb_hash_aset(stats, ID2SYM(rb_intern("peak_in_use")), LONG2NUM(fb_pool->peak));
+	rb_hash_aset(stats, ID2SYM(rb_intern("utilization")), rb_float_new((double)in_use / fb_pool->size));
+	rb_hash_aset(stats, ID2SYM(rb_intern("checkouts")), LONG2NUM(fb_pool->checkouts));
+	rb_hash_aset(stats, ID2SYM(rb_intern("waits")), LONG2NUM(fb_pool->waits));
+	rb_hash_aset(stats, ID2SYM(rb_intern("wait_time")), rb_float_new(fb_pool->wait_time));
+	rb_hash_aset(stats, ID2SYM(rb_intern("max_wait")), rb_float_new(fb_pool->max_wait));
+	rb_hash_aset(stats, ID2SYM(rb_intern("timeouts")), LONG2NUM(fb_pool->timeouts));
+	rb_hash_aset(stats, ID2SYM(rb_intern("reaped")), LONG2NUM(fb_pool->reaped));
+	rb_hash_aset(stats, ID2SYM(rb_intern("discarded")), LONG2NUM(fb_pool->discarded));
+	return stats;
 }
 
-static VALUE database_allocate_instance(VALUE klass)
+/* Checks in the warm-up connections attached so far, whether or not all of them were. */
+static VALUE fb_pool_warm_up_checkin(VALUE args)
 {
-    NEWOBJ(obj, struct RObject);
-    OBJSETUP(obj, klass, T_OBJECT);
-    return (VALUE)obj;
+	VALUE self = rb_ary_entry(args, 0);
+	VALUE warm = rb_ary_entry(args, 1);
+	long i;
+
+	for (i = 0; i < RARRAY_LEN(warm); i++) {
+		pool_checkin(self, rb_ary_entry(warm, i));
+	}
+	return Qnil;
 }
 
-static VALUE hash_from_connection_string(VALUE cs)
+static VALUE fb_pool_warm_up(VALUE args)
 {
-	VALUE hash = rb_hash_new();
-	VALUE re_SemiColon = rb_reg_regcomp(rb_str_new2("\\s*;\\s*"));
-	VALUE re_Equal = rb_reg_regcomp(rb_str_new2("\\s*=\\s*"));
-	ID id_split = rb_intern("split");
-	VALUE pairs = rb_funcall(cs, id_split, 1, re_SemiColon);
-	int i;
-	for (i = 0; i < RARRAY_LEN(pairs); i++) {
-		VALUE pair = rb_ary_entry(pairs, i);
-		VALUE keyValue = rb_funcall(pair, id_split, 1, re_Equal);
-		if (RARRAY_LEN(keyValue) == 2) {
-			VALUE key = rb_ary_entry(keyValue, 0);
-			VALUE val = rb_ary_entry(keyValue, 1);
-			rb_hash_aset(hash, rb_str_intern(key), val);
-		}
+	VALUE self = rb_ary_entry(args, 0);
+	VALUE warm = rb_ary_entry(args, 1);
+	long warm_up = NUM2LONG(rb_ary_entry(args, 2));
+
+	while (RARRAY_LEN(warm) < warm_up) {
+		rb_ary_push(warm, pool_checkout(self));
 	}
-	return hash;
+	return Qnil;
 }
 
-static void check_page_size(int page_size)
+static double fb_pool_option(VALUE opts, const char *key, double def, double min)
 {
-	if (page_size != 1024 && page_size != 2048 && page_size != 4096 && page_size != 8192 && page_size != 16384) {
-		rb_raise(rb_eFbError, "Invalid page size: %d", page_size);
+	VALUE val = rb_hash_aref(opts, ID2SYM(rb_intern(key)));
+	double d = NIL_P(val) ? def : NUM2DBL(val);
+
+	if (d < min) {
+		rb_raise(rb_eArgError, "pool %s must be at least %g", key, min);
 	}
+	return d;
 }
 
 /* call-seq:
- *   Database.new(options) -> Database
+ *   Pool.new(database, options = {}) -> Pool
  *
- * Initialize Database with Hash of values:
- * :database:: Full Firebird connection string, e.g. 'localhost:/var/fbdata/drivertest.fdb' (required)
- * :username:: database username (default: 'sysdba')
- * :password:: database password (default: 'masterkey')
- * :charset:: character set to be used with the connection (default: 'NONE')
- * :role:: database role to connect using (default: nil)
- * :downcase_names:: Column names are reported in lowercase, unless they were originally mixed case (default: nil).
- * :page_size:: page size to use when creating a database (default: 1024)
+ * Creates a pool of connections to +database+, an Fb::Database or its options (see: Database.new).
+ * Pool options:
+ * :size:: most connections open at once (default: 5)
+ * :timeout:: seconds checkout waits for a free connection (default: 5)
+ * :idle_timeout:: seconds an unused connection stays open (default: 300)
+ * :warm_up:: connections to attach straight away (default: 0)
  */
-static VALUE database_initialize(int argc, VALUE *argv, VALUE self)
+static VALUE pool_initialize(int argc, VALUE *argv, VALUE self)
 {
-	VALUE parms, database;
+	struct FbPool *fb_pool;
+	VALUE database, opts;
+	long warm_up;
+
+	Data_Get_Struct(self, struct FbPool, fb_pool);
+	if (!NIL_P(fb_pool->database)) {
+		/* Its connections would be left open, out of reach of checkin and close */
+		rb_raise(rb_eFbError, "pool already initialized");
+	}
+	rb_scan_args(argc, argv, "11", &database, &opts);
+	if (NIL_P(opts)) {
+		opts = rb_hash_new();
+	} else {
+		Check_Type(opts, T_HASH);
+	}
+	if (!rb_obj_is_kind_of(database, rb_cFbDatabase)) {
+		VALUE parms = database;
+		database = database_allocate_instance(rb_cFbDatabase);
+		database_initialize(1, &parms, database);
+	}
+	fb_pool->size = (long)fb_pool_option(opts, "size", 5, 1);
+	fb_pool->timeout = fb_pool_option(opts, "timeout", 5, 0);
+	fb_pool->idle_timeout = fb_pool_option(opts, "idle_timeout", 300, 0);
+	warm_up = (long)fb_pool_option(opts, "warm_up", 0, 0);
+	if (warm_up > fb_pool->size) {
+		rb_raise(rb_eArgError, "pool warm_up must not exceed its size");
+	}
 
-	if (argc >= 1) {
-		parms = argv[0];
-		if (TYPE(parms) == T_STRING) {
-			parms = hash_from_connection_string(parms);
-		} else {
-			Check_Type(parms, T_HASH);
-		}
-		database = rb_hash_aref(parms, ID2SYM(rb_intern("database")));
-		if (NIL_P(database)) rb_raise(rb_eFbError, "Database must be specified.");
-		rb_iv_set(self, "@database", database);
-		rb_iv_set(self, "@username", default_string(parms, "username", "sysdba"));
-		rb_iv_set(self, "@password", default_string(parms, "password", "masterkey"));
-		rb_iv_set(self, "@charset", default_string(parms, "charset", "NONE"));
-		rb_iv_set(self, "@role", rb_hash_aref(parms, ID2SYM(rb_intern("role"))));
-		rb_iv_set(self, "@downcase_names", rb_hash_aref(parms, ID2SYM(rb_intern("downcase_names"))));
-		rb_iv_set(self, "@page_size", default_int(parms, "page_size", 1024));
+	rb_require("thread");
+	fb_pool->database = database;
+	fb_pool->lock = rb_mutex_new();
+	fb_pool->cond = rb_class_new_instance(0, NULL, rb_path2class("ConditionVariable"));
+	fb_pool->idle = rb_ary_new();
+	fb_pool->busy = rb_hash_new();
+	fb_pool->open = 0;
+	fb_pool->closed = 0;
+
+	/* Attach the warm-up connections and check them all in, even if one fails to attach */
+	if (warm_up > 0) {
+		VALUE args = rb_ary_new3(3, self, rb_ary_new2(warm_up), LONG2NUM(warm_up));
+		rb_ensure(fb_pool_warm_up, args, fb_pool_warm_up_checkin, args);
 	}
+	fb_pool->checkouts = 0;
+	fb_pool->peak = 0;
 	return self;
 }
 
-/* call-seq:
- *   create() -> Database
- *   create() {|connection| } -> Database
+/* Fb::IdAllocator
  *
- * Create a database using the current database options.
- * If a block is provided, an open connection to the new database is passed to it
- * before being automatically closed.
+ * Hands out generator values from blocks reserved with one GEN_ID(generator, block_size) each,
+ * so most IDs cost no round trip at all.
  */
-static VALUE database_create(VALUE self)
-{
-	ISC_STATUS isc_status[20];
-	isc_db_handle handle = 0;
-	isc_tr_handle local_transact = 0;
-	VALUE parms, fmt, stmt;
-	char *sql;
 
-	VALUE database = rb_iv_get(self, "@database");
-	VALUE username = rb_iv_get(self, "@username");
-	VALUE password = rb_iv_get(self, "@password");
-	VALUE page_size = rb_iv_get(self, "@page_size");
-	VALUE charset = rb_iv_get(self, "@charset");
+struct FbIdAllocator {
+	VALUE connection;
+	VALUE generator;
+	VALUE statement;	/* Statement reserving a block, prepared on first use */
+	long block_size;
+	ISC_INT64 next;	/* next value to hand out */
+	ISC_INT64 last;	/* last value of the reserved block; next > last when it is used up */
+};
 
-	check_page_size(NUM2INT(page_size));
+static void fb_id_allocator_mark(struct FbIdAllocator *fb_id_allocator)
+{
+	rb_gc_mark(fb_id_allocator->connection);
+	rb_gc_mark(fb_id_allocator->generator);
+	rb_gc_mark(fb_id_allocator->statement);
+}
 
-	parms = rb_ary_new3(5, database, username, password, page_size, charset);
+static void fb_id_allocator_free(struct FbIdAllocator *fb_id_allocator)
+{
+	xfree(fb_id_allocator);
+}
 
-	fmt = rb_str_new2("CREATE DATABASE '%s' USER '%s' PASSWORD '%s' PAGE_SIZE = %d DEFAULT CHARACTER SET %s;");
-	stmt = rb_funcall(fmt, rb_intern("%"), 1, parms);
-	sql = StringValuePtr(stmt);
+static VALUE id_allocator_alloc(VALUE klass)
+{
+	struct FbIdAllocator *fb_id_allocator;
+	VALUE obj = Data_Make_Struct(klass, struct FbIdAllocator, fb_id_allocator_mark, fb_id_allocator_free, fb_id_allocator);
+
+	fb_id_allocator->connection = Qnil;
+	fb_id_allocator->generator = Qnil;
+	fb_id_allocator->statement = Qnil;
+	fb_id_allocator->block_size = 0;
+	fb_id_allocator->next = 1;
+	fb_id_allocator->last = 0;
+	return obj;
+}
 
-	if (isc_dsql_execute_immediate(isc_status, &handle, &local_transact, 0, sql, 3, NULL) != 0) {
-		fb_error_check(isc_status);
-	}
-	if (handle) {
-		if (rb_block_given_p()) {
-			VALUE connection = connection_create(handle, self);
-			rb_ensure(rb_yield,connection,connection_close,connection);
-		} else {
-			isc_detach_database(isc_status, &handle);
-			fb_error_check(isc_status);
-		}
+static struct FbIdAllocator *fb_id_allocator_check_retrieve(VALUE self)
+{
+	struct FbIdAllocator *fb_id_allocator;
+
+	Data_Get_Struct(self, struct FbIdAllocator, fb_id_allocator);
+	if (NIL_P(fb_id_allocator->connection)) {
+		rb_raise(rb_eFbError, "uninitialized id allocator");
 	}
+	return fb_id_allocator;
+}
 
-	return self;
+/* Reserves a block of +n+ values, making it the current block. */
+static void fb_id_allocator_reserve(struct FbIdAllocator *fb_id_allocator, long n)
+{
+	VALUE count = LONG2NUM(n);
+	VALUE rows;
+	ISC_INT64 last;
+
+	if (NIL_P(fb_id_allocator->statement)) {
+		struct FbConnection *fb_connection;
+		Data_Get_Struct(fb_id_allocator->connection, struct FbConnection, fb_connection);
+		fb_connection_check(fb_connection);
+		fb_id_allocator->statement = connection_prepare(fb_id_allocator->connection,
+			fb_generator_reserve_sql(fb_connection, fb_id_allocator->generator));
+	}
+	rows = statement_query(1, &count, fb_id_allocator->statement);
+	last = NUM2LL(rb_ary_entry(rb_ary_entry(rows, 0), 0));
+	fb_id_allocator->next = last - n + 1;
+	fb_id_allocator->last = last;
 }
 
 /* call-seq:
- *   Database.create(options) -> Database
- *   Database.create(options) {|connection| } -> Database
+ *   IdAllocator.new(connection, generator, :block_size => 100) -> IdAllocator
  *
- * Create a database using the specified options (see: Database.new for details of options Hash).
- * If a block is provided, an open connection to the new database is passed to it
- * before being automatically closed.
+ * Creates an allocator handing out values of +generator+ (a name as in Connection#generator_names)
+ * on +connection+, reserving +block_size+ values at a time.  Values of a reserved block that are
+ * never handed out are lost, as are blocks reserved in a transaction that is rolled back:
+ * IDs are unique and increasing, but not gapless.
  */
-static VALUE database_s_create(int argc, VALUE *argv, VALUE klass)
+static VALUE id_allocator_initialize(int argc, VALUE *argv, VALUE self)
 {
-	VALUE obj = database_allocate_instance(klass);
-	database_initialize(argc, argv, obj);
-	return database_create(obj);
+	struct FbIdAllocator *fb_id_allocator;
+	VALUE connection, generator, opts, block_size;
+
+	Data_Get_Struct(self, struct FbIdAllocator, fb_id_allocator);
+	rb_scan_args(argc, argv, "21", &connection, &generator, &opts);
+	if (!rb_obj_is_kind_of(connection, rb_cFbConnection)) {
+		rb_raise(rb_eTypeError, "Fb::Connection expected");
+	}
+	block_size = Qnil;
+	if (!NIL_P(opts)) {
+		Check_Type(opts, T_HASH);
+		block_size = rb_hash_aref(opts, ID2SYM(rb_intern("block_size")));
+	}
+	fb_id_allocator->block_size = NIL_P(block_size) ? 100 : fb_id_count(block_size);
+	fb_id_allocator->connection = connection;
+	fb_id_allocator->generator = rb_str_new_frozen(rb_obj_as_string(generator));
+	return self;
 }
 
 /* call-seq:
- *   connect() -> Connection
- *   connect() {|connection| } -> nil
+ *   next() -> Integer
  *
- * Connect to the database specified by the current database options.
- *
- * If a block is provided, the open connection is passed to it before being
- * automatically closed.
+ * Returns the next value, reserving a new block first when the current one is used up.
  */
-static VALUE database_connect(VALUE self)
+static VALUE id_allocator_next(VALUE self)
 {
-	ISC_STATUS isc_status[20];
-	char *dbp;
-	long length;
-	isc_db_handle handle = 0;
-	VALUE database = rb_iv_get(self, "@database");
+	struct FbIdAllocator *fb_id_allocator = fb_id_allocator_check_retrieve(self);
 
-	Check_Type(database, T_STRING);
-	dbp = connection_create_dbp(self, &length);
-	isc_attach_database(isc_status, 0, StringValuePtr(database), &handle, length, dbp);
-	xfree(dbp);
-	fb_error_check(isc_status);
-	{
-		VALUE connection = connection_create(handle, self);
-		if (rb_block_given_p()) {
-			return rb_ensure(rb_yield, connection, connection_close, connection);
-			return Qnil;
-		} else {
-			return connection;
-		}
+	if (fb_id_allocator->next > fb_id_allocator->last) {
+		fb_id_allocator_reserve(fb_id_allocator, fb_id_allocator->block_size);
 	}
+	return LL2NUM(fb_id_allocator->next++);
 }
 
 /* call-seq:
- *   Database.connect(options) -> Connection
- *   Database.connect(options) {|connection| } -> nil
+ *   take(n) -> Array
  *
- * Connect to a database using the options given (see: Database.new for details of options Hash).
- *
- * If a block is provided, the open connection is passed to it before being
- * automatically closed.
+ * Returns the next +n+ values in ascending order.  What is left of the current block is
+ * used first; the rest comes from one new block of at least block_size values.
  */
-static VALUE database_s_connect(int argc, VALUE *argv, VALUE klass)
+static VALUE id_allocator_take(VALUE self, VALUE n)
 {
-	VALUE obj = database_allocate_instance(klass);
-	database_initialize(argc, argv, obj);
-	return database_connect(obj);
+	struct FbIdAllocator *fb_id_allocator = fb_id_allocator_check_retrieve(self);
+	long count = fb_id_count(n);
+	long left = (long)(fb_id_allocator->last - fb_id_allocator->next + 1);
+	VALUE ids;
+
+	if (left >= count) {
+		ids = fb_id_range(fb_id_allocator->next + count - 1, count);
+		fb_id_allocator->next += count;
+		return ids;
+	}
+	ids = left > 0 ? fb_id_range(fb_id_allocator->last, left) : rb_ary_new2(count);
+	fb_id_allocator_reserve(fb_id_allocator, count - left > fb_id_allocator->block_size ? count - left : fb_id_allocator->block_size);
+	rb_ary_concat(ids, fb_id_range(fb_id_allocator->next + (count - left) - 1, count - left));
+	fb_id_allocator->next += count - left;
+	return ids;
 }
 
 /* call-seq:
- *   drop() -> nil
+ *   remaining() -> int
  *
- * Drop the database specified by the current database options.
+ * Returns how many values of the current block are left to hand out without a round trip.
  */
-static VALUE database_drop(VALUE self)
+static VALUE id_allocator_remaining(VALUE self)
 {
-	struct FbConnection *fb_connection;
+	struct FbIdAllocator *fb_id_allocator = fb_id_allocator_check_retrieve(self);
+	return LL2NUM(fb_id_allocator->last - fb_id_allocator->next + 1);
+}
 
-	VALUE connection = database_connect(self);
-	Data_Get_Struct(connection, struct FbConnection, fb_connection);
-	isc_drop_database(fb_connection->isc_status, &fb_connection->db);
-	fb_error_check(fb_connection->isc_status);
-	/* fb_connection_remove(fb_connection); */
-	return Qnil;
+/* call-seq:
+ *   generator() -> String
+ */
+static VALUE id_allocator_generator(VALUE self)
+{
+	return fb_id_allocator_check_retrieve(self)->generator;
 }
 
 /* call-seq:
- *   Database.drop(options) -> nil
+ *   block_size() -> int
+ */
+static VALUE id_allocator_block_size(VALUE self)
+{
+	return LONG2NUM(fb_id_allocator_check_retrieve(self)->block_size);
+}
+
+/* call-seq:
+ *   close() -> nil
  *
- * Drop the database specified by the options given (see: Database.new for details of options Hash).
+ * Drops the prepared statement and forgets the rest of the current block.
  */
-static VALUE database_s_drop(int argc, VALUE *argv, VALUE klass)
+static VALUE id_allocator_close(VALUE self)
 {
-	VALUE obj = database_allocate_instance(klass);
-	database_initialize(argc, argv, obj);
-	return database_drop(obj);
+	struct FbIdAllocator *fb_id_allocator = fb_id_allocator_check_retrieve(self);
+	VALUE statement = fb_id_allocator->statement;
+
+	fb_id_allocator->statement = Qnil;
+	fb_id_allocator->next = 1;
+	fb_id_allocator->last = 0;
+	if (!NIL_P(statement)) {
+		statement_close(statement);
+	}
+	return Qnil;
 }
 
 void Init_fb()
 {
+	int i;
+
 	rb_mFb = rb_define_module("Fb");
+	rb_define_module_function(rb_mFb, "worker_threads", fb_s_worker_threads, 0);
+	rb_define_module_function(rb_mFb, "worker_threads=", fb_s_set_worker_threads, 1);
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+	rb_global_variable(&fb_worker_queue);
+#endif
 
 	rb_cFbDatabase = rb_define_class_under(rb_mFb, "Database", rb_cData);
     rb_define_alloc_func(rb_cFbDatabase, database_allocate_instance);
@@ -3132,6 +8289,14 @@ void Init_fb()
 	rb_define_attr(rb_cFbDatabase, "role", 1, 1);
 	rb_define_attr(rb_cFbDatabase, "downcase_names", 1, 1);
 	rb_define_attr(rb_cFbDatabase, "page_size", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "statement_cache_size", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "decimal", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "timestamp_format", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "blob_format", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "blob_segment_size", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "statement_timeout", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "count_rows", 1, 1);
+	rb_define_attr(rb_cFbDatabase, "transaction_options", 1, 1);
     rb_define_method(rb_cFbDatabase, "create", database_create, 0);
 	rb_define_singleton_method(rb_cFbDatabase, "create", database_s_create, -1);
 	rb_define_method(rb_cFbDatabase, "connect", database_connect, 0);
@@ -3155,28 +8320,122 @@ void Init_fb()
 	rb_define_method(rb_cFbConnection, "rollback", connection_rollback, 0);
 	rb_define_method(rb_cFbConnection, "close", connection_close, 0);
 	rb_define_method(rb_cFbConnection, "drop", connection_drop, 0);
+	rb_define_method(rb_cFbConnection, "cancel", connection_cancel, 0);
 	rb_define_method(rb_cFbConnection, "open?", connection_is_open, 0);
 	rb_define_method(rb_cFbConnection, "dialect", connection_dialect, 0);
 	rb_define_method(rb_cFbConnection, "db_dialect", connection_db_dialect, 0);
 	rb_define_method(rb_cFbConnection, "table_names", connection_table_names, 0);
 	rb_define_method(rb_cFbConnection, "generator_names", connection_generator_names, 0);
+	rb_define_method(rb_cFbConnection, "next_ids", connection_next_ids, 2);
 	rb_define_method(rb_cFbConnection, "view_names", connection_view_names, 0);
 	rb_define_method(rb_cFbConnection, "role_names", connection_role_names, 0);
 	rb_define_method(rb_cFbConnection, "procedure_names", connection_procedure_names, 0);
 	rb_define_method(rb_cFbConnection, "trigger_names", connection_trigger_names, 0);
 	rb_define_method(rb_cFbConnection, "indexes", connection_indexes, 0);
 	rb_define_method(rb_cFbConnection, "columns", connection_columns, 1);
+	rb_define_method(rb_cFbConnection, "statement_cache_stats", connection_statement_cache_stats, 0);
+	rb_define_method(rb_cFbConnection, "clear_statement_cache", connection_clear_statement_cache, 0);
+	rb_define_method(rb_cFbConnection, "prepare", connection_prepare, 1);
+	rb_define_method(rb_cFbConnection, "decimal", connection_decimal, 0);
+	rb_define_method(rb_cFbConnection, "decimal=", connection_set_decimal, 1);
+	rb_define_method(rb_cFbConnection, "timestamp_format", connection_timestamp_format, 0);
+	rb_define_method(rb_cFbConnection, "timestamp_format=", connection_set_timestamp_format, 1);
+	rb_define_method(rb_cFbConnection, "transaction_options", connection_transaction_options, 0);
+	rb_define_method(rb_cFbConnection, "transaction_options=", connection_set_transaction_options, 1);
+	rb_define_method(rb_cFbConnection, "count_rows", connection_count_rows, 0);
+	rb_define_method(rb_cFbConnection, "count_rows=", connection_set_count_rows, 1);
+	rb_define_method(rb_cFbConnection, "round_trips", connection_round_trips, 0);
+	rb_define_method(rb_cFbConnection, "blob_format", connection_blob_format, 0);
+	rb_define_method(rb_cFbConnection, "blob_format=", connection_set_blob_format, 1);
+	rb_define_method(rb_cFbConnection, "blob_segment_size", connection_blob_segment_size, 0);
+	rb_define_method(rb_cFbConnection, "blob_segment_size=", connection_set_blob_segment_size, 1);
+	rb_define_method(rb_cFbConnection, "statement_timeout", connection_statement_timeout, 0);
+	rb_define_method(rb_cFbConnection, "statement_timeout=", connection_set_statement_timeout, 1);
+	rb_define_method(rb_cFbConnection, "create_blob", connection_create_blob, 0);
 	/* rb_define_method(rb_cFbConnection, "cursor", connection_cursor, 0); */
 
+	rb_cFbRow = rb_define_class_under(rb_mFb, "Row", rb_cData);
+	rb_define_method(rb_cFbRow, "[]", row_aref, 1);
+	rb_define_method(rb_cFbRow, "size", row_size, 0);
+	rb_define_method(rb_cFbRow, "keys", row_keys, 0);
+	rb_define_method(rb_cFbRow, "to_a", row_to_a, 0);
+	rb_define_method(rb_cFbRow, "to_h", row_to_h, 0);
+
+	rb_cFbBlob = rb_define_class_under(rb_mFb, "Blob", rb_cData);
+	rb_define_method(rb_cFbBlob, "read", blob_read, -1);
+	rb_define_method(rb_cFbBlob, "each_chunk", blob_each_chunk, -1);
+	rb_define_method(rb_cFbBlob, "size", blob_size, 0);
+	rb_define_method(rb_cFbBlob, "pos", blob_pos, 0);
+	rb_define_method(rb_cFbBlob, "rewind", blob_rewind, 0);
+	rb_define_method(rb_cFbBlob, "seek", blob_seek, -1);
+	rb_define_method(rb_cFbBlob, "close", blob_close, 0);
+
+	rb_cFbBlobWriter = rb_define_class_under(rb_mFb, "BlobWriter", rb_cData);
+	rb_define_method(rb_cFbBlobWriter, "write", blob_writer_write, 1);
+	rb_define_method(rb_cFbBlobWriter, "<<", blob_writer_append, 1);
+
+	rb_cFbPool = rb_define_class_under(rb_mFb, "Pool", rb_cData);
+	rb_define_alloc_func(rb_cFbPool, pool_alloc);
+	rb_define_method(rb_cFbPool, "initialize", pool_initialize, -1);
+	rb_define_method(rb_cFbPool, "checkout", pool_checkout, 0);
+	rb_define_method(rb_cFbPool, "checkin", pool_checkin, 1);
+	rb_define_method(rb_cFbPool, "with", pool_with, 0);
+	rb_define_method(rb_cFbPool, "reap", pool_reap, 0);
+	rb_define_method(rb_cFbPool, "close", pool_close, 0);
+	rb_define_method(rb_cFbPool, "stats", pool_stats, 0);
+
+#ifdef HAVE_FB_CANCEL_OPERATION
+	rb_global_variable(&fb_timer_thread);
+	rb_global_variable(&fb_timer_lock);
+#endif
+
+	rb_cFbTransactionOptions = rb_define_class_under(rb_mFb, "TransactionOptions", rb_cData);
+	rb_define_alloc_func(rb_cFbTransactionOptions, transaction_options_alloc);
+	rb_define_method(rb_cFbTransactionOptions, "initialize", transaction_options_initialize, -1);
+	rb_define_method(rb_cFbTransactionOptions, "to_h", transaction_options_to_h, 0);
+	rb_define_method(rb_cFbTransactionOptions, "tpb", transaction_options_tpb, 0);
+
+	rb_cFbIdAllocator = rb_define_class_under(rb_mFb, "IdAllocator", rb_cData);
+	rb_define_alloc_func(rb_cFbIdAllocator, id_allocator_alloc);
+	rb_define_method(rb_cFbIdAllocator, "initialize", id_allocator_initialize, -1);
+	rb_define_method(rb_cFbIdAllocator, "next", id_allocator_next, 0);
+	rb_define_method(rb_cFbIdAllocator, "take", id_allocator_take, 1);
+	rb_define_method(rb_cFbIdAllocator, "remaining", id_allocator_remaining, 0);
+	rb_define_method(rb_cFbIdAllocator, "generator", id_allocator_generator, 0);
+	rb_define_method(rb_cFbIdAllocator, "block_size", id_allocator_block_size, 0);
+	rb_define_method(rb_cFbIdAllocator, "close", id_allocator_close, 0);
+
 	rb_cFbCursor = rb_define_class_under(rb_mFb, "Cursor", rb_cData);
 	/* rb_define_method(rb_cFbCursor, "execute", cursor_execute, -1); */
 	rb_define_method(rb_cFbCursor, "fields", cursor_fields, -1);
 	rb_define_method(rb_cFbCursor, "fetch", cursor_fetch, -1);
 	rb_define_method(rb_cFbCursor, "fetchall", cursor_fetchall, -1);
 	rb_define_method(rb_cFbCursor, "each", cursor_each, -1);
+	rb_define_method(rb_cFbCursor, "fetch_many", cursor_fetch_many, -1);
+	rb_define_method(rb_cFbCursor, "each_batch", cursor_each_batch, -1);
+	rb_define_method(rb_cFbCursor, "fetch_columns", cursor_fetch_columns, -1);
+	rb_define_method(rb_cFbCursor, "rows_affected", cursor_get_rows_affected, 0);
+	rb_define_method(rb_cFbCursor, "decimal", cursor_decimal, 0);
+	rb_define_method(rb_cFbCursor, "decimal=", cursor_set_decimal, 1);
+	rb_define_method(rb_cFbCursor, "timestamp_format", cursor_timestamp_format, 0);
+	rb_define_method(rb_cFbCursor, "timestamp_format=", cursor_set_timestamp_format, 1);
+	rb_define_method(rb_cFbCursor, "blob_format", cursor_blob_format, 0);
+	rb_define_method(rb_cFbCursor, "blob_format=", cursor_set_blob_format, 1);
 	rb_define_method(rb_cFbCursor, "close", cursor_close, 0);
 	rb_define_method(rb_cFbCursor, "drop", cursor_drop, 0);
 
+	rb_cFbStatement = rb_define_class_under(rb_mFb, "Statement", rb_cFbCursor);
+	rb_define_attr(rb_cFbStatement, "sql", 1, 0);
+	rb_define_method(rb_cFbStatement, "execute", statement_execute, -1);
+	rb_define_method(rb_cFbStatement, "query", statement_query, -1);
+	rb_define_method(rb_cFbStatement, "each", statement_each, -1);
+	rb_define_method(rb_cFbStatement, "execute_batch", statement_execute_batch, -1);
+	rb_define_method(rb_cFbStatement, "execute_columns", statement_execute_columns, -1);
+	rb_define_method(rb_cFbStatement, "param_count", statement_param_count, 0);
+	rb_define_method(rb_cFbStatement, "statement_type", statement_statement_type, 0);
+	rb_define_method(rb_cFbStatement, "rows_affected", statement_rows_affected, 0);
+	rb_define_method(rb_cFbStatement, "close", statement_close, 0);
+
 	rb_cFbSqlType = rb_define_class_under(rb_mFb, "SqlType", rb_cData);
 	rb_define_singleton_method(rb_cFbSqlType, "from_code", sql_type_from_code, 2);
 
@@ -3189,11 +8448,14 @@ void Init_fb()
 */
 
 	rb_eFbError = rb_define_class_under(rb_mFb, "Error", rb_eStandardError);
+	rb_eFbTimeoutError = rb_define_class_under(rb_mFb, "TimeoutError", rb_eFbError);
 	rb_define_method(rb_eFbError, "error_code", error_error_code, 0);
 
 	rb_sFbField = rb_struct_define("FbField", "name", "sql_type", "sql_subtype", "display_size", "internal_size", "precision", "scale", "nullable", "type_code", NULL);
 	rb_sFbIndex = rb_struct_define("FbIndex", "table_name", "index_name", "unique", "descending", "columns", NULL);
 	rb_sFbColumn = rb_struct_define("FbColumn", "name", "domain", "sql_type", "sql_subtype", "length", "precision", "scale", "default", "nullable", NULL);
+	rb_sFbPackedColumn = rb_struct_define("FbPackedColumn", "directive", "data", "nulls", "count", "scale", NULL);
+	rb_sFbBatchResult = rb_struct_define("FbBatchResult", "rows_affected", "errors", NULL);
 
 	rb_require("date");
 	rb_require("time"); /* Needed as of Ruby 1.8.5 */
@@ -3205,4 +8467,17 @@ void Init_fb()
 	rb_global_variable(&re_lowercase);
 	id_rstrip_bang = rb_intern("rstrip!");
     id_sub_bang = rb_intern("sub!");
+	id_BigDecimal = rb_intern("BigDecimal");
+	id_mult = rb_intern("*");
+	id_jd = rb_intern("jd");
+	id_round = rb_intern("round");
+	id_read = rb_intern("read");
+	decimal_divisors = rb_ary_new();
+	rb_global_variable(&decimal_divisors);
+	for (i = 0; i <= DECIMAL_SCALE_MAX; i++) {
+		rb_ary_push(decimal_divisors, rb_funcall(INT2FIX(10), rb_intern("**"), 1, INT2FIX(i)));
+		decimal_pow10[i] = i ? decimal_pow10[i - 1] * 10 : 1;
+	}
+	decimal_factors = rb_ary_new();
+	rb_global_variable(&decimal_factors);
 }
@@ -150,6 +150,36 @@ class ConnectionTestCases < Test::Unit::TestCase
     end
   end
 
+  def test_count_rows
+    Database.create(@parms.merge(:count_rows => false)) do |connection|
+      assert !connection.count_rows
+      assert_equal -1, connection.execute("CREATE TABLE TEST (ID INT, NAME VARCHAR(20))")
+      connection.transaction do
+        connection.prepare("INSERT INTO TEST (ID, NAME) VALUES (?, ?)") do |insert|
+          trips = connection.round_trips
+          assert_equal -1, insert.execute(1, "one")
+          assert_equal 1, connection.round_trips - trips
+          assert_equal 1, insert.rows_affected
+          assert_equal 2, connection.round_trips - trips
+
+          connection.count_rows = true
+          trips = connection.round_trips
+          assert_equal 1, insert.execute(2, "two")
+          assert_equal 2, connection.round_trips - trips
+        end
+        assert_equal 2, connection.execute("UPDATE TEST SET NAME = UPPER(NAME)")
+        connection.count_rows = false
+        assert_equal -1, connection.execute("DELETE FROM TEST WHERE ID = 1")
+      end
+      assert_equal [[2, "TWO"]], connection.query("SELECT * FROM TEST")
+      connection.execute("SELECT * FROM TEST") do |cursor|
+        cursor.fetch
+        assert_equal 1, cursor.rows_affected
+      end
+      connection.drop
+    end
+  end
+
   def test_multi_insert
     sql_schema = "CREATE TABLE TEST (ID INT, NAME VARCHAR(20))"
     sql_insert = "INSERT INTO TEST (ID, NAME) VALUES (?, ?)"
@@ -540,4 +570,123 @@ class ConnectionTestCases < Test::Unit::TestCase
       end
     end
   end    
+
+  def test_statement_cache
+    sql_schema = "CREATE TABLE TEST (ID INT, NAME VARCHAR(20))"
+    sql_insert = "INSERT INTO TEST (ID, NAME) VALUES (?, ?)"
+    sql_select = "SELECT * FROM TEST WHERE ID = ?"
+    Database.create(@parms.merge(:statement_cache_size => 2)) do |connection|
+      connection.execute(sql_schema)
+      assert_equal 0, connection.statement_cache_stats[:size]
+      5.times { |i| connection.execute(sql_insert, i, "NAME#{i}") }
+      stats = connection.statement_cache_stats
+      assert_equal 2, stats[:capacity]
+      assert_equal 1, stats[:size]
+      assert_equal 2, stats[:misses]
+      assert_equal 4, stats[:hits]
+      assert_equal [[3, "NAME3"]], connection.query(sql_select, 3)
+      assert_equal [[4, "NAME4"]], connection.query(sql_select, 4)
+      connection.query("SELECT * FROM RDB$DATABASE")
+      stats = connection.statement_cache_stats
+      assert_equal 2, stats[:size]
+      assert_equal 1, stats[:evictions]
+      hits = stats[:hits]
+      3.times { |i| assert_equal 1, connection.query(sql_insert, 10 + i, "NAME#{10 + i}") }
+      assert_equal hits + 2, connection.statement_cache_stats[:hits]
+      connection.execute("CREATE TABLE TEST2 (ID INT)")
+      assert_equal 0, connection.statement_cache_stats[:size]
+      connection.drop
+    end
+  end
+
+  def test_cancel
+    sql_slow = "SELECT COUNT(*) FROM RDB$FIELDS A, RDB$FIELDS B, RDB$FIELDS C, RDB$FIELDS D"
+    Database.create(@parms) do |connection|
+      assert !connection.cancel
+      worker = Thread.new { connection.query(sql_slow) }
+      sleep 0.5
+      connection.cancel
+      assert_raise(Error) { worker.join }
+      assert !connection.transaction_started
+      assert_equal 1, connection.query("SELECT * FROM RDB$DATABASE").size
+
+      require 'timeout'
+      assert_raise(Timeout::Error) { Timeout.timeout(0.5) { connection.query(sql_slow) } }
+      assert !connection.transaction_started
+      assert_equal 1, connection.query("SELECT * FROM RDB$DATABASE").size
+      connection.drop
+    end
+  end
+
+  def test_statement_timeout
+    sql_slow = "SELECT COUNT(*) FROM RDB$FIELDS A, RDB$FIELDS B, RDB$FIELDS C, RDB$FIELDS D"
+    Database.create(@parms.merge(:statement_timeout => 500)) do |connection|
+      assert_equal 500, connection.statement_timeout
+      assert_raise(TimeoutError) { connection.query(sql_slow) }
+      assert !connection.transaction_started
+      assert_equal 1, connection.query("SELECT * FROM RDB$DATABASE").size
+      connection.statement_timeout = nil
+      assert_equal 0, connection.statement_timeout
+      assert_raise(TimeoutError) { connection.execute(sql_slow, :timeout => 500) { |cursor| cursor.fetch } }
+      assert_raise(ArgumentError) { connection.query(sql_slow, :timeout => -1) }
+      connection.drop
+    end
+  end
+
+  def test_next_ids
+    Database.create(@parms) do |connection|
+      connection.execute("CREATE GENERATOR TEST_SEQ")
+      connection.execute('CREATE GENERATOR "Test_seq"')
+      assert_equal [1, 2, 3], connection.next_ids("TEST_SEQ", 3)
+      assert_equal [4], connection.next_ids("TEST_SEQ", 1)
+      assert_equal [1, 2], connection.next_ids("Test_seq", 2)
+      assert_raises(ArgumentError) { connection.next_ids("TEST_SEQ", 0) }
+
+      ids = IdAllocator.new(connection, "TEST_SEQ", :block_size => 10)
+      assert_equal 10, ids.block_size
+      assert_equal 0, ids.remaining
+      assert_equal 5, ids.next
+      assert_equal 9, ids.remaining
+      assert_equal (6..9).to_a, ids.take(4)
+      assert_equal (10..25).to_a, ids.take(16)
+      assert_equal 0, ids.remaining
+      assert_equal [26], connection.next_ids("TEST_SEQ", 1)
+      assert_equal 27, ids.next
+      assert_equal [28, 29], ids.take(2)
+      ids.close
+      assert_equal 0, ids.remaining
+      assert_equal 37, ids.next
+      ids.close
+      assert_raises(TypeError) { IdAllocator.new(nil, "TEST_SEQ") }
+      connection.drop
+    end
+  end
+
+  def test_execute_returning
+    Database.create(@parms) do |connection|
+      connection.execute("CREATE TABLE TEST (ID INTEGER, NAME VARCHAR(20))")
+      connection.execute(<<-END_SQL)
+        CREATE PROCEDURE PLUSONE(NUM1 INTEGER) RETURNS (NUM2 INTEGER) AS
+        BEGIN
+          NUM2 = NUM1 + 1;
+        END
+      END_SQL
+      assert_equal [42], connection.execute("EXECUTE PROCEDURE PLUSONE(?)", 41)
+      assert_equal 43, connection.execute("EXECUTE PROCEDURE PLUSONE(?)", 41) { |row| row[0] + 1 }
+      assert !connection.transaction_started
+      assert_equal [[1, "one"]], connection.query("INSERT INTO TEST (ID, NAME) VALUES (?, ?) RETURNING ID, NAME", 1, "one")
+      assert_equal [{"NUM2" => 3}], connection.query(:hash, "EXECUTE PROCEDURE PLUSONE(2)")
+      connection.transaction do
+        assert_equal ["ONE"], connection.execute("UPDATE TEST SET NAME = UPPER(NAME) WHERE ID = 1 RETURNING NAME")
+      end
+      connection.prepare("INSERT INTO TEST (ID, NAME) VALUES (?, ?) RETURNING ID") do |insert|
+        assert_equal [2], insert.execute(2, "two")
+        assert_equal [[3]], insert.query(3, "three")
+        assert_equal 40, insert.execute(4, "four") { |row| row[0] * 10 }
+        assert_equal "ID", insert.fields[0].name
+      end
+      assert_equal 4, connection.query("SELECT COUNT(*) FROM TEST")[0][0]
+      connection.drop
+    end
+  end
 end
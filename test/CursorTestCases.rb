@@ -232,4 +232,123 @@ class CursorTestCases < Test::Unit::TestCase
       end
     end
   end
+
+  def test_fetch_many
+    Database.create(@parms) do |connection|
+      connection.execute("CREATE TABLE TEST (ID INT, NAME VARCHAR(10))")
+      connection.transaction do
+        5.times { |i| connection.execute("INSERT INTO TEST (ID, NAME) VALUES (?, ?)", i, "name_#{i}") }
+      end
+      connection.execute("SELECT * FROM TEST ORDER BY ID") do |cursor|
+        rows = cursor.fetch_many(3)
+        assert_equal [[0, "name_0"], [1, "name_1"], [2, "name_2"]], rows
+        rows = cursor.fetch_many(3, :hash)
+        assert_equal [{"ID" => 3, "NAME" => "name_3"}, {"ID" => 4, "NAME" => "name_4"}], rows
+        assert_equal [], cursor.fetch_many(3)
+        assert_raise(ArgumentError) { cursor.fetch_many(0) }
+      end
+      connection.drop
+    end
+  end
+
+  def test_row_formats
+    Database.create(@parms) do |connection|
+      connection.execute("CREATE TABLE TEST (ID INT, NAME VARCHAR(10))")
+      connection.execute("INSERT INTO TEST (ID, NAME) VALUES (1, 'one')")
+      connection.execute("INSERT INTO TEST (ID, NAME) VALUES (2, 'two')")
+      sql = "SELECT ID, NAME FROM TEST ORDER BY ID"
+      assert_equal [{"ID" => 1, "NAME" => "one"}, {"ID" => 2, "NAME" => "two"}], connection.query(:hash, sql)
+      assert_equal [{:ID => 1, :NAME => "one"}, {:ID => 2, :NAME => "two"}], connection.query(:symbol_hash, sql)
+      rows = connection.query(:struct, sql)
+      assert_equal [1, "one"], [rows[0].ID, rows[0].NAME]
+      assert_equal [2, "two"], rows[1].to_a
+      assert_same rows[0].class, connection.query(:struct, sql).first.class
+      assert_not_same rows[0].class, connection.query(:struct, "SELECT NAME FROM TEST").first.class
+      row = connection.query(:struct, "SELECT A.ID, B.ID, A.NAME FROM TEST A JOIN TEST B ON B.ID = A.ID + 1").first
+      assert_equal [:ID, :ID_2, :NAME], row.members.map { |member| member.to_sym }
+      assert_equal [1, 2, "one"], [row.ID, row.ID_2, row.NAME]
+      connection.execute(sql) do |cursor|
+        keys = cursor.fetch(:hash).keys
+        assert keys.all? { |key| key.frozen? }
+        assert_same keys.first, cursor.fetch(:hash).keys.first
+      end
+      connection.drop
+    end
+  end
+
+  def test_lazy_rows
+    Database.create(@parms) do |connection|
+      connection.execute("CREATE TABLE TEST (ID INT, NAME VARCHAR(10), MEMO BLOB SUB_TYPE TEXT)")
+      connection.execute("INSERT INTO TEST (ID, NAME, MEMO) VALUES (1, 'one', 'first')")
+      connection.execute("INSERT INTO TEST (ID, NAME, MEMO) VALUES (2, NULL, 'second')")
+      connection.transaction do
+        rows = connection.query(:row, "SELECT ID, NAME, MEMO FROM TEST ORDER BY ID")
+        assert_kind_of Fb::Row, rows[0]
+        assert_equal 3, rows[0].size
+        assert_equal ["ID", "NAME", "MEMO"], rows[0].keys
+        assert_equal 1, rows[0][0]
+        assert_equal "one", rows[0]["NAME"]
+        assert_same rows[0]["NAME"], rows[0][:NAME]
+        assert_equal "second", rows[1][-1]
+        assert_nil rows[1]["NAME"]
+        assert_nil rows[1]["MISSING"]
+        assert_equal [2, nil, "second"], rows[1].to_a
+        assert_equal({"ID" => 1, "NAME" => "one", "MEMO" => "first"}, rows[0].to_h)
+      end
+      connection.drop
+    end
+  end
+
+  def test_each_batch
+    Database.create(@parms) do |connection|
+      connection.execute("CREATE TABLE TEST (ID INT)")
+      connection.transaction do
+        7.times { |i| connection.execute("INSERT INTO TEST (ID) VALUES (?)", i) }
+      end
+      connection.execute("SELECT ID FROM TEST ORDER BY ID") do |cursor|
+        sizes = []
+        ids = []
+        cursor.each_batch(3) do |rows|
+          sizes << rows.size
+          ids.concat(rows.map { |row| row[0] })
+        end
+        assert_equal [3, 3, 1], sizes
+        assert_equal (0...7).to_a, ids
+      end
+      connection.execute("SELECT ID FROM TEST ORDER BY ID") do |cursor|
+        cursor.each_batch(10, :hash) do |rows|
+          assert_equal 7, rows.size
+          assert_equal 6, rows.last["ID"]
+        end
+      end
+      connection.drop
+    end
+  end
+
+  def test_fetch_columns
+    Database.create(@parms) do |connection|
+      connection.execute("CREATE TABLE TEST (ID INT, AMOUNT DOUBLE PRECISION, NAME VARCHAR(10))")
+      connection.transaction do
+        connection.execute("INSERT INTO TEST VALUES (?, ?, ?)", 1, 1.5, "one")
+        connection.execute("INSERT INTO TEST VALUES (?, ?, ?)", 2, nil, "two")
+        connection.execute("INSERT INTO TEST VALUES (?, ?, ?)", 3, 3.5, nil)
+      end
+      connection.execute("SELECT * FROM TEST ORDER BY ID") do |cursor|
+        assert_equal [[1, 2], [1.5, nil], ["one", "two"]], cursor.fetch_columns(2)
+        assert_equal({"ID" => [3], "AMOUNT" => [3.5], "NAME" => [nil]}, cursor.fetch_columns(nil, :format => :hash))
+        assert_equal [[], [], []], cursor.fetch_columns
+      end
+      connection.execute("SELECT * FROM TEST ORDER BY ID") do |cursor|
+        id, amount, name = cursor.fetch_columns(nil, :packed => true)
+        assert_instance_of Struct::FbPackedColumn, id
+        assert_equal 3, id.count
+        assert_equal [1, 2, 3], id.data.unpack(id.directive + "*")
+        assert_equal "\0", id.nulls
+        assert_equal [1.5, 0.0, 3.5], amount.data.unpack(amount.directive + "*")
+        assert_equal "\2", amount.nulls
+        assert_equal ["one", "two", nil], name
+      end
+      connection.drop
+    end
+  end
 end
@@ -262,6 +262,169 @@ class DataTypesTestCases < Test::Unit::TestCase
     end
   end
 
+  def test_blob_stream
+    sql_schema = "create table test (id int, attachment blob segment size 1000)"
+    sql_insert = "insert into test (id, attachment) values (?, ?)"
+    attachment = (0...256).map { |i| i.chr }.join * 1000
+    Database.create(@parms.merge(:blob_format => :stream)) do |connection|
+      connection.execute(sql_schema)
+      connection.execute(sql_insert, 1, attachment)
+      connection.transaction do
+        blob = connection.query("select attachment from test").first.first
+        assert_kind_of Fb::Blob, blob
+        assert_equal attachment.size, blob.size
+        assert_equal attachment[0, 100], blob.read(100)
+        assert_equal 100, blob.pos
+        buf = ""
+        assert_same buf, blob.read(50, buf)
+        assert_equal attachment[100, 50], buf
+        assert_equal attachment[150..-1], blob.read
+        assert_nil blob.read(1, buf)
+        assert_equal "", buf
+        assert_equal 0, blob.rewind
+        chunks = []
+        blob.each_chunk(4096) { |chunk| chunks << chunk }
+        assert chunks.all? { |chunk| chunk.size <= 4096 }
+        assert_equal attachment, chunks.join
+        assert_raise(Fb::Error) { blob.seek(10) }
+        blob.close
+      end
+      blob = connection.query("select attachment from test").first.first
+      assert_raise(Fb::Error) { blob.read }
+      connection.execute("select attachment from test") do |cursor|
+        cursor.blob_format = :string
+        assert_equal attachment, cursor.fetch.first
+      end
+      connection.drop
+    end
+  end
+
+  def test_blob_writes
+    require 'stringio'
+    sql_schema = "create table test (id int, attachment blob segment size 1000)"
+    sql_insert = "insert into test (id, attachment) values (?, ?)"
+    sql_select = "select attachment from test where id = ?"
+    attachment = (0...256).map { |i| i.chr }.join * 1000
+    Database.create(@parms.merge(:blob_segment_size => 1000)) do |connection|
+      assert_equal 1000, connection.blob_segment_size
+      connection.execute(sql_schema)
+      connection.execute(sql_insert, 1, StringIO.new(attachment))
+      assert_equal attachment, connection.query(sql_select, 1).first.first
+      connection.blob_segment_size = 65535
+      connection.transaction do
+        blob = connection.create_blob do |w|
+          w << attachment[0, 10]
+          w.write(attachment[10..-1])
+        end
+        assert_kind_of Fb::Blob, blob
+        connection.execute(sql_insert, 2, blob)
+      end
+      assert_equal attachment, connection.query(sql_select, 2).first.first
+      assert_raise(Fb::Error) { connection.create_blob { |w| w << "x" } }
+      assert_raise(ArgumentError) { connection.blob_segment_size = 65536 }
+      connection.drop
+    end
+  end
+
+  def test_decimal_modes
+    require 'bigdecimal'
+    sql_schema = "create table test (n92 numeric(9,2), n184 numeric(18,4), sn41 numeric(4,1))"
+    sql_insert = "insert into test (n92, n184, sn41) values (1234567.89, 12345678901234.5678, -12.3)"
+    sql_select = "select n92, n184, sn41 from test"
+    Database.create(@parms.merge(:decimal => :scaled_integer)) do |connection|
+      connection.execute(sql_schema)
+      connection.execute(sql_insert)
+      assert_equal :scaled_integer, connection.decimal
+      assert_equal [123456789, 123456789012345678, -123], connection.query(sql_select).first
+      connection.decimal = :rational
+      assert_equal [Rational(123456789, 100), Rational(123456789012345678, 10000), Rational(-123, 10)], connection.query(sql_select).first
+      connection.decimal = :bigdecimal
+      assert_equal [BigDecimal("1234567.89"), BigDecimal("12345678901234.5678"), BigDecimal("-12.3")], connection.query(sql_select).first
+      connection.execute(sql_select) do |cursor|
+        cursor.decimal = :float
+        assert_equal :float, cursor.decimal
+        assert_equal [1234567.89, 12345678901234.5678, -12.3], cursor.fetch
+      end
+      assert_raise ArgumentError do
+        connection.decimal = :money
+      end
+      connection.drop
+    end
+  end
+
+  def test_bind_times_as_wall_clock
+    sql_schema = "create table test (ts timestamp, tm time, dt date)"
+    Database.create(@parms) do |connection|
+      connection.execute(sql_schema)
+      connection.prepare("insert into test (ts, tm, dt) values (?, ?, ?)") do |insert|
+        insert.execute(Time.utc(1960, 5, 6, 7, 8, 9), Time.utc(2000, 1, 1, 23, 59, 59), Date.civil(1500, 3, 1))
+        insert.execute(Time.new(2006, 1, 2, 3, 4, 5, "+05:00"), Time.new(2000, 1, 1, 0, 0, 1, "-08:00"), Time.local(2010, 12, 31, 23, 30))
+      end
+      rows = connection.query("select ts, tm, dt from test order by ts")
+      assert_equal [Time.local(1960, 5, 6, 7, 8, 9), Time.utc(2000, 1, 1, 23, 59, 59), Date.civil(1500, 3, 1)], rows[0]
+      assert_equal [Time.local(2006, 1, 2, 3, 4, 5), Time.utc(2000, 1, 1, 0, 0, 1), Date.civil(2010, 12, 31)], rows[1]
+      connection.drop
+    end
+  end
+
+  def test_bind_exact_decimals
+    require 'bigdecimal'
+    sql_schema = "create table test (n42 numeric(4,2), n92 numeric(9,2), n184 numeric(18,4))"
+    Database.create(@parms) do |connection|
+      connection.execute(sql_schema)
+      connection.decimal = :scaled_integer
+      connection.prepare("insert into test (n42, n92, n184) values (?, ?, ?)") do |insert|
+        insert.execute(327, 12345678, 123456789012345)
+        insert.execute("-327.665", "-0.005", "92233720368547.75807")
+        insert.execute(-1.5, BigDecimal("-12.345"), Rational(1, 3))
+        assert_raise(RangeError) { insert.execute("327.68", 0, 0) }
+        assert_raise(RangeError) { insert.execute(0, 21474836.48, 0) }
+        assert_raise(RangeError) { insert.execute(0, 0, 922337203685478) }
+      end
+      assert_equal [[32700, 1234567800, 1234567890123450000], [-32767, -1, 922337203685477581], [-150, -1235, 3333]],
+        connection.query("select n42, n92, n184 from test order by n92 desc")
+      connection.drop
+    end
+  end
+
+  def test_timestamp_formats
+    sql_schema = "create table test (ts timestamp, tm time, dt date)"
+    sql_insert = "insert into test (ts, tm, dt) values ('2006-01-02 10:11:12.3456', '13:14:15.5', '1500-03-01')"
+    sql_select = "select ts, tm, dt from test"
+    ts = Time.local(2006, 1, 2, 10, 11, 12, 345600)
+    tm = Time.utc(2000, 1, 1, 13, 14, 15, 500000)
+    Database.create(@parms) do |connection|
+      connection.execute(sql_schema)
+      connection.execute(sql_insert)
+      row = connection.query(sql_select).first
+      assert_equal [ts, tm, Date.civil(1500, 3, 1)], row
+      assert row[1].utc?
+      connection.timestamp_format = :epoch_int
+      assert_equal [ts.to_i, tm.to_i], connection.query(sql_select).first[0, 2]
+      connection.execute(sql_select) do |cursor|
+        cursor.timestamp_format = :epoch_float
+        assert_equal :epoch_float, cursor.timestamp_format
+        row = cursor.fetch
+        assert_in_delta ts.to_f, row[0], 0.0001
+        assert_in_delta tm.to_f, row[1], 0.0001
+      end
+      assert_raise ArgumentError do
+        connection.timestamp_format = :iso8601
+      end
+      connection.timestamp_format = :time
+      tz = ENV['TZ']
+      begin
+        ["UTC", "America/New_York"].each do |zone|
+          ENV['TZ'] = zone
+          assert_equal Time.local(2006, 1, 2, 10, 11, 12, 345600), connection.query(sql_select).first[0]
+        end
+      ensure
+        ENV['TZ'] = tz
+      end
+      connection.drop
+    end
+  end
+
   def test_insert_incorrect_types
     cols = %w{ I SI BI F D C C10 VC VC10 VC10000 DT TM TS }
     types = %w{ INTEGER SMALLINT BIGINT FLOAT DOUBLE\ PRECISION CHAR CHAR(10) VARCHAR(1) VARCHAR(10) VARCHAR(10000) DATE TIME TIMESTAMP }
@@ -6,3 +6,5 @@ require 'ConnectionTestCases'
 require 'CursorTestCases'
 require 'DataTypesTestCases'
 require 'TransactionTestCases'
+require 'StatementTestCases'
+require 'PoolTestCases'
@@ -0,0 +1,71 @@
+require 'test/unit'
+require 'test/FbTestCases'
+
+class PoolTestCases < Test::Unit::TestCase
+  include FbTestCases
+
+  def test_checkout_checkin
+    Database.create(@parms).connect.close
+    pool = Pool.new(@parms, :size => 2, :timeout => 0.2, :warm_up => 1)
+    stats = pool.stats
+    assert_equal 1, stats[:open]
+    assert_equal 1, stats[:idle]
+    assert_equal 0, stats[:in_use]
+
+    c1 = pool.checkout
+    c2 = pool.checkout
+    assert_instance_of Connection, c1
+    assert_not_equal c1, c2
+    assert_equal 1.0, pool.stats[:utilization]
+    assert_raise(TimeoutError) { pool.checkout }
+    assert_equal 1, pool.stats[:timeouts]
+
+    c1.transaction
+    c1.execute("SELECT * FROM RDB$DATABASE")
+    pool.checkin(c1)
+    assert !c1.transaction_started
+    assert_raise(ArgumentError) { pool.checkin(c1) }
+    assert_same c1, pool.checkout
+    pool.checkin(c1)
+    pool.checkin(c2)
+
+    assert_equal 1, pool.with { |c| c.query("SELECT * FROM RDB$DATABASE").size }
+    assert_raise(RuntimeError) { pool.with { |c| raise "boom" } }
+    stats = pool.stats
+    assert_equal 0, stats[:in_use]
+    assert_equal 2, stats[:peak_in_use]
+    pool.close
+    assert_raise(Error) { pool.checkout }
+    Database.drop(@parms)
+  end
+
+  def test_wait_and_reap
+    Database.create(@parms).connect.close
+    pool = Pool.new(@parms, :size => 1, :timeout => 5, :idle_timeout => 0.2)
+    conn = pool.checkout
+    waiter = Thread.new { pool.with { |c| c } }
+    sleep 0.1
+    pool.checkin(conn)
+    assert_same conn, waiter.value
+    assert_equal 1, pool.stats[:waits]
+    assert pool.stats[:max_wait] > 0
+    sleep 0.3
+    assert_equal 1, pool.reap
+    assert_equal 0, pool.stats[:open]
+    pool.close
+    Database.drop(@parms)
+  end
+
+  def test_discard_closed
+    Database.create(@parms).connect.close
+    pool = Pool.new(@parms, :size => 1)
+    assert_raise(Error) { pool.send(:initialize, @parms) }
+    conn = pool.checkout
+    conn.close
+    pool.checkin(conn)
+    assert_equal 0, pool.stats[:open]
+    assert_not_equal conn, pool.with { |c| c }
+    pool.close
+    Database.drop(@parms)
+  end
+end
@@ -0,0 +1,106 @@
+require 'test/unit'
+require 'test/FbTestCases'
+
+class StatementTestCases < Test::Unit::TestCase
+  include FbTestCases
+
+  def test_prepare_select
+    Database.create(@parms) do |connection|
+      connection.prepare("SELECT * FROM RDB$DATABASE") do |stmt|
+        assert_instance_of Statement, stmt
+        assert_equal "SELECT * FROM RDB$DATABASE", stmt.sql
+        assert_equal 0, stmt.param_count
+        assert_equal 1, stmt.statement_type
+        assert_equal 4, stmt.fields.size
+        assert_equal "RDB$DESCRIPTION", stmt.fields[0].name
+        2.times do
+          rows = stmt.query
+          assert_equal 1, rows.size
+          assert_equal 4, rows[0].size
+        end
+        assert !connection.transaction_started
+      end
+      connection.drop
+    end
+  end
+
+  def test_execute_many
+    sql_schema = "CREATE TABLE TEST (ID INT, NAME VARCHAR(20))"
+    Database.create(@parms) do |connection|
+      connection.execute(sql_schema)
+      connection.prepare("INSERT INTO TEST (ID, NAME) VALUES (?, ?)") do |insert|
+        assert_equal 2, insert.param_count
+        assert_nil insert.fields
+        connection.transaction do
+          10.times { |i| assert_equal 1, insert.execute(i, "NAME#{i}") }
+        end
+      end
+      select = connection.prepare("SELECT ID, NAME FROM TEST WHERE ID < ? ORDER BY ID")
+      assert_equal [[0, "NAME0"], [1, "NAME1"]], select.query(2)
+      assert_equal [{"ID" => 0, "NAME" => "NAME0"}], select.query(:hash, 1)
+      select.execute(3) do |s|
+        assert_equal [0, "NAME0"], s.fetch
+        assert_equal [[1, "NAME1"], [2, "NAME2"]], s.fetchall
+      end
+      ids = []
+      select.each(5) { |row| ids << row[0] }
+      assert_equal [0, 1, 2, 3, 4], ids
+      select.close
+      assert_raise(Error) { select.execute(1) }
+      connection.drop
+    end
+  end
+
+  def test_execute_batch
+    sql_schema = "CREATE TABLE TEST (ID INT NOT NULL PRIMARY KEY, NAME VARCHAR(20), AMOUNT NUMERIC(9,2))"
+    Database.create(@parms) do |connection|
+      connection.execute(sql_schema)
+      connection.prepare("INSERT INTO TEST (ID, NAME, AMOUNT) VALUES (?, ?, ?)") do |insert|
+        rows = (0...25).map { |i| [i, "NAME#{i}", i * 1.5] }
+        result = insert.execute_batch(rows, :batch_size => 10)
+        assert_equal 25, result.rows_affected
+        assert_equal [], result.errors
+        assert !connection.transaction_started
+
+        rows = [[25, "NAME25", 1], [3, "DUPLICATE", 2], [26, "NAME26", 3], [27, "NAME27"]]
+        result = insert.execute_batch(rows)
+        assert_equal 2, result.rows_affected
+        assert_equal [1, 3], result.errors.map { |index, error| index }
+        assert_kind_of Error, result.errors[0][1]
+      end
+      assert_equal [[27, "NAME3"]], connection.query("SELECT COUNT(*), MAX(CASE WHEN ID = 3 THEN NAME END) FROM TEST")
+      connection.prepare("UPDATE TEST SET NAME = 'X' || ? WHERE ID < ? AND NAME <> '?'") do |update|
+        result = update.execute_batch([["A", 5], ["B", 10]])
+        assert_equal 15, result.rows_affected
+      end
+      assert_equal [["XB", 10]], connection.query("SELECT NAME, COUNT(*) FROM TEST WHERE ID < 10 GROUP BY NAME")
+      connection.drop
+    end
+  end
+
+  def test_execute_columns
+    sql_schema = "CREATE TABLE TEST (ID INT NOT NULL, BIG BIGINT, AMOUNT NUMERIC(9,2), RATE DOUBLE PRECISION, NAME VARCHAR(20))"
+    Database.create(@parms) do |connection|
+      connection.execute(sql_schema)
+      ids = (0...25).to_a
+      connection.prepare("INSERT INTO TEST (ID, BIG, AMOUNT, RATE, NAME) VALUES (?, ?, ?, ?, ?)") do |insert|
+        columns = [ids.pack("l*"), ids.map { |i| i * 1_000_000_000 }, ids.map { |i| i * 100 + 5 }.pack("l*"),
+          ids.map { |i| i / 4.0 }.pack("d*"), ids.map { |i| i.even? ? "NAME#{i}" : nil }]
+        assert_equal 25, insert.execute_columns(columns, :batch_size => 10)
+        assert !connection.transaction_started
+        assert_raise(ArgumentError) { insert.execute_columns([[1], [1], [1, 2], [1], [nil]]) }
+        assert_raise(ArgumentError) { insert.execute_columns([[1], [1], [1], [1], "packed"]) }
+      end
+      assert_equal [[24, 24_000_000_000, 2405, 6.0, "NAME24"], [23, 23_000_000_000, 2305, 5.75, nil]],
+        connection.query("SELECT ID, BIG, CAST(AMOUNT * 100 AS INTEGER), RATE, NAME FROM TEST WHERE ID > 22 ORDER BY ID DESC")
+
+      connection.execute("CREATE TABLE COPY (ID INT NOT NULL, AMOUNT NUMERIC(9,2))")
+      columns = connection.execute("SELECT ID, AMOUNT FROM TEST ORDER BY ID") { |c| c.fetch_columns(nil, :packed => true) }
+      connection.prepare("INSERT INTO COPY (ID, AMOUNT) VALUES (?, ?)") do |insert|
+        assert_equal 25, insert.execute_columns(columns)
+      end
+      assert_equal [[25, 30125]], connection.query("SELECT COUNT(*), CAST(SUM(AMOUNT) * 100 AS INTEGER) FROM COPY")
+      connection.drop
+    end
+  end
+end
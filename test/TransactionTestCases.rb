@@ -257,6 +257,51 @@ class TransactionTestCases < Test::Unit::TestCase
     end
   end
 
+  def test_transaction_options_object
+    options = TransactionOptions.new(:isolation => :read_committed, :record_version => true, :read_only => true, :wait => false)
+    assert options.frozen?
+    assert_equal [1, 8, 15, 17, 7], options.tpb.unpack("C*")
+    assert_equal :read_committed, options.to_h[:isolation]
+    assert_equal [1, 9, 2, 6, 21, 4, 5, 0, 0, 0, 20], TransactionOptions.new(:lock_timeout => 5, :auto_undo => false).tpb.unpack("C*")
+    assert_equal [1, 9, 2, 6], TransactionOptions.new.tpb.unpack("C*")
+    assert_equal "READ COMMITTED", TransactionOptions.new("READ COMMITTED").to_h
+    assert_raise(ArgumentError) { TransactionOptions.new(:isolation => :serializable) }
+    assert_raise(ArgumentError) { TransactionOptions.new(:isolation => :snapshot, :record_version => true) }
+    assert_raise(ArgumentError) { TransactionOptions.new(:wait => false, :lock_timeout => 5) }
+    assert_raise(ArgumentError) { TransactionOptions.new(:readonly => true) }
+    assert_raise(RangeError) { TransactionOptions.new(:lock_timeout => 0) }
+
+    sql_schema = "CREATE TABLE TEST (ID INT, NAME VARCHAR(20))"
+    sql_insert = "INSERT INTO TEST (ID, NAME) VALUES (?, ?)"
+    sql_select = "SELECT * FROM TEST ORDER BY ID"
+    sql_update = "UPDATE TEST SET NAME = ? WHERE ID = 1"
+    read_committed = TransactionOptions.new(:isolation => :read_committed, :record_version => true)
+    Database.create(@parms) do |conn1|
+      conn1.execute(sql_schema)
+      conn1.transaction { 10.times { |i| conn1.execute(sql_insert, i, "NAME#{i}") } }
+      Database.connect(@parms.merge(:transaction_options => read_committed)) do |conn2|
+        assert_same read_committed, conn2.transaction_options
+        conn2.transaction do
+          conn1.execute("DELETE FROM TEST WHERE ID > 4")
+          assert_equal 5, conn2.query(sql_select).size
+        end
+        conn1.transaction do
+          conn1.execute(sql_update, "LOCKED")
+          conn2.transaction_options = { :lock_timeout => 1 }
+          started = Time.now
+          assert_raise(Error) { conn2.execute(sql_update, "WAITED") }
+          assert !conn2.transaction_started
+          assert Time.now - started >= 0.5
+          assert_raise(Error) { conn2.transaction(TransactionOptions.new(:wait => false)) { conn2.execute(sql_update, "NO WAIT") } }
+        end
+        conn2.transaction_options = nil
+        assert_nil conn2.transaction_options
+        assert_equal "LOCKED", conn2.query(sql_select)[1][1]
+      end
+      conn1.drop
+    end
+  end
+
   def test_auto_and_explicit_transactions
     sql_schema = "CREATE TABLE TEST (ID INT, NAME VARCHAR(20))"
     sql_insert = "INSERT INTO TEST (ID, NAME) VALUES (?, ?)"